@@ -0,0 +1,253 @@
+#include "BatchConverter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+#include "WorkerPool.h"
+
+namespace {
+
+const unsigned int MAX_WORKER_COUNT = 256;
+
+#ifdef _WIN32
+#define PATH_FORMAT "%ls"
+const wchar_t SEPARATORS[] = L"\\/";
+#else
+#define PATH_FORMAT "%s"
+const char SEPARATORS[] = "/";
+#endif
+
+bool IsOption(const BatchConverter::Char* argument, const char* name)
+{
+    while (*name != 0 && *argument == static_cast<unsigned char>(*name))
+    {
+        ++argument;
+        ++name;
+    }
+    return *name == 0 && *argument == 0;
+}
+
+// Returns 0 if the argument is not a number
+unsigned int ParseCount(const BatchConverter::Char* argument)
+{
+    unsigned long long count = 0;
+    for (; *argument != 0; ++argument)
+    {
+        if (*argument < '0' || *argument > '9' || count > MAX_WORKER_COUNT)
+            return 0;
+        count = count * 10 + (*argument - '0');
+    }
+    return static_cast<unsigned int>(count);
+}
+
+bool IsSameFile(const BatchConverter::Path& a, const BatchConverter::Path& b)
+{
+#ifdef _WIN32
+    return _wcsicmp(a.c_str(), b.c_str()) == 0;
+#else
+    return a == b;
+#endif
+}
+
+bool IsPathLess(const BatchConverter::Path& a, const BatchConverter::Path& b)
+{
+#ifdef _WIN32
+    return _wcsicmp(a.c_str(), b.c_str()) < 0;
+#else
+    return a < b;
+#endif
+}
+
+}
+
+BatchConverter::BatchConverter() :
+    m_workerCount(WorkerPool::getDefaultThreadCount() + 1),
+    m_convertedCount(0),
+    m_seconds(0)
+{
+}
+
+const char* BatchConverter::getUsage()
+{
+    return "<pattern>... --format <extension> [--workers N] [--directory <output directory>]";
+}
+
+bool BatchConverter::ParseArguments(int argc, const Char* const* argv)
+{
+    m_patterns.clear();
+    m_format.clear();
+    m_directory.clear();
+    m_workerCount = WorkerPool::getDefaultThreadCount() + 1;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (IsOption(argv[i], "--format") && i + 1 < argc)
+        {
+            m_format = argv[++i];
+            if (!m_format.empty() && m_format[0] == '.')
+            {
+                m_format.erase(0, 1);
+            }
+        }
+        else if (IsOption(argv[i], "--workers") && i + 1 < argc)
+        {
+            m_workerCount = ParseCount(argv[++i]);
+            if (m_workerCount == 0 || m_workerCount > MAX_WORKER_COUNT)
+                return false;
+        }
+        else if (IsOption(argv[i], "--directory") && i + 1 < argc)
+            m_directory = argv[++i];
+        else if (argv[i][0] != '-')
+            m_patterns.push_back(argv[i]);
+        else
+            return false;
+    }
+    return !m_patterns.empty() && !m_format.empty();
+}
+
+bool BatchConverter::ExpandPattern(const Path& pattern)
+{
+    size_t matchCount = m_files.size();
+#ifdef _WIN32
+    // The names found are relative to the directory of the pattern
+    size_t separator = pattern.find_last_of(SEPARATORS);
+    Path directory = separator == Path::npos ? Path() : pattern.substr(0, separator + 1);
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(
+        pattern.c_str(),
+        FindExInfoBasic,
+        &data,
+        FindExSearchNameMatch,
+        nullptr,
+        FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+    do
+    {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        {
+            m_files.push_back(directory + data.cFileName);
+        }
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+#else
+    // Directories are marked with a trailing separator
+    glob_t matches;
+    if (glob(pattern.c_str(), GLOB_MARK, nullptr, &matches) != 0)
+        return false;
+    for (size_t i = 0; i < matches.gl_pathc; ++i)
+    {
+        Path match = matches.gl_pathv[i];
+        if (!match.empty() && match.back() != '/')
+        {
+            m_files.push_back(match);
+        }
+    }
+    globfree(&matches);
+#endif
+    return m_files.size() > matchCount;
+}
+
+BatchConverter::Path BatchConverter::GetTargetFilename(const Path& source) const
+{
+    size_t separator = source.find_last_of(SEPARATORS);
+    size_t nameStart = separator == Path::npos ? 0 : separator + 1;
+    size_t dot = source.rfind('.');
+    if (dot == Path::npos || dot < nameStart)
+    {
+        dot = source.size();
+    }
+
+    Path target = m_directory.empty() ? source.substr(0, nameStart) : m_directory;
+    if (!target.empty() && target.find_last_of(SEPARATORS) != target.size() - 1)
+    {
+        target += SEPARATORS[0];
+    }
+    target.append(source, nameStart, dot - nameStart);
+    target += '.';
+    return target + m_format;
+}
+
+bool BatchConverter::Run(const Converter& convert)
+{
+    m_files.clear();
+    m_convertedCount = 0;
+    m_seconds = 0;
+    bool succeeded = true;
+    for (const auto& pattern : m_patterns)
+    {
+        if (!ExpandPattern(pattern))
+        {
+            fprintf(stderr, "No files match " PATH_FORMAT "\n", pattern.c_str());
+            succeeded = false;
+        }
+    }
+
+    // Patterns can match the same files
+    std::sort(m_files.begin(), m_files.end());
+    m_files.erase(std::unique(m_files.begin(), m_files.end()), m_files.end());
+
+    // Files which differ only by their extension have the same target, none
+    // of them is converted rather than overwriting the target with the last
+    std::vector<Path> targets(m_files.size());
+    std::vector<unsigned int> order(m_files.size());
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        targets[i] = GetTargetFilename(m_files[i]);
+        order[i] = static_cast<unsigned int>(i);
+    }
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+    {
+        return IsPathLess(targets[a], targets[b]);
+    });
+    std::vector<bool> conflicts(m_files.size(), false);
+    for (size_t i = 1; i < order.size(); ++i)
+    {
+        if (IsSameFile(targets[order[i - 1]], targets[order[i]]))
+        {
+            conflicts[order[i - 1]] = true;
+            conflicts[order[i]] = true;
+        }
+    }
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        if (conflicts[i])
+        {
+            fprintf(stderr, "Cannot convert " PATH_FORMAT ", other files are also converted to " PATH_FORMAT "\n",
+                m_files[i].c_str(), targets[i].c_str());
+        }
+    }
+
+    // The files are converted on the calling thread too. The threads take the
+    // next file when they finish one, so large files do not hold up the rest.
+    WorkerPool workerPool(m_workerCount - 1);
+    std::atomic<unsigned int> convertedCount(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    workerPool.ForEach(getFileCount(), [&](unsigned int fileIndex)
+    {
+        if (conflicts[fileIndex])
+            return;
+
+        const Path& source = m_files[fileIndex];
+        const Path& target = targets[fileIndex];
+        if (IsSameFile(source, target))
+        {
+            fprintf(stderr, "Cannot convert " PATH_FORMAT " to itself\n", source.c_str());
+        }
+        else if (!convert(source, target))
+        {
+            fprintf(stderr, "Cannot convert " PATH_FORMAT "\n", source.c_str());
+        }
+        else
+        {
+            ++convertedCount;
+        }
+    });
+    m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_convertedCount = convertedCount;
+    return succeeded && m_convertedCount == getFileCount();
+}
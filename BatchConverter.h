@@ -0,0 +1,61 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+// Converts the files matching wildcard patterns to another container format
+// on a WorkerPool, one file per iteration, and measures the throughput.
+// Converting a file is up to the caller: the viewer saves with WIC, the
+// portable build decodes with the TiffDecoder or GifDecoder and writes with
+// the TiffEncoder.
+class BatchConverter
+{
+public:
+#ifdef _WIN32
+    typedef std::wstring Path;
+#else
+    typedef std::string Path;
+#endif
+    typedef Path::value_type Char;
+
+    // Converts source to target, called on any thread. The target must not
+    // remain if the conversion fails.
+    typedef std::function<bool(const Path& source, const Path& target)> Converter;
+
+    BatchConverter();
+
+    // Reads the arguments after --convert, see getUsage. Returns false if
+    // they are not valid.
+    bool ParseArguments(int argc, const Char* const* argv);
+
+    // Converts the files, the failures are printed as they happen. The files
+    // which would be converted to the same target, like a.gif and a.png, are
+    // failures and none of them is converted. Returns true if all files were
+    // converted.
+    bool Run(const Converter& convert);
+
+    // The target extension, without the dot
+    const Path&  getFormat()         const { return m_format; }
+    unsigned int getWorkerCount()    const { return m_workerCount; }
+    unsigned int getFileCount()      const { return static_cast<unsigned int>(m_files.size()); }
+    unsigned int getConvertedCount() const { return m_convertedCount; }
+    double       getSeconds()        const { return m_seconds; }
+    double       getFilesPerSecond() const { return m_seconds > 0 ? m_convertedCount / m_seconds : 0; }
+
+    static const char* getUsage();
+
+private:
+    BatchConverter(const BatchConverter&) = delete;
+    BatchConverter& operator=(const BatchConverter&) = delete;
+
+    bool ExpandPattern(const Path& pattern);
+    Path GetTargetFilename(const Path& source) const;
+
+    std::vector<Path> m_patterns;
+    std::vector<Path> m_files;
+    Path              m_format;
+    Path              m_directory;      // Empty to write next to the source files
+    unsigned int      m_workerCount;
+    unsigned int      m_convertedCount;
+    double            m_seconds;
+};
@@ -0,0 +1,1578 @@
+// Headless benchmark of the portable image pipeline. It opens the GIF and
+// TIFF files of a corpus directory with the ByteSource and the GifDecoder or
+// TiffDecoder, decodes and composes their frames like the viewer does, and writes the results as JSON
+// so that they can be compared across commits. It needs no window, Direct2D
+// or WIC, see README.md for the build command.
+// With --transcode it instead streams the pages of a TIFF through the
+// PagePipeline into a new TIFF and samples the anonymous memory of the
+// process, which stays flat however many pages the file has. With --convert
+// it converts the GIF and TIFF files matching the patterns to TIFF on a pool
+// of workers, like the viewer does with WIC, and reports the files per second.
+// The corpus files are also saved as GIF with the GifEncoder, to compare the
+// size of the quantized animations with the source files, their frames are
+// played from a FrameCache, to compare the memory and the decompression of
+// the cached frames with composing them, and their first frames are cached
+// in a ThumbnailCache, to compare showing the cached preview of a file with
+// decoding its first frame, and opened with the files read into memory
+// instead of mapped, to compare the time to the first frame. Longer
+// animations are made from the largest GIF to compare seeking from the
+// first frame with seeking from checkpoints. With --thumbnails it builds
+// the thumbnails of all files of a directory on workers like the grid view
+// of the viewer does, and reports the thumbnails per second.
+//
+// Usage: ZackBench <corpus directory> [--loops N] [--output file] [--label text] [--no-kernels]
+//        ZackBench --transcode <input TIFF> <output TIFF> [--output file] [--label text]
+//        ZackBench --convert <pattern>... --format tiff [--workers N] [--directory <output directory>] [--output file] [--label text]
+//        ZackBench --thumbnails <directory> [--workers N] [--output file] [--label text]
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BatchConverter.h"
+#include "ByteSource.h"
+#include "FrameBufferPool.h"
+#include "FrameCache.h"
+#include "FrameCompositor.h"
+#include "GifDecoder.h"
+#include "GifEncoder.h"
+#include "LatencyStats.h"
+#include "PagePipeline.h"
+#include "PaletteExpander.h"
+#include "PaletteQuantizer.h"
+#include "PixelConverter.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailQueue.h"
+#include "TiffDecoder.h"
+#include "TiffEncoder.h"
+#include "WorkerPool.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const unsigned int DEFAULT_LOOPS = 3;                  // Animation loops played per file
+const size_t MAX_SAMPLES = 1 << 20;                    // Latency samples kept for the percentiles
+const unsigned int KERNEL_WIDTH = 1920;                // Image size of the kernel benchmarks
+const unsigned int KERNEL_HEIGHT = 1080;
+const unsigned int KERNEL_REPEATS = 10;
+const unsigned int QUANTIZER_REPEATS = 2;              // Palettes built and mapped per kernel, the random colors mostly miss the cache
+const unsigned int SPRITE_CANVAS_WIDTH = 3840;         // Canvas and sprite of the disposal previous benchmark
+const unsigned int SPRITE_CANVAS_HEIGHT = 2160;
+const unsigned int SPRITE_SIZE = 64;
+const unsigned int SPRITE_FRAMES = 1000;
+const unsigned int SCALING_REPEATS = 3;                // Decodes of the TIFF page per thread count, the fastest counts
+const unsigned int OPEN_REPEATS = 5;                   // Opens per file and byte source, the fastest counts
+const unsigned int SEEK_FRAME_COUNTS[] = { 64, 256, 1024 };  // Frames of the animations made for the seek benchmark
+const unsigned int SEEK_INTERVAL = 16;                 // Frames between seek checkpoints, the viewer's CHECKPOINT_INTERVAL
+const unsigned int SEEK_TARGETS = 20;                  // Random frames sought per animation
+const unsigned int TRANSCODE_SLOTS = 2;                // Decoded pages waiting to be encoded
+const unsigned int TRANSCODE_SAMPLES = 20;             // Memory samples taken while transcoding
+const uint64_t THUMBNAIL_CACHE_BUDGET = 64 * 1024 * 1024;  // Size of the thumbnail cache file, like the viewer's
+const unsigned int THUMBNAIL_SIZE = 256;
+const unsigned int THUMBNAIL_REPEATS = 20;             // Lookups per file, the cache file is in the page cache after the first
+const unsigned int GRID_PAGE_FILES = 60;               // Files visible in the scrolled grid view, with the look-ahead rows
+const unsigned int GRID_PAGE_MS = 2;                   // Time between two pages while the grid view is scrolled
+
+double ElapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Plays a GIF through the same steps as the viewer: the previous frame is
+// disposed, the area below a frame with the previous disposal method is
+// saved, and the palette indices are expanded and drawn over the canvas.
+// The pages of a TIFF are decoded in parallel and drawn over the canvas one
+// by one, the canvas takes the size of each page.
+class ImagePipeline
+{
+public:
+    explicit ImagePipeline(unsigned int threadCount = WorkerPool::getDefaultThreadCount()) :
+        m_workerPool(threadCount),
+        m_previousDisposal(DM_NONE),
+        m_previousRect(PixelRect::Empty()),
+        m_changedRect(PixelRect::Empty())
+    {
+    }
+
+    // Without allowMapping the file is read into memory, like a file which
+    // cannot be mapped
+    bool Open(const char* filename, bool allowMapping = true)
+    {
+        Close();
+        if (!m_source.Open(filename, allowMapping))
+            return false;
+
+        if (TiffDecoder::IsTiff(m_source.getData(), m_source.getSize()))
+        {
+            TiffPage firstPage;
+            if (!m_tiffDecoder.Open(m_source.getData(), m_source.getSize()) || !m_tiffDecoder.ReadPage(0, firstPage))
+            {
+                Close();
+                return false;
+            }
+            m_compositor.Reset(firstPage.width, firstPage.height);
+            return true;
+        }
+
+        if (!m_decoder.Open(m_source.getData(), m_source.getSize()) || m_decoder.getFrameCount() == 0)
+        {
+            Close();
+            return false;
+        }
+        m_compositor.Reset(m_decoder.getWidth(), m_decoder.getHeight());
+        return true;
+    }
+
+    void Close()
+    {
+        m_decoder.Reset();
+        m_tiffDecoder.Reset();
+        m_source.Close();
+        m_pixels.Release();
+        m_coverage.Release();
+        m_previousDisposal = DM_NONE;
+        m_previousRect = PixelRect::Empty();
+    }
+
+    unsigned int getWidth()      const { return m_compositor.getWidth(); }
+    unsigned int getHeight()     const { return m_compositor.getHeight(); }
+    size_t getStride()           const { return m_compositor.getStride(); }
+    const uint8_t* getPixels()   const { return m_compositor.getPixels(); }
+    const FrameCompositor& getCompositor() const { return m_compositor; }
+    PixelRect getChangedRect()   const { return m_changedRect; }     // Area changed by the last composed frame
+
+    unsigned int getFrameCount()
+    {
+        return m_tiffDecoder.isOpen() ? m_tiffDecoder.getPageCount() : m_decoder.getFrameCount();
+    }
+
+    // Like the viewer, the image a frame is drawn on is kept in the
+    // checkpoints every interval frames, if they are given
+    bool ComposeFrame(unsigned int frameIndex, FrameCache* checkpoints = nullptr, unsigned int interval = 0)
+    {
+        if (m_tiffDecoder.isOpen())
+            return ComposePage(frameIndex);
+
+        const GifFrame& frame = m_decoder.getFrame(frameIndex);
+        PixelRect frameRect = PixelRect::Make(frame.left, frame.top, frame.width, frame.height);
+
+        if (frameIndex == 0)
+        {
+            m_compositor.Clear(0);
+        }
+        else
+        {
+            m_compositor.Dispose(m_previousDisposal, m_previousRect, 0);
+            if (checkpoints && frameIndex % interval == 0)
+            {
+                PixelRect bounds = m_compositor.getBounds();
+                checkpoints->Insert(frameIndex, m_compositor, bounds, bounds, 0, DM_NONE);
+            }
+        }
+        m_previousDisposal = frame.disposal <= DM_PREVIOUS ? static_cast<DISPOSAL_METHODS>(frame.disposal) : DM_NONE;
+        m_previousRect = frameRect;
+        if (m_previousDisposal == DM_PREVIOUS)
+        {
+            m_compositor.SaveCanvas(frameRect);
+        }
+
+        // Like the viewer, the transparent pixels are skipped if there are any
+        if (!m_decoder.ExpandFrame(frameIndex, m_pixels, &m_coverage))
+            return false;
+        bool covered = !m_coverage.empty();
+        m_compositor.Overlay(
+            m_pixels.data(),
+            m_pixels.getStride(),
+            covered ? m_coverage.data() : nullptr,
+            m_coverage.getStride(),
+            frameRect);
+        m_changedRect = m_compositor.TakeDirtyRect();
+        return true;
+    }
+
+    // Continues with the frame after the given image, which is the image the
+    // next frame is drawn on, like seeking from a checkpoint in the viewer
+    void StartAt(const uint8_t* image)
+    {
+        m_compositor.Copy(image, m_compositor.getStride(), m_compositor.getBounds());
+        m_previousDisposal = DM_NONE;
+        m_previousRect = PixelRect::Empty();
+    }
+
+private:
+    bool ComposePage(unsigned int pageIndex)
+    {
+        if (!m_tiffDecoder.ReadPage(pageIndex, m_page))
+            return false;
+        if (!m_pixels.hasSize(m_page.width, m_page.height, 4))
+        {
+            m_pixels = FrameBufferPool::GetInstance().Acquire(m_page.width, m_page.height, 4);
+        }
+        if (!m_tiffDecoder.DecodePage(m_page, m_pixels.data(), m_pixels.getStride(), m_workerPool))
+            return false;
+
+        if (m_page.width != getWidth() || m_page.height != getHeight())
+        {
+            m_compositor.Reset(m_page.width, m_page.height);
+        }
+        PixelRect pageRect = PixelRect::Make(0, 0, m_page.width, m_page.height);
+        m_compositor.Clear(0);
+        m_compositor.Overlay(m_pixels.data(), m_pixels.getStride(), pageRect);
+        m_changedRect = m_compositor.TakeDirtyRect();
+        return true;
+    }
+
+    ByteSource       m_source;
+    GifDecoder       m_decoder;
+    TiffDecoder      m_tiffDecoder;
+    TiffPage         m_page;
+    WorkerPool       m_workerPool;
+    FrameCompositor  m_compositor;
+    FrameBuffer      m_pixels;
+    FrameBuffer      m_coverage;
+    DISPOSAL_METHODS m_previousDisposal;
+    PixelRect        m_previousRect;
+    PixelRect        m_changedRect;
+};
+
+struct FileResult
+{
+    std::string  name;
+    unsigned int width;
+    unsigned int height;
+    unsigned int frameCount;
+    double       openMs;
+    double       framesPerSecond;
+    double       frameP50Ms;
+    double       frameP99Ms;
+};
+
+// Minimal JSON writer for the flat objects of the report
+class JsonWriter
+{
+public:
+    explicit JsonWriter(FILE* file) :
+        m_file(file),
+        m_first(true),
+        m_depth(0)
+    {
+    }
+
+    void BeginObject(const char* name = nullptr) { Begin(name, '{'); }
+    void EndObject() { End('}'); }
+    void BeginArray(const char* name) { Begin(name, '['); }
+    void EndArray() { End(']'); }
+
+    void Number(const char* name, double value)
+    {
+        // JSON has no infinity or NaN
+        Key(name);
+        fprintf(m_file, "%.4g", std::isfinite(value) ? value : 0.0);
+    }
+
+    void Integer(const char* name, unsigned long long value)
+    {
+        Key(name);
+        fprintf(m_file, "%llu", value);
+    }
+
+    void String(const char* name, const std::string& value)
+    {
+        Key(name);
+        fputc('"', m_file);
+        for (unsigned char c : value)
+        {
+            if (c == '"' || c == '\\')
+                fprintf(m_file, "\\%c", c);
+            else if (c < 0x20)
+                fprintf(m_file, "\\u%04x", c);
+            else
+                fputc(c, m_file);
+        }
+        fputc('"', m_file);
+    }
+
+private:
+    void Begin(const char* name, char bracket)
+    {
+        Key(name);
+        fputc(bracket, m_file);
+        m_first = true;
+        ++m_depth;
+    }
+
+    void End(char bracket)
+    {
+        --m_depth;
+        fputc('\n', m_file);
+        Indent();
+        fputc(bracket, m_file);
+        m_first = false;
+        if (m_depth == 0)
+        {
+            fputc('\n', m_file);
+        }
+    }
+
+    void Key(const char* name)
+    {
+        if (m_depth > 0)
+        {
+            fputs(m_first ? "\n" : ",\n", m_file);
+            Indent();
+        }
+        m_first = false;
+        if (name)
+        {
+            fprintf(m_file, "\"%s\": ", name);
+        }
+    }
+
+    void Indent()
+    {
+        for (int i = 0; i < m_depth; ++i)
+        {
+            fputs("  ", m_file);
+        }
+    }
+
+    FILE* m_file;
+    bool  m_first;
+    int   m_depth;
+};
+
+bool HasImageExtension(const std::string& name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string extension = name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+    return extension == ".gif" || extension == ".tif" || extension == ".tiff";
+}
+
+// Returns the files of the directory in name order, like the viewer
+// navigates them
+bool ListFiles(const std::string& directory, std::vector<std::string>& imageFiles, unsigned int& otherFiles)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return false;
+
+    otherFiles = 0;
+    while (dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        std::string name = entry->d_name;
+        if (HasImageExtension(name))
+            imageFiles.push_back(name);
+        else
+            ++otherFiles;
+    }
+    closedir(dir);
+    std::sort(imageFiles.begin(), imageFiles.end());
+    return true;
+}
+
+void FillRandom(std::vector<uint8_t>& bytes, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    for (auto& b : bytes)
+    {
+        b = static_cast<uint8_t>(random());
+    }
+}
+
+// Premultiplied BGRA with a mix of opaque, transparent and translucent pixels
+void FillRandomPremultiplied(std::vector<uint8_t>& pixels, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    for (size_t i = 0; i + 4 <= pixels.size(); i += 4)
+    {
+        unsigned int kind = random() % 4;
+        unsigned int alpha = kind == 0 ? 255 : kind == 1 ? 0 : random() % 256;
+        for (int c = 0; c < 3; ++c)
+        {
+            pixels[i + c] = static_cast<uint8_t>(random() % (alpha + 1));
+        }
+        pixels[i + 3] = static_cast<uint8_t>(alpha);
+    }
+}
+
+void WriteKernelResults(JsonWriter& json)
+{
+    static const struct
+    {
+        PIXEL_FORMATS format;
+        const char*   name;
+    } formats[] =
+    {
+        { PF_BGR24, "bgr24" },
+        { PF_RGB24, "rgb24" },
+        { PF_BGRA32, "bgra32" },
+        { PF_RGBA32, "rgba32" },
+        { PF_BGR32, "bgr32" },
+        { PF_PBGRA32, "pbgra32" },
+        { PF_GRAY8, "gray8" },
+        { PF_GRAY16, "gray16" },
+        { PF_RGB48, "rgb48" },
+        { PF_RGBA64, "rgba64" },
+    };
+    const double pixelCount = static_cast<double>(KERNEL_WIDTH) * KERNEL_HEIGHT * KERNEL_REPEATS;
+    std::vector<uint8_t> destination(static_cast<size_t>(KERNEL_WIDTH) * KERNEL_HEIGHT * 4);
+
+    // Conversion of the source formats, in million pixels per second
+    json.BeginObject("conversion_mpixels_per_s");
+    for (const auto& f : formats)
+    {
+        size_t sourceStride = KERNEL_WIDTH * PixelConverter::getBytesPerPixel(f.format);
+        std::vector<uint8_t> source(sourceStride * KERNEL_HEIGHT);
+        FillRandom(source, 1);
+        json.BeginObject(f.name);
+        for (int k = CK_SCALAR; k <= CK_NEON; ++k)
+        {
+            CPU_KERNELS kernels = static_cast<CPU_KERNELS>(k);
+            if (!PixelConverter::isSupported(kernels))
+                continue;
+            Clock::time_point start = Clock::now();
+            for (unsigned int r = 0; r < KERNEL_REPEATS; ++r)
+            {
+                PixelConverter::Convert(f.format, source.data(), sourceStride, destination.data(),
+                    KERNEL_WIDTH * 4, KERNEL_WIDTH, KERNEL_HEIGHT, kernels);
+            }
+            json.Number(PixelConverter::getKernelsName(kernels), pixelCount / ElapsedMs(start) / 1000);
+        }
+        json.EndObject();
+    }
+    json.EndObject();
+
+    // Expansion of palette indices with a transparent index and coverage
+    std::vector<uint8_t> indices(static_cast<size_t>(KERNEL_WIDTH) * KERNEL_HEIGHT);
+    std::vector<uint8_t> coverage(KERNEL_WIDTH);
+    std::vector<uint8_t> palette(256 * 3);
+    FillRandom(indices, 2);
+    FillRandom(palette, 3);
+    PaletteExpander expander;
+    expander.SetPalette(palette.data(), 256, 0);
+    json.BeginObject("palette_mpixels_per_s");
+    for (int k = CK_SCALAR; k <= CK_NEON; ++k)
+    {
+        CPU_KERNELS kernels = static_cast<CPU_KERNELS>(k);
+        if (!PixelConverter::isSupported(kernels))
+            continue;
+        Clock::time_point start = Clock::now();
+        for (unsigned int r = 0; r < KERNEL_REPEATS; ++r)
+        {
+            for (unsigned int y = 0; y < KERNEL_HEIGHT; ++y)
+            {
+                expander.ExpandRow(indices.data() + y * KERNEL_WIDTH, destination.data() + y * KERNEL_WIDTH * 4,
+                    coverage.data(), KERNEL_WIDTH, kernels);
+            }
+        }
+        json.Number(PixelConverter::getKernelsName(kernels), pixelCount / ElapsedMs(start) / 1000);
+    }
+    json.EndObject();
+
+    // Source-over blending of a full frame
+    std::vector<uint8_t> frame(destination.size());
+    FillRandomPremultiplied(frame, 4);
+    json.BeginObject("blend_mpixels_per_s");
+    for (int k = CK_SCALAR; k <= CK_NEON; ++k)
+    {
+        CPU_KERNELS kernels = static_cast<CPU_KERNELS>(k);
+        if (!PixelConverter::isSupported(kernels))
+            continue;
+        FrameCompositor compositor;
+        compositor.Reset(KERNEL_WIDTH, KERNEL_HEIGHT);
+        compositor.Clear(0xFF204060);
+        Clock::time_point start = Clock::now();
+        for (unsigned int r = 0; r < KERNEL_REPEATS; ++r)
+        {
+            compositor.Overlay(frame.data(), KERNEL_WIDTH * 4, compositor.getBounds(), kernels);
+        }
+        json.Number(PixelConverter::getKernelsName(kernels), pixelCount / ElapsedMs(start) / 1000);
+    }
+    json.EndObject();
+
+    // Palette of an opaque frame with all kinds of colors, and the mapping
+    // of its pixels, which mostly miss the color cache
+    std::vector<uint8_t> opaque(destination.size());
+    FillRandom(opaque, 5);
+    for (size_t i = 3; i < opaque.size(); i += 4)
+    {
+        opaque[i] = 0xFF;
+    }
+    std::vector<uint8_t> paletteIndices(KERNEL_WIDTH);
+    const double quantizedPixels = static_cast<double>(KERNEL_WIDTH) * KERNEL_HEIGHT * QUANTIZER_REPEATS;
+    for (int dither = 0; dither <= 1; ++dither)
+    {
+        json.BeginObject(dither ? "quantizer_dither_mpixels_per_s" : "quantizer_mpixels_per_s");
+        for (int k = CK_SCALAR; k <= CK_NEON; ++k)
+        {
+            CPU_KERNELS kernels = static_cast<CPU_KERNELS>(k);
+            if (!PixelConverter::isSupported(kernels))
+                continue;
+            PaletteQuantizer quantizer(kernels);
+            Clock::time_point start = Clock::now();
+            for (unsigned int r = 0; r < QUANTIZER_REPEATS; ++r)
+            {
+                quantizer.Reset();
+                quantizer.AddPixels(opaque.data(), static_cast<size_t>(KERNEL_WIDTH) * KERNEL_HEIGHT);
+                quantizer.BuildPalette(PaletteQuantizer::MAX_COLORS - 1);
+                for (unsigned int y = 0; y < KERNEL_HEIGHT; ++y)
+                {
+                    quantizer.MapRow(opaque.data() + y * KERNEL_WIDTH * 4, paletteIndices.data(),
+                        KERNEL_WIDTH, 0, y, PaletteQuantizer::MAX_COLORS - 1, dither != 0);
+                }
+            }
+            json.Number(PixelConverter::getKernelsName(kernels), quantizedPixels / ElapsedMs(start) / 1000);
+        }
+        json.EndObject();
+    }
+
+    // A small sprite with the previous disposal method moving over a large canvas
+    FrameCompositor compositor;
+    compositor.Reset(SPRITE_CANVAS_WIDTH, SPRITE_CANVAS_HEIGHT);
+    compositor.Clear(0xFF000000);
+    std::vector<uint8_t> sprite(SPRITE_SIZE * SPRITE_SIZE * 4, 0xFF);
+    PixelRect previousRect = PixelRect::Empty();
+    Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < SPRITE_FRAMES; ++i)
+    {
+        compositor.Dispose(i > 0 ? DM_PREVIOUS : DM_NONE, previousRect, 0);
+        previousRect = PixelRect::Make(
+            (i * 37) % (SPRITE_CANVAS_WIDTH - SPRITE_SIZE),
+            (i * 23) % (SPRITE_CANVAS_HEIGHT - SPRITE_SIZE),
+            SPRITE_SIZE,
+            SPRITE_SIZE);
+        compositor.SaveCanvas(previousRect);
+        compositor.Overlay(sprite.data(), SPRITE_SIZE * 4, previousRect);
+        compositor.TakeDirtyRect();
+    }
+    double elapsedMs = ElapsedMs(start);
+    json.BeginObject("disposal_previous");
+    json.Number("copied_kb_per_frame", compositor.getSavedBytes() / 1024.0 / compositor.getSaveCount());
+    json.Number("canvas_kb", SPRITE_CANVAS_WIDTH * SPRITE_CANVAS_HEIGHT * 4 / 1024.0);
+    json.Number("us_per_frame", elapsedMs * 1000 / SPRITE_FRAMES);
+    json.EndObject();
+}
+
+}
+
+// Decodes the largest first page of the TIFF files with 1, 2, 4 and so on up
+// to all cores, to show how the parallel decode scales
+void WriteTiffScaling(JsonWriter& json, const std::vector<std::string>& files)
+{
+    ByteSource source;
+    TiffDecoder decoder;
+    TiffPage page;
+    std::string largestFile;
+    uint64_t largestPixels = 0;
+    for (const auto& file : files)
+    {
+        if (source.Open(file.c_str()) && decoder.Open(source.getData(), source.getSize()) &&
+            decoder.ReadPage(0, page) && page.conversion != TC_UNSUPPORTED &&
+            static_cast<uint64_t>(page.width) * page.height > largestPixels)
+        {
+            largestPixels = static_cast<uint64_t>(page.width) * page.height;
+            largestFile = file;
+        }
+        decoder.Reset();
+        source.Close();
+    }
+    if (largestFile.empty() || !source.Open(largestFile.c_str()) ||
+        !decoder.Open(source.getData(), source.getSize()) || !decoder.ReadPage(0, page))
+        return;
+
+    FrameBuffer pixels = FrameBufferPool::GetInstance().Acquire(page.width, page.height, 4);
+    unsigned int cores = WorkerPool::getDefaultThreadCount() + 1;
+    json.BeginObject("tiff_scaling");
+    json.String("file", largestFile);
+    json.Integer("width", page.width);
+    json.Integer("height", page.height);
+    json.Integer("blocks", page.getBlockCount());
+    json.BeginArray("decodes");
+    double singleThreadMs = 0;
+    for (unsigned int threads = 1; ; threads = threads * 2 < cores ? threads * 2 : cores)
+    {
+        // The calling thread decodes too
+        WorkerPool workerPool(threads - 1);
+        double fastestMs = 0;
+        for (unsigned int i = 0; i < SCALING_REPEATS; ++i)
+        {
+            Clock::time_point start = Clock::now();
+            decoder.DecodePage(page, pixels.data(), pixels.getStride(), workerPool);
+            double elapsedMs = ElapsedMs(start);
+            fastestMs = i == 0 || elapsedMs < fastestMs ? elapsedMs : fastestMs;
+        }
+        if (threads == 1)
+        {
+            singleThreadMs = fastestMs;
+        }
+        json.BeginObject();
+        json.Integer("threads", threads);
+        json.Number("ms", fastestMs);
+        json.Number("speedup", fastestMs > 0 ? singleThreadMs / fastestMs : 0);
+        json.EndObject();
+        if (threads == cores)
+            break;
+    }
+    json.EndArray();
+    json.EndObject();
+}
+
+// Opens each file and composes its first frame once with the file mapped
+// and once read into memory, like a file which cannot be mapped. Reading
+// copies the whole file before the first frame, mapping only touches the
+// pages the decoder reads. The files are in the page cache after the first
+// open, so this compares the copy and not the disk.
+void WriteOpenToFirstFrame(JsonWriter& json, const std::vector<std::string>& files)
+{
+    ImagePipeline pipeline;
+    double mappedTotalMs = 0;
+    double readTotalMs = 0;
+    json.BeginObject("open_to_first_frame");
+    json.BeginArray("files");
+    for (const auto& file : files)
+    {
+        double fastestMs[2] = {};
+        bool opened = true;
+        for (unsigned int i = 0; i < OPEN_REPEATS * 2 && opened; ++i)
+        {
+            bool mapped = i % 2 == 0;
+            Clock::time_point start = Clock::now();
+            opened = pipeline.Open(file.c_str(), mapped) && pipeline.ComposeFrame(0);
+            double elapsedMs = ElapsedMs(start);
+            double& fastest = fastestMs[mapped ? 0 : 1];
+            fastest = i < 2 || elapsedMs < fastest ? elapsedMs : fastest;
+            pipeline.Close();
+        }
+        struct stat fileStat;
+        if (!opened || stat(file.c_str(), &fileStat) != 0)
+            continue;
+        mappedTotalMs += fastestMs[0];
+        readTotalMs += fastestMs[1];
+
+        json.BeginObject();
+        json.String("file", file);
+        json.Integer("bytes", static_cast<uint64_t>(fileStat.st_size));
+        json.Number("mapped_ms", fastestMs[0]);
+        json.Number("read_ms", fastestMs[1]);
+        json.EndObject();
+    }
+    json.EndArray();
+    json.Number("mapped_ms", mappedTotalMs);
+    json.Number("read_ms", readTotalMs);
+    json.Number("speedup", mappedTotalMs > 0 ? readTotalMs / mappedTotalMs : 0);
+    json.EndObject();
+}
+
+// Seeks to random frames of animations of growing length, made by repeating
+// the frames of the largest GIF of the corpus, once by composing all frames
+// from the first and once from the checkpoint before the frame like the
+// viewer. From the first frame the latency grows with the frame number,
+// from a checkpoint it is at most SEEK_INTERVAL frames. The animations are
+// written by the GifEncoder, which stores the changed areas only, so frames
+// after the first never cover the whole image.
+void WriteSeekLatency(JsonWriter& json, const std::vector<std::string>& files)
+{
+    ImagePipeline pipeline;
+    std::string largestFile;
+    uint64_t largestPixels = 0;
+    for (const auto& file : files)
+    {
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".gif") == 0 &&
+            pipeline.Open(file.c_str()) && pipeline.getFrameCount() > 1 &&
+            static_cast<uint64_t>(pipeline.getWidth()) * pipeline.getHeight() > largestPixels)
+        {
+            largestPixels = static_cast<uint64_t>(pipeline.getWidth()) * pipeline.getHeight();
+            largestFile = file;
+        }
+    }
+    if (largestFile.empty())
+        return;
+
+    const char* directory = getenv("TMPDIR");
+    std::string tempFile = std::string(directory && *directory ? directory : "/tmp") + "/ZackBench.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return;
+    close(descriptor);
+
+    json.BeginObject("seek");
+    json.String("source", largestFile);
+    json.Integer("interval", SEEK_INTERVAL);
+    json.BeginArray("animations");
+    std::mt19937 random(7);
+    for (unsigned int frameCount : SEEK_FRAME_COUNTS)
+    {
+        // Loops of the source animation
+        GifEncoder encoder;
+        if (!pipeline.Open(largestFile.c_str()))
+            break;
+        unsigned int sourceFrames = pipeline.getFrameCount();
+        bool succeeded = encoder.Open(tempFile.c_str(), pipeline.getWidth(), pipeline.getHeight(), 0);
+        for (unsigned int i = 0; i < frameCount && succeeded; ++i)
+        {
+            succeeded = pipeline.ComposeFrame(i % sourceFrames) &&
+                encoder.AddFrame(pipeline.getPixels(), pipeline.getStride(), 100);
+        }
+        if (!encoder.Close() || !succeeded || !pipeline.Open(tempFile.c_str()))
+            break;
+
+        // The first loop keeps the checkpoints
+        frameCount = pipeline.getFrameCount();
+        FrameCache checkpoints(SIZE_MAX);
+        checkpoints.Reset(frameCount);
+        for (unsigned int i = 0; i < frameCount; ++i)
+        {
+            pipeline.ComposeFrame(i, &checkpoints, SEEK_INTERVAL);
+        }
+
+        LatencyStats fromStartLatency(SEEK_TARGETS);
+        LatencyStats checkpointLatency(SEEK_TARGETS);
+        std::vector<uint8_t> expected;
+        unsigned int mismatches = 0;
+        for (unsigned int i = 0; i < SEEK_TARGETS; ++i)
+        {
+            unsigned int target = random() % frameCount;
+            Clock::time_point start = Clock::now();
+            for (unsigned int j = 0; j <= target; ++j)
+            {
+                pipeline.ComposeFrame(j);
+            }
+            fromStartLatency.Add(ElapsedMs(start));
+            expected.assign(pipeline.getPixels(), pipeline.getPixels() + pipeline.getStride() * pipeline.getHeight());
+
+            start = Clock::now();
+            unsigned int first = target - target % SEEK_INTERVAL;
+            const uint8_t* image = first > 0 ? checkpoints.GetPixels(first, pipeline.getCompositor().getBounds()) : nullptr;
+            if (image)
+            {
+                pipeline.StartAt(image);
+            }
+            else
+            {
+                first = 0;
+            }
+            for (unsigned int j = first; j <= target; ++j)
+            {
+                pipeline.ComposeFrame(j);
+            }
+            checkpointLatency.Add(ElapsedMs(start));
+            mismatches += memcmp(pipeline.getPixels(), expected.data(), expected.size()) != 0 ? 1 : 0;
+        }
+
+        json.BeginObject();
+        json.Integer("frames", frameCount);
+        json.Number("from_start_p50_ms", fromStartLatency.getPercentile(0.5));
+        json.Number("from_start_p99_ms", fromStartLatency.getPercentile(0.99));
+        json.Number("checkpoint_p50_ms", checkpointLatency.getPercentile(0.5));
+        json.Number("checkpoint_p99_ms", checkpointLatency.getPercentile(0.99));
+        json.Number("checkpoint_mb", checkpoints.GetUsedBytes() / 1048576.0);
+        json.Integer("mismatches", mismatches);
+        json.EndObject();
+    }
+    pipeline.Close();
+    json.EndArray();
+    json.EndObject();
+    remove(tempFile.c_str());
+}
+
+// Saves the composed frames of each file as GIF into a temporary file, and
+// compares its size with the source file. Files with pages of different
+// sizes are skipped, a GIF has one size.
+void WriteGifExport(JsonWriter& json, const std::vector<std::string>& files)
+{
+    const char* directory = getenv("TMPDIR");
+    std::string tempFile = std::string(directory && *directory ? directory : "/tmp") + "/ZackBench.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return;
+    close(descriptor);
+
+    ImagePipeline pipeline;
+    GifEncoder encoder;
+    uint64_t sourceBytes = 0;
+    uint64_t gifBytes = 0;
+    uint64_t composedPixels = 0;
+    double exportMs = 0;
+    json.BeginObject("gif_export");
+    json.BeginArray("files");
+    for (const auto& file : files)
+    {
+        if (!pipeline.Open(file.c_str()) || !pipeline.ComposeFrame(0))
+            continue;
+        unsigned int width = pipeline.getWidth();
+        unsigned int height = pipeline.getHeight();
+        unsigned int frameCount = pipeline.getFrameCount();
+        Clock::time_point start = Clock::now();
+        bool succeeded = encoder.Open(tempFile.c_str(), width, height, 0);
+        for (unsigned int i = 0; i < frameCount && succeeded; ++i)
+        {
+            succeeded = (i == 0 || pipeline.ComposeFrame(i)) &&
+                pipeline.getWidth() == width && pipeline.getHeight() == height &&
+                encoder.AddFrame(pipeline.getPixels(), pipeline.getStride(), 100);
+        }
+        succeeded = encoder.Close() && succeeded;
+        double elapsedMs = ElapsedMs(start);
+        if (!succeeded)
+            continue;
+
+        struct stat fileStatus;
+        uint64_t fileBytes = stat(file.c_str(), &fileStatus) == 0 ? fileStatus.st_size : 0;
+        sourceBytes += fileBytes;
+        gifBytes += encoder.getSize();
+        composedPixels += static_cast<uint64_t>(width) * height * frameCount;
+        exportMs += elapsedMs;
+        json.BeginObject();
+        json.String("file", file);
+        json.Integer("frames", frameCount);
+        json.Integer("written_frames", encoder.getFrameCount());
+        json.Integer("source_bytes", fileBytes);
+        json.Integer("gif_bytes", encoder.getSize());
+        json.Number("ms", elapsedMs);
+        json.EndObject();
+    }
+    json.EndArray();
+    json.Integer("source_bytes", sourceBytes);
+    json.Integer("gif_bytes", gifBytes);
+    json.Number("size_ratio", sourceBytes > 0 ? static_cast<double>(gifBytes) / sourceBytes : 0);
+    json.Number("mpixels_per_s", exportMs > 0 ? composedPixels / exportMs / 1000 : 0);
+    json.EndObject();
+    remove(tempFile.c_str());
+}
+
+// Composes the frames of each animation and multi-page file into a frame
+// cache, like the first loop in the viewer, and plays them from the cache
+// like the following loops. Compares the memory of the compressed frames
+// with the uncompressed ones and the time to decompress them with the time
+// to decode and compose them, which OverlayNextFrame spends without the
+// cache. The changed areas are decompressed when playing in order, the
+// whole frames when seeking.
+void WriteFrameCache(JsonWriter& json, const std::vector<std::string>& files)
+{
+    ImagePipeline pipeline;
+    FrameCache cache(SIZE_MAX);
+    LatencyStats composeLatency(MAX_SAMPLES);
+    LatencyStats compressLatency(MAX_SAMPLES);
+    LatencyStats changedLatency(MAX_SAMPLES);
+    LatencyStats wholeLatency(MAX_SAMPLES);
+    uint64_t rawBytes = 0;
+    uint64_t compressedBytes = 0;
+    uint64_t wholeBytes = 0;
+    double wholeMs = 0;
+    json.BeginObject("frame_cache");
+    json.BeginArray("files");
+    for (const auto& file : files)
+    {
+        if (!pipeline.Open(file.c_str()) || pipeline.getFrameCount() < 2)
+            continue;
+        unsigned int frameCount = pipeline.getFrameCount();
+        cache.Reset(frameCount);
+        for (unsigned int i = 0; i < frameCount; ++i)
+        {
+            Clock::time_point start = Clock::now();
+            if (!pipeline.ComposeFrame(i))
+                break;
+            composeLatency.Add(ElapsedMs(start));
+
+            start = Clock::now();
+            PixelRect bounds = pipeline.getCompositor().getBounds();
+            cache.Insert(i, pipeline.getCompositor(), i == 0 ? bounds : pipeline.getChangedRect(), bounds, 0, DM_NONE);
+            compressLatency.Add(ElapsedMs(start));
+        }
+
+        unsigned int cachedFrames = 0;
+        unsigned int indexedFrames = 0;
+        for (unsigned int i = 0; i < frameCount; ++i)
+        {
+            FrameCache::Entry* entry = cache.Find(i);
+            if (entry == nullptr)
+                continue;
+            ++cachedFrames;
+            indexedFrames += entry->pixels.isIndexed() ? 1 : 0;
+            Clock::time_point start = Clock::now();
+            cache.GetPixels(i, entry->changedRect);
+            changedLatency.Add(ElapsedMs(start));
+        }
+        for (unsigned int i = 0; i < frameCount; ++i)
+        {
+            FrameCache::Entry* entry = cache.Find(i);
+            if (entry == nullptr)
+                continue;
+            Clock::time_point start = Clock::now();
+            cache.GetPixels(i, PixelRect::Make(0, 0, entry->pixels.width, entry->pixels.height));
+            double elapsedMs = ElapsedMs(start);
+            wholeLatency.Add(elapsedMs);
+            wholeMs += elapsedMs;
+            wholeBytes += static_cast<uint64_t>(entry->pixels.width) * entry->pixels.height * 4;
+        }
+        rawBytes += cache.GetRawBytes();
+        compressedBytes += cache.GetUsedBytes();
+
+        json.BeginObject();
+        json.String("file", file);
+        json.Integer("frames", cachedFrames);
+        json.Integer("indexed_frames", indexedFrames);
+        json.Integer("raw_bytes", cache.GetRawBytes());
+        json.Integer("compressed_bytes", cache.GetUsedBytes());
+        json.EndObject();
+    }
+    pipeline.Close();
+    cache.Reset(0);
+    json.EndArray();
+    json.Number("raw_mb", rawBytes / 1048576.0);
+    json.Number("compressed_mb", compressedBytes / 1048576.0);
+    json.Number("size_ratio", rawBytes > 0 ? static_cast<double>(compressedBytes) / rawBytes : 0);
+    json.Number("compose_p50_ms", composeLatency.getPercentile(0.5));
+    json.Number("compose_p99_ms", composeLatency.getPercentile(0.99));
+    json.Number("compress_p50_ms", compressLatency.getPercentile(0.5));
+    json.Number("changed_area_p50_ms", changedLatency.getPercentile(0.5));
+    json.Number("whole_frame_p50_ms", wholeLatency.getPercentile(0.5));
+    json.Number("whole_frame_p99_ms", wholeLatency.getPercentile(0.99));
+    json.Number("decompress_mb_per_s", wholeMs > 0 ? wholeBytes / 1048576.0 / wholeMs * 1000 : 0);
+    json.EndObject();
+}
+
+// Caches the first frame of each file in a temporary thumbnail cache, opens
+// the cache again like a new run of the viewer does, and measures looking up
+// the previews against decoding the first frames
+void WriteThumbnailCache(JsonWriter& json, const std::vector<std::string>& files)
+{
+    const char* directory = getenv("TMPDIR");
+    std::string tempFile = std::string(directory && *directory ? directory : "/tmp") + "/ZackBench.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return;
+    close(descriptor);
+
+    ImagePipeline pipeline;
+    LatencyStats firstFrameLatency(MAX_SAMPLES);
+    LatencyStats insertLatency(MAX_SAMPLES);
+    {
+        ThumbnailCache cache(THUMBNAIL_CACHE_BUDGET);
+        if (!cache.Open(tempFile.c_str()))
+        {
+            remove(tempFile.c_str());
+            return;
+        }
+        for (const auto& file : files)
+        {
+            Clock::time_point start = Clock::now();
+            if (!pipeline.Open(file.c_str()) || !pipeline.ComposeFrame(0))
+                continue;
+            firstFrameLatency.Add(ElapsedMs(start));
+
+            start = Clock::now();
+            ThumbnailKey key;
+            ThumbnailInfo info = {};
+            info.imageWidth = pipeline.getWidth();
+            info.imageHeight = pipeline.getHeight();
+            info.frameCount = pipeline.getFrameCount();
+            ThumbnailCache::GetThumbnailSize(pipeline.getWidth(), pipeline.getHeight(), THUMBNAIL_SIZE, info.width, info.height);
+            if (ThumbnailCache::GetKey(file.c_str(), key) &&
+                cache.Insert(key, info, pipeline.getPixels(), pipeline.getStride(), pipeline.getWidth(), pipeline.getHeight()))
+            {
+                insertLatency.Add(ElapsedMs(start));
+            }
+        }
+    }
+    pipeline.Close();
+
+    Clock::time_point start = Clock::now();
+    ThumbnailCache cache(THUMBNAIL_CACHE_BUDGET);
+    bool opened = cache.Open(tempFile.c_str());
+    double openMs = ElapsedMs(start);
+
+    // In microseconds, a preview takes a fraction of a millisecond
+    LatencyStats lookupLatency(MAX_SAMPLES);
+    FrameBuffer pixels;
+    for (unsigned int repeat = 0; repeat < THUMBNAIL_REPEATS && opened; ++repeat)
+    {
+        for (const auto& file : files)
+        {
+            start = Clock::now();
+            ThumbnailKey key;
+            ThumbnailInfo info;
+            if (ThumbnailCache::GetKey(file.c_str(), key) && cache.Lookup(key, info, pixels))
+            {
+                lookupLatency.Add(ElapsedMs(start) * 1000);
+            }
+        }
+    }
+
+    json.BeginObject("thumbnail_cache");
+    json.Integer("entries", cache.getEntryCount());
+    json.Integer("file_bytes", cache.getFileSize());
+    json.Integer("hits", cache.getHitCount());
+    json.Integer("misses", cache.getMissCount());
+    json.Integer("corrupt", cache.getCorruptCount());
+    json.Number("open_ms", openMs);
+    json.Number("insert_p50_ms", insertLatency.getPercentile(0.5));
+    json.Number("lookup_p50_us", lookupLatency.getPercentile(0.5));
+    json.Number("lookup_p99_us", lookupLatency.getPercentile(0.99));
+    json.Number("first_frame_p50_ms", firstFrameLatency.getPercentile(0.5));
+    json.Number("first_frame_p99_ms", firstFrameLatency.getPercentile(0.99));
+    json.EndObject();
+    cache.Close();
+    remove(tempFile.c_str());
+}
+
+// Builds the thumbnail of a file like the ThumbnailLoader of the viewer, from
+// the cache if it has the file, otherwise from the composed first frame,
+// which is then added to the cache. The portable decoders cannot decode
+// scaled, the first frame is decoded at full size.
+bool BuildThumbnail(ImagePipeline& pipeline, ThumbnailCache& cache, const std::string& file, FrameBuffer& pixels, bool& cached)
+{
+    ThumbnailKey key;
+    ThumbnailInfo info = {};
+    bool hasKey = ThumbnailCache::GetKey(file.c_str(), key);
+    cached = hasKey && cache.Lookup(key, info, pixels);
+    if (cached)
+        return true;
+
+    if (!pipeline.Open(file.c_str()) || !pipeline.ComposeFrame(0))
+        return false;
+    info.imageWidth = pipeline.getWidth();
+    info.imageHeight = pipeline.getHeight();
+    info.frameCount = pipeline.getFrameCount();
+    ThumbnailCache::GetThumbnailSize(pipeline.getWidth(), pipeline.getHeight(), THUMBNAIL_SIZE, info.width, info.height);
+    if (!pixels.hasSize(info.width, info.height, 4))
+    {
+        pixels = FrameBufferPool::GetInstance().Acquire(info.width, info.height, 4);
+    }
+    ThumbnailCache::Downscale(
+        pipeline.getPixels(),
+        pipeline.getStride(),
+        pipeline.getWidth(),
+        pipeline.getHeight(),
+        pixels.data(),
+        info.width,
+        info.height);
+    pipeline.Close();
+    if (hasKey)
+    {
+        cache.Insert(key, info, pixels.data(), pixels.getStride(), info.width, info.height);
+    }
+    return true;
+}
+
+struct ThumbnailPass
+{
+    unsigned int built;
+    unsigned int cached;
+    unsigned int failed;
+    unsigned int canceled;
+    double       seconds;
+};
+
+// Builds the thumbnails of the files on workers. Without scrolling all files
+// are wanted at once, in order. With scrolling a page of files is wanted at
+// a time and the page moves on every GRID_PAGE_MS, so that files which were
+// not reached are canceled.
+ThumbnailPass RunThumbnailPass(
+    const std::vector<std::string>& files,
+    ThumbnailCache& cache,
+    unsigned int workerCount,
+    bool scrolling)
+{
+    ThumbnailPass pass = {};
+    ThumbnailQueue queue;
+    std::mutex mutex;
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back([&]
+        {
+            // Files are built in parallel, not the strips of one file
+            ImagePipeline pipeline(0);
+            FrameBuffer pixels;
+            size_t item = 0;
+            while (queue.Take(item))
+            {
+                bool cached = false;
+                bool built = BuildThumbnail(pipeline, cache, files[item], pixels, cached);
+                queue.Finish();
+                std::lock_guard<std::mutex> lock(mutex);
+                pass.built += built && !cached;
+                pass.cached += cached;
+                pass.failed += !built;
+            }
+        });
+    }
+
+    std::vector<size_t> items;
+    for (size_t first = 0; first < files.size(); first += scrolling ? GRID_PAGE_FILES : files.size())
+    {
+        size_t end = scrolling ? std::min(files.size(), first + GRID_PAGE_FILES) : files.size();
+        items.clear();
+        for (size_t item = first; item < end; ++item)
+        {
+            items.push_back(item);
+        }
+        queue.SetWanted(items);
+        if (scrolling && end < files.size())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(GRID_PAGE_MS));
+        }
+    }
+    queue.WaitIdle();
+    pass.seconds = ElapsedMs(start) / 1000;
+    pass.canceled = queue.getCanceledCount();
+    queue.Stop();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    return pass;
+}
+
+void WritePass(JsonWriter& json, const char* name, const ThumbnailPass& pass)
+{
+    json.BeginObject(name);
+    json.Integer("built", pass.built);
+    json.Integer("cached", pass.cached);
+    json.Integer("failed", pass.failed);
+    json.Integer("canceled", pass.canceled);
+    json.Number("seconds", pass.seconds);
+    json.Number("thumbnails_per_s", pass.seconds > 0 ? (pass.built + pass.cached) / pass.seconds : 0);
+    json.EndObject();
+}
+
+// Builds the thumbnails of all files of the directory with an empty cache,
+// again with the cache, and while scrolling through the directory. The
+// second pass only finds the files which fit into the cache budget.
+bool WriteThumbnails(JsonWriter& json, const std::string& directory, unsigned int workerCount)
+{
+    std::vector<std::string> files;
+    unsigned int otherFiles = 0;
+    if (!ListFiles(directory, files, otherFiles))
+    {
+        fprintf(stderr, "Cannot read the directory %s\n", directory.c_str());
+        return false;
+    }
+    for (auto& file : files)
+    {
+        file = directory + "/" + file;
+    }
+
+    const char* temp = getenv("TMPDIR");
+    std::string tempFile = std::string(temp && *temp ? temp : "/tmp") + "/ZackBench.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return false;
+    close(descriptor);
+
+    ThumbnailCache cache(THUMBNAIL_CACHE_BUDGET);
+    bool succeeded = cache.Open(tempFile.c_str());
+    if (succeeded)
+    {
+        ThumbnailPass coldPass = RunThumbnailPass(files, cache, workerCount, false);
+        ThumbnailPass warmPass = RunThumbnailPass(files, cache, workerCount, false);
+        cache.Close();
+        cache.Open(tempFile.c_str());
+        ThumbnailPass scrollingPass = RunThumbnailPass(files, cache, workerCount, true);
+
+        json.BeginObject("thumbnails");
+        json.Integer("files", files.size());
+        json.Integer("workers", workerCount);
+        json.Integer("size", THUMBNAIL_SIZE);
+        json.Integer("cache_bytes", cache.getFileSize());
+        WritePass(json, "cold", coldPass);
+        WritePass(json, "warm", warmPass);
+        WritePass(json, "scrolling", scrollingPass);
+        json.EndObject();
+        succeeded = coldPass.failed < files.size();
+    }
+    cache.Close();
+    remove(tempFile.c_str());
+    return succeeded;
+}
+
+// Anonymous resident memory of the process in MB, which excludes the mapped
+// input file, or 0 if unknown
+double GetAnonymousMemoryMb()
+{
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == nullptr)
+        return 0;
+    char line[256];
+    unsigned long kilobytes = 0;
+    while (fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "RssAnon: %lu kB", &kilobytes) == 1)
+            break;
+    }
+    fclose(status);
+    return kilobytes / 1024.0;
+}
+
+// Decodes the pages on a thread while the pages before are encoded, like
+// the viewer saves files
+bool WriteTranscode(JsonWriter& json, const std::string& inputFile, const std::string& outputFile)
+{
+    ByteSource source;
+    TiffDecoder decoder;
+    TiffEncoder encoder;
+    if (!source.Open(inputFile.c_str()) || !decoder.Open(source.getData(), source.getSize()) ||
+        !encoder.Open(outputFile.c_str()))
+    {
+        fprintf(stderr, "Cannot transcode %s to %s\n", inputFile.c_str(), outputFile.c_str());
+        return false;
+    }
+
+    unsigned int pageCount = decoder.getPageCount();
+    FrameBuffer slots[TRANSCODE_SLOTS];
+    PagePipeline pipeline(TRANSCODE_SLOTS);
+    pipeline.Reset(pageCount);
+    std::vector<double> samples;
+    double firstPageMb = 0;
+    double peakMb = 0;
+
+    Clock::time_point start = Clock::now();
+    std::thread decodeThread([&]
+    {
+        TiffPage page;
+        pipeline.Decode([&](unsigned int pageIndex, unsigned int slot)
+        {
+            if (!decoder.ReadPage(pageIndex, page))
+                return false;
+            if (!slots[slot].hasSize(page.width, page.height, 4))
+            {
+                slots[slot] = FrameBufferPool::GetInstance().Acquire(page.width, page.height, 4);
+            }
+            return decoder.DecodePage(page, slots[slot].data(), slots[slot].getStride());
+        });
+    });
+    bool succeeded = pipeline.Encode([&](unsigned int pageIndex, unsigned int slot)
+    {
+        const FrameBuffer& pixels = slots[slot];
+        if (!encoder.WritePage(pixels.data(), pixels.getStride(), pixels.getWidth(), pixels.getHeight()))
+            return false;
+
+        double memoryMb = GetAnonymousMemoryMb();
+        peakMb = memoryMb > peakMb ? memoryMb : peakMb;
+        if (pageIndex == 0)
+        {
+            firstPageMb = memoryMb;
+        }
+        if (static_cast<unsigned long long>(pageIndex) * TRANSCODE_SAMPLES / pageCount !=
+            (static_cast<unsigned long long>(pageIndex) + 1) * TRANSCODE_SAMPLES / pageCount)
+        {
+            samples.push_back(memoryMb);
+        }
+        return true;
+    });
+    decodeThread.join();
+    succeeded = encoder.Close() && succeeded;
+    double elapsedMs = ElapsedMs(start);
+
+    json.BeginObject("transcode");
+    json.String("input", inputFile);
+    json.String("output", outputFile);
+    json.Integer("succeeded", succeeded ? 1 : 0);
+    json.Integer("pages", pipeline.getEncodedCount());
+    json.Integer("peak_slots", pipeline.getPeakSlotCount());
+    json.Number("ms", elapsedMs);
+    json.Number("pages_per_s", elapsedMs > 0 ? pipeline.getEncodedCount() * 1000.0 / elapsedMs : 0);
+    json.Number("anonymous_mb_after_first_page", firstPageMb);
+    json.Number("anonymous_mb_peak", peakMb);
+    json.BeginArray("anonymous_mb_samples");
+    for (double sample : samples)
+    {
+        json.Number(nullptr, sample);
+    }
+    json.EndArray();
+    json.EndObject();
+    return succeeded;
+}
+
+// Writes the composed frames of a GIF or the pages of a TIFF as the pages
+// of a TIFF. The workers convert one file each, so the pages are decoded on
+// the calling thread.
+bool ConvertToTiff(const std::string& sourceFile, const std::string& targetFile)
+{
+    ImagePipeline pipeline(0);
+    TiffEncoder encoder;
+    if (!pipeline.Open(sourceFile.c_str()) || !encoder.Open(targetFile.c_str()))
+        return false;
+
+    bool succeeded = true;
+    unsigned int frameCount = pipeline.getFrameCount();
+    for (unsigned int i = 0; i < frameCount && succeeded; ++i)
+    {
+        succeeded = pipeline.ComposeFrame(i) &&
+            encoder.WritePage(pipeline.getPixels(), pipeline.getStride(), pipeline.getWidth(), pipeline.getHeight());
+    }
+    if (!encoder.Close() || !succeeded)
+    {
+        remove(targetFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool WriteConvert(JsonWriter& json, BatchConverter& converter)
+{
+    bool succeeded = converter.Run(ConvertToTiff);
+    json.BeginObject("convert");
+    json.String("format", converter.getFormat());
+    json.Integer("workers", converter.getWorkerCount());
+    json.Integer("files", converter.getFileCount());
+    json.Integer("converted", converter.getConvertedCount());
+    json.Number("seconds", converter.getSeconds());
+    json.Number("files_per_s", converter.getFilesPerSecond());
+    json.EndObject();
+    return succeeded;
+}
+
+FILE* OpenOutput(const std::string& outputFile)
+{
+    if (outputFile.empty())
+        return stdout;
+    FILE* output = fopen(outputFile.c_str(), "w");
+    if (output == nullptr)
+    {
+        fprintf(stderr, "Cannot write %s\n", outputFile.c_str());
+    }
+    return output;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string corpus;
+    std::string outputFile;
+    std::string label;
+    std::string transcodeInput;
+    std::string transcodeOutput;
+    std::string thumbnailDirectory;
+    std::vector<const char*> convertArguments;
+    unsigned int loops = DEFAULT_LOOPS;
+    unsigned int thumbnailWorkers = std::max(1u, std::thread::hardware_concurrency());
+    bool convert = false;
+    bool kernelBenchmarks = true;
+    bool validArguments = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--transcode") == 0 && i + 2 < argc)
+        {
+            transcodeInput = argv[++i];
+            transcodeOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "--thumbnails") == 0 && i + 1 < argc)
+            thumbnailDirectory = argv[++i];
+        else if (strcmp(argv[i], "--convert") == 0)
+            convert = true;
+        else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+            loops = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputFile = argv[++i];
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            label = argv[++i];
+        else if (strcmp(argv[i], "--no-kernels") == 0)
+            kernelBenchmarks = false;
+        else if (convert)
+            convertArguments.push_back(argv[i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            thumbnailWorkers = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+        else if (corpus.empty() && argv[i][0] != '-')
+            corpus = argv[i];
+        else
+            validArguments = false;
+    }
+
+    // Only TIFF can be written without WIC
+    BatchConverter converter;
+    if (convert)
+    {
+        validArguments = validArguments &&
+            converter.ParseArguments(static_cast<int>(convertArguments.size()), convertArguments.data()) &&
+            (converter.getFormat() == "tif" || converter.getFormat() == "tiff");
+    }
+    if (!validArguments || !corpus.empty() + !transcodeInput.empty() + convert + !thumbnailDirectory.empty() != 1 ||
+        loops == 0 || thumbnailWorkers == 0)
+    {
+        fprintf(stderr, "Usage: %s <corpus directory> [--loops N] [--output file] [--label text] [--no-kernels]\n", argv[0]);
+        fprintf(stderr, "       %s --transcode <input TIFF> <output TIFF> [--output file] [--label text]\n", argv[0]);
+        fprintf(stderr, "       %s --convert %s [--output file] [--label text]\n", argv[0], BatchConverter::getUsage());
+        fprintf(stderr, "       %s --thumbnails <directory> [--workers N] [--output file] [--label text]\n", argv[0]);
+        return 2;
+    }
+
+    if (!transcodeInput.empty() || convert || !thumbnailDirectory.empty())
+    {
+        FILE* output = OpenOutput(outputFile);
+        if (output == nullptr)
+            return 1;
+        JsonWriter json(output);
+        json.BeginObject();
+        json.String("label", label);
+        bool succeeded = convert ? WriteConvert(json, converter) :
+            !thumbnailDirectory.empty() ? WriteThumbnails(json, thumbnailDirectory, thumbnailWorkers) :
+            WriteTranscode(json, transcodeInput, transcodeOutput);
+        json.EndObject();
+        if (output != stdout)
+        {
+            fclose(output);
+        }
+        return succeeded ? 0 : 1;
+    }
+
+    std::vector<std::string> files;
+    unsigned int skippedFiles = 0;
+    if (!ListFiles(corpus, files, skippedFiles))
+    {
+        fprintf(stderr, "Cannot read the directory %s\n", corpus.c_str());
+        return 1;
+    }
+
+    // Open to first frame and sustained playback of each file
+    ImagePipeline pipeline;
+    std::vector<FileResult> results;
+    LatencyStats openLatency(MAX_SAMPLES);
+    LatencyStats frameLatency(MAX_SAMPLES);
+    LatencyStats fileFrameLatency(MAX_SAMPLES);
+    double playbackMs = 0;
+    unsigned long long playedFrames = 0;
+    std::vector<std::string> openedFiles;
+    for (const auto& name : files)
+    {
+        std::string path = corpus + "/" + name;
+        Clock::time_point start = Clock::now();
+        if (!pipeline.Open(path.c_str()) || !pipeline.ComposeFrame(0))
+        {
+            ++skippedFiles;
+            continue;
+        }
+        FileResult result;
+        result.name = name;
+        result.width = pipeline.getWidth();
+        result.height = pipeline.getHeight();
+        result.frameCount = pipeline.getFrameCount();
+        result.openMs = ElapsedMs(start);
+        openLatency.Add(result.openMs);
+        openedFiles.push_back(path);
+
+        fileFrameLatency.Reset();
+        Clock::time_point playbackStart = Clock::now();
+        unsigned int frameCount = pipeline.getFrameCount();
+        for (unsigned int loop = 0; loop < loops; ++loop)
+        {
+            for (unsigned int i = 0; i < frameCount; ++i)
+            {
+                Clock::time_point frameStart = Clock::now();
+                pipeline.ComposeFrame(i);
+                double frameMs = ElapsedMs(frameStart);
+                frameLatency.Add(frameMs);
+                fileFrameLatency.Add(frameMs);
+            }
+        }
+        double fileMs = ElapsedMs(playbackStart);
+        playbackMs += fileMs;
+        playedFrames += static_cast<unsigned long long>(frameCount) * loops;
+        result.framesPerSecond = fileMs > 0 ? frameCount * loops * 1000.0 / fileMs : 0;
+        result.frameP50Ms = fileFrameLatency.getPercentile(0.5);
+        result.frameP99Ms = fileFrameLatency.getPercentile(0.99);
+        results.push_back(result);
+    }
+
+    // Switching to the next file with the pipeline and the pool warmed up,
+    // like paging through a directory
+    LatencyStats switchLatency(MAX_SAMPLES);
+    if (openedFiles.size() > 1)
+    {
+        pipeline.Open(openedFiles[0].c_str());
+        pipeline.ComposeFrame(0);
+        for (size_t i = 1; i < openedFiles.size(); ++i)
+        {
+            Clock::time_point start = Clock::now();
+            if (pipeline.Open(openedFiles[i].c_str()) && pipeline.ComposeFrame(0))
+            {
+                switchLatency.Add(ElapsedMs(start));
+            }
+        }
+    }
+    pipeline.Close();
+
+    FILE* output = OpenOutput(outputFile);
+    if (output == nullptr)
+        return 1;
+
+    JsonWriter json(output);
+    json.BeginObject();
+    json.String("label", label);
+    json.String("corpus", corpus);
+    json.String("kernels", PixelConverter::getKernelsName(PixelConverter::getBestKernels()));
+    json.Integer("loops", loops);
+    json.Integer("skipped_files", skippedFiles);
+
+    json.BeginObject("summary");
+    json.Integer("files", results.size());
+    json.Integer("frames", playedFrames);
+    json.Number("open_p50_ms", openLatency.getPercentile(0.5));
+    json.Number("open_p99_ms", openLatency.getPercentile(0.99));
+    json.Number("frames_per_s", playbackMs > 0 ? playedFrames * 1000.0 / playbackMs : 0);
+    json.Number("frame_p50_ms", frameLatency.getPercentile(0.5));
+    json.Number("frame_p99_ms", frameLatency.getPercentile(0.99));
+    json.Number("switch_p50_ms", switchLatency.getPercentile(0.5));
+    json.Number("switch_p99_ms", switchLatency.getPercentile(0.99));
+    json.EndObject();
+
+    FrameBufferPool& pool = FrameBufferPool::GetInstance();
+    json.BeginObject("frame_buffers");
+    json.Number("peak_mb", pool.getPeakBytes() / 1048576.0);
+    json.Number("reuse_rate", pool.getAcquireCount() > 0 ? static_cast<double>(pool.getReuseCount()) / pool.getAcquireCount() : 0);
+    json.EndObject();
+
+    if (kernelBenchmarks)
+    {
+        json.BeginObject("kernel_benchmarks");
+        WriteKernelResults(json);
+        json.EndObject();
+    }
+
+    WriteTiffScaling(json, openedFiles);
+    WriteOpenToFirstFrame(json, openedFiles);
+    WriteSeekLatency(json, openedFiles);
+    WriteGifExport(json, openedFiles);
+    WriteFrameCache(json, openedFiles);
+    WriteThumbnailCache(json, openedFiles);
+
+    json.BeginArray("files");
+    for (const auto& result : results)
+    {
+        json.BeginObject();
+        json.String("name", result.name);
+        json.Integer("width", result.width);
+        json.Integer("height", result.height);
+        json.Integer("frames", result.frameCount);
+        json.Number("open_ms", result.openMs);
+        json.Number("frames_per_s", result.framesPerSecond);
+        json.Number("frame_p50_ms", result.frameP50Ms);
+        json.Number("frame_p99_ms", result.frameP99Ms);
+        json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "ByteSource.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the blocks in which a file is read which cannot be mapped
+const size_t READ_BLOCK_SIZE = 1024 * 1024;
+
+ByteSource::ByteSource() :
+    m_data(nullptr),
+    m_size(0),
+    m_mapped(false)
+#ifdef _WIN32
+    , m_mapping(nullptr)
+#endif
+{
+}
+
+ByteSource::~ByteSource()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool ByteSource::Open(const wchar_t* filename, bool allowMapping)
+{
+    Close();
+
+    HANDLE file = CreateFileW(
+        filename,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || static_cast<ULONGLONG>(fileSize.QuadPart) > SIZE_MAX)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+
+    // Empty files cannot be mapped
+    if (m_size > 0 && allowMapping)
+    {
+        m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping != nullptr)
+        {
+            m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (m_data == nullptr)
+            {
+                CloseHandle(m_mapping);
+                m_mapping = nullptr;
+            }
+        }
+    }
+
+    bool result = true;
+    if (m_data != nullptr)
+    {
+        m_mapped = true;
+    }
+    else
+    {
+        // Read the file, e.g. if the address space is too fragmented to map it
+        m_buffer.resize(m_size);
+        size_t offset = 0;
+        while (result && offset < m_size)
+        {
+            DWORD toRead = static_cast<DWORD>(m_size - offset < READ_BLOCK_SIZE ? m_size - offset : READ_BLOCK_SIZE);
+            DWORD read = 0;
+            result = ReadFile(file, &m_buffer[offset], toRead, &read, nullptr) && read == toRead;
+            offset += read;
+        }
+        m_data = m_buffer.data();
+    }
+
+    CloseHandle(file);
+    if (!result)
+    {
+        Close();
+    }
+    return result;
+}
+
+void ByteSource::Close()
+{
+    if (m_mapped)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+}
+
+#else
+
+bool ByteSource::Open(const char* filename, bool allowMapping)
+{
+    Close();
+
+    int file = open(filename, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+    {
+        close(file);
+        return false;
+    }
+    m_size = static_cast<size_t>(fileStat.st_size);
+
+    // Empty files cannot be mapped
+    if (m_size > 0 && allowMapping)
+    {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const uint8_t*>(data);
+            m_mapped = true;
+        }
+    }
+
+    bool result = true;
+    if (!m_mapped)
+    {
+        // Read the file, e.g. if the file system does not support mapping
+        m_buffer.resize(m_size);
+        size_t offset = 0;
+        while (result && offset < m_size)
+        {
+            size_t toRead = m_size - offset < READ_BLOCK_SIZE ? m_size - offset : READ_BLOCK_SIZE;
+            ssize_t bytesRead = read(file, &m_buffer[offset], toRead);
+            result = bytesRead > 0;
+            if (result)
+            {
+                offset += static_cast<size_t>(bytesRead);
+            }
+        }
+        m_data = m_buffer.data();
+    }
+
+    close(file);
+    if (!result)
+    {
+        Close();
+    }
+    return result;
+}
+
+void ByteSource::Close()
+{
+    if (m_mapped)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only view of the bytes of a file, so that decoders can parse the file
+// without copying it. The file is memory mapped if possible, otherwise it is
+// read into memory. The decoders need all bytes in one block, so a file
+// which cannot be mapped is read whole before the first frame is decoded.
+class ByteSource
+{
+public:
+    ByteSource();
+    ~ByteSource();
+
+    // Without allowMapping the file is read like a file which cannot be
+    // mapped, to compare both
+#ifdef _WIN32
+    bool Open(const wchar_t* filename, bool allowMapping = true);
+#else
+    bool Open(const char* filename, bool allowMapping = true);
+#endif
+    void Close();
+
+    const uint8_t* getData() const { return m_data; }
+    size_t         getSize() const { return m_size; }
+
+    // Whether the bytes are memory mapped or were read into memory
+    bool           isMapped() const { return m_mapped; }
+
+private:
+    ByteSource(const ByteSource&) = delete;
+    ByteSource& operator=(const ByteSource&) = delete;
+
+    const uint8_t*       m_data;
+    size_t               m_size;
+    bool                 m_mapped;
+    std::vector<uint8_t> m_buffer;      // The bytes of a file which could not be mapped
+#ifdef _WIN32
+    void*                m_mapping;
+#endif
+};
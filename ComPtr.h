@@ -8,6 +8,8 @@ public:
 	ComPtr() :ptr_(nullptr) { }
 	// ptr should be already AddRef'ed for this reference.
 	ComPtr(T* ptr) :ptr_(ptr) { }
+	ComPtr(ComPtr&& other) :ptr_(other.ptr_) { other.ptr_ = nullptr; }
+	ComPtr& operator=(ComPtr&& other) { if (this != &other) { reset(other.ptr_); other.ptr_ = nullptr; } return *this; }
 	~ComPtr() { if (ptr_) ptr_->Release(); }
 
 	T* get() { return ptr_; }
@@ -0,0 +1,183 @@
+#include "FilePrefetcher.h"
+#include <algorithm>
+#include "ComPtr.h"
+#include "Tracer.h"
+
+FilePrefetcher::FilePrefetcher(size_t budgetBytes) :
+    m_budgetBytes(budgetBytes),
+    m_hitCount(0),
+    m_missCount(0),
+    m_maxWidth(0),
+    m_maxHeight(0),
+    m_usedBytes(0),
+    m_stop(false)
+{
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    Stop();
+}
+
+void FilePrefetcher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+bool FilePrefetcher::GetFileVersion(const std::wstring& filename, ULONGLONG& writeTime, ULONGLONG& fileSize)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+    writeTime = (static_cast<ULONGLONG>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    fileSize = (static_cast<ULONGLONG>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    return true;
+}
+
+size_t FilePrefetcher::GetFrameBytes(const Entry& entry)
+{
+    return entry.frame ? entry.frame->pixels.size() : 0;
+}
+
+void FilePrefetcher::Prefetch(const std::vector<std::wstring>& filenames, UINT maxWidth, UINT maxHeight)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop)
+            return;
+
+        m_wanted = filenames;
+        m_maxWidth = maxWidth;
+        m_maxHeight = maxHeight;
+        auto notWanted = [this](const Entry& entry) {
+            return std::find(m_wanted.begin(), m_wanted.end(), entry.filename) == m_wanted.end();
+        };
+        for (const auto& entry : m_entries)
+        {
+            if (notWanted(entry))
+            {
+                m_usedBytes -= GetFrameBytes(entry);
+            }
+        }
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), notWanted), m_entries.end());
+
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread(&FilePrefetcher::Run, this);
+        }
+    }
+    m_wake.notify_one();
+}
+
+std::shared_ptr<DecodedFrame> FilePrefetcher::Take(const std::wstring& filename)
+{
+    ULONGLONG writeTime = 0;
+    ULONGLONG fileSize = 0;
+    bool exists = GetFileVersion(filename, writeTime, fileSize);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& entry : m_entries)
+    {
+        if (entry.filename == filename && entry.frame && exists &&
+            entry.writeTime == writeTime && entry.fileSize == fileSize)
+        {
+            ++m_hitCount;
+            return entry.frame;
+        }
+    }
+    ++m_missCount;
+    return nullptr;
+}
+
+bool FilePrefetcher::FindFileToPrefetch(std::wstring& filename) const
+{
+    for (const auto& wanted : m_wanted)
+    {
+        auto found = std::find_if(m_entries.begin(), m_entries.end(), [&wanted](const Entry& entry) {
+            return entry.filename == wanted;
+        });
+        if (found == m_entries.end())
+        {
+            filename = wanted;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FilePrefetcher::Run()
+{
+    Tracer::SetThreadName("Prefetcher");
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+        return;
+
+    {
+        // The factory of the UI thread belongs to its apartment
+        ComPtr<IWICImagingFactory> factory;
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            nullptr,
+            CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(factory.get_out_storage()));
+
+        while (SUCCEEDED(hr))
+        {
+            Entry entry;
+            UINT maxWidth = 0;
+            UINT maxHeight = 0;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this, &entry] {
+                    return m_stop || FindFileToPrefetch(entry.filename);
+                });
+                if (m_stop)
+                    break;
+                maxWidth = m_maxWidth;
+                maxHeight = m_maxHeight;
+            }
+
+            // A file which cannot be decoded is kept without frame, so that
+            // it is not tried again
+            ComPtr<IWICBitmapDecoder> decoder;
+            if (GetFileVersion(entry.filename, entry.writeTime, entry.fileSize) &&
+                SUCCEEDED(factory->CreateDecoderFromFilename(
+                    entry.filename.c_str(),
+                    nullptr,
+                    GENERIC_READ,
+                    WICDecodeMetadataCacheOnDemand,
+                    decoder.get_out_storage())))
+            {
+                std::shared_ptr<DecodedFrame> frame = std::make_shared<DecodedFrame>();
+                frame->frameIndex = 0;
+                if (SUCCEEDED(FrameDecodeWorker::DecodeFrame(factory.get(), decoder.get(), *frame, maxWidth, maxHeight)))
+                {
+                    entry.frame = frame;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            bool stillWanted = std::find(m_wanted.begin(), m_wanted.end(), entry.filename) != m_wanted.end();
+            if (stillWanted && m_usedBytes + GetFrameBytes(entry) > m_budgetBytes)
+            {
+                // Keep the entry to not decode the file again, but drop the frame
+                entry.frame.reset();
+            }
+            if (stillWanted)
+            {
+                m_usedBytes += GetFrameBytes(entry);
+                m_entries.push_back(std::move(entry));
+            }
+        }
+    }
+
+    CoUninitialize();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <wincodec.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameDecodeWorker.h"
+
+// Decodes the first frame of the files next to the displayed file on a
+// worker thread, so that switching to them does not wait for decoding.
+// Prefetched frames are kept per file name and last write time, so changed
+// files are decoded again. The cache is bounded by a memory budget.
+class FilePrefetcher
+{
+public:
+    explicit FilePrefetcher(size_t budgetBytes);
+    ~FilePrefetcher();
+
+    // Sets the files to prefetch, the most important first. Frames of other
+    // files are dropped. Single frame images are scaled down to fit into
+    // maxWidth x maxHeight.
+    void Prefetch(const std::vector<std::wstring>& filenames, UINT maxWidth, UINT maxHeight);
+
+    // Returns the first frame of the file if it is prefetched and the file
+    // did not change since, otherwise nullptr
+    std::shared_ptr<DecodedFrame> Take(const std::wstring& filename);
+
+    void Stop();
+
+    unsigned int getHitCount()  const { return m_hitCount; }
+    unsigned int getMissCount() const { return m_missCount; }
+
+private:
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+    struct Entry
+    {
+        std::wstring                  filename;
+        ULONGLONG                     writeTime;
+        ULONGLONG                     fileSize;
+        std::shared_ptr<DecodedFrame> frame;       // nullptr if the file could not be decoded
+    };
+
+    static bool GetFileVersion(const std::wstring& filename, ULONGLONG& writeTime, ULONGLONG& fileSize);
+    static size_t GetFrameBytes(const Entry& entry);
+
+    void Run();
+    bool FindFileToPrefetch(std::wstring& filename) const;
+
+    size_t                    m_budgetBytes;
+    unsigned int              m_hitCount;
+    unsigned int              m_missCount;
+
+    std::mutex                m_mutex;      // Protects the members below
+    std::condition_variable   m_wake;
+    std::vector<std::wstring> m_wanted;
+    UINT                      m_maxWidth;
+    UINT                      m_maxHeight;
+    std::vector<Entry>        m_entries;
+    size_t                    m_usedBytes;
+    bool                      m_stop;
+    std::thread               m_thread;
+};
@@ -0,0 +1,412 @@
+#include "FileSaver.h"
+#include "FrameIndex.h"
+#include "GifEncoder.h"
+#include "ImageInfo.h"
+#include "Tracer.h"
+
+FileSaver::FileSaver() :
+    m_containerFormat(GUID_NULL),
+    m_notifyWindow(nullptr),
+    m_progressMessage(0),
+    m_finishedMessage(0),
+    m_dither(false),
+    m_pipeline(SLOT_COUNT),
+    m_decodeResult(S_OK),
+    m_encodeResult(S_OK),
+    m_cancelled(false),
+    m_notified(false)
+{
+}
+
+FileSaver::~FileSaver()
+{
+    Stop();
+}
+
+bool FileSaver::Start(
+    const std::wstring& sourceFilename,
+    const std::wstring& targetFilename,
+    const GUID& containerFormat,
+    HWND notifyWindow,
+    UINT progressMessage,
+    UINT finishedMessage)
+{
+    if (isRunning())
+        return false;
+
+    m_sourceFilename = sourceFilename;
+    m_targetFilename = targetFilename;
+    m_containerFormat = containerFormat;
+    m_notifyWindow = notifyWindow;
+    m_progressMessage = progressMessage;
+    m_finishedMessage = finishedMessage;
+    m_cancelled = false;
+    m_notified = false;
+    m_pipeline.Reset(0);
+    m_thread = std::thread(&FileSaver::Run, this);
+    return true;
+}
+
+HRESULT FileSaver::Save(
+    const std::wstring& sourceFilename,
+    const std::wstring& targetFilename,
+    const GUID& containerFormat)
+{
+    if (isRunning())
+        return HRESULT_FROM_WIN32(ERROR_BUSY);
+
+    m_sourceFilename = sourceFilename;
+    m_targetFilename = targetFilename;
+    m_containerFormat = containerFormat;
+    m_notifyWindow = nullptr;
+    m_cancelled = false;
+    m_pipeline.Reset(0);
+    return SaveAndRelease();
+}
+
+void FileSaver::Cancel()
+{
+    m_cancelled = true;
+    m_pipeline.Cancel();
+}
+
+void FileSaver::Stop()
+{
+    if (m_thread.joinable())
+    {
+        Cancel();
+        m_thread.join();
+    }
+}
+
+void FileSaver::Run()
+{
+    Tracer::SetThreadName("File saver");
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (SUCCEEDED(hr))
+    {
+        hr = SaveAndRelease();
+        CoUninitialize();
+    }
+
+    if (m_notifyWindow)
+    {
+        PostMessage(m_notifyWindow, m_finishedMessage, static_cast<WPARAM>(hr), 0);
+    }
+}
+
+HRESULT FileSaver::SaveAndRelease()
+{
+    // GIF files have a palette per frame, which WIC does not build
+    HRESULT hr = IsEqualGUID(m_containerFormat, GUID_ContainerFormatGif) ? SaveAnimation() : SavePages();
+
+    // The file is released before it is deleted
+    for (auto& slot : m_slots)
+    {
+        slot.frame.reset(nullptr);
+        slot.bitmap.reset(nullptr);
+    }
+    for (auto& rawFrame : m_rawFrames)
+    {
+        rawFrame.pixels.Release();
+    }
+    m_encoder.reset(nullptr);
+    m_decoder.reset(nullptr);
+    m_factory.reset(nullptr);
+
+    if (FAILED(hr))
+    {
+        DeleteFileW(m_targetFilename.c_str());
+    }
+    return hr;
+}
+
+HRESULT FileSaver::OpenSource()
+{
+    // The factory of the UI thread belongs to its apartment. The decoder
+    // reads the file as needed instead of mapping all of it.
+    HRESULT hr = CoCreateInstance(
+        CLSID_WICImagingFactory,
+        nullptr,
+        CLSCTX_INPROC_SERVER,
+        IID_PPV_ARGS(m_factory.get_out_storage()));
+    if (SUCCEEDED(hr))
+    {
+        hr = m_factory->CreateDecoderFromFilename(
+            m_sourceFilename.c_str(),
+            nullptr,
+            GENERIC_READ,
+            WICDecodeMetadataCacheOnDemand,
+            m_decoder.get_out_storage());
+    }
+    return hr;
+}
+
+HRESULT FileSaver::SavePages()
+{
+    TRACE_SCOPE("FileSaver::SavePages");
+    ComPtr<IWICStream> stream;
+    ComPtr<IWICBitmapEncoderInfo> encoderInfo;
+    UINT pageCount = 0;
+    BOOL multiframe = FALSE;
+
+    HRESULT hr = OpenSource();
+    if (SUCCEEDED(hr))
+    {
+        hr = m_decoder->GetFrameCount(&pageCount);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = m_factory->CreateStream(stream.get_out_storage());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = stream->InitializeFromFilename(m_targetFilename.c_str(), GENERIC_WRITE);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = m_factory->CreateEncoder(m_containerFormat, nullptr, m_encoder.get_out_storage());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = m_encoder->Initialize(stream.get(), WICBitmapEncoderNoCache);
+    }
+
+    // Formats with a single frame get the first page
+    if (SUCCEEDED(hr) && SUCCEEDED(m_encoder->GetEncoderInfo(encoderInfo.get_out_storage())))
+    {
+        encoderInfo->DoesSupportMultiframe(&multiframe);
+    }
+    if (FAILED(hr))
+        return hr;
+
+    hr = RunPipeline(
+        multiframe ? pageCount : (pageCount > 0 ? 1 : 0),
+        [this](unsigned int pageIndex, unsigned int slot)
+        {
+            m_decodeResult = DecodePage(pageIndex, m_slots[slot]);
+            return SUCCEEDED(m_decodeResult);
+        },
+        [this](unsigned int pageIndex, unsigned int slot)
+        {
+            m_encodeResult = EncodePage(m_slots[slot]);
+            return SUCCEEDED(m_encodeResult);
+        });
+    if (FAILED(hr))
+        return hr;
+
+    TRACE_SCOPE("CommitFile");
+    return m_encoder->Commit();
+}
+
+HRESULT FileSaver::SaveAnimation()
+{
+    TRACE_SCOPE("FileSaver::SaveAnimation");
+    ImageInfo imageInfo;
+    FrameIndex frameIndex;
+    FrameCompositor compositor;
+    GifEncoder encoder;
+
+    HRESULT hr = OpenSource();
+    if (SUCCEEDED(hr) && FAILED(imageInfo.GetGlobalMetadata(m_decoder.get())))
+    {
+        hr = imageInfo.GetDefaultMetadata(m_decoder.get());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = frameIndex.Build(m_decoder.get(), imageInfo);
+    }
+    if (SUCCEEDED(hr) && !encoder.Open(
+        m_targetFilename.c_str(),
+        imageInfo.getImageWidth(),
+        imageInfo.getImageHeight(),
+        imageInfo.getTotalLoopCount()))
+    {
+        hr = E_FAIL;
+    }
+    if (FAILED(hr))
+        return hr;
+
+    encoder.SetDithering(m_dither);
+    compositor.Reset(imageInfo.getImageWidth(), imageInfo.getImageHeight());
+    const uint32_t backgroundColor = ToCanvasColor(imageInfo.getBackgroundColor());
+
+    // The frames are decoded ahead, and composed and quantized in order.
+    // The decoder is only used by the decoding worker once the index is built.
+    hr = RunPipeline(
+        imageInfo.getFrameCount(),
+        [this](unsigned int frameNumber, unsigned int slot)
+        {
+            m_rawFrames[slot].frameIndex = frameNumber;
+            m_decodeResult = FrameDecodeWorker::DecodeFrame(m_factory.get(), m_decoder.get(), m_rawFrames[slot]);
+            return SUCCEEDED(m_decodeResult);
+        },
+        [&](unsigned int frameNumber, unsigned int slot)
+        {
+            TRACE_SCOPE("SaveComposeFrame");
+            const FrameInfo& frameInfo = frameIndex.getFrame(frameNumber);
+            const DecodedFrame& rawFrame = m_rawFrames[slot];
+            PixelRect position = PixelRect::Make(frameInfo.left, frameInfo.top, frameInfo.width, frameInfo.height);
+
+            // Same steps as the displayed animation, without the caches
+            m_encodeResult = S_OK;
+            if (frameNumber == 0)
+            {
+                compositor.Clear(backgroundColor);
+            }
+            else
+            {
+                const FrameInfo& previousInfo = frameIndex.getFrame(frameNumber - 1);
+                PixelRect previousPosition = PixelRect::Make(
+                    previousInfo.left,
+                    previousInfo.top,
+                    previousInfo.width,
+                    previousInfo.height);
+                if (!compositor.Dispose(previousInfo.disposal, previousPosition, backgroundColor))
+                {
+                    m_encodeResult = E_FAIL;
+                }
+            }
+            if (SUCCEEDED(m_encodeResult))
+            {
+                if (frameInfo.disposal == DM_PREVIOUS)
+                {
+                    compositor.SaveCanvas(position);
+                }
+                PixelRect drawRect = PixelRect::Make(frameInfo.left, frameInfo.top, rawFrame.width, rawFrame.height);
+                drawRect.Intersect(position);
+                const FrameBuffer& coverage = rawFrame.coverage;
+                bool covered = coverage.hasSize(rawFrame.width, rawFrame.height, 1);
+                compositor.Overlay(
+                    rawFrame.pixels.data(),
+                    rawFrame.pixels.getStride(),
+                    covered ? coverage.data() : nullptr,
+                    coverage.getStride(),
+                    drawRect);
+                compositor.TakeDirtyRect();
+
+                if (!encoder.AddFrame(compositor.getPixels(), compositor.getStride(), frameInfo.delay))
+                {
+                    m_encodeResult = E_FAIL;
+                }
+            }
+            return SUCCEEDED(m_encodeResult);
+        });
+
+    // The last frame is written when the file is closed
+    TRACE_SCOPE("CommitFile");
+    if (!encoder.Close() && SUCCEEDED(hr))
+    {
+        hr = E_FAIL;
+    }
+    return hr;
+}
+
+HRESULT FileSaver::RunPipeline(unsigned int pageCount, const PagePipeline::Stage& decode, const PagePipeline::Stage& encode)
+{
+    // A cancel before the reset is repeated
+    m_pipeline.Reset(pageCount);
+    if (m_cancelled)
+    {
+        m_pipeline.Cancel();
+    }
+    m_decodeResult = S_OK;
+    m_encodeResult = S_OK;
+
+    std::thread decodeThread([this, &decode]
+    {
+        Tracer::SetThreadName("File saver decoder");
+        if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+        {
+            m_decodeResult = E_FAIL;
+            m_pipeline.Cancel();
+            return;
+        }
+        m_pipeline.Decode(decode);
+        CoUninitialize();
+    });
+
+    bool saved = m_pipeline.Encode([this, &encode](unsigned int pageIndex, unsigned int slot)
+    {
+        bool encoded = encode(pageIndex, slot);
+        NotifyProgress(pageIndex + 1);
+        return encoded;
+    });
+    decodeThread.join();
+
+    if (FAILED(m_decodeResult))
+        return m_decodeResult;
+    if (FAILED(m_encodeResult))
+        return m_encodeResult;
+    if (!saved || m_pipeline.isCancelled())
+        return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    return S_OK;
+}
+
+HRESULT FileSaver::DecodePage(unsigned int pageIndex, Slot& slot)
+{
+    TRACE_SCOPE("SaveDecodePage");
+    std::lock_guard<std::mutex> lock(m_decoderMutex);
+    HRESULT hr = m_decoder->GetFrame(pageIndex, slot.frame.get_out_storage());
+    if (SUCCEEDED(hr))
+    {
+        // Decodes the pixels in the format of the page
+        hr = m_factory->CreateBitmapFromSource(slot.frame.get(), WICBitmapCacheOnLoad, slot.bitmap.get_out_storage());
+    }
+    return hr;
+}
+
+HRESULT FileSaver::EncodePage(Slot& slot)
+{
+    TRACE_SCOPE("SaveEncodePage");
+    ComPtr<IWICBitmapFrameEncode> frameEncode;
+    ComPtr<IWICMetadataBlockWriter> blockWriter;
+    ComPtr<IWICMetadataBlockReader> blockReader;
+
+    HRESULT hr = m_encoder->CreateNewFrame(frameEncode.get_out_storage(), nullptr);
+    if (SUCCEEDED(hr))
+    {
+        hr = frameEncode->Initialize(nullptr);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // The metadata is read from the decoder, which decodes the next page
+        std::lock_guard<std::mutex> lock(m_decoderMutex);
+        double dpiX = 0;
+        double dpiY = 0;
+        if (SUCCEEDED(slot.frame->GetResolution(&dpiX, &dpiY)) && dpiX > 0 && dpiY > 0)
+        {
+            frameEncode->SetResolution(dpiX, dpiY);
+        }
+        if (SUCCEEDED(slot.frame->QueryInterface(blockReader.get_out_storage())) &&
+            SUCCEEDED(frameEncode->QueryInterface(blockWriter.get_out_storage())))
+        {
+            blockWriter->InitializeFromBlockReader(blockReader.get());
+        }
+        blockReader.reset(nullptr);
+        slot.frame.reset(nullptr);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = frameEncode->WriteSource(slot.bitmap.get(), nullptr);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = frameEncode->Commit();
+    }
+
+    // The slot is decoded again, the pixels are not kept until then
+    slot.bitmap.reset(nullptr);
+    return hr;
+}
+
+void FileSaver::NotifyProgress(unsigned int savedCount)
+{
+    // One message at a time, the window reads the latest count
+    if (m_notifyWindow && !m_notified.exchange(true))
+    {
+        PostMessage(m_notifyWindow, m_progressMessage, savedCount, m_pipeline.getPageCount());
+    }
+}
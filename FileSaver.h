@@ -0,0 +1,107 @@
+#pragma once
+#include <wincodec.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "ComPtr.h"
+#include "FrameDecodeWorker.h"
+#include "PagePipeline.h"
+
+// Saves the pages of a file in another container format off the UI thread.
+// One worker decodes the next pages while another one encodes, and at most
+// SLOT_COUNT decoded pages are in memory, so memory does not grow with the
+// number of pages. Progress and the result are posted to a window, unless
+// the file is saved on the calling thread. Animations saved as GIF are
+// composed like they are displayed and written by the GifEncoder, which
+// quantizes each frame to a palette of its own.
+class FileSaver
+{
+public:
+    FileSaver();
+    ~FileSaver();
+
+    // Starts saving. progressMessage is posted with the number of pages
+    // saved as wParam and the page count as lParam, finishedMessage with the
+    // HRESULT as wParam once the workers are done, which is
+    // HRESULT_FROM_WIN32(ERROR_CANCELLED) if saving was cancelled. The file
+    // is deleted if it could not be saved completely.
+    bool Start(
+        const std::wstring& sourceFilename,
+        const std::wstring& targetFilename,
+        const GUID& containerFormat,
+        HWND notifyWindow,
+        UINT progressMessage,
+        UINT finishedMessage);
+
+    // Saves on the calling thread, which must have initialized COM for the
+    // multithreaded apartment. Nothing is posted, the file is deleted if it
+    // could not be saved completely.
+    HRESULT Save(
+        const std::wstring& sourceFilename,
+        const std::wstring& targetFilename,
+        const GUID& containerFormat);
+
+    // Ordered dithering of the frames of animations saved as GIF
+    void SetDithering(bool dither) { m_dither = dither; }
+
+    // Cancels saving, the workers stop after the pages they work on
+    void Cancel();
+
+    // Cancels saving and waits for the workers
+    void Stop();
+
+    bool isRunning() const { return m_thread.joinable(); }
+
+    unsigned int getSavedCount() const { return m_pipeline.getEncodedCount(); }
+    unsigned int getPageCount()  const { return m_pipeline.getPageCount(); }
+
+    // Called when the progress message is handled, to allow the next one
+    void AcknowledgeProgress() { m_notified = false; }
+
+private:
+    FileSaver(const FileSaver&) = delete;
+    FileSaver& operator=(const FileSaver&) = delete;
+
+    struct Slot
+    {
+        ComPtr<IWICBitmapFrameDecode> frame;    // For the metadata and the resolution
+        ComPtr<IWICBitmap>            bitmap;   // The decoded pixels
+    };
+
+    static const unsigned int SLOT_COUNT = 2;
+
+    void Run();
+    HRESULT SaveAndRelease();
+    HRESULT OpenSource();
+    HRESULT SavePages();
+    HRESULT SaveAnimation();
+    HRESULT RunPipeline(unsigned int pageCount, const PagePipeline::Stage& decode, const PagePipeline::Stage& encode);
+    HRESULT DecodePage(unsigned int pageIndex, Slot& slot);
+    HRESULT EncodePage(Slot& slot);
+    void NotifyProgress(unsigned int savedCount);
+
+    std::wstring                  m_sourceFilename;
+    std::wstring                  m_targetFilename;
+    GUID                          m_containerFormat;
+    HWND                          m_notifyWindow;
+    UINT                          m_progressMessage;
+    UINT                          m_finishedMessage;
+    bool                          m_dither;
+
+    PagePipeline                  m_pipeline;
+    Slot                          m_slots[SLOT_COUNT];
+    DecodedFrame                  m_rawFrames[SLOT_COUNT];  // Frames of animations saved as GIF
+
+    // Used by the workers only
+    ComPtr<IWICImagingFactory>    m_factory;
+    ComPtr<IWICBitmapDecoder>     m_decoder;
+    ComPtr<IWICBitmapEncoder>     m_encoder;
+    std::mutex                    m_decoderMutex;   // The decoder and its frames are used by both workers
+    HRESULT                       m_decodeResult;
+    HRESULT                       m_encodeResult;
+
+    std::atomic<bool>             m_cancelled;      // Also set before the pipeline runs
+    std::atomic<bool>             m_notified;       // Whether a progress message is pending
+    std::thread                   m_thread;         // Encodes and starts the decoding worker
+};
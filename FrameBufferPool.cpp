@@ -0,0 +1,220 @@
+#include "FrameBufferPool.h"
+#include <utility>
+
+FrameBuffer::FrameBuffer() :
+    m_pool(nullptr),
+    m_width(0),
+    m_height(0),
+    m_bytesPerPixel(0)
+{
+}
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other) :
+    FrameBuffer()
+{
+    swap(other);
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other)
+{
+    if (this != &other)
+    {
+        Release();
+        swap(other);
+    }
+    return *this;
+}
+
+FrameBuffer::~FrameBuffer()
+{
+    Release();
+}
+
+void FrameBuffer::swap(FrameBuffer& other)
+{
+    std::swap(m_pool, other.m_pool);
+    m_bytes.swap(other.m_bytes);
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_bytesPerPixel, other.m_bytesPerPixel);
+}
+
+void FrameBuffer::Release()
+{
+    if (m_pool)
+    {
+        m_pool->Release(*this);
+    }
+    m_pool = nullptr;
+    std::vector<uint8_t>().swap(m_bytes);
+    m_width = 0;
+    m_height = 0;
+    m_bytesPerPixel = 0;
+}
+
+FrameBufferPool::FrameBufferPool(size_t budgetBytes) :
+    m_budgetBytes(budgetBytes),
+    m_liveBytes(0),
+    m_peakBytes(0),
+    m_idleBytes(0),
+    m_acquireCount(0),
+    m_reuseCount(0)
+{
+}
+
+FrameBufferPool& FrameBufferPool::GetInstance()
+{
+    // Unlimited until the application sets a budget
+    static FrameBufferPool pool(SIZE_MAX);
+    return pool;
+}
+
+FrameBuffer FrameBufferPool::Acquire(unsigned int width, unsigned int height, unsigned int bytesPerPixel)
+{
+    Key key = { width, height, bytesPerPixel };
+    return Acquire(key, true);
+}
+
+FrameBuffer FrameBufferPool::TryAcquire(unsigned int width, unsigned int height, unsigned int bytesPerPixel)
+{
+    Key key = { width, height, bytesPerPixel };
+    return Acquire(key, false);
+}
+
+FrameBuffer FrameBufferPool::Acquire(const Key& key, bool required)
+{
+    FrameBuffer buffer;
+    size_t bytes = FrameBuffer::GetStride(key.width, key.bytesPerPixel) * key.height;
+    if (bytes == 0)
+        return buffer;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!required && m_liveBytes + bytes > m_budgetBytes)
+            return buffer;
+
+        ++m_acquireCount;
+        m_liveBytes += bytes;
+        if (m_peakBytes < m_liveBytes)
+        {
+            m_peakBytes = m_liveBytes;
+        }
+
+        auto found = m_idle.find(key);
+        if (found != m_idle.end())
+        {
+            buffer.m_bytes.swap(found->second.back());
+            found->second.pop_back();
+            if (found->second.empty())
+            {
+                m_idle.erase(found);
+            }
+            m_idleBytes -= bytes;
+            ++m_reuseCount;
+        }
+        else
+        {
+            // Make room for the new buffer
+            FreeIdle();
+        }
+    }
+
+    // Allocate outside of the lock
+    if (buffer.m_bytes.empty())
+    {
+        buffer.m_bytes.resize(bytes);
+    }
+    buffer.m_pool = this;
+    buffer.m_width = key.width;
+    buffer.m_height = key.height;
+    buffer.m_bytesPerPixel = key.bytesPerPixel;
+    return buffer;
+}
+
+void FrameBufferPool::Release(FrameBuffer& buffer)
+{
+    Key key = { buffer.m_width, buffer.m_height, buffer.m_bytesPerPixel };
+    size_t bytes = buffer.m_bytes.size();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_liveBytes -= bytes;
+    if (m_liveBytes + m_idleBytes + bytes <= m_budgetBytes)
+    {
+        m_idle[key].push_back(std::move(buffer.m_bytes));
+        m_idleBytes += bytes;
+    }
+}
+
+void FrameBufferPool::FreeIdle()
+{
+    // Frees the released buffers of the smallest sizes first, the larger
+    // ones are more expensive to allocate again
+    while (!m_idle.empty() && m_liveBytes + m_idleBytes > m_budgetBytes)
+    {
+        auto first = m_idle.begin();
+        m_idleBytes -= first->second.back().size();
+        first->second.pop_back();
+        if (first->second.empty())
+        {
+            m_idle.erase(first);
+        }
+    }
+}
+
+void FrameBufferPool::Trim()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.clear();
+    m_idleBytes = 0;
+}
+
+void FrameBufferPool::SetBudget(size_t budgetBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budgetBytes = budgetBytes;
+    FreeIdle();
+}
+
+size_t FrameBufferPool::getBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budgetBytes;
+}
+
+size_t FrameBufferPool::getLiveBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_liveBytes;
+}
+
+size_t FrameBufferPool::getPeakBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_peakBytes;
+}
+
+size_t FrameBufferPool::getIdleBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_idleBytes;
+}
+
+unsigned int FrameBufferPool::getAcquireCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_acquireCount;
+}
+
+unsigned int FrameBufferPool::getReuseCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_reuseCount;
+}
+
+void FrameBufferPool::ResetCounts()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_peakBytes = m_liveBytes;
+    m_acquireCount = 0;
+    m_reuseCount = 0;
+}
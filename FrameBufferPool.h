@@ -0,0 +1,125 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class FrameBufferPool;
+
+// Pixels borrowed from a FrameBufferPool. The buffer goes back to the pool
+// when it is released, replaced or destroyed. Rows are aligned to 4 bytes.
+class FrameBuffer
+{
+public:
+    FrameBuffer();
+    FrameBuffer(FrameBuffer&& other);
+    FrameBuffer& operator=(FrameBuffer&& other);
+    ~FrameBuffer();
+
+    uint8_t*       data()       { return m_bytes.data(); }
+    const uint8_t* data() const { return m_bytes.data(); }
+    size_t         size() const { return m_bytes.size(); }
+    bool           empty() const { return m_bytes.empty(); }
+
+    unsigned int   getWidth()         const { return m_width; }
+    unsigned int   getHeight()        const { return m_height; }
+    unsigned int   getBytesPerPixel() const { return m_bytesPerPixel; }
+    size_t         getStride()        const { return GetStride(m_width, m_bytesPerPixel); }
+
+    // Whether the buffer holds the pixels of the given dimensions
+    bool hasSize(unsigned int width, unsigned int height, unsigned int bytesPerPixel) const
+    {
+        return m_width == width && m_height == height && m_bytesPerPixel == bytesPerPixel && !empty();
+    }
+
+    void swap(FrameBuffer& other);
+    void Release();
+
+    static size_t GetStride(unsigned int width, unsigned int bytesPerPixel)
+    {
+        return (static_cast<size_t>(width) * bytesPerPixel + 3) & ~static_cast<size_t>(3);
+    }
+
+private:
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    friend class FrameBufferPool;
+
+    FrameBufferPool*     m_pool;
+    std::vector<uint8_t> m_bytes;
+    unsigned int         m_width;
+    unsigned int         m_height;
+    unsigned int         m_bytesPerPixel;
+};
+
+// Keeps released pixel buffers for reuse, so that decoding, composing and
+// caching the frames of an animation stop allocating memory once the first
+// loop played. Buffers are reused for the same dimensions and pixel size.
+// Released buffers are kept as long as all buffers, in use or not, fit
+// into the budget. The pool can be used from any thread.
+class FrameBufferPool
+{
+public:
+    explicit FrameBufferPool(size_t budgetBytes);
+
+    // The pool of the decoders, the compositor and the caches
+    static FrameBufferPool& GetInstance();
+
+    // Returns a buffer for width x height pixels. The content is undefined.
+    FrameBuffer Acquire(unsigned int width, unsigned int height, unsigned int bytesPerPixel);
+
+    // Like Acquire, but returns an empty buffer if the buffers in use would
+    // exceed the budget. Used for buffers which are only nice to have, like
+    // cached frames.
+    FrameBuffer TryAcquire(unsigned int width, unsigned int height, unsigned int bytesPerPixel);
+
+    // Frees all released buffers
+    void Trim();
+
+    void   SetBudget(size_t budgetBytes);
+    size_t getBudget() const;
+
+    size_t       getLiveBytes()    const;   // Bytes of the buffers in use
+    size_t       getPeakBytes()    const;   // Most bytes in use at a time since ResetCounts
+    size_t       getIdleBytes()    const;   // Bytes of the released buffers kept for reuse
+    unsigned int getAcquireCount() const;
+    unsigned int getReuseCount()   const;   // Acquired buffers which did not need an allocation
+    void         ResetCounts();
+
+private:
+    FrameBufferPool(const FrameBufferPool&) = delete;
+    FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+    friend class FrameBuffer;
+
+    struct Key
+    {
+        unsigned int width;
+        unsigned int height;
+        unsigned int bytesPerPixel;
+
+        bool operator<(const Key& other) const
+        {
+            if (width != other.width)
+                return width < other.width;
+            if (height != other.height)
+                return height < other.height;
+            return bytesPerPixel < other.bytesPerPixel;
+        }
+    };
+
+    FrameBuffer Acquire(const Key& key, bool required);
+    void        Release(FrameBuffer& buffer);
+    void        FreeIdle();
+
+    mutable std::mutex                               m_mutex;
+    std::map<Key, std::vector<std::vector<uint8_t>>> m_idle;
+    size_t                                           m_budgetBytes;
+    size_t                                           m_liveBytes;
+    size_t                                           m_peakBytes;
+    size_t                                           m_idleBytes;
+    unsigned int                                     m_acquireCount;
+    unsigned int                                     m_reuseCount;
+};
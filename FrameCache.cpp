@@ -0,0 +1,177 @@
+#include "FrameCache.h"
+
+namespace {
+
+inline bool Contains(const PixelRect& outer, const PixelRect& inner)
+{
+    return inner.isEmpty() || (inner.left >= outer.left && inner.right <= outer.right &&
+        inner.top >= outer.top && inner.bottom <= outer.bottom);
+}
+
+}
+
+FrameCache::FrameCache(size_t budgetBytes, FrameBufferPool& pool) :
+    m_pool(&pool),
+    m_budgetBytes(budgetBytes),
+    m_usedBytes(0),
+    m_rawBytes(0),
+    m_full(false),
+    m_pixelsIndex(NO_FRAME),
+    m_pixelsRect(PixelRect::Empty()),
+    m_prefetched(false),
+    m_hitCount(0),
+    m_missCount(0),
+    m_prefetchedCount(0),
+    m_lateCount(0)
+{
+}
+
+void FrameCache::Reset(unsigned int frameCount)
+{
+    m_entries.clear();
+    m_entries.resize(frameCount);
+    m_compressor.Reset();
+    m_palette.reset();
+    m_usedBytes = 0;
+    m_rawBytes = 0;
+    m_full = false;
+    m_pixels.Release();
+    m_pixelsIndex = NO_FRAME;
+    m_pixelsRect = PixelRect::Empty();
+    m_prefetched = false;
+    m_hitCount = 0;
+    m_missCount = 0;
+    m_prefetchedCount = 0;
+    m_lateCount = 0;
+}
+
+void FrameCache::Grow(unsigned int frameCount)
+{
+    if (frameCount > m_entries.size())
+    {
+        m_entries.resize(frameCount);
+    }
+}
+
+FrameCache::Entry* FrameCache::Lookup(unsigned int frameIndex)
+{
+    if (frameIndex < m_entries.size() && m_entries[frameIndex])
+    {
+        ++m_hitCount;
+        return m_entries[frameIndex].get();
+    }
+    ++m_missCount;
+    return nullptr;
+}
+
+// Decompresses the area of the frame into m_pixels, in whole bands of rows.
+// The area decompressed before is kept if it is of the same frame.
+void FrameCache::Decompress(unsigned int frameIndex, const PixelRect& rect)
+{
+    const CompressedFrame& frame = m_entries[frameIndex]->pixels;
+    if (!m_pixels.hasSize(frame.width, frame.height, 4))
+    {
+        m_pixels = m_pool->Acquire(frame.width, frame.height, 4);
+        m_pixelsIndex = NO_FRAME;
+    }
+    if (m_pixels.empty())
+        return;
+
+    PixelRect rows = FrameCompressor::GetDecompressedRect(frame, rect);
+    if (m_pixelsIndex != frameIndex)
+    {
+        m_pixelsIndex = frameIndex;
+        m_pixelsRect = PixelRect::Empty();
+    }
+    else if (Contains(m_pixelsRect, rows))
+    {
+        return;
+    }
+
+    // The area stays one rectangle, the pixels between the two are
+    // decompressed as well
+    if (!m_pixelsRect.isEmpty())
+    {
+        rows.Include(m_pixelsRect);
+    }
+    FrameCompressor::Decompress(frame, rows, m_pixels.data(), m_pixels.getStride());
+    m_pixelsRect = rows;
+}
+
+void FrameCache::Prefetch(unsigned int frameIndex, const PixelRect& rect)
+{
+    if (frameIndex >= m_entries.size() || !m_entries[frameIndex])
+        return;
+    Decompress(frameIndex, rect);
+    m_prefetched = true;
+}
+
+const uint8_t* FrameCache::GetPixels(unsigned int frameIndex, const PixelRect& rect)
+{
+    if (frameIndex >= m_entries.size() || !m_entries[frameIndex])
+        return nullptr;
+
+    PixelRect rows = FrameCompressor::GetDecompressedRect(m_entries[frameIndex]->pixels, rect);
+    if (m_prefetched && m_pixelsIndex == frameIndex && Contains(m_pixelsRect, rows))
+    {
+        ++m_prefetchedCount;
+    }
+    else
+    {
+        ++m_lateCount;
+        Decompress(frameIndex, rect);
+    }
+    m_prefetched = false;
+    return m_pixels.empty() ? nullptr : m_pixels.data();
+}
+
+bool FrameCache::Insert(
+    unsigned int frameIndex,
+    const FrameCompositor& compositor,
+    const PixelRect& changedRect,
+    const PixelRect& framePosition,
+    unsigned int frameDelay,
+    DISPOSAL_METHODS frameDisposal)
+{
+    if (frameIndex >= m_entries.size())
+        return false;
+
+    if (m_entries[frameIndex])
+        return true;
+
+    // The size of a frame is only known after compressing it
+    if (m_full)
+        return false;
+
+    std::unique_ptr<Entry> entry(new Entry);
+    m_compressor.Compress(
+        compositor.getPixels(),
+        compositor.getStride(),
+        compositor.getWidth(),
+        compositor.getHeight(),
+        entry->pixels);
+    size_t frameBytes = entry->pixels.getSize();
+    bool newPalette = entry->pixels.palette && entry->pixels.palette != m_palette;
+    if (newPalette)
+    {
+        frameBytes += entry->pixels.palette->size() * sizeof(uint32_t);
+    }
+    if (m_usedBytes + frameBytes > m_budgetBytes)
+    {
+        m_full = true;
+        return false;
+    }
+
+    entry->changedRect = changedRect;
+    entry->framePosition = framePosition;
+    entry->frameDelay = frameDelay;
+    entry->frameDisposal = frameDisposal;
+    if (newPalette)
+    {
+        m_palette = entry->pixels.palette;
+    }
+    m_entries[frameIndex] = std::move(entry);
+    m_usedBytes += frameBytes;
+    m_rawBytes += compositor.getStride() * compositor.getHeight();
+    return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "FrameBufferPool.h"
+#include "FrameCompositor.h"
+#include "FrameCompressor.h"
+
+// Keeps the composed frames of an animation, so that the following
+// animation loops can be played without decoding and composing again.
+// The frames are kept compressed by the FrameCompressor and decompressed
+// into one buffer from the pool when they are used, or before that by
+// Prefetch. The cache stops growing once its memory budget is used up.
+class FrameCache
+{
+public:
+    struct Entry
+    {
+        CompressedFrame      pixels;            // The composed frame
+        PixelRect            changedRect;       // Area in which the frame differs from the frame composed before it
+        PixelRect            framePosition;     // Area of the raw frame within the composed frame
+        unsigned int         frameDelay;
+        DISPOSAL_METHODS     frameDisposal;
+    };
+
+    explicit FrameCache(size_t budgetBytes, FrameBufferPool& pool = FrameBufferPool::GetInstance());
+
+    // Drops all cached frames and prepares the cache for an image
+    // with the given number of frames
+    void Reset(unsigned int frameCount);
+
+    // Makes room for frames found after Reset, like the pages of a TIFF
+    // indexed while paging, and keeps the cached frames
+    void Grow(unsigned int frameCount);
+
+    // Memory in bytes which may be used by the compressed frames
+    void   SetBudget(size_t budgetBytes) { m_budgetBytes = budgetBytes; }
+    size_t GetBudget()     const { return m_budgetBytes; }
+    size_t GetUsedBytes()  const { return m_usedBytes; }
+    size_t GetRawBytes()   const { return m_rawBytes; }     // Memory the cached frames would use uncompressed
+
+    unsigned int GetHitCount()        const { return m_hitCount; }
+    unsigned int GetMissCount()       const { return m_missCount; }
+    unsigned int GetPrefetchedCount() const { return m_prefetchedCount; }  // Frames used after they were prefetched
+    unsigned int GetLateCount()       const { return m_lateCount; }        // Frames decompressed when they were used
+
+    // Returns the cached frame or nullptr, and counts the hit or miss
+    Entry* Lookup(unsigned int frameIndex);
+
+    // Returns the cached frame or nullptr without counting
+    Entry* Find(unsigned int frameIndex)
+    {
+        return frameIndex < m_entries.size() ? m_entries[frameIndex].get() : nullptr;
+    }
+
+    // Decompresses the area of the cached frame ahead of its use, like
+    // while the frame before it is shown
+    void Prefetch(unsigned int frameIndex, const PixelRect& rect);
+
+    // Returns the pixels of the cached frame with at least the area
+    // decompressed, in rows of the stride of the compositor. The pixels stay
+    // valid until the next call of Prefetch or GetPixels.
+    const uint8_t* GetPixels(unsigned int frameIndex, const PixelRect& rect);
+
+    // Compresses the canvas of the compositor into the cache. Returns false
+    // if the frame does not fit into the budget.
+    bool Insert(
+        unsigned int frameIndex,
+        const FrameCompositor& compositor,
+        const PixelRect& changedRect,
+        const PixelRect& framePosition,
+        unsigned int frameDelay,
+        DISPOSAL_METHODS frameDisposal);
+
+private:
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    void Decompress(unsigned int frameIndex, const PixelRect& rect);
+
+    static const unsigned int NO_FRAME = ~0u;
+
+    FrameBufferPool*                             m_pool;
+    FrameCompressor                              m_compressor;
+    std::shared_ptr<const std::vector<uint32_t>> m_palette;        // Of the last frame, counted once for the frames sharing it
+    std::vector<std::unique_ptr<Entry>>          m_entries;
+    size_t                                       m_budgetBytes;
+    size_t                                       m_usedBytes;
+    size_t                                       m_rawBytes;
+    bool                                         m_full;           // Whether a frame did not fit, later frames are not compressed
+    FrameBuffer                                  m_pixels;         // The decompressed frame
+    unsigned int                                 m_pixelsIndex;    // Index of the frame in m_pixels or NO_FRAME
+    PixelRect                                    m_pixelsRect;     // Area of m_pixels which is decompressed
+    bool                                         m_prefetched;     // Whether m_pixels was filled by Prefetch
+    unsigned int                                 m_hitCount;
+    unsigned int                                 m_missCount;
+    unsigned int                                 m_prefetchedCount;
+    unsigned int                                 m_lateCount;
+};
@@ -0,0 +1,373 @@
+#include "FrameCompositor.h"
+#include <algorithm>
+#include <cstring>
+#include "PixelConverterKernels.h"
+
+#ifdef PIXEL_CONVERTER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Source-over of premultiplied pixels as src + round(dst * (255 - src alpha) / 255)
+// for each channel. The sum only saturates for colors larger than their alpha,
+// which are not valid premultiplied colors.
+inline uint8_t BlendChannel(unsigned int source, unsigned int destination, unsigned int inverse)
+{
+    unsigned int sum = source + Premultiply(destination, inverse);
+    return static_cast<uint8_t>(sum > 255 ? 255 : sum);
+}
+
+void BlendRowScalar(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 4, destination += 4)
+    {
+        unsigned int alpha = source[3];
+        if (alpha == 255)
+        {
+            memcpy(destination, source, 4);
+        }
+        else if (alpha != 0 || (source[0] | source[1] | source[2]) != 0)
+        {
+            unsigned int inverse = 255 - alpha;
+            destination[0] = BlendChannel(source[0], destination[0], inverse);
+            destination[1] = BlendChannel(source[1], destination[1], inverse);
+            destination[2] = BlendChannel(source[2], destination[2], inverse);
+            destination[3] = BlendChannel(alpha, destination[3], inverse);
+        }
+    }
+}
+
+#ifdef PIXEL_CONVERTER_X86
+// Blends two pixels widened to 16 bits
+TARGET_SSE2 inline __m128i BlendSse2(__m128i source, __m128i destination)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, 0xFF), 0xFF);
+    __m128i inverse = _mm_xor_si128(alpha, _mm_set1_epi16(0xFF));
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(destination, inverse), _mm_set1_epi16(128));
+    t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    return _mm_add_epi16(source, t);
+}
+
+// Opaque and empty groups of 4 pixels are copied or skipped without blending
+TARGET_SSE2 void BlendRowSse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4, source += 16, destination += 16)
+    {
+        __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(src, alphaMask), alphaMask)) == 0xFFFF)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), src);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(src, zero)) == 0xFFFF)
+            continue;
+
+        __m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(destination));
+        __m128i lo = BlendSse2(_mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero));
+        __m128i hi = BlendSse2(_mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_packus_epi16(lo, hi));
+    }
+    BlendRowScalar(source, destination, width - x);
+}
+
+TARGET_AVX2 inline __m256i BlendAvx2(__m256i source, __m256i destination)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source, 0xFF), 0xFF);
+    __m256i inverse = _mm256_xor_si256(alpha, _mm256_set1_epi16(0xFF));
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(destination, inverse), _mm256_set1_epi16(128));
+    t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    return _mm256_add_epi16(source, t);
+}
+
+TARGET_AVX2 void BlendRowAvx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8, source += 32, destination += 32)
+    {
+        __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(src, alphaMask), alphaMask)) == -1)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), src);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(src, zero)) == -1)
+            continue;
+
+        // Unpacking and packing work within each 128 bit lane, so the pixels
+        // stay in order
+        __m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(destination));
+        __m256i lo = BlendAvx2(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero));
+        __m256i hi = BlendAvx2(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), _mm256_packus_epi16(lo, hi));
+    }
+    BlendRowSse2(source, destination, width - x);
+}
+#endif
+
+void BlendRow(const uint8_t* source, uint8_t* destination, size_t width, CPU_KERNELS kernels)
+{
+    switch (kernels)
+    {
+#ifdef PIXEL_CONVERTER_X86
+    case CK_SSE2:
+        BlendRowSse2(source, destination, width);
+        break;
+    case CK_AVX2:
+        BlendRowAvx2(source, destination, width);
+        break;
+#endif
+    default:
+        BlendRowScalar(source, destination, width);
+        break;
+    }
+}
+
+// Returns the first pixel from x on which is covered, or not covered, 8 at
+// a time while the mask has only the other value
+size_t FindCoverage(const uint8_t* coverage, size_t x, size_t width, bool covered)
+{
+    const uint64_t other = covered ? 0 : UINT64_MAX;
+    for (; x + 8 <= width; x += 8)
+    {
+        uint64_t mask;
+        memcpy(&mask, coverage + x, 8);
+        if (mask != other)
+            break;
+    }
+    while (x < width && (coverage[x] != 0) != covered)
+    {
+        ++x;
+    }
+    return x;
+}
+
+}
+
+void PixelRect::Include(const PixelRect& other)
+{
+    if (other.isEmpty())
+        return;
+    if (isEmpty())
+    {
+        *this = other;
+        return;
+    }
+    left = std::min(left, other.left);
+    top = std::min(top, other.top);
+    right = std::max(right, other.right);
+    bottom = std::max(bottom, other.bottom);
+}
+
+void PixelRect::Intersect(const PixelRect& other)
+{
+    left = std::max(left, other.left);
+    top = std::max(top, other.top);
+    right = std::min(right, other.right);
+    bottom = std::min(bottom, other.bottom);
+    if (isEmpty())
+    {
+        *this = Empty();
+    }
+}
+
+FrameCompositor::FrameCompositor(FrameBufferPool& pool) :
+    m_pool(&pool),
+    m_width(0),
+    m_height(0),
+    m_savedRect(PixelRect::Empty()),
+    m_hasSavedCanvas(false),
+    m_savedBytes(0),
+    m_saveCount(0),
+    m_dirtyRect(PixelRect::Empty())
+{
+}
+
+void FrameCompositor::Reset(unsigned int width, unsigned int height)
+{
+    m_width = width;
+    m_height = height;
+    if (!m_canvas.hasSize(width, height, 4))
+    {
+        m_canvas = m_pool->Acquire(width, height, 4);
+    }
+    if (!m_canvas.empty())
+    {
+        memset(m_canvas.data(), 0, m_canvas.size());
+    }
+    m_savedPixels.Release();
+    m_savedRect = PixelRect::Empty();
+    m_hasSavedCanvas = false;
+    m_savedBytes = 0;
+    m_saveCount = 0;
+    m_dirtyRect = getBounds();
+}
+
+void FrameCompositor::Clear(uint32_t color)
+{
+    Fill(getBounds(), color);
+}
+
+void FrameCompositor::Fill(const PixelRect& rect, uint32_t color)
+{
+    PixelRect area = rect;
+    area.Intersect(getBounds());
+    if (area.isEmpty())
+        return;
+
+    uint8_t* row = GetRow(area.top) + area.left * 4;
+    for (unsigned int x = 0; x < area.getWidth(); ++x)
+    {
+        memcpy(row + x * 4, &color, 4);
+    }
+    size_t rowBytes = area.getWidth() * 4;
+    for (unsigned int y = area.top + 1; y < area.bottom; ++y)
+    {
+        memcpy(GetRow(y) + area.left * 4, row, rowBytes);
+    }
+    m_dirtyRect.Include(area);
+}
+
+void FrameCompositor::Overlay(const uint8_t* pixels, size_t stride, const PixelRect& rect, CPU_KERNELS kernels)
+{
+    PixelRect area = rect;
+    area.Intersect(getBounds());
+    if (area.isEmpty())
+        return;
+
+    const uint8_t* source = pixels + (area.top - rect.top) * stride + (area.left - rect.left) * 4;
+    for (unsigned int y = area.top; y < area.bottom; ++y, source += stride)
+    {
+        BlendRow(source, GetRow(y) + area.left * 4, area.getWidth(), kernels);
+    }
+    m_dirtyRect.Include(area);
+}
+
+void FrameCompositor::Overlay(
+    const uint8_t* pixels,
+    size_t stride,
+    const uint8_t* coverage,
+    size_t coverageStride,
+    const PixelRect& rect,
+    CPU_KERNELS kernels)
+{
+    if (coverage == nullptr)
+    {
+        Overlay(pixels, stride, rect, kernels);
+        return;
+    }
+
+    PixelRect area = rect;
+    area.Intersect(getBounds());
+    if (area.isEmpty())
+        return;
+
+    size_t offset = area.left - rect.left;
+    const uint8_t* source = pixels + (area.top - rect.top) * stride + offset * 4;
+    const uint8_t* mask = coverage + (area.top - rect.top) * coverageStride + offset;
+    size_t width = area.getWidth();
+    PixelRect changed = PixelRect::Empty();
+    for (unsigned int y = area.top; y < area.bottom; ++y, source += stride, mask += coverageStride)
+    {
+        uint8_t* destination = GetRow(y) + area.left * 4;
+        size_t x = FindCoverage(mask, 0, width, true);
+        if (x == width)
+            continue;
+        size_t left = x;
+        size_t right = x;
+        while (x < width)
+        {
+            size_t end = FindCoverage(mask, x, width, false);
+            BlendRow(source + x * 4, destination + x * 4, end - x, kernels);
+            right = end;
+            x = FindCoverage(mask, end, width, true);
+        }
+        changed.Include(PixelRect::Make(
+            area.left + static_cast<unsigned int>(left),
+            y,
+            static_cast<unsigned int>(right - left),
+            1));
+    }
+    m_dirtyRect.Include(changed);
+}
+
+void FrameCompositor::Copy(const uint8_t* image, size_t stride, const PixelRect& rect)
+{
+    PixelRect area = rect;
+    area.Intersect(getBounds());
+    if (area.isEmpty())
+        return;
+
+    size_t rowBytes = area.getWidth() * 4;
+    for (unsigned int y = area.top; y < area.bottom; ++y)
+    {
+        memcpy(GetRow(y) + area.left * 4, image + y * stride + area.left * 4, rowBytes);
+    }
+    m_dirtyRect.Include(area);
+}
+
+void FrameCompositor::SaveCanvas(const PixelRect& rect)
+{
+    m_savedRect = rect;
+    m_savedRect.Intersect(getBounds());
+    m_hasSavedCanvas = true;
+    ++m_saveCount;
+
+    // Frames with the previous disposal method mostly cover the same area,
+    // so the buffer is kept until the size changes
+    if (!m_savedPixels.hasSize(m_savedRect.getWidth(), m_savedRect.getHeight(), 4))
+    {
+        m_savedPixels = m_pool->Acquire(m_savedRect.getWidth(), m_savedRect.getHeight(), 4);
+    }
+    size_t rowBytes = m_savedRect.getWidth() * 4;
+    for (unsigned int y = m_savedRect.top; y < m_savedRect.bottom; ++y)
+    {
+        memcpy(m_savedPixels.data() + (y - m_savedRect.top) * rowBytes, GetRow(y) + m_savedRect.left * 4, rowBytes);
+    }
+    m_savedBytes += m_savedPixels.size();
+}
+
+void FrameCompositor::RestoreCanvas()
+{
+    size_t rowBytes = m_savedRect.getWidth() * 4;
+    for (unsigned int y = m_savedRect.top; y < m_savedRect.bottom; ++y)
+    {
+        memcpy(GetRow(y) + m_savedRect.left * 4, m_savedPixels.data() + (y - m_savedRect.top) * rowBytes, rowBytes);
+    }
+    m_savedBytes += m_savedPixels.size();
+    m_dirtyRect.Include(m_savedRect);
+}
+
+bool FrameCompositor::Dispose(DISPOSAL_METHODS disposal, const PixelRect& rect, uint32_t backgroundColor)
+{
+    switch (disposal)
+    {
+    case DM_UNDEFINED:
+    case DM_NONE:
+        // The next frame is drawn on this one
+        return true;
+    case DM_BACKGROUND:
+        Fill(rect, backgroundColor);
+        return true;
+    case DM_PREVIOUS:
+        // Only the area of the frame changed since the canvas was saved
+        if (!m_hasSavedCanvas)
+            return false;
+        RestoreCanvas();
+        return true;
+    default:
+        return false;
+    }
+}
+
+PixelRect FrameCompositor::TakeDirtyRect()
+{
+    PixelRect dirtyRect = m_dirtyRect;
+    m_dirtyRect = PixelRect::Empty();
+    return dirtyRect;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "FrameBufferPool.h"
+#include "PixelConverter.h"
+
+enum DISPOSAL_METHODS
+{
+    DM_UNDEFINED = 0,
+    DM_NONE = 1,
+    DM_BACKGROUND = 2,
+    DM_PREVIOUS = 3
+};
+
+// A rectangle of pixels. Right and bottom are exclusive.
+struct PixelRect
+{
+    unsigned int left;
+    unsigned int top;
+    unsigned int right;
+    unsigned int bottom;
+
+    bool         isEmpty()   const { return right <= left || bottom <= top; }
+    unsigned int getWidth()  const { return isEmpty() ? 0 : right - left; }
+    unsigned int getHeight() const { return isEmpty() ? 0 : bottom - top; }
+
+    // Grows the rectangle to include the other one
+    void Include(const PixelRect& other);
+
+    // Shrinks the rectangle to the part inside the other one
+    void Intersect(const PixelRect& other);
+
+    static PixelRect Make(unsigned int left, unsigned int top, unsigned int width, unsigned int height)
+    {
+        PixelRect rect = { left, top, left + width, top + height };
+        return rect;
+    }
+    static PixelRect Empty()
+    {
+        PixelRect rect = { 0, 0, 0, 0 };
+        return rect;
+    }
+};
+
+// Composes animation frames on a 32bpp premultiplied BGRA canvas in memory.
+// The frames are drawn with source-over blending by the kernels of the best
+// instruction set, and the frames are disposed with the GIF disposal methods.
+// The compositor keeps track of the area changed since the dirty rectangle
+// was last taken, so that only the changed pixels need to be uploaded for
+// display. The canvas and the saved pixels are taken from a pool. It has no
+// dependency on Windows.
+class FrameCompositor
+{
+public:
+    explicit FrameCompositor(FrameBufferPool& pool = FrameBufferPool::GetInstance());
+
+    // Clears a canvas of the size, which is only allocated if the size
+    // changed. The whole canvas is dirty afterwards.
+    void Reset(unsigned int width, unsigned int height);
+
+    unsigned int   getWidth()  const { return m_width; }
+    unsigned int   getHeight() const { return m_height; }
+    size_t         getStride() const { return static_cast<size_t>(m_width) * 4; }
+    const uint8_t* getPixels() const { return m_canvas.data(); }
+    PixelRect      getBounds() const { return PixelRect::Make(0, 0, m_width, m_height); }
+
+    // Fills the whole canvas with a premultiplied BGRA color, as 0xAARRGGBB
+    void Clear(uint32_t color);
+
+    // Fills the part of the rectangle inside the canvas
+    void Fill(const PixelRect& rect, uint32_t color);
+
+    // Draws premultiplied BGRA pixels over the rectangle. The pixels outside
+    // the canvas are skipped.
+    void Overlay(
+        const uint8_t* pixels,
+        size_t stride,
+        const PixelRect& rect,
+        CPU_KERNELS kernels = PixelConverter::getBestKernels());
+
+    // Draws the pixels with a coverage mask of a byte per pixel, like the
+    // one of the PaletteExpander. The runs of pixels with coverage 0 are
+    // skipped without reading them and are not part of the dirty rectangle.
+    // Without a mask all pixels are drawn.
+    void Overlay(
+        const uint8_t* pixels,
+        size_t stride,
+        const uint8_t* coverage,
+        size_t coverageStride,
+        const PixelRect& rect,
+        CPU_KERNELS kernels = PixelConverter::getBestKernels());
+
+    // Replaces the pixels in the rectangle with the same pixels of an image
+    // of the canvas size
+    void Copy(const uint8_t* image, size_t stride, const PixelRect& rect);
+
+    // Keeps a copy of the part of the canvas a frame with the previous
+    // disposal method is drawn on. The buffer is reused for all frames.
+    void SaveCanvas(const PixelRect& rect);
+
+    // Disposes the frame drawn at the rectangle. Returns false for unknown
+    // disposal methods, or if the canvas was not saved.
+    bool Dispose(DISPOSAL_METHODS disposal, const PixelRect& rect, uint32_t backgroundColor);
+
+    // Bytes copied to save and restore the canvas for the previous disposal
+    // method, and the number of saves since Reset
+    uint64_t     getSavedBytes() const { return m_savedBytes; }
+    unsigned int getSaveCount()  const { return m_saveCount; }
+
+    // Returns the area changed since the last call and starts a new one
+    PixelRect TakeDirtyRect();
+
+private:
+    FrameCompositor(const FrameCompositor&) = delete;
+    FrameCompositor& operator=(const FrameCompositor&) = delete;
+
+    uint8_t* GetRow(unsigned int y) { return m_canvas.data() + y * getStride(); }
+    void     RestoreCanvas();
+
+    FrameBufferPool*     m_pool;
+    unsigned int         m_width;
+    unsigned int         m_height;
+    FrameBuffer          m_canvas;
+    FrameBuffer          m_savedPixels;     // The area below the last frame with the previous disposal method
+    PixelRect            m_savedRect;       // Area of m_savedPixels in the canvas
+    bool                 m_hasSavedCanvas;
+    uint64_t             m_savedBytes;
+    unsigned int         m_saveCount;
+    PixelRect            m_dirtyRect;
+};
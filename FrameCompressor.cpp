@@ -0,0 +1,316 @@
+#include "FrameCompressor.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// The tokens in the top 2 bits of the first byte, the count minus 1 in the
+// low 6 bits. A count field of 63 is followed by 2 bytes with count - 64.
+enum TOKENS
+{
+    TOKEN_LITERAL = 0,      // Followed by count values
+    TOKEN_RUN,              // Followed by the value repeated count times
+    TOKEN_UP                // Copies count pixels from the row above
+};
+
+const unsigned int MAX_SHORT_COUNT = 63;
+const unsigned int MAX_COUNT = 64 + 0xFFFF;
+const unsigned int MIN_MATCH = 3;           // Runs and copies shorter than this are stored as literals
+
+inline unsigned int HashColor(uint32_t color, unsigned int tableSize)
+{
+    return (color * 0x9E3779B1u) >> 22 & (tableSize - 1);
+}
+
+void WriteToken(std::vector<uint8_t>& bytes, unsigned int token, unsigned int count)
+{
+    if (count <= MAX_SHORT_COUNT)
+    {
+        bytes.push_back(static_cast<uint8_t>(token << 6 | (count - 1)));
+    }
+    else
+    {
+        bytes.push_back(static_cast<uint8_t>(token << 6 | MAX_SHORT_COUNT));
+        bytes.push_back(static_cast<uint8_t>((count - 64) & 0xFF));
+        bytes.push_back(static_cast<uint8_t>((count - 64) >> 8));
+    }
+}
+
+template <typename Element>
+void WriteLiteral(std::vector<uint8_t>& bytes, const Element* values, unsigned int count)
+{
+    while (count > 0)
+    {
+        unsigned int length = std::min(count, MAX_COUNT);
+        WriteToken(bytes, TOKEN_LITERAL, length);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(values);
+        bytes.insert(bytes.end(), data, data + length * sizeof(Element));
+        values += length;
+        count -= length;
+    }
+}
+
+// Stores the row as literals, runs and copies of the row above, taking the
+// longer of a run and a copy where one of them is long enough. The row above
+// is nullptr for the first row of a band.
+template <typename Element>
+void CompressRow(std::vector<uint8_t>& bytes, const Element* row, const Element* above, unsigned int width)
+{
+    unsigned int literalStart = 0;
+    unsigned int x = 0;
+    while (x < width)
+    {
+        unsigned int upLength = 0;
+        if (above)
+        {
+            unsigned int end = std::min(width, x + MAX_COUNT);
+            while (x + upLength < end && row[x + upLength] == above[x + upLength])
+            {
+                ++upLength;
+            }
+        }
+        unsigned int runLength = 1;
+        unsigned int end = std::min(width, x + MAX_COUNT);
+        while (x + runLength < end && row[x + runLength] == row[x])
+        {
+            ++runLength;
+        }
+
+        if (upLength < MIN_MATCH && runLength < MIN_MATCH)
+        {
+            ++x;
+            continue;
+        }
+
+        WriteLiteral(bytes, row + literalStart, x - literalStart);
+        if (upLength >= runLength)
+        {
+            WriteToken(bytes, TOKEN_UP, upLength);
+            x += upLength;
+        }
+        else
+        {
+            WriteToken(bytes, TOKEN_RUN, runLength);
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(row + x);
+            bytes.insert(bytes.end(), data, data + sizeof(Element));
+            x += runLength;
+        }
+        literalStart = x;
+    }
+    WriteLiteral(bytes, row + literalStart, x - literalStart);
+}
+
+inline uint32_t ReadColor(const uint8_t* source, const uint32_t* palette)
+{
+    if (palette)
+        return palette[*source];
+    uint32_t color;
+    memcpy(&color, source, 4);
+    return color;
+}
+
+// Decompresses the tokens of one row and returns the bytes after them. Only
+// the pixels from left to right are written, copies from the row above read
+// the same columns.
+const uint8_t* DecompressRow(
+    const uint8_t* source,
+    const uint32_t* palette,
+    uint8_t* row,
+    size_t stride,
+    unsigned int width,
+    unsigned int left,
+    unsigned int right)
+{
+    size_t valueSize = palette ? 1 : 4;
+    unsigned int x = 0;
+    while (x < width)
+    {
+        unsigned int token = *source >> 6;
+        unsigned int count = (*source & MAX_SHORT_COUNT) + 1;
+        ++source;
+        if (count > MAX_SHORT_COUNT)
+        {
+            count = 64 + (source[0] | source[1] << 8);
+            source += 2;
+        }
+
+        // The part of the token between left and right
+        unsigned int start = std::max(x, left);
+        unsigned int end = std::min(x + count, right);
+        uint8_t* destination = row + static_cast<size_t>(start) * 4;
+        if (token == TOKEN_LITERAL)
+        {
+            if (start < end && palette)
+            {
+                const uint8_t* indices = source + (start - x);
+                for (unsigned int i = 0; i < end - start; ++i)
+                {
+                    memcpy(destination + i * 4, &palette[indices[i]], 4);
+                }
+            }
+            else if (start < end)
+            {
+                memcpy(destination, source + static_cast<size_t>(start - x) * 4, static_cast<size_t>(end - start) * 4);
+            }
+            source += count * valueSize;
+        }
+        else if (token == TOKEN_RUN)
+        {
+            uint32_t color = ReadColor(source, palette);
+            source += valueSize;
+            for (unsigned int i = start; i < end; ++i)
+            {
+                memcpy(destination + (i - start) * 4, &color, 4);
+            }
+        }
+        else if (start < end)
+        {
+            memcpy(destination, destination - stride, static_cast<size_t>(end - start) * 4);
+        }
+        x += count;
+    }
+    return source;
+}
+
+}
+
+FrameCompressor::FrameCompressor()
+{
+    ClearTable();
+}
+
+void FrameCompressor::Reset()
+{
+    m_palette.reset();
+    ClearTable();
+}
+
+void FrameCompressor::ClearTable()
+{
+    m_colors.clear();
+    memset(m_tableSlots, 0, sizeof(m_tableSlots));
+}
+
+// Finds the palette index of each pixel in the color table. With addColors
+// the colors missing from the table are added to it. Fails if a color is
+// missing without addColors, or if there are more than 256 colors.
+bool FrameCompressor::IndexPixels(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height, bool addColors)
+{
+    m_indices.resize(static_cast<size_t>(width) * height);
+    uint8_t* indices = m_indices.data();
+
+    // Neighbouring pixels often have the same color
+    uint32_t lastColor = 0;
+    uint8_t lastIndex = 0;
+    bool hasLast = false;
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        const uint8_t* row = pixels + y * stride;
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            uint32_t color;
+            memcpy(&color, row + static_cast<size_t>(x) * 4, 4);
+            if (!hasLast || color != lastColor)
+            {
+                unsigned int slot = HashColor(color, TABLE_SIZE);
+                while (m_tableSlots[slot] != 0 && m_tableColors[slot] != color)
+                {
+                    slot = (slot + 1) & (TABLE_SIZE - 1);
+                }
+                if (m_tableSlots[slot] == 0)
+                {
+                    if (!addColors || m_colors.size() == 256)
+                        return false;
+                    m_colors.push_back(color);
+                    m_tableColors[slot] = color;
+                    m_tableSlots[slot] = static_cast<uint16_t>(m_colors.size());
+                }
+                lastColor = color;
+                lastIndex = static_cast<uint8_t>(m_tableSlots[slot] - 1);
+                hasLast = true;
+            }
+            *indices++ = lastIndex;
+        }
+    }
+    return true;
+}
+
+void FrameCompressor::Compress(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height, CompressedFrame& frame)
+{
+    // Frames of an animation mostly use the colors of the frames before
+    bool indexed = m_palette && IndexPixels(pixels, stride, width, height, false);
+    if (!indexed)
+    {
+        ClearTable();
+        indexed = IndexPixels(pixels, stride, width, height, true);
+        if (indexed)
+        {
+            m_palette = std::make_shared<const std::vector<uint32_t>>(m_colors);
+        }
+        else
+        {
+            Reset();
+        }
+    }
+
+    m_bytes.clear();
+    frame.width = width;
+    frame.height = height;
+    frame.palette = indexed ? m_palette : nullptr;
+    frame.bandOffsets.clear();
+    if (!indexed)
+    {
+        m_rows.resize(static_cast<size_t>(width) * 2);
+    }
+    for (unsigned int bandTop = 0; bandTop < height; bandTop += BAND_ROWS)
+    {
+        frame.bandOffsets.push_back(m_bytes.size());
+        unsigned int bandBottom = std::min(height, bandTop + BAND_ROWS);
+        for (unsigned int y = bandTop; y < bandBottom; ++y)
+        {
+            if (indexed)
+            {
+                const uint8_t* row = m_indices.data() + static_cast<size_t>(y) * width;
+                CompressRow(m_bytes, row, y > bandTop ? row - width : nullptr, width);
+            }
+            else
+            {
+                // The rows are copied for aligned access, alternating between
+                // the two halves
+                uint32_t* row = m_rows.data() + (y & 1) * width;
+                const uint32_t* above = m_rows.data() + ((y + 1) & 1) * width;
+                memcpy(row, pixels + y * stride, static_cast<size_t>(width) * 4);
+                CompressRow(m_bytes, row, y > bandTop ? above : nullptr, width);
+            }
+        }
+    }
+    frame.bytes.assign(m_bytes.begin(), m_bytes.end());
+}
+
+void FrameCompressor::Decompress(const CompressedFrame& frame, const PixelRect& rect, uint8_t* pixels, size_t stride)
+{
+    PixelRect rows = GetDecompressedRect(frame, rect);
+    const uint32_t* palette = frame.palette ? frame.palette->data() : nullptr;
+    for (unsigned int bandTop = rows.top; bandTop < rows.bottom; bandTop += BAND_ROWS)
+    {
+        const uint8_t* source = frame.bytes.data() + frame.bandOffsets[bandTop / BAND_ROWS];
+        unsigned int bandBottom = std::min(rows.bottom, bandTop + BAND_ROWS);
+        for (unsigned int y = bandTop; y < bandBottom; ++y)
+        {
+            source = DecompressRow(source, palette, pixels + y * stride, stride, frame.width, rows.left, rows.right);
+        }
+    }
+}
+
+PixelRect FrameCompressor::GetDecompressedRect(const CompressedFrame& frame, const PixelRect& rect)
+{
+    unsigned int bottom = std::min(rect.bottom, frame.height);
+    if (rect.isEmpty() || rect.top >= bottom)
+        return PixelRect::Empty();
+    unsigned int right = std::min(rect.right, frame.width);
+    if (rect.left >= right)
+        return PixelRect::Empty();
+    unsigned int top = rect.top / BAND_ROWS * BAND_ROWS;
+    bottom = std::min(frame.height, (bottom + BAND_ROWS - 1) / BAND_ROWS * BAND_ROWS);
+    return PixelRect::Make(rect.left, top, right - rect.left, bottom - top);
+}
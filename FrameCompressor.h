@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "FrameCompositor.h"
+
+// A composed frame compressed by the FrameCompressor
+struct CompressedFrame
+{
+    unsigned int                                 width;
+    unsigned int                                 height;
+    std::shared_ptr<const std::vector<uint32_t>> palette;      // Colors of the indices, nullptr if the pixels are stored
+    std::vector<size_t>                          bandOffsets;  // Start of each band of rows in bytes
+    std::vector<uint8_t>                         bytes;
+
+    bool   isIndexed() const { return palette != nullptr; }
+
+    // Memory in bytes used by the frame, without a shared palette
+    size_t getSize() const { return bytes.size() + bandOffsets.size() * sizeof(size_t); }
+};
+
+// Compresses composed 32bpp premultiplied BGRA frames for the FrameCache.
+// Frames with at most 256 colors are stored as 8-bit indices into a palette,
+// which is shared with the frames compressed before as long as their colors
+// are in it. The indices or pixels of each row are stored as literals, as
+// runs of one value, or as copies of the row above, which keeps flat areas
+// and repeated rows small without searching for matches.
+// The rows are grouped into bands which are compressed on their own, so
+// that the changed area of a frame can be decompressed without the rows
+// before it and without writing the columns beside it. It has no
+// dependency on Windows.
+class FrameCompressor
+{
+public:
+    static const unsigned int BAND_ROWS = 16;
+
+    FrameCompressor();
+
+    // Forgets the shared palette, for a new image
+    void Reset();
+
+    // Compresses the image into frame
+    void Compress(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height, CompressedFrame& frame);
+
+    // Decompresses the columns of rect of the bands covering its rows into
+    // pixels. The other pixels are not written.
+    static void Decompress(const CompressedFrame& frame, const PixelRect& rect, uint8_t* pixels, size_t stride);
+
+    // The area written by Decompress for rect
+    static PixelRect GetDecompressedRect(const CompressedFrame& frame, const PixelRect& rect);
+
+private:
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+    static const unsigned int TABLE_SIZE = 1024;    // Slots of the color table, a power of 2 well above 256 colors
+
+    void ClearTable();
+    bool IndexPixels(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height, bool addColors);
+
+    std::shared_ptr<const std::vector<uint32_t>> m_palette;     // Shared by the frames indexed with it
+    std::vector<uint32_t>                        m_colors;      // The colors of the table, in palette order
+    uint32_t                                     m_tableColors[TABLE_SIZE];
+    uint16_t                                     m_tableSlots[TABLE_SIZE];  // Index + 1 of the color in the slot, 0 if the slot is free
+    std::vector<uint8_t>                         m_indices;     // Of the frame being compressed
+    std::vector<uint8_t>                         m_bytes;       // The frame being compressed, copied into the frame at its size
+    std::vector<uint32_t>                        m_rows;        // The row being compressed and the row above it
+};
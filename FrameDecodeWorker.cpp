@@ -0,0 +1,384 @@
+#include "FrameDecodeWorker.h"
+#include "ComPtr.h"
+#include "GifDecoder.h"
+#include "PaletteExpander.h"
+#include "PixelConverter.h"
+#include "ScaledDecoder.h"
+#include "Tracer.h"
+
+FrameDecodeWorker::FrameDecodeWorker() :
+    m_data(nullptr),
+    m_size(0),
+    m_frameCount(0),
+    m_firstFrameIndex(0),
+    m_stop(false),
+    m_restartIndex(NO_RESTART)
+{
+}
+
+FrameDecodeWorker::~FrameDecodeWorker()
+{
+    Stop();
+}
+
+void FrameDecodeWorker::Start(const uint8_t* data, size_t size, unsigned int frameCount, unsigned int firstFrameIndex)
+{
+    Stop();
+
+    m_data = data;
+    m_size = size;
+    m_frameCount = frameCount;
+    m_firstFrameIndex = firstFrameIndex % frameCount;
+    m_stop = false;
+    m_restartIndex = NO_RESTART;
+
+    // All frames are free at the start
+    DecodedFrame* frame;
+    while (m_decodedFrames.Pop(frame)) { }
+    while (m_freeFrames.Pop(frame)) { }
+    for (auto& f : m_frames)
+    {
+        m_freeFrames.Push(&f);
+    }
+
+    m_thread = std::thread(&FrameDecodeWorker::Run, this);
+}
+
+void FrameDecodeWorker::Stop()
+{
+    if (m_thread.joinable())
+    {
+        m_stop = true;
+        Wake();
+        m_thread.join();
+    }
+}
+
+void FrameDecodeWorker::Wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+    }
+    m_wake.notify_one();
+}
+
+DecodedFrame* FrameDecodeWorker::TakeFrame(unsigned int frameIndex)
+{
+    // Frames decoded before the last restart are dropped
+    DecodedFrame* frame;
+    while (m_decodedFrames.Pop(frame))
+    {
+        if (frame->frameIndex == frameIndex)
+            return frame;
+        ReleaseFrame(frame);
+    }
+
+    m_restartIndex = (frameIndex + 1) % m_frameCount;
+    Wake();
+    return nullptr;
+}
+
+void FrameDecodeWorker::ReleaseFrame(DecodedFrame* frame)
+{
+    m_freeFrames.Push(frame);
+    Wake();
+}
+
+void FrameDecodeWorker::Run()
+{
+    Tracer::SetThreadName("Decode worker");
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+        return;
+
+    {
+        // The factory of the UI thread belongs to its apartment
+        ComPtr<IWICImagingFactory> factory;
+        ComPtr<IWICStream> stream;
+        ComPtr<IWICBitmapDecoder> decoder;
+
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            nullptr,
+            CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(factory.get_out_storage()));
+
+        // Frames of GIF files are decoded without WIC, like on the UI thread.
+        // The WIC decoder is only created for the frames the GifDecoder
+        // fails on and for other files.
+        GifDecoder gifDecoder;
+        if (GifDecoder::IsGif(m_data, m_size))
+        {
+            TRACE_SCOPE("OpenGif");
+            gifDecoder.Open(m_data, m_size);
+        }
+        auto createDecoder = [&]() -> HRESULT
+        {
+            TRACE_SCOPE("CreateDecoder");
+            HRESULT hrCreate = factory->CreateStream(stream.get_out_storage());
+            if (SUCCEEDED(hrCreate))
+            {
+                hrCreate = stream->InitializeFromMemory(const_cast<BYTE*>(m_data), static_cast<DWORD>(m_size));
+            }
+            if (SUCCEEDED(hrCreate))
+            {
+                hrCreate = factory->CreateDecoderFromStream(
+                    stream.get(),
+                    nullptr,
+                    WICDecodeMetadataCacheOnDemand,
+                    decoder.get_out_storage());
+            }
+            return hrCreate;
+        };
+        if (SUCCEEDED(hr) && !gifDecoder.isOpen())
+        {
+            hr = createDecoder();
+        }
+
+        unsigned int nextFrameIndex = m_firstFrameIndex;
+        while (SUCCEEDED(hr) && !m_stop)
+        {
+            unsigned int restartIndex = m_restartIndex.exchange(NO_RESTART);
+            if (restartIndex != NO_RESTART)
+            {
+                nextFrameIndex = restartIndex;
+            }
+
+            DecodedFrame* frame;
+            if (!m_freeFrames.Pop(frame))
+            {
+                // All frames are decoded ahead, sleep until one is free
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_wake.wait(lock, [this] {
+                    return m_stop || m_restartIndex != NO_RESTART || !m_freeFrames.isEmpty();
+                });
+                continue;
+            }
+
+            frame->frameIndex = nextFrameIndex;
+            frame->result = E_FAIL;
+            if (gifDecoder.isOpen())
+            {
+                TRACE_SCOPE("DecodeGifFrame");
+                if (gifDecoder.ExpandFrame(nextFrameIndex, frame->pixels, &frame->coverage))
+                {
+                    frame->width = frame->pixels.getWidth();
+                    frame->height = frame->pixels.getHeight();
+                    frame->result = S_OK;
+                }
+            }
+            if (FAILED(frame->result))
+            {
+                if (!decoder.get())
+                {
+                    hr = createDecoder();
+                }
+                frame->result = SUCCEEDED(hr) ? DecodeFrame(factory.get(), decoder.get(), *frame) : hr;
+            }
+            m_decodedFrames.Push(frame);
+            nextFrameIndex = (nextFrameIndex + 1) % m_frameCount;
+        }
+    }
+
+    CoUninitialize();
+}
+
+HRESULT FrameDecodeWorker::DecodeFrame(
+    IWICImagingFactory* factory,
+    IWICBitmapDecoder* decoder,
+    DecodedFrame& frame,
+    UINT maxWidth,
+    UINT maxHeight)
+{
+    TRACE_SCOPE("DecodeFrame");
+    ComPtr<IWICBitmapFrameDecode> pWicFrame;
+    ComPtr<IWICBitmapSource> pSource;
+
+    HRESULT hr = decoder->GetFrame(frame.frameIndex, pWicFrame.get_out_storage());
+
+    // Frames of animations are composed at full size
+    UINT frameCount = 0;
+    UINT width = 0;
+    UINT height = 0;
+    if (SUCCEEDED(hr))
+    {
+        hr = decoder->GetFrameCount(&frameCount);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pWicFrame->GetSize(&width, &height);
+    }
+    if (SUCCEEDED(hr) && frameCount == 1)
+    {
+        ScaledDecoder::GetFitSize(width, height, maxWidth, maxHeight, width, height);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = ScaledDecoder::CreateSource(factory, pWicFrame.get(), width, height, pSource.get_out_storage());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CopyFrame(factory, pSource.get(), frame);
+    }
+
+    return hr;
+}
+
+// Maps the WIC formats the PixelConverter can convert
+static PIXEL_FORMATS GetPixelFormat(const WICPixelFormatGUID& format)
+{
+    if (format == GUID_WICPixelFormat24bppBGR)   return PF_BGR24;
+    if (format == GUID_WICPixelFormat24bppRGB)   return PF_RGB24;
+    if (format == GUID_WICPixelFormat32bppBGRA)  return PF_BGRA32;
+    if (format == GUID_WICPixelFormat32bppRGBA)  return PF_RGBA32;
+    if (format == GUID_WICPixelFormat32bppBGR)   return PF_BGR32;
+    if (format == GUID_WICPixelFormat32bppPBGRA) return PF_PBGRA32;
+    if (format == GUID_WICPixelFormat8bppGray)   return PF_GRAY8;
+    if (format == GUID_WICPixelFormat16bppGray)  return PF_GRAY16;
+    if (format == GUID_WICPixelFormat48bppRGB)   return PF_RGB48;
+    if (format == GUID_WICPixelFormat64bppRGBA)  return PF_RGBA64;
+    return PF_UNSUPPORTED;
+}
+
+HRESULT FrameDecodeWorker::LoadPalette(IWICImagingFactory* factory, IWICBitmapSource* source, PaletteExpander& palette)
+{
+    ComPtr<IWICPalette> pWicPalette;
+    WICColor colors[256];
+    UINT colorCount = 0;
+
+    HRESULT hr = factory->CreatePalette(pWicPalette.get_out_storage());
+    if (SUCCEEDED(hr))
+    {
+        hr = source->CopyPalette(pWicPalette.get());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pWicPalette->GetColors(ARRAYSIZE(colors), colors, &colorCount);
+    }
+    if (SUCCEEDED(hr))
+    {
+        palette.SetPalette(colors, colorCount);
+    }
+    return hr;
+}
+
+HRESULT FrameDecodeWorker::CopyFrame(IWICImagingFactory* factory, IWICBitmapSource* source, DecodedFrame& frame)
+{
+    WICPixelFormatGUID wicFormat;
+    HRESULT hr = source->GetSize(&frame.width, &frame.height);
+    if (SUCCEEDED(hr))
+    {
+        hr = source->GetPixelFormat(&wicFormat);
+    }
+    if (FAILED(hr))
+        return hr;
+
+    // The buffer is kept for frames of the same size and otherwise traded
+    // for one of the pool
+    if (!frame.pixels.hasSize(frame.width, frame.height, 4))
+    {
+        frame.pixels = FrameBufferPool::GetInstance().Acquire(frame.width, frame.height, 4);
+    }
+    UINT stride = static_cast<UINT>(frame.pixels.getStride());
+
+    PIXEL_FORMATS format = GetPixelFormat(wicFormat);
+    if (format == PF_PBGRA32)
+    {
+        frame.coverage.Release();
+        return source->CopyPixels(
+            nullptr,
+            stride,
+            static_cast<UINT>(frame.pixels.size()),
+            frame.pixels.data());
+    }
+
+    // Indexed frames are expanded through a lookup table of their palette
+    PaletteExpander palette;
+    bool indexed = (wicFormat == GUID_WICPixelFormat8bppIndexed) && SUCCEEDED(LoadPalette(factory, source, palette));
+
+    // The transparent pixels of indexed frames are skipped when the frame is
+    // composed
+    bool covered = indexed && palette.hasTransparency();
+    if (!covered)
+    {
+        frame.coverage.Release();
+    }
+    else if (!frame.coverage.hasSize(frame.width, frame.height, 1))
+    {
+        frame.coverage = FrameBufferPool::GetInstance().Acquire(frame.width, frame.height, 1);
+    }
+    size_t visiblePixels = 0;
+
+    if (format == PF_UNSUPPORTED && !indexed)
+    {
+        // Indexed and other formats are left to WIC
+        ComPtr<IWICFormatConverter> pConverter;
+        hr = factory->CreateFormatConverter(pConverter.get_out_storage());
+        if (SUCCEEDED(hr))
+        {
+            hr = pConverter->Initialize(
+                source,
+                GUID_WICPixelFormat32bppPBGRA,
+                WICBitmapDitherTypeNone,
+                nullptr,
+                0.f,
+                WICBitmapPaletteTypeCustom);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pConverter->CopyPixels(
+                nullptr,
+                stride,
+                static_cast<UINT>(frame.pixels.size()),
+                frame.pixels.data());
+        }
+        return hr;
+    }
+
+    // Decode bands of rows which stay in the cache while they are converted
+    UINT bytesPerPixel = indexed ? 1 : static_cast<UINT>(PixelConverter::getBytesPerPixel(format));
+    UINT sourceStride = static_cast<UINT>(FrameBuffer::GetStride(frame.width, bytesPerPixel));
+    UINT bandRows = sourceStride > 0 ? static_cast<UINT>(CONVERT_BAND_BYTES / sourceStride) : 1;
+    if (bandRows == 0)
+        bandRows = 1;
+    if (bandRows > frame.height)
+        bandRows = frame.height;
+    FrameBuffer band = FrameBufferPool::GetInstance().Acquire(frame.width, bandRows, bytesPerPixel);
+
+    for (UINT y = 0; SUCCEEDED(hr) && y < frame.height; y += bandRows)
+    {
+        UINT rows = (frame.height - y < bandRows) ? frame.height - y : bandRows;
+        WICRect rect = { 0, static_cast<INT>(y), static_cast<INT>(frame.width), static_cast<INT>(rows) };
+        hr = source->CopyPixels(&rect, sourceStride, sourceStride * rows, band.data());
+        if (SUCCEEDED(hr) && indexed)
+        {
+            for (UINT row = 0; row < rows; ++row)
+            {
+                visiblePixels += palette.ExpandRow(
+                    band.data() + static_cast<size_t>(row) * sourceStride,
+                    frame.pixels.data() + static_cast<size_t>(y + row) * stride,
+                    covered ? frame.coverage.data() + (y + row) * frame.coverage.getStride() : nullptr,
+                    frame.width);
+            }
+        }
+        else if (SUCCEEDED(hr))
+        {
+            PixelConverter::Convert(
+                format,
+                band.data(),
+                sourceStride,
+                frame.pixels.data() + static_cast<size_t>(y) * stride,
+                stride,
+                frame.width,
+                rows);
+        }
+    }
+
+    // A frame without transparent pixels is blended faster without its coverage
+    if (covered && visiblePixels == static_cast<size_t>(frame.width) * frame.height)
+    {
+        frame.coverage.Release();
+    }
+    return hr;
+}
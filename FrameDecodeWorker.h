@@ -0,0 +1,89 @@
+#pragma once
+#include <wincodec.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "FrameBufferPool.h"
+#include "SpscRing.h"
+
+class PaletteExpander;
+
+// A frame decoded to 32bppPBGRA by the FrameDecodeWorker
+struct DecodedFrame
+{
+    unsigned int         frameIndex;
+    unsigned int         width;
+    unsigned int         height;
+    FrameBuffer          pixels;        // Rows of width * 4 bytes
+    FrameBuffer          coverage;      // 0 for each transparent pixel of indexed frames, empty if all pixels are drawn
+    HRESULT              result;
+};
+
+// Decodes the frames following the displayed frame on a worker thread, so
+// that the UI thread only needs to compose them. The worker uses its own
+// decoders on the bytes of the file, the GifDecoder for GIF files and WIC
+// for the others, because decoders must not be used from two threads at the
+// same time.
+class FrameDecodeWorker
+{
+public:
+    FrameDecodeWorker();
+    ~FrameDecodeWorker();
+
+    // Starts decoding at firstFrameIndex. The bytes must stay valid until
+    // Stop is called.
+    void Start(const uint8_t* data, size_t size, unsigned int frameCount, unsigned int firstFrameIndex);
+    void Stop();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // Returns the frame if the worker already decoded it. Otherwise returns
+    // nullptr and lets the worker continue with the frame after it. The
+    // frame must be given back with ReleaseFrame.
+    DecodedFrame* TakeFrame(unsigned int frameIndex);
+    void ReleaseFrame(DecodedFrame* frame);
+
+    // Decodes frame.frameIndex into frame. Can be called from any thread
+    // that owns the factory and the decoder. If a maximum size is given,
+    // single frame images are scaled down to fit into it.
+    static HRESULT DecodeFrame(
+        IWICImagingFactory* factory,
+        IWICBitmapDecoder* decoder,
+        DecodedFrame& frame,
+        UINT maxWidth = 0,
+        UINT maxHeight = 0);
+
+    // Converts the pixels of the source to 32bppPBGRA into frame. Indexed and
+    // common formats are converted by the PaletteExpander and the
+    // PixelConverter, others by WIC. Indexed frames with transparent pixels
+    // also get their coverage.
+    static HRESULT CopyFrame(IWICImagingFactory* factory, IWICBitmapSource* source, DecodedFrame& frame);
+
+private:
+    FrameDecodeWorker(const FrameDecodeWorker&) = delete;
+    FrameDecodeWorker& operator=(const FrameDecodeWorker&) = delete;
+
+    void Run();
+    void Wake();
+    static HRESULT LoadPalette(IWICImagingFactory* factory, IWICBitmapSource* source, PaletteExpander& palette);
+
+    static const size_t       QUEUE_SIZE = 4;   // Number of frames decoded ahead
+    static const size_t       CONVERT_BAND_BYTES = 256 * 1024;  // Source bytes decoded at a time for the PixelConverter
+    static const unsigned int NO_RESTART = ~0u;
+
+    const uint8_t*            m_data;
+    size_t                    m_size;
+    unsigned int              m_frameCount;
+    unsigned int              m_firstFrameIndex;
+
+    DecodedFrame                           m_frames[QUEUE_SIZE];
+    SpscRing<DecodedFrame*, QUEUE_SIZE>    m_decodedFrames;    // From the worker to the UI thread
+    SpscRing<DecodedFrame*, QUEUE_SIZE>    m_freeFrames;       // From the UI thread back to the worker
+
+    std::thread               m_thread;
+    std::atomic<bool>         m_stop;
+    std::atomic<unsigned int> m_restartIndex;   // Frame to continue with, or NO_RESTART
+    std::mutex                m_wakeMutex;      // Only used to let the idle worker sleep
+    std::condition_variable   m_wake;
+};
@@ -0,0 +1,273 @@
+#include "FrameIndex.h"
+#include <intsafe.h>
+#include "ComPtr.h"
+#include "GifDecoder.h"
+
+FrameIndex::FrameIndex()
+{
+    Reset();
+}
+
+void FrameIndex::Reset()
+{
+    m_frames.clear();
+    m_imageWidth = 0;
+    m_imageHeight = 0;
+    m_defaultFrame.left = 0;
+    m_defaultFrame.top = 0;
+    m_defaultFrame.width = 0;
+    m_defaultFrame.height = 0;
+    m_defaultFrame.delay = 0;
+    m_defaultFrame.disposal = DM_UNDEFINED;
+    m_defaultFrame.hasTransparency = false;
+    m_defaultFrame.transparentIndex = 0;
+}
+
+HRESULT FrameIndex::Build(IWICBitmapDecoder* decoder, const ImageInfo& imageInfo)
+{
+    Reset();
+    m_imageWidth = imageInfo.getImageWidth();
+    m_imageHeight = imageInfo.getImageHeight();
+    m_defaultFrame.width = imageInfo.getImageWidthPixel();
+    m_defaultFrame.height = imageInfo.getImageHeightPixel();
+
+    HRESULT hr = S_OK;
+    m_frames.reserve(imageInfo.getFrameCount());
+    for (UINT i = 0; i < imageInfo.getFrameCount() && SUCCEEDED(hr); ++i)
+    {
+        ComPtr<IWICBitmapFrameDecode> pWicFrame;
+        ComPtr<IWICMetadataQueryReader> pFrameMetadataQueryReader;
+        FrameInfo frameInfo = m_defaultFrame;
+
+        hr = decoder->GetFrame(i, pWicFrame.get_out_storage());
+        if (SUCCEEDED(hr))
+        {
+            // Frames without metadata (e.g. pages of a TIFF) keep the defaults
+            if (SUCCEEDED(pWicFrame->GetMetadataQueryReader(pFrameMetadataQueryReader.get_out_storage())))
+            {
+                ReadFrameInfo(pFrameMetadataQueryReader.get(), frameInfo);
+            }
+
+            // Pages have no delay and each has its own size
+            UINT uWidth = 0;
+            UINT uHeight = 0;
+            if (frameInfo.delay == 0 && SUCCEEDED(pWicFrame->GetSize(&uWidth, &uHeight)))
+            {
+                frameInfo.width = uWidth;
+                frameInfo.height = uHeight;
+            }
+            m_frames.push_back(frameInfo);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        m_frames.clear();
+    }
+    return hr;
+}
+
+void FrameIndex::BuildPages(const ImageInfo& imageInfo)
+{
+    Reset();
+    m_imageWidth = imageInfo.getImageWidth();
+    m_imageHeight = imageInfo.getImageHeight();
+    m_defaultFrame.width = imageInfo.getImageWidthPixel();
+    m_defaultFrame.height = imageInfo.getImageHeightPixel();
+    m_frames.assign(imageInfo.getFrameCount(), m_defaultFrame);
+}
+
+void FrameIndex::BuildGif(const GifDecoder& decoder, const ImageInfo& imageInfo)
+{
+    Reset();
+    m_imageWidth = imageInfo.getImageWidth();
+    m_imageHeight = imageInfo.getImageHeight();
+    m_defaultFrame.width = imageInfo.getImageWidthPixel();
+    m_defaultFrame.height = imageInfo.getImageHeightPixel();
+
+    // The same values ReadFrameInfo reads from the metadata
+    m_frames.resize(decoder.getFrameCount());
+    for (unsigned int i = 0; i < decoder.getFrameCount(); ++i)
+    {
+        const GifFrame& frame = decoder.getFrame(i);
+        FrameInfo& frameInfo = m_frames[i];
+        frameInfo.left = frame.left;
+        frameInfo.top = frame.top;
+        frameInfo.width = frame.width;
+        frameInfo.height = frame.height;
+        frameInfo.delay = frame.hasGraphicControl && frame.delay >= 20 ? frame.delay : 20;
+        frameInfo.disposal = frame.hasGraphicControl ? static_cast<DISPOSAL_METHODS>(frame.disposal) : DM_UNDEFINED;
+        frameInfo.hasTransparency = frame.hasGraphicControl && frame.hasTransparency;
+        frameInfo.transparentIndex = frameInfo.hasTransparency ? frame.transparentIndex : 0;
+    }
+}
+
+bool FrameIndex::CoversImage(const FrameInfo& frameInfo) const
+{
+    return frameInfo.left == 0 && frameInfo.top == 0 &&
+        frameInfo.width >= m_imageWidth && frameInfo.height >= m_imageHeight;
+}
+
+bool FrameIndex::isKeyFrame(unsigned int frameIndex) const
+{
+    // The first frame is drawn on the background
+    if (frameIndex == 0)
+        return true;
+
+    // Pages are shown on their own
+    const FrameInfo& frameInfo = getFrame(frameIndex);
+    if (frameInfo.delay == 0)
+        return true;
+
+    if (CoversImage(frameInfo) && !frameInfo.hasTransparency && frameInfo.disposal != DM_PREVIOUS)
+        return true;
+
+    // The frame before cleared the whole image to the background
+    const FrameInfo& previousFrameInfo = getFrame(frameIndex - 1);
+    return CoversImage(previousFrameInfo) && previousFrameInfo.disposal == DM_BACKGROUND;
+}
+
+HRESULT FrameIndex::ReadFrameInfo(IWICMetadataQueryReader* pFrameMetadataQueryReader, FrameInfo& frameInfo)
+{
+    PROPVARIANT propValue;
+    PropVariantInit(&propValue);
+
+    HRESULT hr = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Left", &propValue);
+    if (SUCCEEDED(hr))
+    {
+        hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
+        if (SUCCEEDED(hr))
+        {
+            frameInfo.left = propValue.uiVal;
+        }
+        PropVariantClear(&propValue);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Top", &propValue);
+        if (SUCCEEDED(hr))
+        {
+            hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
+            if (SUCCEEDED(hr))
+            {
+                frameInfo.top = propValue.uiVal;
+            }
+            PropVariantClear(&propValue);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Width", &propValue);
+        if (SUCCEEDED(hr))
+        {
+            hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
+            if (SUCCEEDED(hr))
+            {
+                frameInfo.width = propValue.uiVal;
+            }
+            PropVariantClear(&propValue);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Height", &propValue);
+        if (SUCCEEDED(hr))
+        {
+            hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
+            if (SUCCEEDED(hr))
+            {
+                frameInfo.height = propValue.uiVal;
+            }
+            PropVariantClear(&propValue);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Get delay from the optional Graphic Control Extension
+        if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/Delay",
+            &propValue)))
+        {
+            hr = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
+            if (SUCCEEDED(hr))
+            {
+                // Convert the delay retrieved in 10 ms units to a delay in 1 ms units
+                hr = UIntMult(propValue.uiVal, 10, &frameInfo.delay);
+            }
+            PropVariantClear(&propValue);
+        }
+        else
+        {
+            // Failed to get delay from graphic control extension. Possibly a
+            // single frame image (non-animated gif)
+            frameInfo.delay = 0;
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            // Insert an artificial delay to ensure rendering for gif with very small
+            // or 0 delay.  This delay number is picked to match with most browsers' 
+            // gif display speed.
+            //
+            // This will defeat the purpose of using zero delay intermediate frames in 
+            // order to preserve compatibility. If this is removed, the zero delay 
+            // intermediate frames will not be visible.
+            if (frameInfo.delay < 20)
+            {
+                frameInfo.delay = 20;
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/Disposal",
+            &propValue)))
+        {
+            hr = (propValue.vt == VT_UI1) ? S_OK : E_FAIL;
+            if (SUCCEEDED(hr))
+            {
+                frameInfo.disposal = (DISPOSAL_METHODS)propValue.bVal;
+            }
+            PropVariantClear(&propValue);
+        }
+        else
+        {
+            // Failed to get the disposal method, use default. Possibly a 
+            // non-animated gif.
+            frameInfo.disposal = DM_UNDEFINED;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // The transparent color index is only valid if the flag is set
+        if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/TransparencyFlag",
+            &propValue)))
+        {
+            frameInfo.hasTransparency = (propValue.vt == VT_BOOL && propValue.boolVal);
+            PropVariantClear(&propValue);
+        }
+
+        if (frameInfo.hasTransparency &&
+            SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/TransparentColorIndex",
+            &propValue)))
+        {
+            if (propValue.vt == VT_UI1)
+            {
+                frameInfo.transparentIndex = propValue.bVal;
+            }
+            PropVariantClear(&propValue);
+        }
+    }
+
+    PropVariantClear(&propValue);
+    return hr;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <wincodec.h>
+#include <vector>
+#include "ImageInfo.h"
+
+class GifDecoder;
+
+// Timing, position and disposal of a single frame
+struct FrameInfo
+{
+    unsigned int     left;
+    unsigned int     top;
+    unsigned int     width;
+    unsigned int     height;
+    unsigned int     delay;             // Delay in ms, 0 if the frames are pages
+    DISPOSAL_METHODS disposal;
+    bool             hasTransparency;
+    unsigned char    transparentIndex;  // Palette index of the transparent color
+};
+
+// The frame metadata of all frames, read once when the file is opened so
+// that playback and page navigation need no metadata queries.
+class FrameIndex
+{
+public:
+    FrameIndex();
+
+    HRESULT Build(IWICBitmapDecoder* decoder, const ImageInfo& imageInfo);
+
+    // Builds the index of a file with pages only without metadata queries.
+    // The pages get the size of the image until they are decoded.
+    void BuildPages(const ImageInfo& imageInfo);
+
+    // Builds the index of a GIF read by the GifDecoder, without metadata
+    // queries
+    void BuildGif(const GifDecoder& decoder, const ImageInfo& imageInfo);
+    void Reset();
+
+    unsigned int     getFrameCount() const { return static_cast<unsigned int>(m_frames.size()); }
+
+    // Returns the frame info or, if the metadata of the frame could not be
+    // read, a frame covering the whole image without delay
+    const FrameInfo& getFrame(unsigned int frameIndex) const
+    {
+        return frameIndex < m_frames.size() ? m_frames[frameIndex] : m_defaultFrame;
+    }
+
+    // Whether the frame can be composed without composing the frames before
+    // it, because the frame is drawn on the background only, or because it
+    // hides everything drawn before and is not disposed to the previous frame.
+    // Pages, which have no delay, are always key frames.
+    bool isKeyFrame(unsigned int frameIndex) const;
+
+private:
+    FrameIndex(const FrameIndex&) = delete;
+    FrameIndex& operator=(const FrameIndex&) = delete;
+
+    static HRESULT ReadFrameInfo(IWICMetadataQueryReader* pFrameMetadataQueryReader, FrameInfo& frameInfo);
+
+    bool CoversImage(const FrameInfo& frameInfo) const;
+
+    std::vector<FrameInfo> m_frames;
+    FrameInfo              m_defaultFrame;
+    unsigned int           m_imageWidth;
+    unsigned int           m_imageHeight;
+};
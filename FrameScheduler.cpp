@@ -0,0 +1,90 @@
+#include "FrameScheduler.h"
+
+namespace {
+
+class SteadyClock : public SchedulerClock
+{
+public:
+    TimePoint Now() const override { return std::chrono::steady_clock::now(); }
+};
+
+const SteadyClock steadyClock;
+
+}
+
+FrameScheduler::FrameScheduler(const SchedulerClock* clock) :
+    m_clock(clock ? clock : &steadyClock),
+    m_policy(CP_DROP),
+    m_toleranceMs(0),
+    m_running(false),
+    m_droppedCount(0),
+    m_stretchedCount(0)
+{
+}
+
+void FrameScheduler::SetPolicy(CATCH_UP_POLICIES policy, unsigned int toleranceMs)
+{
+    m_policy = policy;
+    m_toleranceMs = toleranceMs;
+}
+
+void FrameScheduler::Start()
+{
+    m_deadline = m_clock->Now();
+    m_running = true;
+}
+
+void FrameScheduler::Stop()
+{
+    m_running = false;
+}
+
+void FrameScheduler::Advance(unsigned int delayMs)
+{
+    m_deadline += std::chrono::milliseconds(delayMs);
+    if (m_policy == CP_STRETCH)
+    {
+        TimePoint now = m_clock->Now();
+        if (now - m_deadline > std::chrono::milliseconds(m_toleranceMs))
+        {
+            m_deadline = now;
+            ++m_stretchedCount;
+        }
+    }
+}
+
+bool FrameScheduler::ShouldDrop(unsigned int delayMs) const
+{
+    if (m_policy != CP_DROP)
+        return false;
+
+    // The frame would be replaced before it could be seen
+    TimePoint end = m_deadline + std::chrono::milliseconds(delayMs);
+    return m_clock->Now() - end > std::chrono::milliseconds(m_toleranceMs);
+}
+
+void FrameScheduler::Drop(unsigned int delayMs)
+{
+    m_deadline += std::chrono::milliseconds(delayMs);
+    ++m_droppedCount;
+}
+
+unsigned int FrameScheduler::getWaitMs() const
+{
+    auto wait = m_deadline - m_clock->Now();
+    if (wait <= TimePoint::duration::zero())
+        return 0;
+
+    auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(wait);
+    if (waitMs < wait)
+    {
+        waitMs += std::chrono::milliseconds(1);
+    }
+    return static_cast<unsigned int>(waitMs.count());
+}
+
+void FrameScheduler::ResetCounts()
+{
+    m_droppedCount = 0;
+    m_stretchedCount = 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <chrono>
+
+// The time used by the FrameScheduler. Tests can replace the steady clock
+// with a virtual clock.
+class SchedulerClock
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    virtual ~SchedulerClock() {}
+    virtual TimePoint Now() const = 0;
+};
+
+// How the FrameScheduler catches up when frames are shown late
+enum CATCH_UP_POLICIES
+{
+    CP_STRETCH = 0,     // Show every frame and move the following deadlines back
+    CP_DROP             // Compose but do not show frames whose time has passed
+};
+
+// Computes when the frames of an animation are due. The deadlines are
+// absolute times counted from the start of the animation, so the time spent
+// decoding and composing and the inaccuracy of the timer do not add up over
+// the frames. Lateness up to the tolerance is made up by shorter waits,
+// larger lateness is handled by the catch-up policy.
+class FrameScheduler
+{
+public:
+    typedef SchedulerClock::TimePoint TimePoint;
+
+    // Uses the steady clock if no clock is given
+    explicit FrameScheduler(const SchedulerClock* clock = nullptr);
+
+    void SetPolicy(CATCH_UP_POLICIES policy, unsigned int toleranceMs);
+    CATCH_UP_POLICIES getPolicy()    const { return m_policy; }
+    unsigned int      getTolerance() const { return m_toleranceMs; }
+
+    // Starts a schedule with the frame shown now
+    void Start();
+    void Stop();
+    bool isRunning() const { return m_running; }
+
+    // Moves the deadline past the frame shown for delayMs. With the stretch
+    // policy a deadline which passed more than the tolerance ago is moved to
+    // now.
+    void Advance(unsigned int delayMs);
+
+    // Whether the frame due now, which is shown for delayMs, should not be
+    // shown because the deadline after it passed as well. Always false with
+    // the stretch policy.
+    bool ShouldDrop(unsigned int delayMs) const;
+
+    // Moves the deadline past a frame which is not shown
+    void Drop(unsigned int delayMs);
+
+    TimePoint    getDeadline() const { return m_deadline; }
+
+    // Milliseconds until the deadline rounded up, 0 if it passed
+    unsigned int getWaitMs() const;
+
+    unsigned int getDroppedCount()   const { return m_droppedCount; }
+    unsigned int getStretchedCount() const { return m_stretchedCount; }
+    void         ResetCounts();
+
+private:
+    FrameScheduler(const FrameScheduler&) = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    const SchedulerClock* m_clock;
+    CATCH_UP_POLICIES     m_policy;
+    unsigned int          m_toleranceMs;
+    bool                  m_running;
+    TimePoint             m_deadline;       // When the next frame is due
+    unsigned int          m_droppedCount;
+    unsigned int          m_stretchedCount; // Number of times the schedule was moved back
+};
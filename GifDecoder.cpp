@@ -0,0 +1,446 @@
+#include "GifDecoder.h"
+#include <cstring>
+
+namespace {
+
+inline unsigned int ReadUInt16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Writes decoded pixels row by row into the frame buffer, following the
+// row order of interlaced frames
+class RowWriter
+{
+public:
+    RowWriter(uint8_t* pixels, size_t stride, unsigned int width, unsigned int height, bool interlaced) :
+        m_pixels(pixels),
+        m_stride(stride),
+        m_width(width),
+        m_height(height),
+        m_interlaced(interlaced),
+        m_pass(0),
+        m_x(0),
+        m_y(0),
+        m_row(pixels)
+    {
+    }
+
+    bool isDone() const { return m_row == nullptr; }
+
+    // Number of pixels which can be written to the current row
+    unsigned int getRowSpace() const { return m_width - m_x; }
+    uint8_t*     getRowPosition() const { return m_row + m_x; }
+
+    void Advance(unsigned int count)
+    {
+        m_x += count;
+        if (m_x == m_width)
+        {
+            m_x = 0;
+            NextRow();
+        }
+    }
+
+    void Write(const uint8_t* pixels, unsigned int count)
+    {
+        while (count > 0 && m_row != nullptr)
+        {
+            unsigned int n = count < getRowSpace() ? count : getRowSpace();
+            memcpy(getRowPosition(), pixels, n);
+            pixels += n;
+            count -= n;
+            Advance(n);
+        }
+    }
+
+    void Fill(uint8_t value)
+    {
+        while (m_row != nullptr)
+        {
+            memset(getRowPosition(), value, getRowSpace());
+            Advance(getRowSpace());
+        }
+    }
+
+private:
+    void NextRow()
+    {
+        static const unsigned int passStart[] = { 0, 4, 2, 1 };
+        static const unsigned int passStep[] = { 8, 8, 4, 2 };
+
+        if (!m_interlaced)
+        {
+            ++m_y;
+        }
+        else
+        {
+            m_y += passStep[m_pass];
+            while (m_y >= m_height && m_pass < 3)
+            {
+                ++m_pass;
+                m_y = passStart[m_pass];
+            }
+        }
+        m_row = (m_y < m_height) ? m_pixels + m_y * m_stride : nullptr;
+    }
+
+    uint8_t*     m_pixels;
+    size_t       m_stride;
+    unsigned int m_width;
+    unsigned int m_height;
+    bool         m_interlaced;
+    unsigned int m_pass;
+    unsigned int m_x;
+    unsigned int m_y;
+    uint8_t*     m_row;
+};
+
+}
+
+GifDecoder::GifDecoder()
+{
+    Reset();
+}
+
+void GifDecoder::Reset()
+{
+    m_data = nullptr;
+    m_size = 0;
+    m_width = 0;
+    m_height = 0;
+    m_pixelAspectRatio = 0;
+    m_backgroundIndex = 0;
+    m_globalColorCount = 0;
+    m_globalPaletteOffset = 0;
+    m_loopCount = 0;
+    m_frames.clear();
+    m_indices.Release();
+}
+
+bool GifDecoder::SkipSubBlocks(size_t& pos) const
+{
+    while (pos < m_size)
+    {
+        unsigned int blockSize = m_data[pos++];
+        if (blockSize == 0)
+            return true;
+        pos += blockSize;
+    }
+    return false;
+}
+
+bool GifDecoder::IsGif(const uint8_t* data, size_t size)
+{
+    return size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0);
+}
+
+bool GifDecoder::Open(const uint8_t* data, size_t size)
+{
+    Reset();
+
+    // Header and logical screen descriptor
+    if (size < 13 || !IsGif(data, size))
+        return false;
+
+    m_data = data;
+    m_size = size;
+    m_width = ReadUInt16(data + 6);
+    m_height = ReadUInt16(data + 8);
+    unsigned int flags = data[10];
+    m_backgroundIndex = data[11];
+    m_pixelAspectRatio = data[12];
+
+    size_t pos = 13;
+    if (flags & 0x80)
+    {
+        m_globalColorCount = 2u << (flags & 0x07);
+        m_globalPaletteOffset = pos;
+        pos += m_globalColorCount * 3;
+        if (pos > m_size)
+        {
+            Reset();
+            return false;
+        }
+    }
+
+    // The graphic control extension applies to the next image
+    GifFrame nextFrame = {};
+
+    while (pos < m_size)
+    {
+        unsigned int blockType = m_data[pos++];
+        if (blockType == 0x3B)
+        {
+            // Trailer
+            break;
+        }
+        else if (blockType == 0x21)
+        {
+            if (pos >= m_size)
+                break;
+            unsigned int label = m_data[pos++];
+            if (label == 0xF9 && pos + 6 <= m_size && m_data[pos] >= 4)
+            {
+                // Graphic control extension
+                unsigned int packed = m_data[pos + 1];
+                nextFrame.hasGraphicControl = true;
+                nextFrame.disposal = (packed >> 2) & 0x07;
+                nextFrame.hasTransparency = (packed & 0x01) != 0;
+                nextFrame.delay = ReadUInt16(m_data + pos + 2) * 10;
+                nextFrame.transparentIndex = m_data[pos + 4];
+            }
+            else if (label == 0xFF && pos + 12 <= m_size && m_data[pos] == 11 &&
+                (memcmp(m_data + pos + 1, "NETSCAPE2.0", 11) == 0 ||
+                 memcmp(m_data + pos + 1, "ANIMEXTS1.0", 11) == 0))
+            {
+                //  The first sub block contains the looping information:
+                //  byte 0: extsize (must be > 1)
+                //  byte 1: loopType (1 == animated gif)
+                //  byte 2: loop count (least significant byte)
+                //  byte 3: loop count (most significant byte)
+                size_t subBlock = pos + 12;
+                if (subBlock + 4 <= m_size && m_data[subBlock] >= 3 && m_data[subBlock + 1] == 1)
+                {
+                    m_loopCount = ReadUInt16(m_data + subBlock + 2);
+                }
+            }
+            if (!SkipSubBlocks(pos))
+                break;
+        }
+        else if (blockType == 0x2C)
+        {
+            // Image descriptor
+            if (pos + 9 > m_size)
+                break;
+            GifFrame frame = nextFrame;
+            frame.left = ReadUInt16(m_data + pos);
+            frame.top = ReadUInt16(m_data + pos + 2);
+            frame.width = ReadUInt16(m_data + pos + 4);
+            frame.height = ReadUInt16(m_data + pos + 6);
+            unsigned int packed = m_data[pos + 8];
+            frame.interlaced = (packed & 0x40) != 0;
+            pos += 9;
+
+            if (packed & 0x80)
+            {
+                frame.localColorCount = 2u << (packed & 0x07);
+                frame.localPaletteOffset = pos;
+                pos += frame.localColorCount * 3;
+            }
+
+            if (pos >= m_size)
+                break;
+
+            // A truncated last frame is kept, it is decoded as far as possible
+            frame.dataOffset = pos;
+            m_frames.push_back(frame);
+            nextFrame = GifFrame();
+
+            ++pos;  // LZW minimum code size
+            if (!SkipSubBlocks(pos))
+                break;
+        }
+        else
+        {
+            // Unknown block, the rest of the file cannot be parsed
+            break;
+        }
+    }
+
+    return true;
+}
+
+const uint8_t* GifDecoder::getGlobalPalette(unsigned int& colorCount) const
+{
+    colorCount = m_globalColorCount;
+    return m_globalColorCount > 0 ? m_data + m_globalPaletteOffset : nullptr;
+}
+
+const uint8_t* GifDecoder::getFramePalette(unsigned int frameIndex, unsigned int& colorCount) const
+{
+    const GifFrame& frame = m_frames[frameIndex];
+    if (frame.localColorCount > 0)
+    {
+        colorCount = frame.localColorCount;
+        return m_data + frame.localPaletteOffset;
+    }
+    return getGlobalPalette(colorCount);
+}
+
+bool GifDecoder::DecodeFrame(unsigned int frameIndex, uint8_t* pixels, size_t stride)
+{
+    if (frameIndex >= m_frames.size())
+        return false;
+
+    const GifFrame& frame = m_frames[frameIndex];
+    RowWriter writer(pixels, stride, frame.width, frame.height, frame.interlaced);
+    if (frame.width == 0 || frame.height == 0)
+        return true;
+
+    size_t pos = frame.dataOffset;
+    unsigned int minCodeSize = m_data[pos++];
+    if (minCodeSize < 1 || minCodeSize > 11)
+        return false;
+
+    const unsigned int clearCode = 1u << minCodeSize;
+    const unsigned int endCode = clearCode + 1;
+
+    for (unsigned int code = 0; code < clearCode; ++code)
+    {
+        m_prefix[code] = 0;
+        m_suffix[code] = static_cast<uint8_t>(code);
+        m_first[code] = static_cast<uint8_t>(code);
+        m_length[code] = 1;
+    }
+
+    unsigned int codeSize = minCodeSize + 1;
+    unsigned int codeMask = (1u << codeSize) - 1;
+    unsigned int nextCode = clearCode + 2;
+    unsigned int prevCode = MAX_CODES;     // No previous code after a clear code
+
+    uint32_t bitBuffer = 0;
+    unsigned int bitCount = 0;
+    size_t blockRemaining = 0;
+
+    while (!writer.isDone())
+    {
+        // Refill the bit buffer from the data sub blocks
+        while (bitCount < codeSize)
+        {
+            if (blockRemaining == 0)
+            {
+                if (pos >= m_size || m_data[pos] == 0)
+                    break;
+                blockRemaining = m_data[pos++];
+            }
+            if (pos >= m_size)
+                break;
+            bitBuffer |= static_cast<uint32_t>(m_data[pos++]) << bitCount;
+            bitCount += 8;
+            --blockRemaining;
+        }
+        if (bitCount < codeSize)
+            break;
+
+        unsigned int code = bitBuffer & codeMask;
+        bitBuffer >>= codeSize;
+        bitCount -= codeSize;
+
+        if (code == clearCode)
+        {
+            codeSize = minCodeSize + 1;
+            codeMask = (1u << codeSize) - 1;
+            nextCode = clearCode + 2;
+            prevCode = MAX_CODES;
+            continue;
+        }
+        if (code == endCode)
+            break;
+
+        if (prevCode == MAX_CODES)
+        {
+            // The first code after a clear code is always a single pixel
+            if (code >= clearCode)
+                break;
+        }
+        else
+        {
+            // A code which is not yet in the table is the previous string
+            // followed by its own first pixel
+            if (code > nextCode || (code == nextCode && nextCode == MAX_CODES))
+                break;
+            if (nextCode < MAX_CODES)
+            {
+                m_prefix[nextCode] = static_cast<uint16_t>(prevCode);
+                m_suffix[nextCode] = (code == nextCode) ? m_first[prevCode] : m_first[code];
+                m_first[nextCode] = m_first[prevCode];
+                m_length[nextCode] = m_length[prevCode] + 1;
+                ++nextCode;
+                if (nextCode > codeMask && codeSize < 12)
+                {
+                    ++codeSize;
+                    codeMask = (1u << codeSize) - 1;
+                }
+            }
+        }
+        prevCode = code;
+
+        // Write the string of the code backwards, directly into the frame if
+        // it fits into the current row
+        unsigned int length = m_length[code];
+        if (length == 1)
+        {
+            *writer.getRowPosition() = m_suffix[code];
+            writer.Advance(1);
+        }
+        else if (length <= writer.getRowSpace())
+        {
+            uint8_t* out = writer.getRowPosition();
+            for (unsigned int i = length; i-- > 0; code = m_prefix[code])
+            {
+                out[i] = m_suffix[code];
+            }
+            writer.Advance(length);
+        }
+        else
+        {
+            for (unsigned int i = length; i-- > 0; code = m_prefix[code])
+            {
+                m_string[i] = m_suffix[code];
+            }
+            writer.Write(m_string, length);
+        }
+    }
+
+    writer.Fill(frame.hasTransparency ? frame.transparentIndex : 0);
+    return true;
+}
+
+bool GifDecoder::ExpandFrame(unsigned int frameIndex, FrameBuffer& pixels, FrameBuffer* coverage, CPU_KERNELS kernels)
+{
+    const GifFrame& frame = m_frames[frameIndex];
+    if (!m_indices.hasSize(frame.width, frame.height, 1))
+    {
+        m_indices = FrameBufferPool::GetInstance().Acquire(frame.width, frame.height, 1);
+    }
+    if (!pixels.hasSize(frame.width, frame.height, 4))
+    {
+        pixels = FrameBufferPool::GetInstance().Acquire(frame.width, frame.height, 4);
+    }
+    if (m_indices.empty() || pixels.empty() || !DecodeFrame(frameIndex, m_indices.data(), m_indices.getStride()))
+        return false;
+
+    unsigned int colorCount = 0;
+    const uint8_t* colors = getFramePalette(frameIndex, colorCount);
+    m_palette.SetPalette(colors, colors ? colorCount : 0, frame.hasTransparency ? frame.transparentIndex : -1);
+
+    // The transparent pixels are skipped when the frame is composed
+    bool covered = coverage && m_palette.hasTransparency();
+    if (coverage && !covered)
+    {
+        coverage->Release();
+    }
+    else if (covered && !coverage->hasSize(frame.width, frame.height, 1))
+    {
+        *coverage = FrameBufferPool::GetInstance().Acquire(frame.width, frame.height, 1);
+    }
+
+    size_t visiblePixels = 0;
+    for (unsigned int y = 0; y < frame.height; ++y)
+    {
+        visiblePixels += m_palette.ExpandRow(
+            m_indices.data() + y * m_indices.getStride(),
+            pixels.data() + y * pixels.getStride(),
+            covered ? coverage->data() + y * coverage->getStride() : nullptr,
+            frame.width,
+            kernels);
+    }
+
+    // A frame without transparent pixels is blended faster without its coverage
+    if (covered && visiblePixels == static_cast<size_t>(frame.width) * frame.height)
+    {
+        coverage->Release();
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "FrameBufferPool.h"
+#include "PaletteExpander.h"
+
+// Position, timing and palette of a single GIF frame
+struct GifFrame
+{
+    unsigned int left;
+    unsigned int top;
+    unsigned int width;
+    unsigned int height;
+    unsigned int delay;                 // Delay in ms as stored in the file
+    unsigned int disposal;              // Disposal method of the graphic control extension
+    bool         hasGraphicControl;     // Whether the frame has a graphic control extension
+    bool         hasTransparency;
+    uint8_t      transparentIndex;
+    bool         interlaced;
+    unsigned int localColorCount;       // 0 if the frame uses the global palette
+    size_t       localPaletteOffset;
+    size_t       dataOffset;            // Offset of the LZW minimum code size
+};
+
+// Portable GIF decoder that works directly on the bytes of the file. Open
+// reads the logical screen descriptor, the palettes, the looping information
+// and the descriptors of all frames in one pass without decoding any pixels.
+// DecodeFrame decodes the palette indices of one frame, ExpandFrame also
+// expands them to colors, like the viewer composes them.
+//
+// The decoder does not copy the file, so the bytes must stay valid as long as
+// the decoder is used.
+class GifDecoder
+{
+public:
+    GifDecoder();
+
+    // Whether the bytes start with a GIF header
+    static bool IsGif(const uint8_t* data, size_t size);
+
+    bool Open(const uint8_t* data, size_t size);
+    void Reset();
+    bool isOpen() const { return m_data != nullptr; }
+
+    unsigned int getWidth()            const { return m_width; }
+    unsigned int getHeight()           const { return m_height; }
+
+    // The raw pixel aspect ratio byte, 0 if the pixels are square
+    unsigned int getPixelAspectRatio() const { return m_pixelAspectRatio; }
+
+    bool         hasGlobalPalette()    const { return m_globalColorCount > 0; }
+    unsigned int getBackgroundIndex()  const { return m_backgroundIndex; }
+
+    // Whether the NETSCAPE2.0 or ANIMEXTS1.0 extension limits the number of
+    // loops. If not, the animation loops infinitely.
+    bool         hasLoop()             const { return m_loopCount != 0; }
+    unsigned int getLoopCount()        const { return m_loopCount; }
+
+    unsigned int    getFrameCount()    const { return static_cast<unsigned int>(m_frames.size()); }
+    const GifFrame& getFrame(unsigned int frameIndex) const { return m_frames[frameIndex]; }
+
+    // Returns the RGB triples of the global palette, or nullptr if there is none
+    const uint8_t* getGlobalPalette(unsigned int& colorCount) const;
+
+    // Returns the RGB triples of the palette used by the frame, which is the
+    // local palette if the frame has one and the global palette otherwise
+    const uint8_t* getFramePalette(unsigned int frameIndex, unsigned int& colorCount) const;
+
+    // Decodes the palette indices of a frame into pixels. The buffer must hold
+    // frame height rows of stride bytes, each at least frame width bytes wide.
+    // Pixels missing from truncated data are set to the transparent index, or
+    // to 0 if the frame is not transparent.
+    bool DecodeFrame(unsigned int frameIndex, uint8_t* pixels, size_t stride);
+
+    // Decodes a frame to 32bpp premultiplied BGRA through its palette. If
+    // coverage is not nullptr, it receives the coverage of the transparent
+    // pixels for FrameCompositor::Overlay, or is released if all pixels are
+    // visible.
+    bool ExpandFrame(
+        unsigned int frameIndex,
+        FrameBuffer& pixels,
+        FrameBuffer* coverage,
+        CPU_KERNELS kernels = PixelConverter::getBestKernels());
+
+private:
+    GifDecoder(const GifDecoder&) = delete;
+    GifDecoder& operator=(const GifDecoder&) = delete;
+
+    bool SkipSubBlocks(size_t& pos) const;
+
+    static const unsigned int MAX_CODES = 4096;
+
+    const uint8_t*        m_data;
+    size_t                m_size;
+    unsigned int          m_width;
+    unsigned int          m_height;
+    unsigned int          m_pixelAspectRatio;
+    unsigned int          m_backgroundIndex;
+    unsigned int          m_globalColorCount;
+    size_t                m_globalPaletteOffset;
+    unsigned int          m_loopCount;
+    std::vector<GifFrame> m_frames;
+    PaletteExpander       m_palette;
+    FrameBuffer           m_indices;
+
+    // LZW string table. Each code is the string of its prefix code followed
+    // by its suffix byte.
+    uint16_t              m_prefix[MAX_CODES];
+    uint8_t               m_suffix[MAX_CODES];
+    uint8_t               m_first[MAX_CODES];
+    uint16_t              m_length[MAX_CODES];
+    uint8_t               m_string[MAX_CODES];
+};
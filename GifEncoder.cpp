@@ -0,0 +1,426 @@
+#include "GifEncoder.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const unsigned int MAX_DELAY = 65535;   // In 1/100 s
+
+inline uint32_t ReadPixel(const uint8_t* pixel)
+{
+    uint32_t value;
+    memcpy(&value, pixel, sizeof(value));
+    return value;
+}
+
+}
+
+GifEncoder::GifEncoder(CPU_KERNELS kernels) :
+    m_file(nullptr),
+    m_position(0),
+    m_failed(false),
+    m_dither(false),
+    m_width(0),
+    m_height(0),
+    m_frameCount(0),
+    m_pendingDelay(0),
+    m_hasPending(false),
+    m_quantizer(kernels),
+    m_hashKeys(HASH_SIZE),
+    m_hashCodes(HASH_SIZE),
+    m_bitBuffer(0),
+    m_bitCount(0),
+    m_blockSize(0)
+{
+}
+
+GifEncoder::~GifEncoder()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool GifEncoder::Open(const wchar_t* filename, unsigned int width, unsigned int height, unsigned int loopCount)
+#else
+bool GifEncoder::Open(const char* filename, unsigned int width, unsigned int height, unsigned int loopCount)
+#endif
+{
+    Close();
+#ifdef _WIN32
+    if (_wfopen_s(&m_file, filename, L"wb") != 0)
+    {
+        m_file = nullptr;
+    }
+#else
+    m_file = fopen(filename, "wb");
+#endif
+    if (m_file == nullptr)
+        return false;
+    return Start(width, height, loopCount);
+}
+
+bool GifEncoder::Start(unsigned int width, unsigned int height, unsigned int loopCount)
+{
+    m_position = 0;
+    m_failed = width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF;
+    m_frameCount = 0;
+    m_hasPending = false;
+    m_pendingDelay = 0;
+    if (m_failed)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_background.assign(static_cast<size_t>(width) * height * 4, 0);
+    m_pending.resize(m_background.size());
+
+    // No global color table, the frames have their own
+    static const uint8_t signature[6] = { 'G', 'I', 'F', '8', '9', 'a' };
+    static const uint8_t screen[3] = { 0, 0, 0 };
+    Write(signature, sizeof(signature));
+    Write16(width);
+    Write16(height);
+    Write(screen, sizeof(screen));
+
+    static const uint8_t loop[16] = { 0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1 };
+    static const uint8_t terminator = 0;
+    Write(loop, sizeof(loop));
+    Write16(loopCount > 0xFFFF ? 0xFFFF : loopCount);
+    return Write(&terminator, 1);
+}
+
+bool GifEncoder::Close()
+{
+    if (m_file == nullptr)
+        return false;
+    if (m_hasPending)
+    {
+        WritePending(nullptr, 0);
+    }
+    static const uint8_t trailer = 0x3B;
+    Write(&trailer, 1);
+
+    bool succeeded = fclose(m_file) == 0 && !m_failed && m_frameCount > 0;
+    m_file = nullptr;
+    m_background.clear();
+    m_background.shrink_to_fit();
+    m_pending.clear();
+    m_pending.shrink_to_fit();
+    m_framePixels.clear();
+    m_framePixels.shrink_to_fit();
+    m_indices.clear();
+    m_indices.shrink_to_fit();
+    return succeeded;
+}
+
+bool GifEncoder::Write(const void* data, size_t size)
+{
+    if (m_failed || fwrite(data, 1, size, m_file) != size)
+    {
+        m_failed = true;
+        return false;
+    }
+    m_position += size;
+    return true;
+}
+
+bool GifEncoder::Write16(unsigned int value)
+{
+    uint8_t bytes[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+    return Write(bytes, sizeof(bytes));
+}
+
+bool GifEncoder::AddFrame(const uint8_t* pixels, size_t stride, unsigned int delayMs)
+{
+    if (m_file == nullptr || m_failed)
+        return false;
+
+    size_t rowBytes = static_cast<size_t>(m_width) * 4;
+    if (m_hasPending)
+    {
+        bool repeated = true;
+        for (unsigned int y = 0; y < m_height && repeated; ++y)
+        {
+            repeated = memcmp(pixels + y * stride, &m_pending[y * rowBytes], rowBytes) == 0;
+        }
+        if (repeated)
+        {
+            m_pendingDelay += delayMs;
+            return true;
+        }
+        if (!WritePending(pixels, stride))
+            return false;
+    }
+
+    for (unsigned int y = 0; y < m_height; ++y)
+    {
+        memcpy(&m_pending[y * rowBytes], pixels + y * stride, rowBytes);
+    }
+    m_pendingDelay = delayMs;
+    m_hasPending = true;
+    return true;
+}
+
+bool GifEncoder::NeedsClear(const uint8_t* next, size_t stride) const
+{
+    // Pixels which become transparent cannot be drawn over the frame before
+    for (unsigned int y = 0; y < m_height; ++y)
+    {
+        const uint8_t* pending = &m_pending[static_cast<size_t>(y) * m_width * 4];
+        const uint8_t* row = next + y * stride;
+        for (unsigned int x = 0; x < m_width * 4; x += 4)
+        {
+            if (pending[x + 3] >= 128 && row[x + 3] < 128)
+                return true;
+        }
+    }
+    return false;
+}
+
+PixelRect GifEncoder::FindChangedRect() const
+{
+    size_t rowBytes = static_cast<size_t>(m_width) * 4;
+    unsigned int top = 0;
+    unsigned int bottom = m_height;
+    while (top < bottom && memcmp(&m_background[top * rowBytes], &m_pending[top * rowBytes], rowBytes) == 0)
+    {
+        ++top;
+    }
+    while (bottom > top && memcmp(&m_background[(bottom - 1) * rowBytes], &m_pending[(bottom - 1) * rowBytes], rowBytes) == 0)
+    {
+        --bottom;
+    }
+    if (top == bottom)
+        return PixelRect::Empty();
+
+    unsigned int left = m_width;
+    unsigned int right = 0;
+    for (unsigned int y = top; y < bottom; ++y)
+    {
+        const uint8_t* background = &m_background[y * rowBytes];
+        const uint8_t* pending = &m_pending[y * rowBytes];
+        for (unsigned int x = 0; x < left; ++x)
+        {
+            if (ReadPixel(background + x * 4) != ReadPixel(pending + x * 4))
+            {
+                left = x;
+                break;
+            }
+        }
+        for (unsigned int x = m_width; x > right; --x)
+        {
+            if (ReadPixel(background + (x - 1) * 4) != ReadPixel(pending + (x - 1) * 4))
+            {
+                right = x;
+                break;
+            }
+        }
+    }
+    PixelRect rect = { left, top, right, bottom };
+    return rect;
+}
+
+bool GifEncoder::WritePending(const uint8_t* next, size_t stride)
+{
+    bool clear = next != nullptr && NeedsClear(next, stride);
+    PixelRect rect = clear ? PixelRect::Make(0, 0, m_width, m_height) : FindChangedRect();
+    if (rect.isEmpty())
+    {
+        // A frame has at least one pixel
+        rect = PixelRect::Make(0, 0, 1, 1);
+    }
+    bool written = WriteFrame(rect, clear ? DM_BACKGROUND : DM_NONE);
+
+    // The image the next frame is drawn on
+    if (clear)
+    {
+        std::fill(m_background.begin(), m_background.end(), 0);
+    }
+    else
+    {
+        m_background.swap(m_pending);
+    }
+    m_hasPending = false;
+    return written;
+}
+
+bool GifEncoder::WriteFrame(const PixelRect& rect, DISPOSAL_METHODS disposal)
+{
+    unsigned int width = rect.getWidth();
+    unsigned int height = rect.getHeight();
+    size_t count = static_cast<size_t>(width) * height;
+    m_framePixels.resize(count * 4);
+    m_indices.resize(count);
+
+    // The pixels which did not change show the frame before through the
+    // transparent color
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        size_t offset = ((static_cast<size_t>(rect.top) + y) * m_width + rect.left) * 4;
+        const uint8_t* background = &m_background[offset];
+        const uint8_t* pending = &m_pending[offset];
+        uint8_t* frame = &m_framePixels[static_cast<size_t>(y) * width * 4];
+        for (unsigned int x = 0; x < width * 4; x += 4)
+        {
+            uint32_t pixel = ReadPixel(pending + x);
+            pixel = pixel == ReadPixel(background + x) ? 0 : pixel;
+            memcpy(frame + x, &pixel, sizeof(pixel));
+        }
+    }
+
+    // The last index is transparent
+    m_quantizer.Reset();
+    m_quantizer.AddPixels(m_framePixels.data(), count);
+    unsigned int colorCount = m_quantizer.BuildPalette(PaletteQuantizer::MAX_COLORS - 1);
+    uint8_t transparentIndex = static_cast<uint8_t>(colorCount);
+    unsigned int tableBits = 1;
+    while ((1u << tableBits) < colorCount + 1)
+    {
+        ++tableBits;
+    }
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        m_quantizer.MapRow(
+            &m_framePixels[static_cast<size_t>(y) * width * 4],
+            &m_indices[static_cast<size_t>(y) * width],
+            width,
+            rect.left,
+            rect.top + y,
+            transparentIndex,
+            m_dither);
+    }
+
+    unsigned int delay = (m_pendingDelay + 5) / 10;
+    uint8_t control[4] =
+    {
+        0x21, 0xF9, 4, static_cast<uint8_t>((disposal << 2) | 1)
+    };
+    Write(control, sizeof(control));
+    Write16(delay > MAX_DELAY ? MAX_DELAY : delay);
+    uint8_t controlEnd[2] = { transparentIndex, 0 };
+    Write(controlEnd, sizeof(controlEnd));
+
+    static const uint8_t separator = 0x2C;
+    Write(&separator, 1);
+    Write16(rect.left);
+    Write16(rect.top);
+    Write16(width);
+    Write16(height);
+    uint8_t flags = static_cast<uint8_t>(0x80 | (tableBits - 1));   // Local color table
+    Write(&flags, 1);
+
+    uint8_t table[PaletteQuantizer::MAX_COLORS * 3] = {};
+    memcpy(table, m_quantizer.getPalette(), colorCount * 3);
+    Write(table, static_cast<size_t>(3) << tableBits);
+
+    bool written = WriteImageData(count, tableBits < 2 ? 2 : tableBits);
+    if (written)
+    {
+        ++m_frameCount;
+    }
+    return written;
+}
+
+void GifEncoder::PutCode(unsigned int code, unsigned int codeSize)
+{
+    m_bitBuffer |= code << m_bitCount;
+    m_bitCount += codeSize;
+    while (m_bitCount >= 8)
+    {
+        m_block[m_blockSize++] = static_cast<uint8_t>(m_bitBuffer);
+        m_bitBuffer >>= 8;
+        m_bitCount -= 8;
+        if (m_blockSize == 255)
+        {
+            FlushBlock();
+        }
+    }
+}
+
+void GifEncoder::FlushBlock()
+{
+    if (m_blockSize > 0)
+    {
+        uint8_t size = static_cast<uint8_t>(m_blockSize);
+        Write(&size, 1);
+        Write(m_block, m_blockSize);
+        m_blockSize = 0;
+    }
+}
+
+bool GifEncoder::WriteImageData(size_t count, unsigned int minCodeSize)
+{
+    uint8_t codeSizeByte = static_cast<uint8_t>(minCodeSize);
+    Write(&codeSizeByte, 1);
+
+    const unsigned int clearCode = 1u << minCodeSize;
+    const unsigned int endCode = clearCode + 1;
+    unsigned int nextCode = clearCode + 2;
+    unsigned int codeSize = minCodeSize + 1;
+    std::fill(m_hashKeys.begin(), m_hashKeys.end(), 0);
+    m_bitBuffer = 0;
+    m_bitCount = 0;
+    m_blockSize = 0;
+    PutCode(clearCode, codeSize);
+
+    // The decoder adds a string one code later than the encoder, so the
+    // code size grows one code later too
+    unsigned int prefix = m_indices[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        unsigned int byte = m_indices[i];
+        uint32_t key = ((prefix << 8) | byte) + 1;
+        uint32_t slot = (key * 2654435761u) >> 19;
+        while (m_hashKeys[slot] != 0 && m_hashKeys[slot] != key)
+        {
+            slot = (slot + 1) & (HASH_SIZE - 1);
+        }
+        if (m_hashKeys[slot] == key)
+        {
+            prefix = m_hashCodes[slot];
+            continue;
+        }
+
+        if (nextCode > (1u << codeSize) && codeSize < 12)
+        {
+            ++codeSize;
+        }
+        PutCode(prefix, codeSize);
+        if (nextCode < MAX_CODES)
+        {
+            m_hashKeys[slot] = key;
+            m_hashCodes[slot] = static_cast<uint16_t>(nextCode++);
+        }
+        else
+        {
+            // The table is full, the strings start over
+            PutCode(clearCode, codeSize);
+            std::fill(m_hashKeys.begin(), m_hashKeys.end(), 0);
+            nextCode = clearCode + 2;
+            codeSize = minCodeSize + 1;
+        }
+        prefix = byte;
+    }
+    if (nextCode > (1u << codeSize) && codeSize < 12)
+    {
+        ++codeSize;
+    }
+    PutCode(prefix, codeSize);
+
+    // No string is added for the last code
+    if (nextCode >= (1u << codeSize) && codeSize < 12)
+    {
+        ++codeSize;
+    }
+    PutCode(endCode, codeSize);
+    if (m_bitCount > 0)
+    {
+        m_block[m_blockSize++] = static_cast<uint8_t>(m_bitBuffer);
+        m_bitCount = 0;
+        m_bitBuffer = 0;
+    }
+    FlushBlock();
+
+    static const uint8_t terminator = 0;
+    return Write(&terminator, 1);
+}
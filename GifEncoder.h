@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "FrameCompositor.h"
+#include "PaletteQuantizer.h"
+
+// Writes an animated GIF of composed frames, 32bpp premultiplied BGRA of the
+// size of the image, one frame at a time. Each frame gets a palette of its
+// own from the PaletteQuantizer. Only the rectangle which changed since the
+// frame before is written, with the pixels which did not change transparent,
+// and a frame which repeats the one before extends its delay instead. A
+// frame is written when the next one is known, because pixels which become
+// transparent need the frame before to be disposed to the background.
+class GifEncoder
+{
+public:
+    explicit GifEncoder(CPU_KERNELS kernels = PixelConverter::getBestKernels());
+    ~GifEncoder();
+
+    // A loop count of 0 repeats the animation forever
+#ifdef _WIN32
+    bool Open(const wchar_t* filename, unsigned int width, unsigned int height, unsigned int loopCount);
+#else
+    bool Open(const char* filename, unsigned int width, unsigned int height, unsigned int loopCount);
+#endif
+
+    // Ordered dithering of the frames added after the call
+    void SetDithering(bool dither) { m_dither = dither; }
+
+    bool AddFrame(const uint8_t* pixels, size_t stride, unsigned int delayMs);
+
+    // Writes the last frame and finishes the file. Returns false if any
+    // frame could not be written.
+    bool Close();
+
+    // Frames written, without the repeated ones
+    unsigned int getFrameCount() const { return m_frameCount; }
+    uint64_t     getSize()       const { return m_position; }
+
+private:
+    GifEncoder(const GifEncoder&) = delete;
+    GifEncoder& operator=(const GifEncoder&) = delete;
+
+    bool Start(unsigned int width, unsigned int height, unsigned int loopCount);
+    bool WritePending(const uint8_t* next, size_t stride);
+    bool WriteFrame(const PixelRect& rect, DISPOSAL_METHODS disposal);
+    bool WriteImageData(size_t count, unsigned int minCodeSize);
+    PixelRect FindChangedRect() const;
+    bool NeedsClear(const uint8_t* next, size_t stride) const;
+
+    bool Write(const void* data, size_t size);
+    bool Write16(unsigned int value);
+    void PutCode(unsigned int code, unsigned int codeSize);
+    void FlushBlock();
+
+    static const unsigned int MAX_CODES = 4096;
+    static const unsigned int HASH_SIZE = 8192;     // Open addressing table of the LZW strings
+
+    FILE*                 m_file;
+    uint64_t              m_position;
+    bool                  m_failed;
+    bool                  m_dither;
+    unsigned int          m_width;
+    unsigned int          m_height;
+    unsigned int          m_frameCount;
+
+    std::vector<uint8_t>  m_background;     // The image the pending frame is drawn on
+    std::vector<uint8_t>  m_pending;        // The frame written when the next one is known
+    unsigned int          m_pendingDelay;   // In ms, including repeated frames
+    bool                  m_hasPending;
+
+    PaletteQuantizer      m_quantizer;
+    std::vector<uint8_t>  m_framePixels;    // The changed rectangle, unchanged pixels transparent
+    std::vector<uint8_t>  m_indices;
+
+    std::vector<uint32_t> m_hashKeys;       // Prefix code and byte, plus 1 so 0 is free
+    std::vector<uint16_t> m_hashCodes;
+    uint32_t              m_bitBuffer;
+    unsigned int          m_bitCount;
+    uint8_t               m_block[256];
+    unsigned int          m_blockSize;
+};
@@ -1,5 +1,6 @@
 #include "ImageInfo.h"
 #include "ComPtr.h"
+#include "GifDecoder.h"
 #include "ImagingFactorySingleton.h"
 
 ImageInfo::ImageInfo()
@@ -108,34 +109,7 @@ HRESULT ImageInfo::GetGlobalMetadata(IWICBitmapDecoder* decoder)
             hr = (propValue.vt == VT_UI1 ? S_OK : E_FAIL);
             if (SUCCEEDED(hr))
             {
-                UINT uPixelAspRatio = propValue.bVal;
-
-                if (uPixelAspRatio != 0)
-                {
-                    // Need to calculate the ratio. The value in uPixelAspRatio 
-                    // allows specifying widest pixel 4:1 to the tallest pixel of 
-                    // 1:4 in increments of 1/64th
-                    float pixelAspRatio = (uPixelAspRatio + 15.f) / 64.f;
-
-                    // Calculate the image width and height in pixel based on the
-                    // pixel aspect ratio. Only shrink the image.
-                    if (pixelAspRatio > 1.f)
-                    {
-                        m_imageWidthPixel = m_imageWidth;
-                        m_imageHeightPixel = static_cast<unsigned int>(m_imageHeight / pixelAspRatio);
-                    }
-                    else
-                    {
-                        m_imageWidthPixel = static_cast<unsigned int>(m_imageWidth * pixelAspRatio);
-                        m_imageHeightPixel = m_imageHeight;
-                    }
-                }
-                else
-                {
-                    // The value is 0, so its ratio is 1
-                    m_imageWidthPixel = m_imageWidth;
-                    m_imageHeightPixel = m_imageHeight;
-                }
+                SetPixelAspectRatio(propValue.bVal);
             }
             PropVariantClear(&propValue);
         }
@@ -191,6 +165,68 @@ HRESULT ImageInfo::GetGlobalMetadata(IWICBitmapDecoder* decoder)
     return hr;
 }
 
+void ImageInfo::SetPageMetadata(unsigned int width, unsigned int height, unsigned int pageCount)
+{
+    Reset();
+    m_frameCount = pageCount;
+    m_imageWidth = width;
+    m_imageHeight = height;
+    m_imageWidthPixel = width;
+    m_imageHeightPixel = height;
+}
+
+void ImageInfo::SetGifMetadata(const GifDecoder& decoder)
+{
+    Reset();
+    m_frameCount = decoder.getFrameCount();
+    m_imageWidth = decoder.getWidth();
+    m_imageHeight = decoder.getHeight();
+    SetPixelAspectRatio(decoder.getPixelAspectRatio());
+
+    // Without a loop count the animation loops infinitely
+    m_totalLoopCount = decoder.getLoopCount();
+    m_hasLoop = decoder.hasLoop();
+
+    // The background color is only valid with a global palette
+    unsigned int colorCount = 0;
+    const uint8_t* palette = decoder.getGlobalPalette(colorCount);
+    if (palette && decoder.getBackgroundIndex() < colorCount)
+    {
+        const uint8_t* color = palette + decoder.getBackgroundIndex() * 3;
+        m_backgroundColor = D2D1::ColorF((color[0] << 16) | (color[1] << 8) | color[2], 1.f);
+    }
+}
+
+void ImageInfo::SetPixelAspectRatio(unsigned int uPixelAspRatio)
+{
+    if (uPixelAspRatio != 0)
+    {
+        // Need to calculate the ratio. The value in uPixelAspRatio 
+        // allows specifying widest pixel 4:1 to the tallest pixel of 
+        // 1:4 in increments of 1/64th
+        float pixelAspRatio = (uPixelAspRatio + 15.f) / 64.f;
+
+        // Calculate the image width and height in pixel based on the
+        // pixel aspect ratio. Only shrink the image.
+        if (pixelAspRatio > 1.f)
+        {
+            m_imageWidthPixel = m_imageWidth;
+            m_imageHeightPixel = static_cast<unsigned int>(m_imageHeight / pixelAspRatio);
+        }
+        else
+        {
+            m_imageWidthPixel = static_cast<unsigned int>(m_imageWidth * pixelAspRatio);
+            m_imageHeightPixel = m_imageHeight;
+        }
+    }
+    else
+    {
+        // The value is 0, so its ratio is 1
+        m_imageWidthPixel = m_imageWidth;
+        m_imageHeightPixel = m_imageHeight;
+    }
+}
+
 void ImageInfo::Reset()
 {
     m_totalLoopCount = 0;
@@ -1,7 +1,22 @@
 #pragma once
 #include <wincodec.h>
 #include <d2d1.h>
+#include "FrameCompositor.h"
 
+class GifDecoder;
+
+// Converts a color to the premultiplied BGRA used by the FrameCompositor
+inline uint32_t ToCanvasColor(const D2D1_COLOR_F& color)
+{
+    auto toByte = [](float value) -> uint32_t
+    {
+        return value <= 0.f ? 0 : value >= 1.f ? 255 : static_cast<uint32_t>(value * 255.f + 0.5f);
+    };
+    return (toByte(color.a) << 24) |
+        (toByte(color.r * color.a) << 16) |
+        (toByte(color.g * color.a) << 8) |
+        toByte(color.b * color.a);
+}
 
 class ImageInfo {
 public:
@@ -9,6 +24,14 @@ public:
     HRESULT GetDefaultMetadata(IWICBitmapDecoder* decoder);
     HRESULT GetGlobalMetadata(IWICBitmapDecoder* decoder);
 
+    // Sets the metadata of a file with pages and without animation metadata,
+    // which was read by a decoder other than WIC
+    void SetPageMetadata(unsigned int width, unsigned int height, unsigned int pageCount);
+
+    // Sets the metadata of a GIF read by the GifDecoder, like
+    // GetGlobalMetadata without metadata queries
+    void SetGifMetadata(const GifDecoder& decoder);
+
     void Reset();
 
     // The number of loops for which the animation will be played
@@ -30,6 +53,7 @@ public:
     D2D1_COLOR_F	 getBackgroundColor()  const { return m_backgroundColor; }
 private:
     HRESULT GetBackgroundColor(IWICBitmapDecoder* decoder, IWICMetadataQueryReader *pMetadataQueryReader);
+    void SetPixelAspectRatio(unsigned int uPixelAspRatio);
 public:
     unsigned int     m_totalLoopCount;
     bool             m_hasLoop;
@@ -0,0 +1,38 @@
+#include "LatencyStats.h"
+#include <algorithm>
+
+LatencyStats::LatencyStats(size_t maxSamples) :
+    m_samples(maxSamples > 0 ? maxSamples : 1),
+    m_next(0),
+    m_count(0)
+{
+}
+
+void LatencyStats::Add(double latency)
+{
+    m_samples[m_next] = latency;
+    m_next = (m_next + 1) % m_samples.size();
+    ++m_count;
+}
+
+void LatencyStats::Reset()
+{
+    m_next = 0;
+    m_count = 0;
+}
+
+double LatencyStats::getPercentile(double fraction) const
+{
+    size_t kept = std::min(m_count, m_samples.size());
+    if (kept == 0)
+        return 0;
+
+    std::vector<double> sorted(m_samples.begin(), m_samples.begin() + kept);
+    size_t rank = static_cast<size_t>(fraction * (kept - 1) + 0.5);
+    if (rank >= kept)
+    {
+        rank = kept - 1;
+    }
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Collects the most recent latency samples in ms and reports percentiles
+class LatencyStats
+{
+public:
+    explicit LatencyStats(size_t maxSamples = 4096);
+
+    void   Add(double latency);
+    void   Reset();
+
+    size_t getCount() const { return m_count; }
+
+    // Returns the latency below which the given fraction (0 to 1) of the
+    // kept samples lie, or 0 if there are no samples
+    double getPercentile(double fraction) const;
+
+private:
+    std::vector<double> m_samples;
+    size_t              m_next;
+    size_t              m_count;
+};
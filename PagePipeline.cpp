@@ -0,0 +1,113 @@
+#include "PagePipeline.h"
+
+PagePipeline::PagePipeline(unsigned int slotCount) :
+    m_slotCount(slotCount > 0 ? slotCount : 1),
+    m_pageCount(0),
+    m_encodedCount(0),
+    m_peakSlotCount(0),
+    m_cancelled(false),
+    m_failed(false),
+    m_stop(false)
+{
+}
+
+void PagePipeline::Reset(unsigned int pageCount)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pageCount = pageCount;
+    m_encodedCount = 0;
+    m_peakSlotCount = 0;
+    m_cancelled = false;
+    m_failed = false;
+    m_stop = false;
+    m_decodedSlots.clear();
+    m_freeSlots.clear();
+    for (unsigned int i = 0; i < m_slotCount; ++i)
+    {
+        m_freeSlots.push_back(i);
+    }
+}
+
+void PagePipeline::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled = true;
+        m_stop = true;
+    }
+    m_changed.notify_all();
+}
+
+void PagePipeline::Fail()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = true;
+        m_stop = true;
+    }
+    m_changed.notify_all();
+}
+
+bool PagePipeline::Decode(const Stage& decode)
+{
+    for (unsigned int pageIndex = 0; pageIndex < m_pageCount; ++pageIndex)
+    {
+        unsigned int slot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_stop || !m_freeSlots.empty(); });
+            if (m_stop)
+                return false;
+            slot = m_freeSlots.front();
+            m_freeSlots.pop_front();
+            unsigned int heldSlots = m_slotCount - static_cast<unsigned int>(m_freeSlots.size());
+            if (heldSlots > m_peakSlotCount)
+            {
+                m_peakSlotCount = heldSlots;
+            }
+        }
+
+        if (!decode(pageIndex, slot))
+        {
+            Fail();
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_decodedSlots.push_back(slot);
+        }
+        m_changed.notify_all();
+    }
+    return true;
+}
+
+bool PagePipeline::Encode(const Stage& encode)
+{
+    for (unsigned int pageIndex = 0; pageIndex < m_pageCount; ++pageIndex)
+    {
+        unsigned int slot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_stop || !m_decodedSlots.empty(); });
+            if (m_stop)
+                return false;
+            slot = m_decodedSlots.front();
+            m_decodedSlots.pop_front();
+        }
+
+        if (!encode(pageIndex, slot))
+        {
+            Fail();
+            return false;
+        }
+        ++m_encodedCount;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_freeSlots.push_back(slot);
+        }
+        m_changed.notify_all();
+    }
+    return true;
+}
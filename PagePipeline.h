@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+// Passes the pages of a file from a decoding thread to an encoding thread
+// through a fixed number of slots, so that the next page is decoded while a
+// page is encoded, and memory does not grow with the number of pages. The
+// owner keeps the pages in its own array of slots and the pipeline only
+// hands out the slot indices. Pages are encoded in order.
+class PagePipeline
+{
+public:
+    // Fills or consumes a slot for the page. Returns false to stop both
+    // threads.
+    typedef std::function<bool(unsigned int pageIndex, unsigned int slot)> Stage;
+
+    explicit PagePipeline(unsigned int slotCount);
+
+    // Prepares a run over the pages. Not to be called while the threads run.
+    void Reset(unsigned int pageCount);
+
+    // Run on the decoding thread and the encoding thread. Return true if all
+    // pages passed the stage.
+    bool Decode(const Stage& decode);
+    bool Encode(const Stage& encode);
+
+    // Stops both threads after the pages they are working on. Can be called
+    // from any thread.
+    void Cancel();
+
+    bool         isCancelled()       const { return m_cancelled; }
+    bool         hasFailed()         const { return m_failed; }
+    unsigned int getPageCount()      const { return m_pageCount; }
+    unsigned int getEncodedCount()   const { return m_encodedCount; }
+    unsigned int getSlotCount()      const { return m_slotCount; }
+
+    // Most slots held by the two threads at once since the reset, which
+    // never exceeds the slot count however many pages there are
+    unsigned int getPeakSlotCount()  const { return m_peakSlotCount; }
+
+private:
+    PagePipeline(const PagePipeline&) = delete;
+    PagePipeline& operator=(const PagePipeline&) = delete;
+
+    void Fail();
+
+    unsigned int              m_slotCount;
+    unsigned int              m_pageCount;
+    std::atomic<unsigned int> m_encodedCount;
+    std::atomic<unsigned int> m_peakSlotCount;
+    std::atomic<bool>         m_cancelled;
+    std::atomic<bool>         m_failed;
+
+    std::mutex                m_mutex;          // Protects the members below
+    std::condition_variable   m_changed;        // Signals slots, failures and cancel to both threads
+    std::deque<unsigned int>  m_freeSlots;
+    std::deque<unsigned int>  m_decodedSlots;   // In page order
+    bool                      m_stop;
+};
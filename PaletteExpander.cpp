@@ -0,0 +1,198 @@
+#include "PaletteExpander.h"
+#include <cstring>
+#include "PixelConverterKernels.h"
+
+#ifdef PIXEL_CONVERTER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline unsigned int CountBits(unsigned int value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+inline uint32_t PremultiplyColor(uint32_t color)
+{
+    unsigned int alpha = color >> 24;
+    if (alpha == 255)
+        return color;
+    return (alpha << 24) |
+        (Premultiply((color >> 16) & 0xFF, alpha) << 16) |
+        (Premultiply((color >> 8) & 0xFF, alpha) << 8) |
+        Premultiply(color & 0xFF, alpha);
+}
+
+void LookupScalar(const uint32_t* table, const uint8_t* indices, uint8_t* destination, size_t width)
+{
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        uint32_t pixels[4] = { table[indices[x]], table[indices[x + 1]], table[indices[x + 2]], table[indices[x + 3]] };
+        memcpy(destination + x * 4, pixels, sizeof(pixels));
+    }
+    for (; x < width; ++x)
+    {
+        memcpy(destination + x * 4, &table[indices[x]], 4);
+    }
+}
+
+#ifdef PIXEL_CONVERTER_X86
+TARGET_AVX2 void LookupAvx2(const uint32_t* table, const uint8_t* indices, uint8_t* destination, size_t width)
+{
+    const int* base = reinterpret_cast<const int*>(table);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + x)));
+        __m256i pixels = _mm256_i32gather_epi32(base, index, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x * 4), pixels);
+    }
+    LookupScalar(table, indices + x, destination + x * 4, width - x);
+}
+
+// Marks the pixels which do not have the transparent index, 16 at a time
+TARGET_SSE2 size_t CoverSse2(const uint8_t* indices, uint8_t* coverage, size_t width, uint8_t transparentIndex)
+{
+    const __m128i transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xFF));
+    size_t hidden = 0;
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i isTransparent = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + x)), transparent);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(coverage + x), _mm_xor_si128(isTransparent, ones));
+        hidden += CountBits(static_cast<unsigned int>(_mm_movemask_epi8(isTransparent)));
+    }
+    for (; x < width; ++x)
+    {
+        bool isTransparent = indices[x] == transparentIndex;
+        coverage[x] = isTransparent ? 0 : 0xFF;
+        hidden += isTransparent ? 1 : 0;
+    }
+    return width - hidden;
+}
+#endif
+
+size_t CoverScalar(const uint8_t* indices, uint8_t* coverage, size_t width, uint8_t transparentIndex)
+{
+    size_t visible = 0;
+    for (size_t x = 0; x < width; ++x)
+    {
+        bool isVisible = indices[x] != transparentIndex;
+        coverage[x] = isVisible ? 0xFF : 0;
+        visible += isVisible ? 1 : 0;
+    }
+    return visible;
+}
+
+}
+
+PaletteExpander::PaletteExpander() :
+    m_transparentIndex(MULTIPLE_TRANSPARENT)
+{
+    memset(m_table, 0, sizeof(m_table));
+}
+
+void PaletteExpander::SetPalette(const uint32_t* colors, unsigned int colorCount)
+{
+    if (colorCount > 256)
+        colorCount = 256;
+    for (unsigned int i = 0; i < colorCount; ++i)
+    {
+        m_table[i] = PremultiplyColor(colors[i]);
+    }
+    memset(m_table + colorCount, 0, (256 - colorCount) * sizeof(uint32_t));
+    UpdateTransparency(colorCount);
+}
+
+void PaletteExpander::SetPalette(const uint8_t* rgb, unsigned int colorCount, int transparentIndex)
+{
+    if (colorCount > 256)
+        colorCount = 256;
+    for (unsigned int i = 0; i < colorCount; ++i, rgb += 3)
+    {
+        m_table[i] = 0xFF000000u | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+    }
+    memset(m_table + colorCount, 0, (256 - colorCount) * sizeof(uint32_t));
+    if (transparentIndex >= 0 && transparentIndex < 256)
+    {
+        m_table[transparentIndex] = 0;
+    }
+    UpdateTransparency(colorCount);
+}
+
+void PaletteExpander::UpdateTransparency(unsigned int colorCount)
+{
+    // The entries past the palette are 0 as well, but valid images do not
+    // use them and they blend as a no-op, so they do not count as
+    // transparent colors. Otherwise every short palette would be tested by
+    // alpha.
+    m_transparentIndex = NO_TRANSPARENCY;
+    for (int i = 0; i < static_cast<int>(colorCount); ++i)
+    {
+        if ((m_table[i] >> 24) == 0)
+        {
+            if (m_transparentIndex != NO_TRANSPARENCY)
+            {
+                m_transparentIndex = MULTIPLE_TRANSPARENT;
+                return;
+            }
+            m_transparentIndex = i;
+        }
+    }
+}
+
+size_t PaletteExpander::ExpandRow(
+    const uint8_t* indices,
+    uint8_t* destination,
+    uint8_t* coverage,
+    size_t width,
+    CPU_KERNELS kernels) const
+{
+    // A gather only pays off with AVX2, the other instruction sets read the
+    // table one pixel at a time
+#ifdef PIXEL_CONVERTER_X86
+    if (kernels == CK_AVX2)
+        LookupAvx2(m_table, indices, destination, width);
+    else
+#endif
+        LookupScalar(m_table, indices, destination, width);
+
+    if (coverage == nullptr)
+        return width;
+
+    if (m_transparentIndex == NO_TRANSPARENCY)
+    {
+        memset(coverage, 0xFF, width);
+        return width;
+    }
+
+    if (m_transparentIndex == MULTIPLE_TRANSPARENT)
+    {
+        // Palettes with several transparent colors are tested by alpha
+        size_t visible = 0;
+        for (size_t x = 0; x < width; ++x)
+        {
+            bool isVisible = (m_table[indices[x]] >> 24) != 0;
+            coverage[x] = isVisible ? 0xFF : 0;
+            visible += isVisible ? 1 : 0;
+        }
+        return visible;
+    }
+
+    uint8_t transparentIndex = static_cast<uint8_t>(m_transparentIndex);
+    switch (kernels)
+    {
+#ifdef PIXEL_CONVERTER_X86
+    case CK_SSE2:
+    case CK_AVX2:
+        return CoverSse2(indices, coverage, width, transparentIndex);
+#endif
+    default:
+        return CoverScalar(indices, coverage, width, transparentIndex);
+    }
+}
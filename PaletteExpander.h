@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "PixelConverter.h"
+
+// Expands 8bpp palette indices to 32bpp premultiplied BGRA through a lookup
+// table, which is built once per palette. Together with the colors it can
+// write a coverage mask, so that fully transparent pixels can be skipped
+// when the frame is composed.
+class PaletteExpander
+{
+public:
+    PaletteExpander();
+
+    // Sets a palette of colors in 0xAARRGGBB format with straight alpha,
+    // like WICColor. Missing entries are transparent black, but only the
+    // transparent colors of the palette get a coverage of 0.
+    void SetPalette(const uint32_t* colors, unsigned int colorCount);
+
+    // Sets a palette of RGB triples, like the palettes of a GIF, and the
+    // transparent index or -1 if there is none
+    void SetPalette(const uint8_t* rgb, unsigned int colorCount, int transparentIndex);
+
+    // The premultiplied BGRA colors of all 256 indices
+    const uint32_t* getTable() const { return m_table; }
+    bool            hasTransparency() const { return m_transparentIndex != NO_TRANSPARENCY; }
+
+    // The only fully transparent index, which the kernels compare to write
+    // the coverage, or -1 if there is none or several
+    int             getTransparentIndex() const { return m_transparentIndex >= 0 ? m_transparentIndex : -1; }
+
+    // Expands width indices. If coverage is not nullptr, it receives 0xFF for
+    // each pixel with a visible color and 0 for each fully transparent pixel.
+    // Returns the number of visible pixels.
+    size_t ExpandRow(
+        const uint8_t* indices,
+        uint8_t* destination,
+        uint8_t* coverage,
+        size_t width,
+        CPU_KERNELS kernels = PixelConverter::getBestKernels()) const;
+
+private:
+    void UpdateTransparency(unsigned int colorCount);
+
+    static const int NO_TRANSPARENCY = -1;
+    static const int MULTIPLE_TRANSPARENT = -2;
+
+    uint32_t m_table[256];
+    int      m_transparentIndex;    // The only fully transparent index, or one of the values above
+};
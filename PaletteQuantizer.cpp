@@ -0,0 +1,380 @@
+#include "PaletteQuantizer.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+const uint32_t INVALID_COLOR = 0xFFFFFFFF;  // Not a 24 bit color
+const int DITHER_SPREAD = 32;               // Range of the threshold pattern, about the distance of the colors of a full palette
+
+// Thresholds 0 to 63 of the ordered dithering
+const uint8_t BAYER[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+unsigned int FindNearestScalar(const PalettePlanes& palette, int red, int green, int blue)
+{
+    int32_t best = INT_MAX;
+    for (unsigned int i = 0; i < palette.count; ++i)
+    {
+        int dr = palette.red[i] - red;
+        int dg = palette.green[i] - green;
+        int db = palette.blue[i] - blue;
+        int32_t key = MakeNearestKey(dr * dr + dg * dg + db * db, i);
+        best = key < best ? key : best;
+    }
+    return SelectNearest(&best, 1);
+}
+
+FindNearestFunction GetFindNearest(CPU_KERNELS kernels)
+{
+    FindNearestFunction findNearest = nullptr;
+    switch (kernels)
+    {
+    case CK_SSE2: findNearest = GetSse2FindNearest(); break;
+    case CK_AVX2: findNearest = GetAvx2FindNearest(); break;
+    default:      break;
+    }
+    return findNearest ? findNearest : FindNearestScalar;
+}
+
+// Reads the straight color of a premultiplied pixel. Returns false if the
+// pixel is transparent.
+inline bool ReadColor(const uint8_t* pixel, unsigned int& red, unsigned int& green, unsigned int& blue)
+{
+    unsigned int alpha = pixel[3];
+    if (alpha < 128)
+        return false;
+    blue = pixel[0];
+    green = pixel[1];
+    red = pixel[2];
+    if (alpha < 255)
+    {
+        blue = std::min(255u, (blue * 255 + alpha / 2) / alpha);
+        green = std::min(255u, (green * 255 + alpha / 2) / alpha);
+        red = std::min(255u, (red * 255 + alpha / 2) / alpha);
+    }
+    return true;
+}
+
+inline unsigned int Dither(unsigned int value, int offset)
+{
+    int dithered = static_cast<int>(value) + offset;
+    return dithered < 0 ? 0 : dithered > 255 ? 255 : static_cast<unsigned int>(dithered);
+}
+
+}
+
+FindNearestFunction GetScalarFindNearest()
+{
+    return FindNearestScalar;
+}
+
+PaletteQuantizer::PaletteQuantizer(CPU_KERNELS kernels) :
+    m_findNearest(GetFindNearest(kernels)),
+    m_leafCount(0),
+    m_leafLevel(OCTREE_DEPTH),
+    m_lastColor(INVALID_COLOR),
+    m_lastLeaf(0),
+    m_colorCount(0),
+    m_cacheColors(CACHE_SIZE, INVALID_COLOR),
+    m_cacheIndices(CACHE_SIZE, 0)
+{
+    memset(m_palette, 0, sizeof(m_palette));
+    m_planes.count = 0;
+    Reset();
+}
+
+void PaletteQuantizer::Reset()
+{
+    m_nodes.clear();
+    m_freeNodes.clear();
+    for (auto& nodes : m_reducible)
+    {
+        nodes.clear();
+    }
+    m_leafCount = 0;
+    m_leafLevel = OCTREE_DEPTH;
+    m_lastColor = INVALID_COLOR;
+    AddNode(0);
+}
+
+uint32_t PaletteQuantizer::AddNode(unsigned int level)
+{
+    // The children of reduced nodes are reused
+    uint32_t index;
+    if (!m_freeNodes.empty())
+    {
+        index = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+    Node& node = m_nodes[index];
+    memset(&node, 0, sizeof(node));
+    node.leaf = level >= m_leafLevel;
+    if (node.leaf)
+    {
+        ++m_leafCount;
+    }
+    return index;
+}
+
+void PaletteQuantizer::AddColor(unsigned int red, unsigned int green, unsigned int blue)
+{
+    uint32_t color = (red << 16) | (green << 8) | blue;
+    uint32_t index = m_lastLeaf;
+    if (color != m_lastColor)
+    {
+        // Each level takes the next bit of the channels
+        index = 0;
+        for (unsigned int level = 0; !m_nodes[index].leaf; ++level)
+        {
+            unsigned int shift = 7 - level;
+            unsigned int child = (((red >> shift) & 1) << 2) | (((green >> shift) & 1) << 1) | ((blue >> shift) & 1);
+            uint32_t next = m_nodes[index].children[child];
+            if (next == 0)
+            {
+                next = AddNode(level + 1);
+                if (m_nodes[index].childCount++ == 0)
+                {
+                    m_reducible[level].push_back(index);
+                }
+                m_nodes[index].children[child] = next;
+            }
+            index = next;
+        }
+        m_lastColor = color;
+        m_lastLeaf = index;
+    }
+
+    Node& leaf = m_nodes[index];
+    leaf.red += red;
+    leaf.green += green;
+    leaf.blue += blue;
+    ++leaf.count;
+
+    if (m_leafCount > MAX_LEAVES)
+    {
+        ReduceNode();
+        m_lastColor = INVALID_COLOR;
+    }
+}
+
+void PaletteQuantizer::ReduceNode()
+{
+    // The children of the deepest nodes with children are leaves
+    unsigned int level = OCTREE_DEPTH;
+    while (level > 0 && m_reducible[level - 1].empty())
+    {
+        --level;
+    }
+    if (level == 0)
+        return;
+
+    uint32_t index = m_reducible[level - 1].back();
+    m_reducible[level - 1].pop_back();
+    Node& node = m_nodes[index];
+    for (auto& child : node.children)
+    {
+        if (child != 0)
+        {
+            const Node& leaf = m_nodes[child];
+            node.red += leaf.red;
+            node.green += leaf.green;
+            node.blue += leaf.blue;
+            node.count += leaf.count;
+            m_freeNodes.push_back(child);
+            child = 0;
+        }
+    }
+    m_leafCount -= node.childCount - 1;
+    node.childCount = 0;
+    node.leaf = true;
+
+    // Colors added later stop at the level of the reduced nodes instead of
+    // growing branches which would be reduced right away
+    m_leafLevel = std::min(m_leafLevel, level - 1);
+}
+
+void PaletteQuantizer::CollectLeaves(std::vector<Cluster>& clusters) const
+{
+    clusters.clear();
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (node.leaf)
+        {
+            if (node.count > 0)
+            {
+                Cluster cluster;
+                cluster.red = static_cast<int>((node.red + node.count / 2) / node.count);
+                cluster.green = static_cast<int>((node.green + node.count / 2) / node.count);
+                cluster.blue = static_cast<int>((node.blue + node.count / 2) / node.count);
+                cluster.count = node.count;
+                clusters.push_back(cluster);
+            }
+            continue;
+        }
+        for (uint32_t child : node.children)
+        {
+            if (child != 0)
+            {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+void PaletteQuantizer::AddPixels(const uint8_t* pixels, size_t count)
+{
+    unsigned int red, green, blue;
+    for (size_t i = 0; i < count; ++i, pixels += 4)
+    {
+        if (ReadColor(pixels, red, green, blue))
+        {
+            AddColor(red, green, blue);
+        }
+    }
+}
+
+unsigned int PaletteQuantizer::BuildPalette(unsigned int maxColors)
+{
+    maxColors = maxColors == 0 ? 1 : maxColors > MAX_COLORS ? MAX_COLORS : maxColors;
+    std::vector<Cluster> clusters;
+    CollectLeaves(clusters);
+    if (clusters.size() <= maxColors)
+    {
+        SetPalette(clusters);
+        return m_colorCount;
+    }
+
+    // The initial palette
+    while (m_leafCount > maxColors)
+    {
+        ReduceNode();
+    }
+    m_lastColor = INVALID_COLOR;
+    std::vector<Cluster> colors;
+    CollectLeaves(colors);
+    SetPalette(colors);
+
+    // Each color moves to the center of the clusters nearest to it
+    std::vector<uint64_t> sums(colors.size() * 4);
+    for (unsigned int iteration = 0; iteration < KMEANS_ITERATIONS; ++iteration)
+    {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (const auto& cluster : clusters)
+        {
+            uint64_t* sum = &sums[m_findNearest(m_planes, cluster.red, cluster.green, cluster.blue) * 4];
+            sum[0] += static_cast<uint64_t>(cluster.red) * cluster.count;
+            sum[1] += static_cast<uint64_t>(cluster.green) * cluster.count;
+            sum[2] += static_cast<uint64_t>(cluster.blue) * cluster.count;
+            sum[3] += cluster.count;
+        }
+        for (size_t i = 0; i < colors.size(); ++i)
+        {
+            const uint64_t* sum = &sums[i * 4];
+            if (sum[3] > 0)
+            {
+                colors[i].red = static_cast<int>((sum[0] + sum[3] / 2) / sum[3]);
+                colors[i].green = static_cast<int>((sum[1] + sum[3] / 2) / sum[3]);
+                colors[i].blue = static_cast<int>((sum[2] + sum[3] / 2) / sum[3]);
+            }
+        }
+        SetPalette(colors);
+    }
+    return m_colorCount;
+}
+
+void PaletteQuantizer::SetPalette(const std::vector<Cluster>& colors)
+{
+    m_colorCount = static_cast<unsigned int>(std::min<size_t>(colors.size(), MAX_COLORS));
+    for (unsigned int i = 0; i < m_colorCount; ++i)
+    {
+        m_palette[i * 3] = static_cast<uint8_t>(colors[i].red);
+        m_palette[i * 3 + 1] = static_cast<uint8_t>(colors[i].green);
+        m_palette[i * 3 + 2] = static_cast<uint8_t>(colors[i].blue);
+        m_planes.red[i] = static_cast<int16_t>(colors[i].red);
+        m_planes.green[i] = static_cast<int16_t>(colors[i].green);
+        m_planes.blue[i] = static_cast<int16_t>(colors[i].blue);
+    }
+    m_planes.count = (m_colorCount + PalettePlanes::ALIGNMENT - 1) / PalettePlanes::ALIGNMENT * PalettePlanes::ALIGNMENT;
+    for (unsigned int i = m_colorCount; i < m_planes.count; ++i)
+    {
+        m_planes.red[i] = PalettePlanes::PADDING;
+        m_planes.green[i] = PalettePlanes::PADDING;
+        m_planes.blue[i] = PalettePlanes::PADDING;
+    }
+    std::fill(m_cacheColors.begin(), m_cacheColors.end(), INVALID_COLOR);
+}
+
+uint8_t PaletteQuantizer::FindNearest(unsigned int red, unsigned int green, unsigned int blue)
+{
+    if (m_colorCount == 0)
+        return 0;
+    uint32_t color = (red << 16) | (green << 8) | blue;
+    uint32_t slot = (color * 2654435761u) >> 17;
+    if (m_cacheColors[slot] != color)
+    {
+        m_cacheColors[slot] = color;
+        m_cacheIndices[slot] = static_cast<uint8_t>(m_findNearest(m_planes, red, green, blue));
+    }
+    return m_cacheIndices[slot];
+}
+
+void PaletteQuantizer::MapRow(
+    const uint8_t* pixels,
+    uint8_t* indices,
+    size_t width,
+    unsigned int x,
+    unsigned int y,
+    uint8_t transparentIndex,
+    bool dither)
+{
+    const uint8_t* thresholds = BAYER[y & 7];
+    uint32_t previousPixel = 0;
+    uint8_t previousIndex = transparentIndex;
+    unsigned int red, green, blue;
+    for (size_t i = 0; i < width; ++i, pixels += 4)
+    {
+        // Runs of the same pixel are mapped once without dithering
+        uint32_t pixel;
+        memcpy(&pixel, pixels, sizeof(pixel));
+        if (!dither && i > 0 && pixel == previousPixel)
+        {
+            indices[i] = previousIndex;
+            continue;
+        }
+
+        if (!ReadColor(pixels, red, green, blue))
+        {
+            indices[i] = transparentIndex;
+        }
+        else if (dither)
+        {
+            int offset = (thresholds[(x + i) & 7] * 2 - 63) * DITHER_SPREAD / 128;
+            indices[i] = FindNearest(Dither(red, offset), Dither(green, offset), Dither(blue, offset));
+        }
+        else
+        {
+            indices[i] = FindNearest(red, green, blue);
+        }
+        previousPixel = pixel;
+        previousIndex = indices[i];
+    }
+}
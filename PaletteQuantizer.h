@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PaletteQuantizerKernels.h"
+#include "PixelConverter.h"
+
+// Reduces the colors of 32bpp premultiplied BGRA to a palette of at most
+// 256 colors. An octree collects the colors of the pixels added and is
+// reduced to a few thousand clusters, which are reduced further to the
+// initial palette. A few k-means iterations over the clusters then move the
+// colors of the palette to the centers of the pixels nearest to them.
+// Pixels are mapped with a nearest color search of the best x86 instruction
+// set, or the scalar search, the results are cached per color. Pixels with alpha below 128 are
+// transparent.
+class PaletteQuantizer
+{
+public:
+    static const unsigned int MAX_COLORS = 256;
+
+    explicit PaletteQuantizer(CPU_KERNELS kernels = PixelConverter::getBestKernels());
+
+    // Starts collecting the colors of a new palette
+    void Reset();
+
+    void AddPixels(const uint8_t* pixels, size_t count);
+
+    // Builds the palette from the pixels added since Reset, and returns the
+    // number of colors. If there are no more colors than maxColors, the
+    // palette has the exact colors.
+    unsigned int BuildPalette(unsigned int maxColors);
+
+    unsigned int   getColorCount() const { return m_colorCount; }
+
+    // R, G, B of each color
+    const uint8_t* getPalette()    const { return m_palette; }
+
+    // Maps width pixels to the indices of the palette and the transparent
+    // pixels to transparentIndex. Ordered dithering adds an 8x8 threshold
+    // pattern, x and y are the position of the first pixel in the image.
+    void MapRow(
+        const uint8_t* pixels,
+        uint8_t* indices,
+        size_t width,
+        unsigned int x,
+        unsigned int y,
+        uint8_t transparentIndex,
+        bool dither);
+
+private:
+    PaletteQuantizer(const PaletteQuantizer&) = delete;
+    PaletteQuantizer& operator=(const PaletteQuantizer&) = delete;
+
+    struct Node
+    {
+        uint64_t     red;
+        uint64_t     green;
+        uint64_t     blue;
+        uint32_t     count;
+        uint32_t     children[8];   // 0 if there is no child, the root has index 0
+        unsigned int childCount;
+        bool         leaf;
+    };
+
+    struct Cluster
+    {
+        int      red;
+        int      green;
+        int      blue;
+        uint32_t count;
+    };
+
+    static const unsigned int OCTREE_DEPTH = 8;
+    static const unsigned int MAX_LEAVES = 4096;        // Clusters kept for the k-means iterations
+    static const unsigned int KMEANS_ITERATIONS = 3;
+    static const unsigned int CACHE_SIZE = 1 << 15;     // Colors mapped before
+
+    void AddColor(unsigned int red, unsigned int green, unsigned int blue);
+    uint32_t AddNode(unsigned int level);
+    void ReduceNode();
+    void CollectLeaves(std::vector<Cluster>& clusters) const;
+    void SetPalette(const std::vector<Cluster>& colors);
+    uint8_t FindNearest(unsigned int red, unsigned int green, unsigned int blue);
+
+    FindNearestFunction          m_findNearest;
+    std::vector<Node>            m_nodes;
+    std::vector<uint32_t>        m_freeNodes;                   // Children of reduced nodes
+    std::vector<uint32_t>        m_reducible[OCTREE_DEPTH];     // Nodes with children, per level
+    unsigned int                 m_leafCount;
+    unsigned int                 m_leafLevel;                   // New nodes at this level are leaves
+    uint32_t                     m_lastColor;                   // Repeated colors skip the tree
+    uint32_t                     m_lastLeaf;
+
+    uint8_t                      m_palette[MAX_COLORS * 3];
+    unsigned int                 m_colorCount;
+    PalettePlanes                m_planes;
+    std::vector<uint32_t>        m_cacheColors;                 // Color of each cache entry, or an invalid color
+    std::vector<uint8_t>         m_cacheIndices;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include "PixelConverterKernels.h"
+
+// The palette of the nearest color search in planes of 16 bit values. The
+// colors are padded to a multiple of ALIGNMENT with colors which are never
+// the nearest, so that the kernels need no remainder loop.
+struct PalettePlanes
+{
+    static const unsigned int ALIGNMENT = 16;
+    static const int16_t      PADDING = 1024;
+
+    int16_t      red[256];
+    int16_t      green[256];
+    int16_t      blue[256];
+    unsigned int count;         // Padded number of colors
+};
+
+// Returns the index of the color nearest to red, green, blue by squared
+// euclidean distance, the lowest index if several are as near. All kernels
+// return the same index.
+typedef unsigned int (*FindNearestFunction)(const PalettePlanes& palette, int red, int green, int blue);
+
+// Return nullptr if the instruction set is not available in this build.
+// NEON builds use the scalar kernel.
+FindNearestFunction GetScalarFindNearest();
+FindNearestFunction GetSse2FindNearest();
+FindNearestFunction GetAvx2FindNearest();
+
+// The kernels compare the squared distance and the index of a color packed
+// into one key, so the smallest key is the nearest color with the lowest
+// index. The distance to a padding color still fits.
+inline int32_t MakeNearestKey(int32_t distance, unsigned int index)
+{
+    return (distance << 8) | static_cast<int32_t>(index);
+}
+
+// Picks the smallest of the keys the vector kernels kept per lane, and
+// returns its index
+inline unsigned int SelectNearest(const int32_t* keys, unsigned int count)
+{
+    int32_t best = keys[0];
+    for (unsigned int i = 1; i < count; ++i)
+    {
+        best = keys[i] < best ? keys[i] : best;
+    }
+    return static_cast<unsigned int>(best & 0xFF);
+}
@@ -0,0 +1,129 @@
+#include "PaletteQuantizerKernels.h"
+
+#ifdef PIXEL_CONVERTER_X86
+
+#include <climits>
+#include <immintrin.h>
+
+namespace {
+
+/******************************************************************
+*  SSE2                                                           *
+******************************************************************/
+
+// Nearest keys of eight colors, the first four in lo and the others in hi.
+// The differences fit 16 bits, their squares are summed in 32 bits.
+TARGET_SSE2 inline void KeysSse2(__m128i dr, __m128i dg, __m128i db, __m128i index, __m128i& lo, __m128i& hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rgLo = _mm_unpacklo_epi16(dr, dg);
+    __m128i rgHi = _mm_unpackhi_epi16(dr, dg);
+    __m128i bLo = _mm_unpacklo_epi16(db, zero);
+    __m128i bHi = _mm_unpackhi_epi16(db, zero);
+    lo = _mm_add_epi32(_mm_madd_epi16(rgLo, rgLo), _mm_madd_epi16(bLo, bLo));
+    hi = _mm_add_epi32(_mm_madd_epi16(rgHi, rgHi), _mm_madd_epi16(bHi, bHi));
+    lo = _mm_or_si128(_mm_slli_epi32(lo, 8), index);
+    hi = _mm_or_si128(_mm_slli_epi32(hi, 8), _mm_add_epi32(index, _mm_set1_epi32(4)));
+}
+
+// SSE2 has no 32 bit minimum
+TARGET_SSE2 inline __m128i MinSse2(__m128i a, __m128i b)
+{
+    __m128i less = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(less, a), _mm_andnot_si128(less, b));
+}
+
+TARGET_SSE2 unsigned int FindNearestSse2(const PalettePlanes& palette, int red, int green, int blue)
+{
+    const __m128i r = _mm_set1_epi16(static_cast<short>(red));
+    const __m128i g = _mm_set1_epi16(static_cast<short>(green));
+    const __m128i b = _mm_set1_epi16(static_cast<short>(blue));
+    const __m128i step = _mm_set1_epi32(8);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i bestLo = _mm_set1_epi32(INT_MAX);
+    __m128i bestHi = bestLo;
+
+    for (unsigned int i = 0; i < palette.count; i += 8)
+    {
+        __m128i dr = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(palette.red + i)), r);
+        __m128i dg = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(palette.green + i)), g);
+        __m128i db = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(palette.blue + i)), b);
+        __m128i lo, hi;
+        KeysSse2(dr, dg, db, index, lo, hi);
+        bestLo = MinSse2(lo, bestLo);
+        bestHi = MinSse2(hi, bestHi);
+        index = _mm_add_epi32(index, step);
+    }
+
+    int32_t keys[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(keys), MinSse2(bestLo, bestHi));
+    return SelectNearest(keys, 4);
+}
+
+/******************************************************************
+*  AVX2                                                           *
+******************************************************************/
+
+TARGET_AVX2 unsigned int FindNearestAvx2(const PalettePlanes& palette, int red, int green, int blue)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i r = _mm256_set1_epi16(static_cast<short>(red));
+    const __m256i g = _mm256_set1_epi16(static_cast<short>(green));
+    const __m256i b = _mm256_set1_epi16(static_cast<short>(blue));
+    const __m256i step = _mm256_set1_epi32(16);
+
+    // Unpacking works within the 128 bit lanes
+    __m256i indexLo = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+    __m256i indexHi = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+    __m256i bestLo = _mm256_set1_epi32(INT_MAX);
+    __m256i bestHi = bestLo;
+
+    for (unsigned int i = 0; i < palette.count; i += 16)
+    {
+        __m256i dr = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(palette.red + i)), r);
+        __m256i dg = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(palette.green + i)), g);
+        __m256i db = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(palette.blue + i)), b);
+        __m256i rgLo = _mm256_unpacklo_epi16(dr, dg);
+        __m256i rgHi = _mm256_unpackhi_epi16(dr, dg);
+        __m256i bLo = _mm256_unpacklo_epi16(db, zero);
+        __m256i bHi = _mm256_unpackhi_epi16(db, zero);
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(rgLo, rgLo), _mm256_madd_epi16(bLo, bLo));
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(rgHi, rgHi), _mm256_madd_epi16(bHi, bHi));
+        bestLo = _mm256_min_epi32(_mm256_or_si256(_mm256_slli_epi32(lo, 8), indexLo), bestLo);
+        bestHi = _mm256_min_epi32(_mm256_or_si256(_mm256_slli_epi32(hi, 8), indexHi), bestHi);
+        indexLo = _mm256_add_epi32(indexLo, step);
+        indexHi = _mm256_add_epi32(indexHi, step);
+    }
+
+    __m256i best = _mm256_min_epi32(bestLo, bestHi);
+    __m128i best128 = _mm_min_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+    int32_t keys[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(keys), best128);
+    return SelectNearest(keys, 4);
+}
+
+}
+
+FindNearestFunction GetSse2FindNearest()
+{
+    return FindNearestSse2;
+}
+
+FindNearestFunction GetAvx2FindNearest()
+{
+    return FindNearestAvx2;
+}
+
+#else
+
+FindNearestFunction GetSse2FindNearest()
+{
+    return nullptr;
+}
+
+FindNearestFunction GetAvx2FindNearest()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,277 @@
+#include "PixelConverter.h"
+#include <cstring>
+#include "PixelConverterKernels.h"
+
+#ifdef PIXEL_CONVERTER_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+const size_t CHUNK_PIXELS = 256;    // Pixels of 16 bit formats reduced to 8 bits at a time
+
+void ConvertBgr24(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 3, destination += 4)
+    {
+        destination[0] = source[0];
+        destination[1] = source[1];
+        destination[2] = source[2];
+        destination[3] = 255;
+    }
+}
+
+void ConvertRgb24(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 3, destination += 4)
+    {
+        destination[0] = source[2];
+        destination[1] = source[1];
+        destination[2] = source[0];
+        destination[3] = 255;
+    }
+}
+
+void ConvertBgra32(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 4, destination += 4)
+    {
+        unsigned int alpha = source[3];
+        destination[0] = Premultiply(source[0], alpha);
+        destination[1] = Premultiply(source[1], alpha);
+        destination[2] = Premultiply(source[2], alpha);
+        destination[3] = static_cast<uint8_t>(alpha);
+    }
+}
+
+void ConvertRgba32(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 4, destination += 4)
+    {
+        unsigned int alpha = source[3];
+        destination[0] = Premultiply(source[2], alpha);
+        destination[1] = Premultiply(source[1], alpha);
+        destination[2] = Premultiply(source[0], alpha);
+        destination[3] = static_cast<uint8_t>(alpha);
+    }
+}
+
+void ConvertBgr32(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, source += 4, destination += 4)
+    {
+        destination[0] = source[0];
+        destination[1] = source[1];
+        destination[2] = source[2];
+        destination[3] = 255;
+    }
+}
+
+void ConvertGray8(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    for (size_t x = 0; x < width; ++x, ++source, destination += 4)
+    {
+        destination[0] = *source;
+        destination[1] = *source;
+        destination[2] = *source;
+        destination[3] = 255;
+    }
+}
+
+void ConvertNarrow16(const uint8_t* source, uint8_t* destination, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, source += 2)
+    {
+        destination[i] = Narrow16(source[0] | (source[1] << 8));
+    }
+}
+
+const PixelKernels scalarKernels = {
+    ConvertBgr24,
+    ConvertRgb24,
+    ConvertBgra32,
+    ConvertRgba32,
+    ConvertBgr32,
+    ConvertGray8,
+    ConvertNarrow16
+};
+
+#ifdef PIXEL_CONVERTER_X86
+void Cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// Whether the operating system saves the AVX registers
+bool IsAvxStateEnabled()
+{
+#ifdef _MSC_VER
+    return (_xgetbv(0) & 6) == 6;
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & 6) == 6;
+#endif
+}
+#endif
+
+const PixelKernels* GetKernels(CPU_KERNELS kernels)
+{
+    switch (kernels)
+    {
+    case CK_SSE2: return GetSse2Kernels();
+    case CK_AVX2: return GetAvx2Kernels();
+    default:      return GetScalarKernels();
+    }
+}
+
+CPU_KERNELS DetectBestKernels()
+{
+#ifdef PIXEL_CONVERTER_X86
+    int info[4] = {};
+    Cpuid(info, 0);
+    int maxLeaf = info[0];
+    Cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && IsAvxStateEnabled();
+    bool avx2 = false;
+    if (avx && maxLeaf >= 7)
+    {
+        Cpuid(info, 7);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    if (avx2 && GetAvx2Kernels())
+        return CK_AVX2;
+    if (sse2 && GetSse2Kernels())
+        return CK_SSE2;
+#endif
+    return CK_SCALAR;
+}
+
+}
+
+const PixelKernels* GetScalarKernels()
+{
+    return &scalarKernels;
+}
+
+size_t PixelConverter::getBytesPerPixel(PIXEL_FORMATS format)
+{
+    switch (format)
+    {
+    case PF_BGR24:
+    case PF_RGB24:  return 3;
+    case PF_BGRA32:
+    case PF_RGBA32:
+    case PF_BGR32:
+    case PF_PBGRA32: return 4;
+    case PF_GRAY8:  return 1;
+    case PF_GRAY16: return 2;
+    case PF_RGB48:  return 6;
+    case PF_RGBA64: return 8;
+    default:        return 0;
+    }
+}
+
+CPU_KERNELS PixelConverter::getBestKernels()
+{
+    static const CPU_KERNELS best = DetectBestKernels();
+    return best;
+}
+
+bool PixelConverter::isSupported(CPU_KERNELS kernels)
+{
+    if (kernels == CK_SCALAR)
+        return true;
+    if (GetKernels(kernels) == nullptr)
+        return false;
+    // The best kernels imply the simpler ones of the same architecture
+    CPU_KERNELS best = getBestKernels();
+    return kernels == best || (kernels == CK_SSE2 && best == CK_AVX2);
+}
+
+const char* PixelConverter::getKernelsName(CPU_KERNELS kernels)
+{
+    switch (kernels)
+    {
+    case CK_SSE2: return "sse2";
+    case CK_AVX2: return "avx2";
+    case CK_NEON: return "neon";
+    default:      return "scalar";
+    }
+}
+
+void PixelConverter::ConvertRow(
+    PIXEL_FORMATS format,
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    CPU_KERNELS kernels)
+{
+    const PixelKernels* k = GetKernels(kernels);
+    if (k == nullptr)
+    {
+        k = GetScalarKernels();
+    }
+
+    switch (format)
+    {
+    case PF_BGR24:   k->bgr24(source, destination, width); return;
+    case PF_RGB24:   k->rgb24(source, destination, width); return;
+    case PF_BGRA32:  k->bgra32(source, destination, width); return;
+    case PF_RGBA32:  k->rgba32(source, destination, width); return;
+    case PF_BGR32:   k->bgr32(source, destination, width); return;
+    case PF_PBGRA32: memcpy(destination, source, width * 4); return;
+    case PF_GRAY8:   k->gray8(source, destination, width); return;
+    default:         break;
+    }
+
+    // 16 bit formats are reduced to the matching 8 bit format in chunks
+    // which stay in the L1 cache
+    ConvertRowFunction convert8 = nullptr;
+    size_t channels = 0;
+    switch (format)
+    {
+    case PF_GRAY16: convert8 = k->gray8;  channels = 1; break;
+    case PF_RGB48:  convert8 = k->rgb24;  channels = 3; break;
+    case PF_RGBA64: convert8 = k->rgba32; channels = 4; break;
+    default:        return;
+    }
+
+    uint8_t narrowed[CHUNK_PIXELS * 4];
+    while (width > 0)
+    {
+        size_t count = width < CHUNK_PIXELS ? width : CHUNK_PIXELS;
+        k->narrow16(source, narrowed, count * channels);
+        convert8(narrowed, destination, count);
+        source += count * channels * 2;
+        destination += count * 4;
+        width -= count;
+    }
+}
+
+void PixelConverter::Convert(
+    PIXEL_FORMATS format,
+    const uint8_t* source,
+    size_t sourceStride,
+    uint8_t* destination,
+    size_t destinationStride,
+    unsigned int width,
+    unsigned int height,
+    CPU_KERNELS kernels)
+{
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        ConvertRow(format, source, destination, width, kernels);
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
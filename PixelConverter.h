@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Source pixel formats which can be converted to 32bpp premultiplied BGRA.
+// 16 bit channels are little endian.
+enum PIXEL_FORMATS
+{
+    PF_UNSUPPORTED = 0,
+    PF_BGR24,       // 24bpp B, G, R
+    PF_RGB24,       // 24bpp R, G, B
+    PF_BGRA32,      // 32bpp B, G, R, A with straight alpha
+    PF_RGBA32,      // 32bpp R, G, B, A with straight alpha
+    PF_BGR32,       // 32bpp B, G, R and an unused byte
+    PF_PBGRA32,     // 32bpp B, G, R, A with premultiplied alpha, copied as is
+    PF_GRAY8,       // 8bpp gray
+    PF_GRAY16,      // 16bpp gray
+    PF_RGB48,       // 48bpp R, G, B
+    PF_RGBA64       // 64bpp R, G, B, A with straight alpha
+};
+
+// Instruction sets of the conversion kernels
+enum CPU_KERNELS
+{
+    CK_SCALAR = 0,  // Portable reference kernels
+    CK_SSE2,
+    CK_AVX2,
+    CK_NEON
+};
+
+// Converts rows of pixels to 32bpp premultiplied BGRA, the format Direct2D
+// expects. The kernels for the best instruction set of the CPU are chosen
+// at runtime. All kernels produce exactly the same result as the scalar
+// kernels: colors are premultiplied as round(c * a / 255) and 16 bit
+// channels are reduced as round(v * 255 / 65535).
+class PixelConverter
+{
+public:
+    static size_t getBytesPerPixel(PIXEL_FORMATS format);
+
+    // The best instruction set supported by the CPU and this build
+    static CPU_KERNELS getBestKernels();
+    static bool        isSupported(CPU_KERNELS kernels);
+    static const char* getKernelsName(CPU_KERNELS kernels);
+
+    // Converts width pixels. Source and destination must not overlap.
+    static void ConvertRow(
+        PIXEL_FORMATS format,
+        const uint8_t* source,
+        uint8_t* destination,
+        size_t width,
+        CPU_KERNELS kernels = getBestKernels());
+
+    static void Convert(
+        PIXEL_FORMATS format,
+        const uint8_t* source,
+        size_t sourceStride,
+        uint8_t* destination,
+        size_t destinationStride,
+        unsigned int width,
+        unsigned int height,
+        CPU_KERNELS kernels = getBestKernels());
+
+private:
+    PixelConverter() = delete;
+    PixelConverter(const PixelConverter&) = delete;
+    PixelConverter& operator=(const PixelConverter&) = delete;
+};
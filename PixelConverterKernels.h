@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_CONVERTER_X86
+#endif
+
+// MSVC allows the intrinsics of any instruction set, GCC and Clang only in
+// functions compiled for it
+#if defined(PIXEL_CONVERTER_X86) && defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// Row kernels of one instruction set, used by the PixelConverter. The 16 bit
+// formats are converted by reducing the channels to 8 bits with narrow16
+// first.
+typedef void (*ConvertRowFunction)(const uint8_t* source, uint8_t* destination, size_t width);
+
+struct PixelKernels
+{
+    ConvertRowFunction bgr24;
+    ConvertRowFunction rgb24;
+    ConvertRowFunction bgra32;
+    ConvertRowFunction rgba32;
+    ConvertRowFunction bgr32;
+    ConvertRowFunction gray8;
+    ConvertRowFunction narrow16;    // Reduces width 16 bit values to 8 bits
+};
+
+// Return nullptr if the instruction set is not available in this build.
+// NEON builds use the scalar kernels.
+const PixelKernels* GetScalarKernels();
+const PixelKernels* GetSse2Kernels();
+const PixelKernels* GetAvx2Kernels();
+
+// Reference arithmetic shared by all kernels
+inline uint8_t Premultiply(unsigned int color, unsigned int alpha)
+{
+    unsigned int t = color * alpha + 128;
+    return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+}
+
+inline uint8_t Narrow16(unsigned int value)
+{
+    unsigned int t = value + 128 > 65535 ? 65535 : value + 128;
+    return static_cast<uint8_t>((t - (t >> 8)) >> 8);
+}
@@ -0,0 +1,365 @@
+#include "PixelConverterKernels.h"
+
+#ifdef PIXEL_CONVERTER_X86
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+
+inline uint32_t Load32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Remaining pixels are converted by the scalar kernels
+const PixelKernels& Scalar()
+{
+    return *GetScalarKernels();
+}
+
+/******************************************************************
+*  SSE2                                                           *
+******************************************************************/
+
+// Premultiplies the colors of four BGRA pixels. If swap is set, the colors
+// are read as RGBA.
+template<bool swap>
+TARGET_SSE2 inline __m128i PremultiplySse2(__m128i pixels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+    __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+    __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+    __m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    if (swap)
+    {
+        lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+        hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    // (t + (t >> 8)) >> 8 with t = c * a + 128 is round(c * a / 255)
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), round);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    __m128i result = _mm_packus_epi16(lo, hi);
+    return _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, pixels));
+}
+
+template<bool swap>
+TARGET_SSE2 void PremultiplyRowSse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4, source += 16, destination += 16)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), PremultiplySse2<swap>(pixels));
+    }
+    if (swap)
+        Scalar().rgba32(source, destination, width - x);
+    else
+        Scalar().bgra32(source, destination, width - x);
+}
+
+TARGET_SSE2 void ConvertBgra32Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    PremultiplyRowSse2<false>(source, destination, width);
+}
+
+TARGET_SSE2 void ConvertRgba32Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    PremultiplyRowSse2<true>(source, destination, width);
+}
+
+TARGET_SSE2 void ConvertBgr32Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4, source += 16, destination += 16)
+    {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_or_si128(pixels, alpha));
+    }
+    Scalar().bgr32(source, destination, width - x);
+}
+
+// SSE2 has no byte shuffle, so the 24 bit pixels are loaded one by one as
+// 32 bit values. The fourth byte belongs to the next pixel, so the last
+// pixel is left to the scalar kernel.
+template<bool swap>
+TARGET_SSE2 void Expand24Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const __m128i low = _mm_set1_epi32(0x000000FF);
+    const __m128i middle = _mm_set1_epi32(0x0000FF00);
+    size_t x = 0;
+    for (; x + 5 <= width; x += 4, source += 12, destination += 16)
+    {
+        __m128i pixels = _mm_setr_epi32(
+            static_cast<int>(Load32(source)),
+            static_cast<int>(Load32(source + 3)),
+            static_cast<int>(Load32(source + 6)),
+            static_cast<int>(Load32(source + 9)));
+        if (swap)
+        {
+            __m128i blue = _mm_and_si128(_mm_srli_epi32(pixels, 16), low);
+            __m128i red = _mm_slli_epi32(_mm_and_si128(pixels, low), 16);
+            pixels = _mm_or_si128(_mm_or_si128(blue, red), _mm_and_si128(pixels, middle));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_or_si128(pixels, alpha));
+    }
+    if (swap)
+        Scalar().rgb24(source, destination, width - x);
+    else
+        Scalar().bgr24(source, destination, width - x);
+}
+
+TARGET_SSE2 void ConvertBgr24Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    Expand24Sse2<false>(source, destination, width);
+}
+
+TARGET_SSE2 void ConvertRgb24Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    Expand24Sse2<true>(source, destination, width);
+}
+
+TARGET_SSE2 void ConvertGray8Sse2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xFF));
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16, source += 16, destination += 64)
+    {
+        __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        __m128i grayGrayLo = _mm_unpacklo_epi8(gray, gray);
+        __m128i grayGrayHi = _mm_unpackhi_epi8(gray, gray);
+        __m128i grayAlphaLo = _mm_unpacklo_epi8(gray, alpha);
+        __m128i grayAlphaHi = _mm_unpackhi_epi8(gray, alpha);
+        __m128i* out = reinterpret_cast<__m128i*>(destination);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(grayGrayLo, grayAlphaLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(grayGrayLo, grayAlphaLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(grayGrayHi, grayAlphaHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(grayGrayHi, grayAlphaHi));
+    }
+    Scalar().gray8(source, destination, width - x);
+}
+
+// round(v * 255 / 65535) is (t - (t >> 8)) >> 8 with t = v + 128, which is
+// exact if the addition saturates
+TARGET_SSE2 inline __m128i Narrow16Sse2(__m128i values)
+{
+    __m128i t = _mm_adds_epu16(values, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_sub_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+TARGET_SSE2 void ConvertNarrow16Sse2(const uint8_t* source, uint8_t* destination, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, source += 32, destination += 16)
+    {
+        __m128i lo = Narrow16Sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+        __m128i hi = Narrow16Sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_packus_epi16(lo, hi));
+    }
+    Scalar().narrow16(source, destination, count - i);
+}
+
+const PixelKernels sse2Kernels = {
+    ConvertBgr24Sse2,
+    ConvertRgb24Sse2,
+    ConvertBgra32Sse2,
+    ConvertRgba32Sse2,
+    ConvertBgr32Sse2,
+    ConvertGray8Sse2,
+    ConvertNarrow16Sse2
+};
+
+/******************************************************************
+*  AVX2                                                           *
+******************************************************************/
+
+// Premultiplies the colors of eight BGRA pixels. If swap is set, the colors
+// are read as RGBA. Unpacking and packing work within the 128 bit lanes, so
+// the pixels stay in order.
+template<bool swap>
+TARGET_AVX2 inline __m256i PremultiplyAvx2(__m256i pixels)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+
+    __m256i lo = _mm256_unpacklo_epi8(pixels, zero);
+    __m256i hi = _mm256_unpackhi_epi8(pixels, zero);
+    __m256i alphaLo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i alphaHi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    if (swap)
+    {
+        lo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+        hi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, alphaLo), round);
+    hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, alphaHi), round);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+    __m256i result = _mm256_packus_epi16(lo, hi);
+    return _mm256_or_si256(_mm256_andnot_si256(alphaMask, result), _mm256_and_si256(alphaMask, pixels));
+}
+
+template<bool swap>
+TARGET_AVX2 void PremultiplyRowAvx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8, source += 32, destination += 32)
+    {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), PremultiplyAvx2<swap>(pixels));
+    }
+    if (swap)
+        Scalar().rgba32(source, destination, width - x);
+    else
+        Scalar().bgra32(source, destination, width - x);
+}
+
+TARGET_AVX2 void ConvertBgra32Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    PremultiplyRowAvx2<false>(source, destination, width);
+}
+
+TARGET_AVX2 void ConvertRgba32Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    PremultiplyRowAvx2<true>(source, destination, width);
+}
+
+TARGET_AVX2 void ConvertBgr32Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8, source += 32, destination += 32)
+    {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), _mm256_or_si256(pixels, alpha));
+    }
+    Scalar().bgr32(source, destination, width - x);
+}
+
+// Each 128 bit lane gets four 24 bit pixels, which are spread to 32 bits with
+// a byte shuffle. The second lane reads 4 bytes past its pixels, so the loop
+// keeps two pixels in reserve.
+template<bool swap>
+TARGET_AVX2 void Expand24Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m256i shuffle = swap ?
+        _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                         2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+        _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                         0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 10 <= width; x += 8, source += 24, destination += 32)
+    {
+        __m256i pixels = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 12)),
+            1);
+        pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), pixels);
+    }
+    if (swap)
+        Scalar().rgb24(source, destination, width - x);
+    else
+        Scalar().bgr24(source, destination, width - x);
+}
+
+TARGET_AVX2 void ConvertBgr24Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    Expand24Avx2<false>(source, destination, width);
+}
+
+TARGET_AVX2 void ConvertRgb24Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    Expand24Avx2<true>(source, destination, width);
+}
+
+TARGET_AVX2 void ConvertGray8Avx2(const uint8_t* source, uint8_t* destination, size_t width)
+{
+    const __m256i spread = _mm256_set1_epi32(0x00010101);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16, source += 16, destination += 64)
+    {
+        __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        __m256i lo = _mm256_cvtepu8_epi32(gray);
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(gray, 8));
+        lo = _mm256_or_si256(_mm256_mullo_epi32(lo, spread), alpha);
+        hi = _mm256_or_si256(_mm256_mullo_epi32(hi, spread), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + 32), hi);
+    }
+    Scalar().gray8(source, destination, width - x);
+}
+
+TARGET_AVX2 inline __m256i Narrow16Avx2(__m256i values)
+{
+    __m256i t = _mm256_adds_epu16(values, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_sub_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+TARGET_AVX2 void ConvertNarrow16Avx2(const uint8_t* source, uint8_t* destination, size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32, source += 64, destination += 32)
+    {
+        __m256i lo = Narrow16Avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)));
+        __m256i hi = Narrow16Avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 32)));
+
+        // Packing interleaves the lanes of both vectors
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), packed);
+    }
+    ConvertNarrow16Sse2(source, destination, count - i);
+}
+
+const PixelKernels avx2Kernels = {
+    ConvertBgr24Avx2,
+    ConvertRgb24Avx2,
+    ConvertBgra32Avx2,
+    ConvertRgba32Avx2,
+    ConvertBgr32Avx2,
+    ConvertGray8Avx2,
+    ConvertNarrow16Avx2
+};
+
+}
+
+const PixelKernels* GetSse2Kernels()
+{
+    return &sse2Kernels;
+}
+
+const PixelKernels* GetAvx2Kernels()
+{
+    return &avx2Kernels;
+}
+
+#else
+
+const PixelKernels* GetSse2Kernels()
+{
+    return nullptr;
+}
+
+const PixelKernels* GetAvx2Kernels()
+{
+    return nullptr;
+}
+
+#endif
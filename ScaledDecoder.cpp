@@ -0,0 +1,180 @@
+#include "ScaledDecoder.h"
+#include "ComPtr.h"
+
+void ScaledDecoder::GetFitSize(
+    UINT width,
+    UINT height,
+    UINT maxWidth,
+    UINT maxHeight,
+    UINT& fitWidth,
+    UINT& fitHeight)
+{
+    fitWidth = width;
+    fitHeight = height;
+    if (width == 0 || height == 0 || maxWidth == 0 || maxHeight == 0)
+        return;
+
+    double scale = static_cast<double>(maxWidth) / width;
+    if (static_cast<double>(maxHeight) / height < scale)
+    {
+        scale = static_cast<double>(maxHeight) / height;
+    }
+    if (scale < 1.0)
+    {
+        fitWidth = static_cast<UINT>(width * scale + 0.5);
+        fitHeight = static_cast<UINT>(height * scale + 0.5);
+        if (fitWidth == 0)
+            fitWidth = 1;
+        if (fitHeight == 0)
+            fitHeight = 1;
+    }
+}
+
+HRESULT ScaledDecoder::CreateSource(
+    IWICImagingFactory* factory,
+    IWICBitmapSource* frame,
+    UINT width,
+    UINT height,
+    IWICBitmapSource** source)
+{
+    *source = nullptr;
+    UINT frameWidth = 0;
+    UINT frameHeight = 0;
+    HRESULT hr = frame->GetSize(&frameWidth, &frameHeight);
+    if (FAILED(hr))
+        return hr;
+
+    if (width == frameWidth && height == frameHeight)
+    {
+        frame->AddRef();
+        *source = frame;
+        return S_OK;
+    }
+
+    // Let the decoder skip as much as possible, then filter the rest
+    ComPtr<IWICBitmapSource> reduced;
+    if (FAILED(DecodeNativeScaled(factory, frame, width, height, reduced.get_out_storage())))
+    {
+        frame->AddRef();
+        reduced.reset(frame);
+    }
+
+    UINT reducedWidth = 0;
+    UINT reducedHeight = 0;
+    hr = reduced->GetSize(&reducedWidth, &reducedHeight);
+    if (SUCCEEDED(hr) && reducedWidth == width && reducedHeight == height)
+    {
+        *source = reduced.new_ref();
+        return S_OK;
+    }
+
+    // The Fant scaler averages the source pixels covering each target pixel
+    // and only requests the source rows needed for the next target rows
+    ComPtr<IWICBitmapScaler> scaler;
+    if (SUCCEEDED(hr))
+    {
+        hr = factory->CreateBitmapScaler(scaler.get_out_storage());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = scaler->Initialize(reduced.get(), width, height, WICBitmapInterpolationModeFant);
+    }
+    if (SUCCEEDED(hr))
+    {
+        *source = scaler.new_ref();
+    }
+    return hr;
+}
+
+HRESULT ScaledDecoder::DecodeNativeScaled(
+    IWICImagingFactory* factory,
+    IWICBitmapSource* frame,
+    UINT width,
+    UINT height,
+    IWICBitmapSource** source)
+{
+    ComPtr<IWICBitmapSourceTransform> transform;
+    ComPtr<IWICBitmap> bitmap;
+    ComPtr<IWICBitmapLock> lock;
+
+    UINT frameWidth = 0;
+    UINT frameHeight = 0;
+    HRESULT hr = frame->GetSize(&frameWidth, &frameHeight);
+    if (SUCCEEDED(hr))
+    {
+        hr = frame->QueryInterface(IID_PPV_ARGS(transform.get_out_storage()));
+    }
+
+    // The closest size of the decoder may be smaller than requested, which
+    // would lose detail, or the full size, which would not save anything
+    UINT reducedWidth = width;
+    UINT reducedHeight = height;
+    if (SUCCEEDED(hr))
+    {
+        hr = transform->GetClosestSize(&reducedWidth, &reducedHeight);
+    }
+    if (SUCCEEDED(hr) &&
+        (reducedWidth < width || reducedHeight < height || reducedWidth >= frameWidth))
+    {
+        hr = E_FAIL;
+    }
+
+    // Only formats which need no palette are requested
+    WICPixelFormatGUID format = GUID_WICPixelFormat32bppBGRA;
+    if (SUCCEEDED(hr))
+    {
+        hr = transform->GetClosestPixelFormat(&format);
+    }
+    if (SUCCEEDED(hr) &&
+        format != GUID_WICPixelFormat32bppBGRA &&
+        format != GUID_WICPixelFormat32bppPBGRA &&
+        format != GUID_WICPixelFormat32bppBGR &&
+        format != GUID_WICPixelFormat24bppBGR &&
+        format != GUID_WICPixelFormat8bppGray)
+    {
+        hr = E_FAIL;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = factory->CreateBitmap(reducedWidth, reducedHeight, format, WICBitmapCacheOnLoad, bitmap.get_out_storage());
+    }
+
+    WICRect rect = { 0, 0, static_cast<INT>(reducedWidth), static_cast<INT>(reducedHeight) };
+    if (SUCCEEDED(hr))
+    {
+        hr = bitmap->Lock(&rect, WICBitmapLockWrite, lock.get_out_storage());
+    }
+
+    UINT stride = 0;
+    UINT bufferSize = 0;
+    BYTE* buffer = nullptr;
+    if (SUCCEEDED(hr))
+    {
+        hr = lock->GetStride(&stride);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = lock->GetDataPointer(&bufferSize, &buffer);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = transform->CopyPixels(
+            nullptr,
+            reducedWidth,
+            reducedHeight,
+            &format,
+            WICBitmapTransformRotate0,
+            stride,
+            bufferSize,
+            buffer);
+    }
+
+    // The bitmap can only be read once it is unlocked
+    lock.reset(nullptr);
+    if (SUCCEEDED(hr))
+    {
+        *source = bitmap.new_ref();
+    }
+    return hr;
+}
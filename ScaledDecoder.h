@@ -0,0 +1,40 @@
+#pragma once
+#include <wincodec.h>
+
+// Decodes frames directly at a smaller size, so that images larger than the
+// screen do not need to be decoded at full resolution. Decoders which can
+// scale natively, like the JPEG decoder, skip most of the decoding work.
+// Other decoders are read through a box filter row by row.
+class ScaledDecoder
+{
+public:
+    // Calculates the largest size with the aspect ratio of the image that
+    // fits into maxWidth x maxHeight. Images that fit keep their size.
+    static void GetFitSize(
+        UINT width,
+        UINT height,
+        UINT maxWidth,
+        UINT maxHeight,
+        UINT& fitWidth,
+        UINT& fitHeight);
+
+    // Creates a source that reads the frame scaled to width x height
+    static HRESULT CreateSource(
+        IWICImagingFactory* factory,
+        IWICBitmapSource* frame,
+        UINT width,
+        UINT height,
+        IWICBitmapSource** source);
+
+private:
+    ScaledDecoder() = delete;
+    ScaledDecoder(const ScaledDecoder&) = delete;
+    ScaledDecoder& operator=(const ScaledDecoder&) = delete;
+
+    static HRESULT DecodeNativeScaled(
+        IWICImagingFactory* factory,
+        IWICBitmapSource* frame,
+        UINT width,
+        UINT height,
+        IWICBitmapSource** source);
+};
@@ -1,67 +1,297 @@
 #include "ShellNavigator.h"
 #include <shlobj.h>
+#include <wincodec.h>
 #include "ComPtr.h"
+#include "Tracer.h"
 
 
-ShellNavigator::ShellNavigator() : m_index(0)
+ShellNavigator::ShellNavigator() :
+    m_index(0),
+    m_searching(false),
+    m_notifyWindow(nullptr),
+    m_notifyMessage(0),
+    m_stop(false),
+    m_notified(false)
 {
 }
 
 
 ShellNavigator::~ShellNavigator()
 {
+    Stop();
 }
 
-void ShellNavigator::Reset(IShellItem* shellItem)
+std::wstring ShellNavigator::MakeKey(const std::wstring& path)
 {
+    std::wstring key = path;
+    if (!key.empty())
+    {
+        CharLowerBuffW(&key[0], static_cast<DWORD>(key.size()));
+    }
+    return key;
+}
+
+// Collects the lower case file extensions of all installed WIC decoders
+std::unordered_set<std::wstring> ShellNavigator::GetDecoderExtensions()
+{
+    std::unordered_set<std::wstring> extensions;
+    ComPtr<IWICImagingFactory> factory;
+    ComPtr<IEnumUnknown> decoders;
+    HRESULT hr = CoCreateInstance(
+        CLSID_WICImagingFactory,
+        nullptr,
+        CLSCTX_INPROC_SERVER,
+        IID_PPV_ARGS(factory.get_out_storage()));
+    if (SUCCEEDED(hr))
+    {
+        hr = factory->CreateComponentEnumerator(WICDecoder, WICComponentEnumerateDefault, decoders.get_out_storage());
+    }
+    if (FAILED(hr))
+        return extensions;
+
+    ComPtr<IUnknown> component;
+    ULONG fetched = 0;
+    while (decoders->Next(1, component.get_out_storage(), &fetched) == S_OK && fetched == 1)
+    {
+        ComPtr<IWICBitmapCodecInfo> codecInfo;
+        UINT length = 0;
+        if (SUCCEEDED(component->QueryInterface(IID_PPV_ARGS(codecInfo.get_out_storage()))) &&
+            SUCCEEDED(codecInfo->GetFileExtensions(0, nullptr, &length)) && length > 0)
+        {
+            // A comma separated list like ".jpeg,.jpe,.jpg"
+            std::wstring list(length, L'\0');
+            if (SUCCEEDED(codecInfo->GetFileExtensions(length, &list[0], &length)))
+            {
+                list = MakeKey(list.c_str());
+                size_t start = 0;
+                while (start < list.size())
+                {
+                    size_t end = list.find(L',', start);
+                    if (end == std::wstring::npos)
+                        end = list.size();
+                    if (end > start)
+                        extensions.insert(list.substr(start, end - start));
+                    start = end + 1;
+                }
+            }
+        }
+        component.reset(nullptr);
+    }
+    return extensions;
+}
+
+void ShellNavigator::Stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    m_stop = false;
+    m_notified = false;
+    m_found.clear();
+}
+
+void ShellNavigator::Reset(IShellItem* shellItem, HWND notifyWindow, UINT notifyMessage)
+{
+    TRACE_SCOPE("ShellNavigator::Reset");
+    Stop();
+
     m_index = 0;
     m_files.clear();
+    m_positions.clear();
+    m_searching = false;
+    m_notifyWindow = notifyWindow;
+    m_notifyMessage = notifyMessage;
+
     ComPtr<IShellItem> parent;
-    if (SUCCEEDED(shellItem->GetParent(parent.get_out_storage())))
+    LPWSTR currentPath = nullptr;
+    LPWSTR folderPath = nullptr;
+    if (SUCCEEDED(shellItem->GetDisplayName(SIGDN_FILESYSPATH, &currentPath)) &&
+        SUCCEEDED(shellItem->GetParent(parent.get_out_storage())) &&
+        SUCCEEDED(parent->GetDisplayName(SIGDN_FILESYSPATH, &folderPath)))
+    {
+        // Shell items belong to the apartment of the UI thread, so the
+        // worker gets the paths
+        m_currentKey = MakeKey(currentPath);
+        m_searching = true;
+        m_thread = std::thread(&ShellNavigator::Run, this, std::wstring(folderPath), m_currentKey);
+    }
+    CoTaskMemFree(currentPath);
+    CoTaskMemFree(folderPath);
+}
+
+void ShellNavigator::Run(std::wstring folderPath, std::wstring currentKey)
+{
+    Tracer::SetThreadName("Shell navigator");
+    TRACE_SCOPE("ShellNavigator::Run");
+    if (FAILED(CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+        return;
+
     {
+        std::unordered_set<std::wstring> extensions = GetDecoderExtensions();
+
+        ComPtr<IShellItem> folder;
         ComPtr<IEnumShellItems> enum_shell_items;
-        if (SUCCEEDED(parent->BindToHandler(nullptr, BHID_StorageEnum, IID_PPV_ARGS(enum_shell_items.get_out_storage()))))
+        if (SUCCEEDED(SHCreateItemFromParsingName(folderPath.c_str(), nullptr, IID_PPV_ARGS(folder.get_out_storage()))) &&
+            SUCCEEDED(folder->BindToHandler(nullptr, BHID_StorageEnum, IID_PPV_ARGS(enum_shell_items.get_out_storage()))))
         {
-            IShellItem*	child[1000];
-            ULONG count = ARRAYSIZE(child);
+            IShellItem* child[ENUM_BATCH_SIZE];
             ULONG fetched;
-            while (SUCCEEDED(enum_shell_items->Next(count, child, &fetched)) && (fetched > 0))
+            std::vector<File> batch;
+            while (!m_stop && SUCCEEDED(enum_shell_items->Next(ENUM_BATCH_SIZE, child, &fetched)) && (fetched > 0))
             {
-                for (ULONG i = 0; i < fetched; ++i) {
-                    int order = 0;
-                    if ((m_index == 0)
-                        && SUCCEEDED(shellItem->Compare(child[i], SICHINT_TEST_FILESYSPATH_IF_NOT_EQUAL, &order))
-                        && (order == 0))
+                for (ULONG i = 0; i < fetched; ++i)
+                {
+                    // Only files with the extension of a decoder are listed,
+                    // and always the current file
+                    SFGAOF attributes = 0;
+                    LPWSTR path = nullptr;
+                    if (SUCCEEDED(child[i]->GetAttributes(SFGAO_FOLDER, &attributes)) && !(attributes & SFGAO_FOLDER) &&
+                        SUCCEEDED(child[i]->GetDisplayName(SIGDN_FILESYSPATH, &path)))
+                    {
+                        File file;
+                        file.path = path;
+                        file.key = MakeKey(file.path);
+                        size_t dot = file.key.find_last_of(L".\\");
+                        if (file.key == currentKey ||
+                            (dot != std::wstring::npos && file.key[dot] == L'.' && extensions.count(file.key.substr(dot)) > 0))
+                        {
+                            batch.push_back(std::move(file));
+                        }
+                        CoTaskMemFree(path);
+                    }
+                    child[i]->Release();
+                }
+
+                if (!batch.empty())
+                {
                     {
-                        m_index = m_files.size();
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        for (auto& file : batch)
+                        {
+                            m_found.push_back(std::move(file));
+                        }
+                    }
+                    batch.clear();
+
+                    // One notification at a time, the UI thread takes all
+                    // files found until then
+                    if (m_notifyWindow && !m_notified.exchange(true))
+                    {
+                        PostMessage(m_notifyWindow, m_notifyMessage, 0, 0);
                     }
-                    m_files.emplace_back(child[i]);
                 }
             }
         }
     }
+
+    CoUninitialize();
+}
+
+void ShellNavigator::TakeFiles()
+{
+    m_notified = false;
+
+    std::vector<File> found;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        found.swap(m_found);
+    }
+
+    for (auto& file : found)
+    {
+        m_positions.emplace(std::move(file.key), m_files.size());
+        m_files.push_back(std::move(file.path));
+    }
+
+    // Until the current file is found, it is placed after all files found
+    // so far, as the enumeration did not reach it yet
+    if (m_searching)
+    {
+        auto position = m_positions.find(m_currentKey);
+        m_index = (position != m_positions.end()) ? position->second : m_files.size();
+        m_searching = (position == m_positions.end());
+    }
+}
+
+bool ShellNavigator::GetFile(size_t index, IShellItem** shellItem) const
+{
+    return SUCCEEDED(SHCreateItemFromParsingName(m_files[index].c_str(), nullptr, IID_PPV_ARGS(shellItem)));
 }
 
 bool ShellNavigator::GetNext(IShellItem** shellItem)
 {
-    if (m_index < m_files.size() - 1)
+    TakeFiles();
+    *shellItem = nullptr;
+    while (m_index + 1 < m_files.size())
     {
         ++m_index;
-        *shellItem = m_files[m_index].new_ref();
-        return true;
+        m_searching = false;
+        if (GetFile(m_index, shellItem))
+            return true;
     }
-    *shellItem = nullptr;
     return false;
 }
 
 bool ShellNavigator::GetPrevious(IShellItem** shellItem)
 {
-    if (m_index > 0)
+    TakeFiles();
+    *shellItem = nullptr;
+    while (m_index > 0)
     {
         --m_index;
-        *shellItem = m_files[m_index].new_ref();
+        m_searching = false;
+        if (GetFile(m_index, shellItem))
+            return true;
+    }
+    return false;
+}
+
+bool ShellNavigator::GetNeighbour(ptrdiff_t offset, std::wstring& filename)
+{
+    TakeFiles();
+    if ((offset < 0 && static_cast<size_t>(-offset) <= m_index) ||
+        (offset >= 0 && static_cast<size_t>(offset) < m_files.size() - m_index))
+    {
+        filename = m_files[m_index + offset];
         return true;
     }
-    *shellItem = nullptr;
+    filename.clear();
     return false;
 }
+
+size_t ShellNavigator::GetFileCount()
+{
+    TakeFiles();
+    return m_files.size();
+}
+
+size_t ShellNavigator::GetCurrentIndex()
+{
+    TakeFiles();
+    return m_index;
+}
+
+bool ShellNavigator::GetFilename(size_t index, std::wstring& filename)
+{
+    TakeFiles();
+    if (index >= m_files.size())
+    {
+        filename.clear();
+        return false;
+    }
+    filename = m_files[index];
+    return true;
+}
+
+bool ShellNavigator::MoveTo(size_t index, IShellItem** shellItem)
+{
+    TakeFiles();
+    *shellItem = nullptr;
+    if (index >= m_files.size() || !GetFile(index, shellItem))
+        return false;
+    m_index = index;
+    m_searching = false;
+    return true;
+}
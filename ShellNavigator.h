@@ -1,23 +1,73 @@
 #pragma once
 #include "ComPtr.h"
 #include <shobjidl.h>
-#include <deque>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+// Lists the image files in the folder of the displayed file. The folder is
+// enumerated on a worker thread which publishes the files in batches, so
+// that navigation works before large folders are completely enumerated.
 class ShellNavigator
 {
 public:
     ShellNavigator();
     ~ShellNavigator();
-    void Reset(IShellItem* shellItem);
+
+    // Starts enumerating the folder of the item. The message is posted to
+    // the window whenever a batch of files was found.
+    void Reset(IShellItem* shellItem, HWND notifyWindow, UINT notifyMessage);
     bool GetNext(IShellItem** shellItem);
     bool GetPrevious(IShellItem** shellItem);
+
+    // Gets the path of the file at the given distance from the current file
+    // without moving to it
+    bool GetNeighbour(ptrdiff_t offset, std::wstring& filename);
+
+    // The files found so far, for the grid view. The index of a file stays
+    // the same while more files are found.
+    size_t GetFileCount();
+    size_t GetCurrentIndex();       // GetFileCount() until the current file is found
+    bool   GetFilename(size_t index, std::wstring& filename);
+
+    // Makes the file at the index the current file
+    bool   MoveTo(size_t index, IShellItem** shellItem);
 private:
     ShellNavigator(const ShellNavigator&) = delete;
     ShellNavigator& operator=(const ShellNavigator&) = delete;
 
-    std::wstring                   m_path;
-    std::deque<ComPtr<IShellItem>> m_files;
-    size_t                         m_index;
-};
+    struct File
+    {
+        std::wstring path;
+        std::wstring key;       // The lower case path
+    };
 
+    static const ULONG ENUM_BATCH_SIZE = 256;
+
+    static std::wstring MakeKey(const std::wstring& path);
+    static std::unordered_set<std::wstring> GetDecoderExtensions();
+
+    void Run(std::wstring folderPath, std::wstring currentKey);
+    void Stop();
+    void TakeFiles();
+    bool GetFile(size_t index, IShellItem** shellItem) const;
+
+    // Used by the UI thread only
+    std::vector<std::wstring>               m_files;
+    std::unordered_map<std::wstring, size_t> m_positions;   // Index of each file by key
+    std::wstring                            m_currentKey;
+    size_t                                  m_index;        // m_files.size() until the current file is found
+    bool                                    m_searching;    // Whether the current file was not yet found
+    HWND                                    m_notifyWindow;
+    UINT                                    m_notifyMessage;
+
+    std::mutex                              m_mutex;        // Protects m_found
+    std::vector<File>                       m_found;        // Files found but not yet taken by the UI thread
+    std::atomic<bool>                       m_stop;
+    std::atomic<bool>                       m_notified;     // Whether a notification is pending
+    std::thread                             m_thread;
+};
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "BatchConverter.h"
+#include "ZackTests.h"
+
+namespace {
+
+BatchConverter::Path MakePath(const std::string& text)
+{
+    return BatchConverter::Path(text.begin(), text.end());
+}
+
+// Runs the converter on the arguments without writing any file and returns
+// the sources and targets passed to the conversion, sorted by source
+bool RunConverter(const std::vector<std::string>& arguments, BatchConverter& converter,
+    std::vector<std::pair<BatchConverter::Path, BatchConverter::Path>>& conversions)
+{
+    std::vector<BatchConverter::Path> paths;
+    std::vector<const BatchConverter::Char*> argv;
+    for (const auto& argument : arguments)
+    {
+        paths.push_back(MakePath(argument));
+    }
+    for (const auto& path : paths)
+    {
+        argv.push_back(path.c_str());
+    }
+    if (!converter.ParseArguments(static_cast<int>(argv.size()), argv.data()))
+        return false;
+
+    std::mutex mutex;
+    conversions.clear();
+    bool result = converter.Run([&](const BatchConverter::Path& source, const BatchConverter::Path& target)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        conversions.push_back(std::make_pair(source, target));
+        return true;
+    });
+    std::sort(conversions.begin(), conversions.end());
+    return result;
+}
+
+}
+
+TEST_CASE(BatchConverterSkipsSameTargets)
+{
+    // random.gif and random.indices would both be written to random.tiff
+    BatchConverter converter;
+    std::vector<std::pair<BatchConverter::Path, BatchConverter::Path>> conversions;
+    CHECK(!RunConverter({
+        GetTestDataPath("random.*"),
+        GetTestDataPath("palette4.tif"),
+        "--format", "tiff",
+        "--directory", "converted",
+        "--workers", "3" }, converter, conversions));
+    CHECK(converter.getFileCount() == 3);
+    CHECK(converter.getConvertedCount() == 1);
+    REQUIRE(conversions.size() == 1);
+    CHECK(conversions[0].first == MakePath(GetTestDataPath("palette4.tif")));
+    CHECK(conversions[0].second.substr(0, 10) == MakePath("converted") + conversions[0].second[9]);
+    CHECK(conversions[0].second.substr(10) == MakePath("palette4.tiff"));
+
+    // Without the duplicates all files are converted next to the sources
+    CHECK(RunConverter({
+        GetTestDataPath("random.gif"),
+        GetTestDataPath("interlaced.gif"),
+        GetTestDataPath("*.gif"),
+        "--format", ".tiff" }, converter, conversions));
+    CHECK(converter.getConvertedCount() == 4);
+    REQUIRE(conversions.size() == 4);
+    CHECK(conversions[1].first == MakePath(GetTestDataPath("disposal.gif")));
+    CHECK(conversions[1].second == MakePath(GetTestDataPath("disposal.tiff")));
+}
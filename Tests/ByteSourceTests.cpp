@@ -0,0 +1,33 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ByteSource.h"
+#include "ZackTests.h"
+
+TEST_CASE(ByteSourceMapsOrReadsFile)
+{
+    std::vector<uint8_t> expected;
+    REQUIRE(ReadTestData("rgba-deflate-tiles.tif", expected));
+    std::string path = GetTestDataPath("rgba-deflate-tiles.tif");
+#ifdef _WIN32
+    std::wstring filename(path.begin(), path.end());
+#else
+    std::string filename = path;
+#endif
+
+    // Both ways give the same bytes
+    const bool allowMapping[] = { true, false };
+    for (bool mapping : allowMapping)
+    {
+        ByteSource source;
+        REQUIRE(source.Open(filename.c_str(), mapping));
+        CHECK(source.isMapped() == mapping);
+        REQUIRE(source.getSize() == expected.size());
+        CHECK(memcmp(source.getData(), expected.data(), expected.size()) == 0);
+        source.Close();
+        CHECK(source.getData() == nullptr && source.getSize() == 0 && !source.isMapped());
+    }
+
+    ByteSource missing;
+    CHECK(!missing.Open((filename + filename).c_str()));
+}
@@ -0,0 +1,599 @@
+# Writes the GIF, TIFF and zlib files of the unit tests and the pixels they
+# are expected to decode to. The files are written byte by byte with their
+# own LZW, PackBits and TIFF writers, so that every case the decoders handle
+# can be produced exactly, and the expected pixels are computed from the
+# source samples, not by the decoders under test. The GIFs and TIFFs are
+# read back with Pillow as a check of the writers.
+#
+# Usage: python3 Tests/Data/MakeTestData.py [output directory]
+
+import os
+import random
+import struct
+import sys
+import zlib
+
+from PIL import Image
+
+OUTPUT = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+
+
+def write(name, data):
+    with open(os.path.join(OUTPUT, name), 'wb') as file:
+        file.write(bytes(data))
+
+
+# Reference arithmetic of the PixelConverter
+def premultiply(color, alpha):
+    return (color * alpha + 127) // 255
+
+
+def narrow16(value):
+    return (value * 255 + 32767) // 65535
+
+
+def bgra(red, green, blue, alpha=255):
+    return bytes((premultiply(blue, alpha), premultiply(green, alpha), premultiply(red, alpha), alpha))
+
+
+# GIF
+
+def gif_lzw(indices, min_code_size):
+    """GIF LZW with codes of up to 12 bits, least significant bit first."""
+    clear_code = 1 << min_code_size
+    end_code = clear_code + 1
+    out = bytearray()
+    bits = 0
+    bit_count = 0
+
+    def emit(code, size):
+        nonlocal bits, bit_count
+        bits |= code << bit_count
+        bit_count += size
+        while bit_count >= 8:
+            out.append(bits & 0xFF)
+            bits >>= 8
+            bit_count -= 8
+
+    def reset():
+        return {bytes([i]): i for i in range(clear_code)}, end_code + 1, min_code_size + 1
+
+    table, next_code, size = reset()
+    emit(clear_code, size)
+    string = b''
+    for index in indices:
+        extended = string + bytes([index])
+        if extended in table:
+            string = extended
+            continue
+        emit(table[string], size)
+        if next_code < 4096:
+            table[extended] = next_code
+            next_code += 1
+            if next_code > (1 << size) and size < 12:
+                size += 1
+        else:
+            emit(clear_code, size)
+            table, next_code, size = reset()
+        string = bytes([index])
+    if string:
+        emit(table[string], size)
+    emit(end_code, size)
+    if bit_count > 0:
+        out.append(bits & 0xFF)
+    return bytes(out)
+
+
+def sub_blocks(data):
+    out = bytearray()
+    for i in range(0, len(data), 255):
+        chunk = data[i:i + 255]
+        out.append(len(chunk))
+        out += chunk
+    out.append(0)
+    return bytes(out)
+
+
+def palette_bits(colors):
+    bits = 1
+    while (1 << bits) < len(colors):
+        bits += 1
+    return bits
+
+
+def palette_bytes(colors, bits):
+    out = bytearray()
+    for color in colors:
+        out += bytes(color)
+    out += bytes(3 * ((1 << bits) - len(colors)))
+    return bytes(out)
+
+
+def interlaced_rows(height):
+    rows = []
+    for start, step in ((0, 8), (4, 8), (2, 4), (1, 2)):
+        rows += range(start, height, step)
+    return rows
+
+
+def make_gif(width, height, palette, frames, loop=None, background=0):
+    """Frames are dicts with left, top, width, height, indices and optionally
+    disposal, delay, transparent, interlaced and palette (local)."""
+    bits = palette_bits(palette)
+    out = bytearray(b'GIF89a')
+    out += struct.pack('<HHBBB', width, height, 0x80 | (bits - 1), background, 0)
+    out += palette_bytes(palette, bits)
+    if loop is not None:
+        out += b'\x21\xFF\x0BNETSCAPE2.0\x03\x01' + struct.pack('<H', loop) + b'\x00'
+    for frame in frames:
+        transparent = frame.get('transparent')
+        flags = frame.get('disposal', 0) << 2 | (1 if transparent is not None else 0)
+        out += b'\x21\xF9\x04' + struct.pack('<BHB', flags, frame.get('delay', 10) // 10, transparent or 0) + b'\x00'
+
+        local = frame.get('palette')
+        flags = 0
+        if local:
+            local_bits = palette_bits(local)
+            flags |= 0x80 | (local_bits - 1)
+        if frame.get('interlaced'):
+            flags |= 0x40
+        out += b'\x2C' + struct.pack('<HHHHB', frame['left'], frame['top'], frame['width'], frame['height'], flags)
+        if local:
+            out += palette_bytes(local, local_bits)
+
+        indices = frame['indices']
+        if frame.get('interlaced'):
+            rows = [indices[y * frame['width']:(y + 1) * frame['width']] for y in range(frame['height'])]
+            indices = b''.join(rows[y] for y in interlaced_rows(frame['height']))
+        min_code_size = max(2, palette_bits(local or palette))
+        out.append(min_code_size)
+        out += sub_blocks(gif_lzw(indices, min_code_size))
+    out += b'\x3B'
+    return bytes(out)
+
+
+def check_gif_indices(name, indices):
+    image = Image.open(os.path.join(OUTPUT, name))
+    assert image.tobytes() == indices, name
+
+
+def write_gifs():
+    rng = random.Random(3)
+
+    # Random indices of all 256 colors fill the code table and need clear codes
+    width, height = 61, 47
+    palette = [(i, 255 - i, i * 7 & 0xFF) for i in range(256)]
+    indices = bytes(rng.randrange(256) for _ in range(width * height))
+    write('random.gif', make_gif(width, height, palette, [
+        dict(left=0, top=0, width=width, height=height, indices=indices)]))
+    write('random.indices', indices)
+    check_gif_indices('random.gif', indices)
+
+    # Interlaced frame with a local palette of 4 colors and long runs, which
+    # build strings longer than a row
+    width, height = 23, 19
+    indices = bytes((x // 5 + y // 3) % 4 for y in range(height) for x in range(width))
+    write('interlaced.gif', make_gif(width, height, [(0, 0, 0), (255, 255, 255)], [
+        dict(left=0, top=0, width=width, height=height, indices=indices, interlaced=True,
+             palette=[(255, 0, 0), (0, 255, 0), (0, 0, 255), (255, 255, 0)])], loop=3))
+    write('interlaced.indices', indices)
+    check_gif_indices('interlaced.gif', indices)
+
+
+def compose_frames(width, height, palette, frames):
+    """Composes the frames the way the GIF specification describes it, on a
+    transparent canvas which is also the background of disposal method 2."""
+    canvas = bytearray(width * height * 4)
+    composed = []
+    for frame in frames:
+        left, top, frame_width, frame_height = frame['left'], frame['top'], frame['width'], frame['height']
+        saved = bytes(canvas)
+        colors = frame.get('palette') or palette
+        for y in range(frame_height):
+            for x in range(frame_width):
+                index = frame['indices'][y * frame_width + x]
+                if index != frame.get('transparent'):
+                    position = ((top + y) * width + left + x) * 4
+                    canvas[position:position + 4] = bgra(*colors[index])
+        composed.append(bytes(canvas))
+        if frame.get('disposal') == 2:
+            for y in range(top, top + frame_height):
+                canvas[(y * width + left) * 4:(y * width + left + frame_width) * 4] = bytes(frame_width * 4)
+        elif frame.get('disposal') == 3:
+            canvas[:] = saved
+    return composed
+
+
+def write_animation(name, width, height, palette, frames):
+    """Writes the animation and its composed frames. Pillow composes the
+    frames the same way until it disposes a frame to the background, which
+    it fills with the color of the transparent index instead of clearing."""
+    write(name + '.gif', make_gif(width, height, palette, frames, loop=0))
+    composed = compose_frames(width, height, palette, frames)
+    write(name + '.bgra', b''.join(composed))
+
+    image = Image.open(os.path.join(OUTPUT, name + '.gif'))
+    assert image.n_frames == len(frames), name
+    for i in range(len(frames)):
+        if i > 0 and frames[i - 1].get('disposal') == 2:
+            break
+        image.seek(i)
+        data = image.convert('RGBA').tobytes()
+        assert b''.join(bgra(*data[j:j + 4]) for j in range(0, len(data), 4)) == composed[i], name
+
+
+def rect_indices(width, height, function):
+    return bytes(function(x, y) for y in range(height) for x in range(width))
+
+
+def write_animations():
+    # Each disposal method after frames with holes of the transparent index,
+    # which let the frames below show through
+    palette = [(0, 0, 0), (255, 0, 0), (0, 255, 0), (0, 0, 255), (255, 255, 0), (0, 255, 255), (255, 0, 255), (255, 255, 255)]
+    width, height = 21, 17
+    write_animation('disposal', width, height, palette, [
+        # Full background, left in place
+        dict(left=0, top=0, width=width, height=height, disposal=1,
+             indices=rect_indices(width, height, lambda x, y: 1 + (x // 4 + y // 4) % 3)),
+        # Restored to the background above after it was shown
+        dict(left=3, top=2, width=9, height=7, disposal=3, transparent=0,
+             indices=rect_indices(9, 7, lambda x, y: 0 if (x + y) % 3 == 0 else 4)),
+        # Cleared to transparent pixels after it was shown
+        dict(left=8, top=6, width=11, height=8, disposal=2, transparent=5,
+             indices=rect_indices(11, 8, lambda x, y: 5 if x < 2 or y == 3 else 6)),
+        # Without a disposal method it stays, like disposal none
+        dict(left=1, top=9, width=6, height=8, disposal=0, transparent=0,
+             indices=rect_indices(6, 8, lambda x, y: 0 if x == y else 7)),
+        # Drawn over everything before, with a local palette
+        dict(left=14, top=0, width=7, height=17, disposal=1, transparent=2,
+             palette=[(10, 20, 30), (40, 50, 60), (0, 0, 0), (200, 100, 50)],
+             indices=rect_indices(7, 17, lambda x, y: 2 if y % 4 == 0 else (x + y) % 2 * 3)),
+    ])
+
+    # Frames with disposal previous in a row restore the canvas saved before
+    # each of them, and interlaced frames with local palettes blend the same
+    # way as the others
+    width, height = 16, 24
+    write_animation('blending', width, height, palette, [
+        dict(left=0, top=0, width=width, height=height, disposal=1, transparent=0,
+             indices=rect_indices(width, height, lambda x, y: 0 if x > 11 else 3)),
+        dict(left=2, top=2, width=10, height=20, disposal=3, transparent=1, interlaced=True,
+             palette=[(90, 80, 70), (0, 0, 0)],
+             indices=rect_indices(10, 20, lambda x, y: (x * y) % 3 == 0)),
+        dict(left=6, top=10, width=10, height=14, disposal=3, transparent=7,
+             indices=rect_indices(10, 14, lambda x, y: 7 if (x + y) % 2 else 2)),
+        dict(left=0, top=0, width=4, height=4, disposal=2, transparent=0,
+             indices=rect_indices(4, 4, lambda x, y: 6)),
+        dict(left=4, top=20, width=12, height=4, disposal=1,
+             indices=rect_indices(12, 4, lambda x, y: 1 + x % 7)),
+    ])
+
+
+# TIFF
+
+def tiff_lzw(data):
+    """TIFF LZW, most significant bit first, with codes growing one early."""
+    clear_code, end_code = 256, 257
+    out = bytearray()
+    bits = 0
+    bit_count = 0
+
+    def emit(code, size):
+        nonlocal bits, bit_count
+        bits = bits << size | code
+        bit_count += size
+        while bit_count >= 8:
+            out.append(bits >> (bit_count - 8) & 0xFF)
+            bit_count -= 8
+        bits &= (1 << bit_count) - 1
+
+    def reset():
+        return {bytes([i]): i for i in range(256)}, end_code + 1, 9
+
+    table, next_code, size = reset()
+    emit(clear_code, size)
+    string = b''
+    for byte in data:
+        extended = string + bytes([byte])
+        if extended in table:
+            string = extended
+            continue
+        emit(table[string], size)
+        table[extended] = next_code
+        next_code += 1
+        if next_code == 4094:
+            emit(clear_code, size)
+            table, next_code, size = reset()
+        elif next_code >= (1 << size) and size < 12:
+            size += 1
+        string = bytes([byte])
+    if string:
+        emit(table[string], size)
+        next_code += 1
+        if next_code >= (1 << size) and size < 12:
+            size += 1
+    emit(end_code, size)
+    if bit_count > 0:
+        out.append(bits << (8 - bit_count) & 0xFF)
+    return bytes(out)
+
+
+def packbits(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        run = 1
+        while i + run < len(data) and run < 128 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            out += bytes((257 - run, data[i]))
+            i += run
+            continue
+        start = i
+        while i < len(data) and i - start < 128:
+            if i + 2 < len(data) and data[i] == data[i + 1] == data[i + 2]:
+                break
+            i += 1
+        out.append(i - start - 1)
+        out += data[start:i]
+    return bytes(out)
+
+
+COMPRESSIONS = {'none': 1, 'lzw': 5, 'deflate': 8, 'packbits': 32773}
+
+
+def compress(data, compression):
+    if compression == 'lzw':
+        return tiff_lzw(data)
+    if compression == 'deflate':
+        return zlib.compress(data, 9)
+    if compression == 'packbits':
+        return packbits(data)
+    return data
+
+
+def pack_samples(samples, bits, order):
+    """Packs a row of samples to bytes, in the byte order of the file."""
+    if bits == 8:
+        return bytes(samples)
+    if bits == 16:
+        return b''.join(struct.pack(order + 'H', sample) for sample in samples)
+    out = bytearray()
+    per_byte = 8 // bits
+    for i in range(0, len(samples), per_byte):
+        byte = 0
+        for j, sample in enumerate(samples[i:i + per_byte]):
+            byte |= sample << (8 - bits * (j + 1))
+        out.append(byte)
+    return bytes(out)
+
+
+def encode_page(page, order):
+    """Returns the compressed blocks of the page. Samples are a list of rows
+    of interleaved samples."""
+    width, height, spp, bits = page['width'], page['height'], page['spp'], page['bits']
+    rows = page['samples']
+    if page.get('predictor') == 2:
+        mask = (1 << bits) - 1
+        rows = [[row[i] if i < spp else (row[i] - row[i - spp]) & mask for i in range(len(row))] for row in rows]
+
+    blocks = []
+    tile = page.get('tile')
+    if tile:
+        tile_width, tile_height = tile
+        for top in range(0, height, tile_height):
+            for left in range(0, width, tile_width):
+                data = bytearray()
+                for y in range(top, top + tile_height):
+                    row = rows[y][left * spp:(left + tile_width) * spp] if y < height else []
+                    row = list(row) + [0] * (tile_width * spp - len(row))
+                    data += pack_samples(row, bits, order)
+                blocks.append(data)
+    else:
+        rows_per_strip = page.get('rows_per_strip', height)
+        for top in range(0, height, rows_per_strip):
+            data = bytearray()
+            for y in range(top, min(height, top + rows_per_strip)):
+                data += pack_samples(rows[y], bits, order)
+            blocks.append(data)
+    return [compress(bytes(block), page.get('compression', 'none')) for block in blocks]
+
+
+def make_tiff(pages, order='<', big=False):
+    """Writes the pages with their directories after their blocks."""
+    out = bytearray((b'II' if order == '<' else b'MM'))
+    if big:
+        out += struct.pack(order + 'HHHQ', 43, 8, 0, 0)
+        next_position = 8
+    else:
+        out += struct.pack(order + 'HI', 42, 0)
+        next_position = 4
+
+    for page in pages:
+        blocks = encode_page(page, order)
+        offsets = []
+        for block in blocks:
+            offsets.append(len(out))
+            out += block
+            if len(out) % 2:
+                out.append(0)
+
+        entries = [
+            (256, 4, [page['width']]),
+            (257, 4, [page['height']]),
+            (258, 3, [page['bits']] * page['spp']),
+            (259, 3, [COMPRESSIONS[page.get('compression', 'none')]]),
+            (262, 3, [page['photometric']]),
+            (277, 3, [page['spp']]),
+        ]
+        if page.get('tile'):
+            entries += [
+                (322, 3, [page['tile'][0]]),
+                (323, 3, [page['tile'][1]]),
+                (324, 16 if big else 4, offsets),
+                (325, 4, [len(block) for block in blocks]),
+            ]
+        else:
+            entries += [
+                (273, 16 if big else 4, offsets),
+                (278, 4, [page.get('rows_per_strip', page['height'])]),
+                (279, 4, [len(block) for block in blocks]),
+            ]
+        if page.get('predictor'):
+            entries.append((317, 3, [page['predictor']]))
+        if page.get('colormap'):
+            entries.append((320, 3, page['colormap']))
+        if page.get('extra') is not None:
+            entries.append((338, 3, [page['extra']]))
+        entries.sort()
+
+        # Values which do not fit into the entries follow the directory
+        type_formats = {3: 'H', 4: 'I', 16: 'Q'}
+        inline_size = 8 if big else 4
+        entry_size = 20 if big else 12
+        count_size = 8 if big else 2
+        directory = len(out)
+        values_position = directory + count_size + len(entries) * entry_size + inline_size
+        directory_bytes = bytearray(struct.pack(order + ('Q' if big else 'H'), len(entries)))
+        values = bytearray()
+        for tag, type, items in entries:
+            data = b''.join(struct.pack(order + type_formats[type], item) for item in items)
+            directory_bytes += struct.pack(order + ('HHQ' if big else 'HHI'), tag, type, len(items))
+            if len(data) <= inline_size:
+                directory_bytes += data + bytes(inline_size - len(data))
+            else:
+                directory_bytes += struct.pack(order + ('Q' if big else 'I'), values_position + len(values))
+                values += data
+                if len(values) % 2:
+                    values.append(0)
+        out += directory_bytes
+        link_position = len(out)
+        out += bytes(inline_size)
+        out += values
+        struct.pack_into(order + ('Q' if big else 'I'), out, next_position, directory)
+        next_position = link_position
+    return bytes(out)
+
+
+def random_rows(rng, width, height, spp, bits, smooth=False):
+    """Rows of samples, smooth rows compress well with the predictor."""
+    top = (1 << bits) - 1
+    rows = []
+    for y in range(height):
+        if smooth:
+            rows.append([(x * 5 + y * 3 + s * 40) & top for x in range(width) for s in range(spp)])
+        else:
+            rows.append([rng.randrange(top + 1) for _ in range(width * spp)])
+    return rows
+
+
+def expected_pixels(page):
+    width, height, spp, bits = page['width'], page['height'], page['spp'], page['bits']
+    out = bytearray()
+    for row in page['samples']:
+        for x in range(width):
+            samples = row[x * spp:(x + 1) * spp]
+            if bits == 16:
+                samples = [narrow16(sample) for sample in samples]
+            elif bits < 8 and page['photometric'] != 3:
+                samples = [sample * (255 // ((1 << bits) - 1)) for sample in samples]
+            if page['photometric'] == 3:
+                colormap = page['colormap']
+                count = 1 << bits
+                index = samples[0]
+                out += bgra(colormap[index] >> 8, colormap[count + index] >> 8, colormap[2 * count + index] >> 8)
+            elif page['photometric'] in (0, 1):
+                gray = samples[0] if page['photometric'] == 1 else 255 - samples[0]
+                alpha = samples[1] if spp == 2 else 255
+                out += bgra(gray, gray, gray, alpha)
+            elif spp == 4 and page.get('extra') == 1:
+                alpha = samples[3]
+                out += bytes((min(samples[2], alpha), min(samples[1], alpha), min(samples[0], alpha), alpha))
+            else:
+                alpha = samples[3] if spp == 4 else 255
+                out += bgra(samples[0], samples[1], samples[2], alpha)
+    return bytes(out)
+
+
+def pillow_pixels(image):
+    """The pixels Pillow reads, in the format of the expected pixels."""
+    if image.mode.startswith('I;16'):
+        data = image.tobytes()
+        order = '>' if image.mode == 'I;16B' else '<'
+        values = struct.unpack('%s%dH' % (order, len(data) // 2), data)
+        return b''.join(bgra(narrow16(v), narrow16(v), narrow16(v)) for v in values)
+    if image.mode in ('L', 'P', 'RGB'):
+        data = image.convert('RGB').tobytes()
+        return b''.join(bgra(*data[i:i + 3]) for i in range(0, len(data), 3))
+    data = image.convert('RGBA').tobytes()
+    return b''.join(bgra(*data[i:i + 4]) for i in range(0, len(data), 4))
+
+
+def write_tiff(name, pages, order='<', big=False):
+    write(name, make_tiff(pages, order, big))
+    image = Image.open(os.path.join(OUTPUT, name))
+    for i, page in enumerate(pages):
+        pixels = expected_pixels(page)
+        write('%s.%d.bgra' % (os.path.splitext(name)[0], i), pixels)
+        image.seek(i)
+        assert pillow_pixels(image) == pixels, name
+
+
+def write_tiffs():
+    rng = random.Random(5)
+
+    # RGB in strips of 8 rows with LZW and the predictor, odd sizes
+    page = dict(width=37, height=29, spp=3, bits=8, photometric=2, compression='lzw', predictor=2, rows_per_strip=8)
+    page['samples'] = random_rows(rng, 37, 29, 3, 8, smooth=True)
+    write_tiff('rgb-lzw-predictor.tif', [page])
+
+    # Random gray in one strip with LZW fills the code table and needs clear codes
+    page = dict(width=96, height=64, spp=1, bits=8, photometric=1, compression='lzw')
+    page['samples'] = random_rows(rng, 96, 64, 1, 8)
+    write_tiff('gray-lzw.tif', [page])
+
+    # Straight RGBA in tiles of 16 with Deflate, the tiles on the right and
+    # bottom are cut off
+    page = dict(width=40, height=21, spp=4, bits=8, photometric=2, compression='deflate', extra=2, tile=(16, 16))
+    page['samples'] = random_rows(rng, 40, 21, 4, 8)
+    write_tiff('rgba-deflate-tiles.tif', [page])
+
+    # 16 bit gray in big endian order with PackBits
+    page = dict(width=19, height=13, spp=1, bits=16, photometric=1, compression='packbits', rows_per_strip=5)
+    page['samples'] = [[rng.choice((0, 65535, rng.randrange(65536))) for _ in range(19)] for _ in range(13)]
+    write_tiff('gray16-packbits-be.tif', [page], order='>')
+
+    # 4 bit palette without compression, rows end in the middle of a byte
+    colormap = [rng.randrange(65536) for _ in range(48)]
+    page = dict(width=11, height=7, spp=1, bits=4, photometric=3, colormap=colormap)
+    page['samples'] = random_rows(rng, 11, 7, 1, 4)
+    write_tiff('palette4.tif', [page])
+
+    # BigTIFF with three pages of different formats and sizes
+    pages = []
+    for width, height, spp, photometric in ((9, 6, 1, 0), (12, 5, 3, 2), (7, 8, 2, 1)):
+        page = dict(width=width, height=height, spp=spp, bits=8, photometric=photometric, compression='deflate')
+        if spp == 2:
+            page['extra'] = 2
+        page['samples'] = random_rows(rng, width, height, spp, 8)
+        pages.append(page)
+    write_tiff('bigtiff-pages.tif', pages, big=True)
+
+
+# zlib
+
+def write_zlib():
+    rng = random.Random(7)
+    text = b''.join(rng.choice((b'frame ', b'page ', b'pixel ', b'row ', bytes([rng.randrange(256)]))) for _ in range(3000))
+    write('text.raw', text)
+    write('text-stored.zlib', zlib.compress(text, 0))
+    write('text-dynamic.zlib', zlib.compress(text, 9))
+    compressor = zlib.compressobj(1, zlib.DEFLATED, 15, 9, zlib.Z_FIXED)
+    write('text-fixed.zlib', compressor.compress(text) + compressor.flush())
+
+
+if __name__ == '__main__':
+    write_gifs()
+    write_animations()
+    write_tiffs()
+    write_zlib()
@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "FrameCache.h"
+#include "FrameCompositor.h"
+#include "GifDecoder.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Plays an animation with the steps of the viewer: the first loop decodes
+// and composes each frame and caches the composed frame, the following
+// loops copy the changed area of the cached frames
+class AnimationPlayer
+{
+public:
+    explicit AnimationPlayer(GifDecoder& decoder) :
+        m_decoder(decoder),
+        m_cache(SIZE_MAX),
+        m_disposal(DM_NONE),
+        m_position(PixelRect::Empty()),
+        m_decodeCount(0)
+    {
+        m_compositor.Reset(decoder.getWidth(), decoder.getHeight());
+        m_cache.Reset(decoder.getFrameCount());
+    }
+
+    bool ShowFrame(unsigned int frameIndex)
+    {
+        if (frameIndex > 0 && !m_compositor.Dispose(m_disposal, m_position, 0))
+            return false;
+
+        FrameCache::Entry* cachedFrame = m_cache.Lookup(frameIndex);
+        if (cachedFrame)
+        {
+            const uint8_t* pixels = m_cache.GetPixels(frameIndex, cachedFrame->changedRect);
+            if (pixels == nullptr)
+                return false;
+            m_position = cachedFrame->framePosition;
+            m_disposal = cachedFrame->frameDisposal;
+            if (m_disposal == DM_PREVIOUS)
+            {
+                if (frameIndex == 0)
+                {
+                    m_compositor.Clear(0);
+                }
+                m_compositor.SaveCanvas(m_position);
+            }
+            m_compositor.Copy(pixels, m_compositor.getStride(), cachedFrame->changedRect);
+            m_compositor.TakeDirtyRect();
+            return true;
+        }
+
+        const GifFrame& frame = m_decoder.getFrame(frameIndex);
+        if (!m_decoder.ExpandFrame(frameIndex, m_pixels, nullptr))
+            return false;
+        ++m_decodeCount;
+
+        if (frameIndex == 0)
+        {
+            m_compositor.Clear(0);
+        }
+        m_position = PixelRect::Make(frame.left, frame.top, frame.width, frame.height);
+        m_disposal = static_cast<DISPOSAL_METHODS>(frame.disposal);
+        if (m_disposal == DM_PREVIOUS)
+        {
+            m_compositor.SaveCanvas(m_position);
+        }
+        m_compositor.Overlay(m_pixels.data(), m_pixels.getStride(), m_position);
+        m_cache.Insert(frameIndex, m_compositor, m_compositor.TakeDirtyRect(), m_position, 0, m_disposal);
+        return true;
+    }
+
+    const FrameCompositor& getCompositor()  const { return m_compositor; }
+    const FrameCache&      getCache()       const { return m_cache; }
+    unsigned int           getDecodeCount() const { return m_decodeCount; }
+
+private:
+    GifDecoder&      m_decoder;
+    FrameCompositor  m_compositor;
+    FrameCache       m_cache;
+    FrameBuffer      m_pixels;
+    DISPOSAL_METHODS m_disposal;
+    PixelRect        m_position;
+    unsigned int     m_decodeCount;
+};
+
+// Plays the animation twice and compares each shown frame with the
+// expected frames
+void CheckLoops(const char* name)
+{
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData(std::string(name) + ".gif", file) && ReadTestData(std::string(name) + ".bgra", expected));
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    unsigned int frameCount = decoder.getFrameCount();
+    size_t canvasSize = static_cast<size_t>(decoder.getWidth()) * decoder.getHeight() * 4;
+    REQUIRE(expected.size() == canvasSize * frameCount);
+
+    AnimationPlayer player(decoder);
+    for (unsigned int loop = 0; loop < 2; ++loop)
+    {
+        for (unsigned int i = 0; i < frameCount; ++i)
+        {
+            REQUIRE(player.ShowFrame(i));
+            CHECK(memcmp(player.getCompositor().getPixels(), expected.data() + i * canvasSize, canvasSize) == 0);
+        }
+
+        // Only the first loop decodes
+        CHECK(player.getDecodeCount() == frameCount);
+    }
+    CHECK(player.getCache().GetMissCount() == frameCount);
+    CHECK(player.getCache().GetHitCount() == frameCount);
+}
+
+}
+
+TEST_CASE(FrameCachePlaysSecondLoopWithoutDecoding)
+{
+    CheckLoops("disposal");
+    CheckLoops("blending");
+}
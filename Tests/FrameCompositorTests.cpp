@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "FrameCompositor.h"
+#include "GifDecoder.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Composes all frames of the animation with the steps of the viewer, with
+// or without skipping the transparent pixels, and compares each composed
+// frame with the expected frames
+void CheckAnimation(const char* name, CPU_KERNELS kernels, bool covered)
+{
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData(std::string(name) + ".gif", file) && ReadTestData(std::string(name) + ".bgra", expected));
+
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    size_t canvasSize = static_cast<size_t>(decoder.getWidth()) * decoder.getHeight() * 4;
+    REQUIRE(expected.size() == canvasSize * decoder.getFrameCount());
+
+    FrameCompositor compositor;
+    compositor.Reset(decoder.getWidth(), decoder.getHeight());
+    FrameBuffer pixels, coverage;
+    DISPOSAL_METHODS previousDisposal = DM_NONE;
+    PixelRect previousRect = PixelRect::Empty();
+    for (unsigned int i = 0; i < decoder.getFrameCount(); ++i)
+    {
+        const GifFrame& frame = decoder.getFrame(i);
+        PixelRect frameRect = PixelRect::Make(frame.left, frame.top, frame.width, frame.height);
+        if (i == 0)
+        {
+            compositor.Clear(0);
+        }
+        else
+        {
+            CHECK(compositor.Dispose(previousDisposal, previousRect, 0));
+        }
+        previousDisposal = static_cast<DISPOSAL_METHODS>(frame.disposal);
+        previousRect = frameRect;
+        if (previousDisposal == DM_PREVIOUS)
+        {
+            compositor.SaveCanvas(frameRect);
+        }
+
+        REQUIRE(decoder.ExpandFrame(i, pixels, covered ? &coverage : nullptr, kernels));
+        compositor.Overlay(
+            pixels.data(),
+            pixels.getStride(),
+            coverage.empty() ? nullptr : coverage.data(),
+            coverage.getStride(),
+            frameRect,
+            kernels);
+
+        bool same = memcmp(compositor.getPixels(), expected.data() + i * canvasSize, canvasSize) == 0;
+        if (!same)
+        {
+            fprintf(stderr, "%s: frame %u differs with %s kernels%s\n",
+                name, i, PixelConverter::getKernelsName(kernels), covered ? " and coverage" : "");
+        }
+        CHECK(same);
+    }
+}
+
+void CheckAnimation(const char* name)
+{
+    const CPU_KERNELS allKernels[] = { CK_SCALAR, CK_SSE2, CK_AVX2, CK_NEON };
+    for (CPU_KERNELS kernels : allKernels)
+    {
+        if (PixelConverter::isSupported(kernels))
+        {
+            CheckAnimation(name, kernels, false);
+            CheckAnimation(name, kernels, true);
+        }
+    }
+}
+
+}
+
+TEST_CASE(CompositorMatchesDisposalMethods)
+{
+    CheckAnimation("disposal");
+}
+
+TEST_CASE(CompositorMatchesBlendedInterlacedFrames)
+{
+    CheckAnimation("blending");
+}
+
+TEST_CASE(CompositorSkipsUncoveredPixels)
+{
+    // Pixels without coverage are neither read nor changed, and the dirty
+    // rectangle only holds the covered pixels
+    const unsigned int width = 37;
+    std::vector<uint8_t> pixels(width * 3 * 4, 0x80);
+    std::vector<uint8_t> coverage(width * 3, 0);
+    coverage[width + 5] = 0xFF;
+    for (unsigned int x = 12; x < 30; ++x)
+    {
+        coverage[2 * width + x] = 0xFF;
+    }
+
+    FrameCompositor compositor;
+    compositor.Reset(40, 10);
+    compositor.Clear(0xFF102030);
+    compositor.TakeDirtyRect();
+    compositor.Overlay(pixels.data(), width * 4, coverage.data(), width, PixelRect::Make(2, 4, width, 3));
+
+    PixelRect dirty = compositor.TakeDirtyRect();
+    CHECK(dirty.left == 7 && dirty.right == 32 && dirty.top == 5 && dirty.bottom == 7);
+    for (unsigned int y = 0; y < 10; ++y)
+    {
+        for (unsigned int x = 0; x < 40; ++x)
+        {
+            bool covered = y >= 4 && y < 7 && x >= 2 && x < 2 + width && coverage[(y - 4) * width + x - 2] != 0;
+            const uint8_t* pixel = compositor.getPixels() + (y * 40 + x) * 4;
+            CHECK(covered ? pixel[0] == 0x80 + 0x18 : pixel[0] == 0x30);
+        }
+    }
+
+    // An empty mask changes nothing
+    std::vector<uint8_t> empty(width * 3, 0);
+    compositor.Overlay(pixels.data(), width * 4, empty.data(), width, PixelRect::Make(2, 4, width, 3));
+    CHECK(compositor.TakeDirtyRect().isEmpty());
+}
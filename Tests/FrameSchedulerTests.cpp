@@ -0,0 +1,141 @@
+#include <chrono>
+#include <vector>
+#include "FrameScheduler.h"
+#include "ZackTests.h"
+
+namespace {
+
+const unsigned int FRAME_DELAY = 100;
+
+// A clock which only moves when the test moves it
+class FakeClock : public SchedulerClock
+{
+public:
+    FakeClock() : m_start(std::chrono::hours(1)), m_now(m_start) {}
+
+    TimePoint Now() const override { return m_now; }
+    void      Wait(unsigned int ms) { m_now += std::chrono::milliseconds(ms); }
+    void      Wait(std::chrono::microseconds time) { m_now += time; }
+
+    long long getMs(TimePoint time) const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time - m_start).count();
+    }
+
+private:
+    TimePoint m_start;
+    TimePoint m_now;
+};
+
+struct PresentedFrame
+{
+    unsigned int frameIndex;
+    long long    deadlineMs;
+    long long    shownMs;
+
+    bool operator==(const PresentedFrame& other) const
+    {
+        return frameIndex == other.frameIndex && deadlineMs == other.deadlineMs && shownMs == other.shownMs;
+    }
+};
+
+// Plays frames of FRAME_DELAY ms like the viewer, where composing each frame
+// takes the time given for it: the schedule starts when the first frame is
+// shown, the timer fires at the deadline and the frames which would be
+// replaced before they could be seen are composed but not shown
+std::vector<PresentedFrame> Play(FrameScheduler& scheduler, FakeClock& clock, const std::vector<unsigned int>& composeMs)
+{
+    std::vector<PresentedFrame> presented;
+    unsigned int frameIndex = 0;
+    clock.Wait(composeMs[0]);
+    scheduler.Start();
+    for (;;)
+    {
+        PresentedFrame frame = { frameIndex, clock.getMs(scheduler.getDeadline()), clock.getMs(clock.Now()) };
+        presented.push_back(frame);
+
+        scheduler.Advance(FRAME_DELAY);
+        clock.Wait(scheduler.getWaitMs());
+        if (++frameIndex >= composeMs.size())
+            break;
+
+        clock.Wait(composeMs[frameIndex]);
+        while (frameIndex + 1 < composeMs.size() && scheduler.ShouldDrop(FRAME_DELAY))
+        {
+            scheduler.Drop(FRAME_DELAY);
+            clock.Wait(composeMs[++frameIndex]);
+        }
+    }
+    return presented;
+}
+
+}
+
+TEST_CASE(SchedulerDropsFramesAfterStall)
+{
+    // Composing frame 2 takes 250 ms, so frames 2 and 3 would be replaced
+    // before they could be seen, and frame 4 is shown 50 ms late, still on
+    // the original schedule
+    FakeClock clock;
+    FrameScheduler scheduler(&clock);
+    scheduler.SetPolicy(CP_DROP, 10);
+    std::vector<PresentedFrame> presented = Play(scheduler, clock, { 0, 0, 250, 0, 0, 0, 0 });
+    const std::vector<PresentedFrame> expected = {
+        { 0, 0, 0 }, { 1, 100, 100 }, { 4, 400, 450 }, { 5, 500, 500 }, { 6, 600, 600 } };
+    CHECK(presented == expected);
+    CHECK(scheduler.getDroppedCount() == 2);
+    CHECK(scheduler.getStretchedCount() == 0);
+}
+
+TEST_CASE(SchedulerStretchesAfterStall)
+{
+    // Every frame is shown, and the frames after the late one are due one
+    // delay after it was shown
+    FakeClock clock;
+    FrameScheduler scheduler(&clock);
+    scheduler.SetPolicy(CP_STRETCH, 10);
+    CHECK(!scheduler.ShouldDrop(FRAME_DELAY));
+    std::vector<PresentedFrame> presented = Play(scheduler, clock, { 0, 0, 250, 0, 0, 0, 0 });
+    const std::vector<PresentedFrame> expected = {
+        { 0, 0, 0 }, { 1, 100, 100 }, { 2, 200, 450 }, { 3, 450, 450 },
+        { 4, 550, 550 }, { 5, 650, 650 }, { 6, 750, 750 } };
+    CHECK(presented == expected);
+    CHECK(scheduler.getDroppedCount() == 0);
+    CHECK(scheduler.getStretchedCount() == 1);
+}
+
+TEST_CASE(SchedulerMakesUpLatenessWithinTolerance)
+{
+    // Composing frames 1 and 2 makes them 8 ms late, which the shorter
+    // waits make up, so neither policy changes the schedule
+    const CATCH_UP_POLICIES policies[] = { CP_DROP, CP_STRETCH };
+    for (CATCH_UP_POLICIES policy : policies)
+    {
+        FakeClock clock;
+        FrameScheduler scheduler(&clock);
+        scheduler.SetPolicy(policy, 10);
+        std::vector<PresentedFrame> presented = Play(scheduler, clock, { 5, 8, 8, 0 });
+        const std::vector<PresentedFrame> expected = {
+            { 0, 5, 5 }, { 1, 105, 113 }, { 2, 205, 213 }, { 3, 305, 305 } };
+        CHECK(presented == expected);
+        CHECK(scheduler.getDroppedCount() == 0);
+        CHECK(scheduler.getStretchedCount() == 0);
+    }
+}
+
+TEST_CASE(SchedulerRoundsWaitUp)
+{
+    FakeClock clock;
+    FrameScheduler scheduler(&clock);
+    scheduler.Start();
+    CHECK(scheduler.isRunning());
+    CHECK(scheduler.getWaitMs() == 0);
+    scheduler.Advance(20);
+    CHECK(scheduler.getWaitMs() == 20);
+    clock.Wait(std::chrono::microseconds(18500));
+    CHECK(scheduler.getWaitMs() == 2);
+    clock.Wait(std::chrono::microseconds(1000));
+    CHECK(scheduler.getWaitMs() == 1);
+    clock.Wait(5);
+    CHECK(scheduler.getWaitMs() == 0);
+}
@@ -0,0 +1,98 @@
+#include <cstring>
+#include <vector>
+#include "GifDecoder.h"
+#include "ZackTests.h"
+
+TEST_CASE(GifDecodesRandomIndices)
+{
+    // All 256 colors in random order fill the code table several times
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData("random.gif", file) && ReadTestData("random.indices", expected));
+
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.getWidth() == 61);
+    CHECK(decoder.getHeight() == 47);
+    CHECK(decoder.hasGlobalPalette());
+    CHECK(!decoder.hasLoop());
+    REQUIRE(decoder.getFrameCount() == 1);
+
+    const GifFrame& frame = decoder.getFrame(0);
+    CHECK(frame.width == 61 && frame.height == 47);
+    CHECK(!frame.interlaced && !frame.hasTransparency);
+    CHECK(frame.localColorCount == 0);
+
+    unsigned int colorCount = 0;
+    const uint8_t* palette = decoder.getFramePalette(0, colorCount);
+    REQUIRE(palette && colorCount == 256);
+    CHECK(palette[3 * 200] == 200 && palette[3 * 200 + 1] == 55);
+
+    // Rows wider than the frame keep the bytes after it
+    const size_t stride = 64;
+    std::vector<uint8_t> indices(stride * 47, 0xEE);
+    REQUIRE(decoder.DecodeFrame(0, indices.data(), stride));
+    for (unsigned int y = 0; y < 47; ++y)
+    {
+        CHECK(memcmp(indices.data() + y * stride, expected.data() + y * 61, 61) == 0);
+        CHECK(indices[y * stride + 61] == 0xEE);
+    }
+}
+
+TEST_CASE(GifDecodesInterlacedFrameWithLocalPalette)
+{
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData("interlaced.gif", file) && ReadTestData("interlaced.indices", expected));
+
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.hasLoop() && decoder.getLoopCount() == 3);
+    REQUIRE(decoder.getFrameCount() == 1);
+    const GifFrame& frame = decoder.getFrame(0);
+    CHECK(frame.interlaced);
+    CHECK(frame.localColorCount == 4);
+
+    unsigned int colorCount = 0;
+    const uint8_t* palette = decoder.getFramePalette(0, colorCount);
+    REQUIRE(palette && colorCount == 4);
+    CHECK(palette[6] == 0 && palette[7] == 0 && palette[8] == 255);
+
+    std::vector<uint8_t> indices(expected.size());
+    REQUIRE(decoder.DecodeFrame(0, indices.data(), 23));
+    CHECK(indices == expected);
+}
+
+TEST_CASE(GifFillsTruncatedFrame)
+{
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData("random.gif", file) && ReadTestData("random.indices", expected));
+
+    // The pixels after the end of the data are set to index 0
+    file.resize(file.size() / 2);
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    REQUIRE(decoder.getFrameCount() == 1);
+    std::vector<uint8_t> indices(expected.size(), 0xEE);
+    REQUIRE(decoder.DecodeFrame(0, indices.data(), 61));
+
+    size_t decoded = 0;
+    while (decoded < indices.size() && indices[decoded] == expected[decoded])
+    {
+        ++decoded;
+    }
+    CHECK(decoded > expected.size() / 4);
+    CHECK(decoded < expected.size());
+    for (size_t i = decoded + 16; i < indices.size(); ++i)
+    {
+        CHECK(indices[i] == 0);
+    }
+}
+
+TEST_CASE(GifRejectsInvalidFiles)
+{
+    const uint8_t notGif[] = "PNG not a GIF";
+    GifDecoder decoder;
+    CHECK(!decoder.Open(notGif, sizeof(notGif)));
+    CHECK(!decoder.Open(notGif, 0));
+    CHECK(decoder.getFrameCount() == 0);
+    CHECK(!decoder.DecodeFrame(0, nullptr, 0));
+}
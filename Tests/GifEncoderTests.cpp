@@ -0,0 +1,299 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "FrameCompositor.h"
+#include "GifDecoder.h"
+#include "GifEncoder.h"
+#include "ZackTests.h"
+
+namespace {
+
+typedef std::vector<uint8_t> Image;
+
+// Opaque colors which differ in every channel, so that frames of no more
+// colors than a palette holds are written without loss
+uint32_t GetColor(unsigned int index)
+{
+    return 0xFF000000u | ((index * 37 + 11) & 0xFF) << 16 | ((index * 101 + 7) & 0xFF) << 8 | ((index * 59) & 0xFF);
+}
+
+void SetPixel(Image& image, unsigned int width, unsigned int x, unsigned int y, uint32_t color)
+{
+    memcpy(&image[(static_cast<size_t>(y) * width + x) * 4], &color, sizeof(color));
+}
+
+Image MakeRandomImage(unsigned int width, unsigned int height, unsigned int colorCount, std::mt19937& random)
+{
+    Image image(static_cast<size_t>(width) * height * 4);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            SetPixel(image, width, x, y, GetColor(random() % colorCount));
+        }
+    }
+    return image;
+}
+
+// Writes the frames with the encoder and reads the file back
+bool EncodeFrames(
+    unsigned int width,
+    unsigned int height,
+    const std::vector<Image>& frames,
+    const std::vector<unsigned int>& delays,
+    std::vector<uint8_t>& file,
+    unsigned int& frameCount)
+{
+    const char* directory = getenv("TMPDIR");
+    std::string tempFile = std::string(directory && *directory ? directory : "/tmp") + "/ZackTests.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return false;
+    close(descriptor);
+
+    GifEncoder encoder;
+    bool result = encoder.Open(tempFile.c_str(), width, height, 3);
+    for (size_t i = 0; i < frames.size() && result; ++i)
+    {
+        result = encoder.AddFrame(frames[i].data(), static_cast<size_t>(width) * 4, delays[i]);
+    }
+    result = encoder.Close() && result;
+    frameCount = encoder.getFrameCount();
+    uint64_t size = encoder.getSize();
+
+    FILE* input = fopen(tempFile.c_str(), "rb");
+    file.resize(static_cast<size_t>(size));
+    result = result && input != nullptr && fread(file.data(), 1, file.size(), input) == file.size() && fgetc(input) == EOF;
+    if (input != nullptr)
+    {
+        fclose(input);
+    }
+    remove(tempFile.c_str());
+    return result;
+}
+
+// Composes the frames of the file with the steps of the viewer
+bool ComposeFrames(GifDecoder& decoder, std::vector<Image>& composed)
+{
+    FrameCompositor compositor;
+    compositor.Reset(decoder.getWidth(), decoder.getHeight());
+    compositor.Clear(0);
+    FrameBuffer pixels, coverage;
+    composed.clear();
+    for (unsigned int i = 0; i < decoder.getFrameCount(); ++i)
+    {
+        const GifFrame& frame = decoder.getFrame(i);
+        PixelRect frameRect = PixelRect::Make(frame.left, frame.top, frame.width, frame.height);
+        if (!decoder.ExpandFrame(i, pixels, &coverage))
+            return false;
+        compositor.Overlay(
+            pixels.data(),
+            pixels.getStride(),
+            coverage.empty() ? nullptr : coverage.data(),
+            coverage.getStride(),
+            frameRect);
+        const uint8_t* canvas = compositor.getPixels();
+        composed.push_back(Image(canvas, canvas + compositor.getStride() * compositor.getHeight()));
+        if (!compositor.Dispose(static_cast<DISPOSAL_METHODS>(frame.disposal), frameRect, 0))
+            return false;
+    }
+    return true;
+}
+
+// Encodes the frames, decodes them again and compares the composed frames
+// with the frames which were not repeats of the one before
+void CheckRoundTrip(unsigned int width, unsigned int height, const std::vector<Image>& frames, GifDecoder& decoder, std::vector<uint8_t>& file)
+{
+    std::vector<unsigned int> delays(frames.size(), 40);
+    unsigned int frameCount = 0;
+    REQUIRE(EncodeFrames(width, height, frames, delays, file, frameCount));
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.getWidth() == width && decoder.getHeight() == height);
+    CHECK(decoder.getLoopCount() == 3);
+    REQUIRE(decoder.getFrameCount() == frameCount);
+
+    std::vector<Image> composed;
+    REQUIRE(ComposeFrames(decoder, composed));
+    unsigned int frameIndex = 0;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        if (i > 0 && frames[i] == frames[i - 1])
+            continue;
+        REQUIRE(frameIndex < composed.size());
+        bool same = composed[frameIndex] == frames[i];
+        if (!same)
+        {
+            fprintf(stderr, "Frame %u of %u x %u differs after the round trip\n", frameIndex, width, height);
+        }
+        CHECK(same);
+        ++frameIndex;
+    }
+    CHECK(frameIndex == frameCount);
+}
+
+void CheckRoundTrip(unsigned int width, unsigned int height, const std::vector<Image>& frames)
+{
+    GifDecoder decoder;
+    std::vector<uint8_t> file;
+    CheckRoundTrip(width, height, frames, decoder, file);
+}
+
+}
+
+TEST_CASE(GifEncoderRoundTripsFramesOfEverySize)
+{
+    // Single rows of every length up to where the codes are 10 bits wide,
+    // so that the code size grows at every possible place and the last
+    // code and the end code fall on every side of it, with the smallest
+    // and larger palettes
+    std::mt19937 random(17);
+    const unsigned int colorCounts[] = { 1, 2, 3, 4, 5, 17, 255 };
+    for (unsigned int width = 1; width <= 700; ++width)
+    {
+        unsigned int colorCount = colorCounts[width % 7];
+        CheckRoundTrip(width, 1, { MakeRandomImage(width, 1, colorCount, random) });
+    }
+}
+
+TEST_CASE(GifEncoderRoundTripsFullCodeTables)
+{
+    // Frames large enough to fill the 4096 codes of the table many times,
+    // which starts the strings over with a clear code, for random pixels of
+    // few and many colors and for long runs of the same pixels
+    std::mt19937 random(23);
+    CheckRoundTrip(256, 256, { MakeRandomImage(256, 256, 3, random) });
+    CheckRoundTrip(300, 200, { MakeRandomImage(300, 200, 255, random) });
+    for (unsigned int width = 4000; width <= 4200; width += 13)
+    {
+        CheckRoundTrip(width, 3, { MakeRandomImage(width, 3, 2, random) });
+    }
+
+    Image runs(640 * 480 * 4);
+    for (unsigned int y = 0; y < 480; ++y)
+    {
+        for (unsigned int x = 0; x < 640; ++x)
+        {
+            SetPixel(runs, 640, x, y, GetColor((x / 40 + y / 30) % 6));
+        }
+    }
+    CheckRoundTrip(640, 480, { runs });
+}
+
+TEST_CASE(GifEncoderWritesChangedRectangles)
+{
+    // Each frame after the first only holds the rectangle which changed,
+    // drawn over the frame before
+    std::mt19937 random(5);
+    const unsigned int width = 64;
+    const unsigned int height = 48;
+    std::vector<Image> frames = { MakeRandomImage(width, height, 40, random) };
+    frames.push_back(frames.back());
+    for (unsigned int y = 10; y < 20; ++y)
+    {
+        for (unsigned int x = 30; x < 37; ++x)
+        {
+            SetPixel(frames.back(), width, x, y, GetColor((x + y) % 3 + 100));
+        }
+    }
+    frames.push_back(frames.back());
+    SetPixel(frames.back(), width, 63, 47, GetColor(200));
+
+    GifDecoder decoder;
+    std::vector<uint8_t> file;
+    CheckRoundTrip(width, height, frames, decoder, file);
+    REQUIRE(decoder.getFrameCount() == 3);
+    const GifFrame& first = decoder.getFrame(0);
+    CHECK(first.left == 0 && first.top == 0 && first.width == width && first.height == height);
+    const GifFrame& second = decoder.getFrame(1);
+    CHECK(second.left == 30 && second.top == 10 && second.width == 7 && second.height == 10);
+    const GifFrame& third = decoder.getFrame(2);
+    CHECK(third.left == 63 && third.top == 47 && third.width == 1 && third.height == 1);
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        const GifFrame& frame = decoder.getFrame(i);
+        CHECK(frame.disposal == DM_NONE && frame.hasGraphicControl && frame.hasTransparency);
+        CHECK(frame.delay == 40 && frame.localColorCount > 0);
+    }
+}
+
+TEST_CASE(GifEncoderExtendsRepeatedFrames)
+{
+    // A repeated frame adds its delay to the frame before instead of being
+    // written, also as the last frame
+    std::mt19937 random(9);
+    const unsigned int width = 20;
+    const unsigned int height = 10;
+    Image first = MakeRandomImage(width, height, 8, random);
+    Image second = MakeRandomImage(width, height, 8, random);
+    std::vector<Image> frames = { first, first, first, second, second, first };
+    std::vector<unsigned int> delays = { 30, 40, 50, 100, 20, 70 };
+
+    std::vector<uint8_t> file;
+    unsigned int frameCount = 0;
+    REQUIRE(EncodeFrames(width, height, frames, delays, file, frameCount));
+    CHECK(frameCount == 3);
+    GifDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    REQUIRE(decoder.getFrameCount() == 3);
+    CHECK(decoder.getFrame(0).delay == 120);
+    CHECK(decoder.getFrame(1).delay == 120);
+    CHECK(decoder.getFrame(2).delay == 70);
+
+    std::vector<Image> composed;
+    REQUIRE(ComposeFrames(decoder, composed));
+    CHECK(composed[0] == first && composed[1] == second && composed[2] == first);
+}
+
+TEST_CASE(GifEncoderClearsToTransparentPixels)
+{
+    // Pixels which become transparent need the frame before to be disposed
+    // to the background, and the whole next frame is written over the
+    // cleared canvas
+    const unsigned int width = 16;
+    const unsigned int height = 12;
+    std::vector<Image> frames(5, Image(width * height * 4, 0));
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            // An opaque frame, one with a transparent hole, one which only
+            // adds pixels, one with nothing left and a transparent one
+            SetPixel(frames[0], width, x, y, GetColor(x + y));
+            if (x < 4 || x >= 8 || y < 3 || y >= 9)
+            {
+                SetPixel(frames[1], width, x, y, GetColor(x + y + 1));
+            }
+            if (x < 2 || y < 2)
+            {
+                SetPixel(frames[3], width, x, y, GetColor(x * y));
+            }
+        }
+    }
+    frames[2] = frames[1];
+    SetPixel(frames[2], width, 5, 5, GetColor(3));
+    SetPixel(frames[2], width, 6, 7, GetColor(4));
+
+    GifDecoder decoder;
+    std::vector<uint8_t> file;
+    CheckRoundTrip(width, height, frames, decoder, file);
+    REQUIRE(decoder.getFrameCount() == 5);
+    const DISPOSAL_METHODS disposals[] = { DM_BACKGROUND, DM_NONE, DM_BACKGROUND, DM_BACKGROUND, DM_NONE };
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        CHECK(decoder.getFrame(i).disposal == static_cast<unsigned int>(disposals[i]));
+    }
+
+    // The frames after a clear cover the whole canvas, except for the
+    // transparent one, which has nothing to draw and is a single pixel
+    for (unsigned int i = 1; i < 4; ++i)
+    {
+        const GifFrame& frame = decoder.getFrame(i);
+        CHECK(frame.left == 0 && frame.top == 0 && frame.width == width && frame.height == height);
+    }
+    const GifFrame& last = decoder.getFrame(4);
+    CHECK(last.left == 0 && last.top == 0 && last.width == 1 && last.height == 1);
+}
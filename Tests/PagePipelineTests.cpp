@@ -0,0 +1,222 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "PagePipeline.h"
+#include "ZackTests.h"
+
+namespace {
+
+// The pages in the slots of the owner, and the stages which count what is
+// decoded and encoded. A slot holds one page at a time.
+struct PageSlots
+{
+    explicit PageSlots(unsigned int slotCount) :
+        pages(slotCount, -1),
+        held(slotCount),
+        decodedCount(0),
+        liveCount(0),
+        peakLiveCount(0),
+        outOfOrderCount(0),
+        sharedCount(0)
+    {
+    }
+
+    bool Decode(unsigned int pageIndex, unsigned int slot)
+    {
+        if (slot >= pages.size() || held[slot].exchange(true))
+        {
+            ++sharedCount;
+            return false;
+        }
+        pages[slot] = static_cast<int>(pageIndex);
+        unsigned int live = ++liveCount;
+        unsigned int peak = peakLiveCount;
+        while (live > peak && !peakLiveCount.compare_exchange_weak(peak, live))
+        {
+        }
+        ++decodedCount;
+        return true;
+    }
+
+    bool Encode(unsigned int pageIndex, unsigned int slot)
+    {
+        if (slot >= pages.size() || pages[slot] != static_cast<int>(pageIndex))
+        {
+            ++outOfOrderCount;
+        }
+        --liveCount;
+        held[slot] = false;
+        return true;
+    }
+
+    std::vector<int>               pages;
+    std::vector<std::atomic<bool>> held;
+    std::atomic<unsigned int>      decodedCount;
+    std::atomic<unsigned int>      liveCount;
+    std::atomic<unsigned int>      peakLiveCount;
+    std::atomic<unsigned int>      outOfOrderCount;
+    std::atomic<unsigned int>      sharedCount;
+};
+
+}
+
+TEST_CASE(PagePipelineEncodesInOrder)
+{
+    const unsigned int SLOT_COUNT = 3;
+    const unsigned int PAGE_COUNT = 500;
+    PagePipeline pipeline(SLOT_COUNT);
+    CHECK(pipeline.getSlotCount() == SLOT_COUNT);
+
+    // Run twice, a reset pipeline starts over
+    for (unsigned int run = 0; run < 2; ++run)
+    {
+        PageSlots slots(SLOT_COUNT);
+        pipeline.Reset(PAGE_COUNT);
+        bool decoded = false;
+        std::thread decodeThread([&]
+        {
+            decoded = pipeline.Decode([&](unsigned int pageIndex, unsigned int slot)
+            {
+                return slots.Decode(pageIndex, slot);
+            });
+        });
+        bool encoded = pipeline.Encode([&](unsigned int pageIndex, unsigned int slot)
+        {
+            if (pageIndex == 0)
+            {
+                // The decoder fills every slot while the first page is
+                // encoded, and then waits however long the encoder takes
+                while (slots.decodedCount < SLOT_COUNT)
+                {
+                    std::this_thread::yield();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                CHECK(slots.decodedCount == SLOT_COUNT);
+            }
+            else if (pageIndex % 7 == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            return slots.Encode(pageIndex, slot);
+        });
+        decodeThread.join();
+
+        CHECK(decoded && encoded);
+        CHECK(!pipeline.isCancelled() && !pipeline.hasFailed());
+        CHECK(pipeline.getEncodedCount() == PAGE_COUNT);
+        CHECK(slots.decodedCount == PAGE_COUNT);
+        CHECK(slots.outOfOrderCount == 0);
+        CHECK(slots.sharedCount == 0);
+
+        // Memory does not grow with the pages: no more pages are alive at
+        // once than there are slots
+        CHECK(pipeline.getPeakSlotCount() == SLOT_COUNT);
+        CHECK(slots.peakLiveCount <= SLOT_COUNT);
+        CHECK(slots.liveCount == 0);
+    }
+}
+
+TEST_CASE(PagePipelineStopsOnCancel)
+{
+    const unsigned int SLOT_COUNT = 2;
+    const unsigned int PAGE_COUNT = 100;
+    PagePipeline pipeline(SLOT_COUNT);
+    PageSlots slots(SLOT_COUNT);
+    pipeline.Reset(PAGE_COUNT);
+    bool decoded = true;
+    std::thread decodeThread([&]
+    {
+        decoded = pipeline.Decode([&](unsigned int pageIndex, unsigned int slot)
+        {
+            return slots.Decode(pageIndex, slot);
+        });
+    });
+
+    // The page being encoded is finished, then both threads stop
+    bool encoded = pipeline.Encode([&](unsigned int pageIndex, unsigned int slot)
+    {
+        if (pageIndex == 10)
+        {
+            pipeline.Cancel();
+        }
+        return slots.Encode(pageIndex, slot);
+    });
+    decodeThread.join();
+
+    CHECK(!decoded && !encoded);
+    CHECK(pipeline.isCancelled() && !pipeline.hasFailed());
+    CHECK(pipeline.getEncodedCount() == 11);
+    CHECK(slots.decodedCount <= 11 + SLOT_COUNT);
+    CHECK(slots.outOfOrderCount == 0);
+    CHECK(pipeline.getPeakSlotCount() <= SLOT_COUNT);
+
+    // A cancel before the threads start stops them before the first page
+    pipeline.Reset(PAGE_COUNT);
+    pipeline.Cancel();
+    unsigned int stageCount = 0;
+    CHECK(!pipeline.Decode([&](unsigned int, unsigned int) { ++stageCount; return true; }));
+    CHECK(!pipeline.Encode([&](unsigned int, unsigned int) { ++stageCount; return true; }));
+    CHECK(stageCount == 0);
+    CHECK(pipeline.getEncodedCount() == 0);
+}
+
+TEST_CASE(PagePipelineStopsAtFailingStage)
+{
+    const unsigned int SLOT_COUNT = 2;
+    const unsigned int PAGE_COUNT = 50;
+    const unsigned int FAILING_PAGE = 7;
+    PagePipeline pipeline(SLOT_COUNT);
+
+    // A page which cannot be decoded, the pages before it may be dropped
+    // without being encoded
+    {
+        PageSlots slots(SLOT_COUNT);
+        pipeline.Reset(PAGE_COUNT);
+        bool decoded = true;
+        std::thread decodeThread([&]
+        {
+            decoded = pipeline.Decode([&](unsigned int pageIndex, unsigned int slot)
+            {
+                return pageIndex != FAILING_PAGE && slots.Decode(pageIndex, slot);
+            });
+        });
+        bool encoded = pipeline.Encode([&](unsigned int pageIndex, unsigned int slot)
+        {
+            return slots.Encode(pageIndex, slot);
+        });
+        decodeThread.join();
+
+        CHECK(!decoded && !encoded);
+        CHECK(pipeline.hasFailed() && !pipeline.isCancelled());
+        CHECK(slots.decodedCount == FAILING_PAGE);
+        CHECK(pipeline.getEncodedCount() <= FAILING_PAGE);
+        CHECK(slots.outOfOrderCount == 0);
+    }
+
+    // A page which cannot be encoded stops the decoder waiting for a slot
+    {
+        PageSlots slots(SLOT_COUNT);
+        pipeline.Reset(PAGE_COUNT);
+        bool decoded = true;
+        std::thread decodeThread([&]
+        {
+            decoded = pipeline.Decode([&](unsigned int pageIndex, unsigned int slot)
+            {
+                return slots.Decode(pageIndex, slot);
+            });
+        });
+        bool encoded = pipeline.Encode([&](unsigned int pageIndex, unsigned int slot)
+        {
+            return pageIndex != FAILING_PAGE && slots.Encode(pageIndex, slot);
+        });
+        decodeThread.join();
+
+        CHECK(!decoded && !encoded);
+        CHECK(pipeline.hasFailed() && !pipeline.isCancelled());
+        CHECK(pipeline.getEncodedCount() == FAILING_PAGE);
+        CHECK(slots.decodedCount <= FAILING_PAGE + SLOT_COUNT);
+        CHECK(slots.outOfOrderCount == 0);
+        CHECK(pipeline.getPeakSlotCount() <= SLOT_COUNT);
+    }
+}
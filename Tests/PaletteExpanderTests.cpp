@@ -0,0 +1,112 @@
+#include <cstring>
+#include <vector>
+#include "PaletteExpander.h"
+#include "ZackTests.h"
+
+TEST_CASE(PaletteExpanderWritesCoverage)
+{
+    // A full palette with one transparent index, which the kernels compare
+    uint8_t rgb[3 * 256];
+    for (unsigned int i = 0; i < sizeof(rgb); ++i)
+    {
+        rgb[i] = static_cast<uint8_t>(i * 5);
+    }
+    PaletteExpander palette;
+    palette.SetPalette(rgb, 256, 2);
+    CHECK(palette.hasTransparency());
+
+    // Widths around the 16 and 8 pixels of the kernels
+    const CPU_KERNELS allKernels[] = { CK_SCALAR, CK_SSE2, CK_AVX2, CK_NEON };
+    for (CPU_KERNELS kernels : allKernels)
+    {
+        if (!PixelConverter::isSupported(kernels))
+            continue;
+        for (size_t width = 1; width < 40; ++width)
+        {
+            std::vector<uint8_t> indices(width);
+            size_t expectedVisible = 0;
+            for (size_t x = 0; x < width; ++x)
+            {
+                indices[x] = static_cast<uint8_t>((x * 7 + width) % 5 * 60);
+                expectedVisible += indices[x] != 2 ? 1 : 0;
+            }
+            std::vector<uint8_t> pixels(width * 4 + 4, 0xEE);
+            std::vector<uint8_t> coverage(width + 1, 0xEE);
+            CHECK(palette.ExpandRow(indices.data(), pixels.data(), coverage.data(), width, kernels) == expectedVisible);
+            for (size_t x = 0; x < width; ++x)
+            {
+                uint32_t color;
+                memcpy(&color, pixels.data() + x * 4, 4);
+                CHECK(color == palette.getTable()[indices[x]]);
+                CHECK(coverage[x] == (indices[x] != 2 ? 0xFF : 0));
+            }
+            CHECK(coverage[width] == 0xEE && pixels[width * 4] == 0xEE);
+        }
+    }
+}
+
+TEST_CASE(PaletteExpanderComparesIndexOfShortPalette)
+{
+    // The entries past a short GIF palette do not count as transparent, so
+    // the kernels compare the one transparent index. They expand to 0, which
+    // blends as a no-op.
+    uint8_t rgb[3 * 16];
+    for (unsigned int i = 0; i < sizeof(rgb); ++i)
+    {
+        rgb[i] = static_cast<uint8_t>(i * 5 + 1);
+    }
+    PaletteExpander palette;
+    palette.SetPalette(rgb, 16, 3);
+    CHECK(palette.getTransparentIndex() == 3);
+    CHECK(palette.getTable()[3] == 0 && palette.getTable()[16] == 0 && palette.getTable()[255] == 0);
+
+    const CPU_KERNELS allKernels[] = { CK_SCALAR, CK_SSE2, CK_AVX2, CK_NEON };
+    for (CPU_KERNELS kernels : allKernels)
+    {
+        if (!PixelConverter::isSupported(kernels))
+            continue;
+        const size_t width = 37;
+        std::vector<uint8_t> indices(width);
+        size_t expectedVisible = 0;
+        for (size_t x = 0; x < width; ++x)
+        {
+            indices[x] = static_cast<uint8_t>(x % 3 == 0 ? 3 : x * 11 % 20);
+            expectedVisible += indices[x] != 3 ? 1 : 0;
+        }
+        std::vector<uint8_t> pixels(width * 4);
+        std::vector<uint8_t> coverage(width);
+        CHECK(palette.ExpandRow(indices.data(), pixels.data(), coverage.data(), width, kernels) == expectedVisible);
+        for (size_t x = 0; x < width; ++x)
+        {
+            uint32_t color;
+            memcpy(&color, pixels.data() + x * 4, 4);
+            CHECK(color == (indices[x] < 16 ? palette.getTable()[indices[x]] : 0));
+            CHECK(coverage[x] == (indices[x] != 3 ? 0xFF : 0));
+        }
+    }
+
+    // Without a transparent index every pixel is drawn
+    palette.SetPalette(rgb, 16, -1);
+    CHECK(!palette.hasTransparency());
+}
+
+TEST_CASE(PaletteExpanderCoversByAlpha)
+{
+    // Palettes with several transparent colors are tested by alpha
+    const uint32_t colors[4] = { 0xFF112233, 0x80FF0000, 0x00FFFFFF, 0x00000000 };
+    PaletteExpander palette;
+    palette.SetPalette(colors, 4);
+    CHECK(palette.getTable()[1] == 0x80800000);
+    CHECK(palette.getTable()[2] == 0);
+    CHECK(palette.hasTransparency() && palette.getTransparentIndex() == -1);
+
+    const uint8_t indices[5] = { 0, 1, 2, 3, 0 };
+    uint8_t pixels[20];
+    uint8_t coverage[5] = {};
+    CHECK(palette.ExpandRow(indices, pixels, coverage, 5, CK_SCALAR) == 3);
+    CHECK(coverage[0] == 0xFF && coverage[1] == 0xFF && coverage[2] == 0 && coverage[3] == 0 && coverage[4] == 0xFF);
+
+    // A short palette with one transparent color is compared by index
+    palette.SetPalette(colors, 3);
+    CHECK(palette.getTransparentIndex() == 2);
+}
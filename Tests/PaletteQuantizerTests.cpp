@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "PaletteQuantizer.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Fills the planes like PaletteQuantizer::SetPalette, with the padding
+// colors after the palette
+void SetPlanes(PalettePlanes& planes, const std::vector<uint8_t>& rgb)
+{
+    unsigned int colorCount = static_cast<unsigned int>(rgb.size() / 3);
+    for (unsigned int i = 0; i < colorCount; ++i)
+    {
+        planes.red[i] = rgb[i * 3];
+        planes.green[i] = rgb[i * 3 + 1];
+        planes.blue[i] = rgb[i * 3 + 2];
+    }
+    planes.count = (colorCount + PalettePlanes::ALIGNMENT - 1) / PalettePlanes::ALIGNMENT * PalettePlanes::ALIGNMENT;
+    for (unsigned int i = colorCount; i < planes.count; ++i)
+    {
+        planes.red[i] = PalettePlanes::PADDING;
+        planes.green[i] = PalettePlanes::PADDING;
+        planes.blue[i] = PalettePlanes::PADDING;
+    }
+}
+
+}
+
+TEST_CASE(QuantizerKernelsMatchScalar)
+{
+    // Palettes of every size, with repeated colors so that several colors
+    // are as near and the lowest index must win, searched for random colors
+    // and for the corners of the color cube
+    struct Kernel
+    {
+        CPU_KERNELS         kernels;
+        FindNearestFunction findNearest;
+    };
+    const Kernel vectorKernels[] = { { CK_SSE2, GetSse2FindNearest() }, { CK_AVX2, GetAvx2FindNearest() } };
+    FindNearestFunction scalar = GetScalarFindNearest();
+    REQUIRE(scalar != nullptr);
+
+    std::mt19937 random(2024);
+    PalettePlanes planes;
+    for (unsigned int colorCount = 1; colorCount <= PaletteQuantizer::MAX_COLORS; ++colorCount)
+    {
+        std::vector<uint8_t> rgb(colorCount * 3);
+        for (auto& value : rgb)
+        {
+            value = static_cast<uint8_t>(random());
+        }
+        for (unsigned int i = 7; i < colorCount; i += 7)
+        {
+            unsigned int copy = random() % i;
+            rgb[i * 3] = rgb[copy * 3];
+            rgb[i * 3 + 1] = rgb[copy * 3 + 1];
+            rgb[i * 3 + 2] = rgb[copy * 3 + 2];
+        }
+        SetPlanes(planes, rgb);
+
+        for (unsigned int i = 0; i < 200; ++i)
+        {
+            int red, green, blue;
+            if (i < 8)
+            {
+                red = i & 1 ? 255 : 0;
+                green = i & 2 ? 255 : 0;
+                blue = i & 4 ? 255 : 0;
+            }
+            else if (i < 8 + colorCount && i < 40)
+            {
+                red = rgb[(i - 8) * 3];
+                green = rgb[(i - 8) * 3 + 1];
+                blue = rgb[(i - 8) * 3 + 2];
+            }
+            else
+            {
+                red = random() & 0xFF;
+                green = random() & 0xFF;
+                blue = random() & 0xFF;
+            }
+
+            unsigned int expected = scalar(planes, red, green, blue);
+            CHECK(expected < colorCount);
+            for (const Kernel& kernel : vectorKernels)
+            {
+                if (kernel.findNearest == nullptr || !PixelConverter::isSupported(kernel.kernels))
+                    continue;
+                unsigned int found = kernel.findNearest(planes, red, green, blue);
+                if (found != expected)
+                {
+                    fprintf(stderr, "%s kernel finds %u instead of %u for %d, %d, %d in %u colors\n",
+                        PixelConverter::getKernelsName(kernel.kernels), found, expected, red, green, blue, colorCount);
+                }
+                CHECK(found == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE(QuantizerKeepsExactColors)
+{
+    // No more colors than the palette holds are kept as they are, and every
+    // kernel maps each pixel to its color
+    std::vector<uint8_t> pixels;
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+        uint8_t color[4] = { static_cast<uint8_t>(i * 2), static_cast<uint8_t>(255 - i), static_cast<uint8_t>(i * 7), 255 };
+        pixels.insert(pixels.end(), color, color + 4);
+    }
+    const uint8_t transparent[4] = { 1, 2, 3, 100 };
+    pixels.insert(pixels.end(), transparent, transparent + 4);
+    const size_t width = pixels.size() / 4;
+
+    const CPU_KERNELS allKernels[] = { CK_SCALAR, CK_SSE2, CK_AVX2, CK_NEON };
+    for (CPU_KERNELS kernels : allKernels)
+    {
+        if (!PixelConverter::isSupported(kernels))
+            continue;
+        PaletteQuantizer quantizer(kernels);
+        quantizer.AddPixels(pixels.data(), width);
+        REQUIRE(quantizer.BuildPalette(PaletteQuantizer::MAX_COLORS - 1) == 100);
+
+        std::vector<uint8_t> indices(width);
+        quantizer.MapRow(pixels.data(), indices.data(), width, 0, 0, 255, false);
+        const uint8_t* palette = quantizer.getPalette();
+        for (size_t x = 0; x + 1 < width; ++x)
+        {
+            const uint8_t* pixel = pixels.data() + x * 4;
+            const uint8_t* color = palette + indices[x] * 3;
+            CHECK(color[0] == pixel[2] && color[1] == pixel[1] && color[2] == pixel[0]);
+        }
+        CHECK(indices[width - 1] == 255);
+    }
+}
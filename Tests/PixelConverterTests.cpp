@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "PixelConverter.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Converts the source pixels with the scalar kernels and compares the
+// result with the expected BGRA bytes
+void CheckConversion(PIXEL_FORMATS format, const std::vector<uint8_t>& source, const std::vector<uint8_t>& expected)
+{
+    size_t width = expected.size() / 4;
+    REQUIRE(source.size() == width * PixelConverter::getBytesPerPixel(format));
+    std::vector<uint8_t> destination(expected.size() + 4, 0xEE);
+    PixelConverter::ConvertRow(format, source.data(), destination.data(), width, CK_SCALAR);
+    CHECK(memcmp(destination.data(), expected.data(), expected.size()) == 0);
+    CHECK(destination[expected.size()] == 0xEE);
+}
+
+}
+
+TEST_CASE(PixelConverterSwapsAndFillsAlpha)
+{
+    CheckConversion(PF_BGR24, { 1, 2, 3, 250, 251, 252 }, { 1, 2, 3, 255, 250, 251, 252, 255 });
+    CheckConversion(PF_RGB24, { 1, 2, 3, 250, 251, 252 }, { 3, 2, 1, 255, 252, 251, 250, 255 });
+    CheckConversion(PF_BGR32, { 1, 2, 3, 0, 4, 5, 6, 99 }, { 1, 2, 3, 255, 4, 5, 6, 255 });
+    CheckConversion(PF_PBGRA32, { 1, 2, 3, 4, 10, 20, 30, 40 }, { 1, 2, 3, 4, 10, 20, 30, 40 });
+    CheckConversion(PF_GRAY8, { 0, 128, 255 }, { 0, 0, 0, 255, 128, 128, 128, 255, 255, 255, 255, 255 });
+}
+
+TEST_CASE(PixelConverterPremultipliesWithRounding)
+{
+    // round(c * a / 255): 200 * 128 / 255 = 100.39, 255 * 1 / 255 = 1,
+    // 1 * 127 / 255 = 0.498 and 1 * 128 / 255 = 0.502
+    CheckConversion(PF_BGRA32,
+        { 200, 255, 0, 128, 255, 255, 255, 1, 1, 1, 1, 127, 1, 1, 1, 128, 9, 8, 7, 0 },
+        { 100, 128, 0, 128, 1, 1, 1, 1, 0, 0, 0, 127, 1, 1, 1, 128, 0, 0, 0, 0 });
+    CheckConversion(PF_RGBA32,
+        { 200, 255, 0, 128, 10, 20, 30, 255 },
+        { 0, 128, 100, 128, 30, 20, 10, 255 });
+}
+
+TEST_CASE(PixelConverterNarrows16BitChannels)
+{
+    // round(v * 255 / 65535) = round(v / 257): 128 is 0.498, 129 is 0.502,
+    // 0x8080 is exactly 128
+    CheckConversion(PF_GRAY16,
+        { 0x80, 0x00, 0x81, 0x00, 0x80, 0x80, 0xFF, 0xFF },
+        { 0, 0, 0, 255, 1, 1, 1, 255, 128, 128, 128, 255, 255, 255, 255, 255 });
+    CheckConversion(PF_RGB48,
+        { 0x00, 0x00, 0x80, 0x80, 0xFF, 0xFF },
+        { 255, 128, 0, 255 });
+
+    // The channels are narrowed before they are premultiplied
+    CheckConversion(PF_RGBA64,
+        { 0xFF, 0xFF, 0x80, 0x80, 0x00, 0x00, 0x80, 0x80 },
+        { 0, 64, 128, 128 });
+}
+
+TEST_CASE(PixelConverterConvertsStridedImages)
+{
+    const uint8_t source[] = { 1, 2, 3, 0xAA, 4, 5, 6, 0xAA };
+    uint8_t destination[2 * 8];
+    memset(destination, 0xEE, sizeof(destination));
+    PixelConverter::Convert(PF_RGB24, source, 4, destination, 8, 1, 2, CK_SCALAR);
+    const uint8_t expected[] = { 3, 2, 1, 255, 0xEE, 0xEE, 0xEE, 0xEE, 6, 5, 4, 255, 0xEE, 0xEE, 0xEE, 0xEE };
+    CHECK(memcmp(destination, expected, sizeof(expected)) == 0);
+    CHECK(PixelConverter::getBytesPerPixel(PF_UNSUPPORTED) == 0);
+    CHECK(PixelConverter::isSupported(CK_SCALAR));
+}
+
+TEST_CASE(PixelConverterKernelsMatchScalar)
+{
+    // Random rows of every width up to several vectors and a few wider ones,
+    // so that each kernel runs its vector loop and its tail. The rows start
+    // one byte into the buffer to catch aligned loads, and every 5th pixel
+    // has alpha 0 or 255 for the shortcuts of the kernels.
+    const PIXEL_FORMATS formats[] = {
+        PF_BGR24, PF_RGB24, PF_BGRA32, PF_RGBA32, PF_BGR32,
+        PF_PBGRA32, PF_GRAY8, PF_GRAY16, PF_RGB48, PF_RGBA64 };
+    const CPU_KERNELS allKernels[] = { CK_SSE2, CK_AVX2, CK_NEON };
+    std::vector<size_t> widths;
+    for (size_t width = 1; width <= 70; ++width)
+    {
+        widths.push_back(width);
+    }
+    widths.push_back(257);
+    widths.push_back(1023);
+
+    std::mt19937 random(12345);
+    for (PIXEL_FORMATS format : formats)
+    {
+        size_t bytesPerPixel = PixelConverter::getBytesPerPixel(format);
+        for (size_t width : widths)
+        {
+            std::vector<uint8_t> source(1 + width * bytesPerPixel);
+            for (auto& byte : source)
+            {
+                byte = static_cast<uint8_t>(random());
+            }
+            if (format == PF_BGRA32 || format == PF_RGBA32 || format == PF_RGBA64)
+            {
+                for (size_t x = 0; x < width; x += 5)
+                {
+                    uint8_t alpha = (x / 5) % 2 == 0 ? 0 : 255;
+                    memset(source.data() + 1 + (x + 1) * bytesPerPixel - bytesPerPixel / 4, alpha, bytesPerPixel / 4);
+                }
+            }
+
+            std::vector<uint8_t> expected(1 + width * 4 + 4, 0xEE);
+            PixelConverter::ConvertRow(format, source.data() + 1, expected.data() + 1, width, CK_SCALAR);
+            for (CPU_KERNELS kernels : allKernels)
+            {
+                if (!PixelConverter::isSupported(kernels))
+                    continue;
+
+                std::vector<uint8_t> destination(expected.size(), 0xEE);
+                PixelConverter::ConvertRow(format, source.data() + 1, destination.data() + 1, width, kernels);
+                bool same = destination == expected;
+                if (!same)
+                {
+                    fprintf(stderr, "Format %d with width %zu differs with %s kernels\n",
+                        format, width, PixelConverter::getKernelsName(kernels));
+                }
+                CHECK(same);
+            }
+        }
+    }
+}
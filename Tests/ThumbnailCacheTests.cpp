@@ -0,0 +1,204 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "ThumbnailCache.h"
+#include "ZackTests.h"
+
+namespace {
+
+const unsigned int SIZE = 8;                        // Thumbnails are not scaled
+const size_t FILE_HEADER_BYTES = 16;
+const size_t RECORD_HEADER_BYTES = 72;
+const size_t RECORD_BYTES = RECORD_HEADER_BYTES + SIZE * SIZE * 4;
+
+// Creates an empty file for the cache, like ZackBench
+bool MakeTempFile(std::string& tempFile)
+{
+    const char* directory = getenv("TMPDIR");
+    tempFile = std::string(directory && *directory ? directory : "/tmp") + "/ZackTests.XXXXXX";
+    int descriptor = mkstemp(&tempFile[0]);
+    if (descriptor < 0)
+        return false;
+    close(descriptor);
+    return true;
+}
+
+ThumbnailKey MakeKey(unsigned int number)
+{
+    ThumbnailKey key = { 0x1234567890ull * (number + 1), 1000 + number, 7 };
+    return key;
+}
+
+// Opaque pixels which differ for each number
+std::vector<uint8_t> MakePixels(unsigned int number)
+{
+    std::vector<uint8_t> pixels(SIZE * SIZE * 4);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        pixels[i] = i % 4 == 3 ? 255 : static_cast<uint8_t>(i * 7 + number * 13);
+    }
+    return pixels;
+}
+
+bool InsertThumbnail(ThumbnailCache& cache, unsigned int number)
+{
+    ThumbnailInfo info = { SIZE * 10, SIZE * 10, number + 1, 0, 0xFF000000, SIZE, SIZE };
+    std::vector<uint8_t> pixels = MakePixels(number);
+    return cache.Insert(MakeKey(number), info, pixels.data(), SIZE * 4, SIZE, SIZE);
+}
+
+// Looks the thumbnail up and checks that it holds what was inserted
+bool LookupThumbnail(ThumbnailCache& cache, unsigned int number)
+{
+    ThumbnailInfo info;
+    FrameBuffer pixels;
+    if (!cache.Lookup(MakeKey(number), info, pixels))
+        return false;
+    std::vector<uint8_t> expected = MakePixels(number);
+    CHECK(info.frameCount == number + 1 && info.width == SIZE && info.height == SIZE);
+    CHECK(pixels.hasSize(SIZE, SIZE, 4));
+    CHECK(memcmp(pixels.data(), expected.data(), expected.size()) == 0);
+    return true;
+}
+
+// Flips the bits of one byte of the closed cache file
+bool DamageFile(const std::string& tempFile, size_t offset)
+{
+    FILE* file = fopen(tempFile.c_str(), "r+b");
+    if (file == nullptr)
+        return false;
+    bool result = fseek(file, static_cast<long>(offset), SEEK_SET) == 0;
+    int value = result ? fgetc(file) : EOF;
+    result = value != EOF && fseek(file, static_cast<long>(offset), SEEK_SET) == 0 && fputc(value ^ 0xFF, file) != EOF;
+    return fclose(file) == 0 && result;
+}
+
+}
+
+TEST_CASE(ThumbnailCacheMissesDamagedPixels)
+{
+    std::string tempFile;
+    REQUIRE(MakeTempFile(tempFile));
+    {
+        ThumbnailCache cache(1 << 20);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        CHECK(InsertThumbnail(cache, 0));
+        CHECK(InsertThumbnail(cache, 1));
+        CHECK(cache.getFileSize() == FILE_HEADER_BYTES + RECORD_BYTES * 2);
+    }
+
+    // The header of the record is intact, so the file loads with both
+    // records and the damage is found by the lookup
+    REQUIRE(DamageFile(tempFile, FILE_HEADER_BYTES + RECORD_HEADER_BYTES + 5));
+    {
+        ThumbnailCache cache(1 << 20);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        CHECK(cache.getEntryCount() == 2);
+        CHECK(cache.getCorruptCount() == 0);
+        CHECK(!LookupThumbnail(cache, 0));
+        CHECK(cache.getCorruptCount() == 1);
+        CHECK(cache.getEntryCount() == 1);
+        CHECK(LookupThumbnail(cache, 1));
+        CHECK(!LookupThumbnail(cache, 0));
+        CHECK(cache.getHitCount() == 1 && cache.getMissCount() == 2);
+
+        // The thumbnail can be cached again
+        CHECK(InsertThumbnail(cache, 0));
+        CHECK(LookupThumbnail(cache, 0));
+    }
+    remove(tempFile.c_str());
+}
+
+TEST_CASE(ThumbnailCacheTruncatesAtDamagedHeader)
+{
+    std::string tempFile;
+    REQUIRE(MakeTempFile(tempFile));
+    {
+        ThumbnailCache cache(1 << 20);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            CHECK(InsertThumbnail(cache, i));
+        }
+    }
+
+    // A byte of the key of the second record, the records after it cannot
+    // be trusted either
+    REQUIRE(DamageFile(tempFile, FILE_HEADER_BYTES + RECORD_BYTES + 9));
+    {
+        ThumbnailCache cache(1 << 20);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        CHECK(cache.getCorruptCount() == 1);
+        CHECK(cache.getEntryCount() == 1);
+        CHECK(cache.getFileSize() == FILE_HEADER_BYTES + RECORD_BYTES);
+        CHECK(LookupThumbnail(cache, 0));
+        CHECK(!LookupThumbnail(cache, 1));
+        CHECK(!LookupThumbnail(cache, 2));
+    }
+
+    // The file itself was truncated
+    {
+        ThumbnailCache cache(1 << 20);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        CHECK(cache.getCorruptCount() == 0);
+        CHECK(cache.getFileSize() == FILE_HEADER_BYTES + RECORD_BYTES);
+    }
+    remove(tempFile.c_str());
+}
+
+TEST_CASE(ThumbnailCacheCompactsToNewestRecords)
+{
+    // Room for ten records, compaction keeps what fits into half of it
+    const uint64_t budget = FILE_HEADER_BYTES + RECORD_BYTES * 10;
+    const unsigned int THUMBNAIL_COUNT = 40;
+    std::string tempFile;
+    REQUIRE(MakeTempFile(tempFile));
+    {
+        ThumbnailCache cache(budget);
+        REQUIRE(cache.Open(tempFile.c_str()));
+        for (unsigned int i = 0; i < THUMBNAIL_COUNT; ++i)
+        {
+            CHECK(InsertThumbnail(cache, i));
+            CHECK(cache.getFileSize() <= budget);
+            CHECK(cache.getFileSize() == FILE_HEADER_BYTES + RECORD_BYTES * cache.getEntryCount());
+        }
+        CHECK(cache.getEntryCount() > 1);
+    }
+
+    // The cached thumbnails are the newest ones, without gaps
+    ThumbnailCache cache(budget);
+    REQUIRE(cache.Open(tempFile.c_str()));
+    CHECK(cache.getCorruptCount() == 0);
+    size_t entryCount = cache.getEntryCount();
+    REQUIRE(entryCount > 1 && entryCount <= 10);
+    for (unsigned int i = 0; i < THUMBNAIL_COUNT; ++i)
+    {
+        CHECK(LookupThumbnail(cache, i) == (i >= THUMBNAIL_COUNT - entryCount));
+    }
+    cache.Close();
+    remove(tempFile.c_str());
+}
+
+TEST_CASE(ThumbnailCacheIsOpenedOnce)
+{
+    std::string tempFile;
+    REQUIRE(MakeTempFile(tempFile));
+    ThumbnailCache first(1 << 20);
+    ThumbnailCache second(1 << 20);
+    REQUIRE(first.Open(tempFile.c_str()));
+    CHECK(InsertThumbnail(first, 0));
+    CHECK(!second.Open(tempFile.c_str()));
+    CHECK(!second.isOpen());
+    CHECK(!InsertThumbnail(second, 1));
+
+    // The file is free again once the first cache closed it
+    first.Close();
+    REQUIRE(second.Open(tempFile.c_str()));
+    CHECK(LookupThumbnail(second, 0));
+    CHECK(!first.Open(tempFile.c_str()));
+    second.Close();
+    remove(tempFile.c_str());
+}
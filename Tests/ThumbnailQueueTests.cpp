@@ -0,0 +1,174 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "ThumbnailQueue.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Calls WaitIdle on a thread, lets it wait, runs the action and returns
+// whether the wait ended within a second. A queue which stays busy is
+// stopped, so that the thread ends anyway.
+template <typename Action>
+bool WaitIdleEnds(ThumbnailQueue& queue, Action action)
+{
+    std::atomic<bool> idle(false);
+    std::thread waiter([&]
+    {
+        queue.WaitIdle();
+        idle = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    action();
+    for (unsigned int i = 0; i < 1000 && !idle; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    bool ended = idle;
+    if (!ended)
+    {
+        queue.Stop();
+    }
+    waiter.join();
+    return ended;
+}
+
+}
+
+TEST_CASE(ThumbnailQueueHandsOutWantedItemsOnce)
+{
+    ThumbnailQueue queue;
+    queue.SetWanted({ 5, 3, 9 });
+    size_t item = 0;
+    CHECK(queue.Take(item) && item == 5);
+    CHECK(queue.Take(item) && item == 3);
+    CHECK(queue.Take(item) && item == 9);
+
+    // Items which stay wanted are not handed out again, in any order
+    queue.SetWanted({ 3, 9, 7, 5 });
+    CHECK(queue.Take(item) && item == 7);
+    CHECK(queue.isWanted(5) && queue.isWanted(7) && !queue.isWanted(4));
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        queue.Finish();
+    }
+    CHECK(queue.getFinishedCount() == 4);
+    CHECK(queue.getCanceledCount() == 0);
+    CHECK(WaitIdleEnds(queue, [] {}));
+}
+
+TEST_CASE(ThumbnailQueueDropsItemsNotTaken)
+{
+    ThumbnailQueue queue;
+    queue.SetWanted({ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 });
+    size_t item = 0;
+    CHECK(queue.Take(item) && item == 1);
+    CHECK(queue.Take(item) && item == 2);
+
+    // The items from 4 on were neither taken nor are wanted any more. 3
+    // stays wanted, 1 was taken before it was dropped.
+    queue.SetWanted({ 2, 3, 20 });
+    CHECK(queue.getCanceledCount() == 7);
+    CHECK(!queue.isWanted(1) && queue.isWanted(2) && !queue.isWanted(4));
+    CHECK(queue.Take(item) && item == 3);
+    CHECK(queue.Take(item) && item == 20);
+
+    // Only items not taken yet are canceled
+    queue.SetWanted({ 30, 31 });
+    CHECK(queue.getCanceledCount() == 7);
+    queue.SetWanted({});
+    CHECK(queue.getCanceledCount() == 9);
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        queue.Finish();
+    }
+    CHECK(WaitIdleEnds(queue, [] {}));
+}
+
+TEST_CASE(ThumbnailQueueRequeuesItemsBackInView)
+{
+    ThumbnailQueue queue;
+    queue.SetWanted({ 1, 2 });
+    size_t item = 0;
+    CHECK(queue.Take(item) && item == 1);
+    queue.Finish();
+
+    // Item 1 scrolls out of view and back in, its thumbnail was dropped
+    // and is built again. Item 2 was never taken, so it is handed out once.
+    queue.SetWanted({ 2 });
+    queue.SetWanted({ 1, 2 });
+    CHECK(queue.Take(item) && item == 1);
+    CHECK(queue.Take(item) && item == 2);
+    queue.Finish();
+    queue.Finish();
+
+    // After a reset every item of the new list is handed out
+    queue.Reset();
+    CHECK(!queue.isWanted(1));
+    queue.SetWanted({ 2, 1 });
+    CHECK(queue.Take(item) && item == 2);
+    CHECK(queue.Take(item) && item == 1);
+    queue.Finish();
+    queue.Finish();
+    CHECK(queue.getFinishedCount() == 5);
+}
+
+TEST_CASE(ThumbnailQueueWaitIdleEnds)
+{
+    // Once the workers finished all wanted items
+    const unsigned int WORKER_COUNT = 4;
+    const size_t ITEM_COUNT = 1000;
+    ThumbnailQueue queue;
+    std::mutex mutex;
+    std::multiset<size_t> built;
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < WORKER_COUNT; ++i)
+    {
+        workers.emplace_back([&]
+        {
+            size_t item;
+            while (queue.Take(item))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    built.insert(item);
+                }
+                queue.Finish();
+            }
+        });
+    }
+    std::vector<size_t> items;
+    for (size_t i = 0; i < ITEM_COUNT; ++i)
+    {
+        items.push_back(ITEM_COUNT - i);
+    }
+    queue.SetWanted(items);
+    CHECK(WaitIdleEnds(queue, [] {}));
+    CHECK(queue.getFinishedCount() == ITEM_COUNT);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        CHECK(built.size() == ITEM_COUNT);
+        CHECK(std::set<size_t>(built.begin(), built.end()).size() == ITEM_COUNT);
+    }
+    queue.Stop();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    // Once the items it waits for are no longer wanted, without any worker
+    ThumbnailQueue waiting;
+    waiting.SetWanted({ 1, 2, 3 });
+    CHECK(WaitIdleEnds(waiting, [&] { waiting.SetWanted({}); }));
+    waiting.SetWanted({ 4 });
+    CHECK(WaitIdleEnds(waiting, [&] { waiting.Reset(); }));
+
+    // Once the queue is stopped, which also ends Take
+    waiting.SetWanted({ 5 });
+    CHECK(WaitIdleEnds(waiting, [&] { waiting.Stop(); }));
+    size_t item;
+    CHECK(!waiting.Take(item));
+}
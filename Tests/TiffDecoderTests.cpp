@@ -0,0 +1,139 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include "TiffDecoder.h"
+#include "WorkerPool.h"
+#include "ZackTests.h"
+
+namespace {
+
+// Decodes each page of the file and compares it with the expected pixels of
+// MakeTestData.py, once on the calling thread and once on a pool
+void CheckPages(const char* name, unsigned int pageCount)
+{
+    std::vector<uint8_t> file;
+    REQUIRE(ReadTestData(std::string(name) + ".tif", file));
+
+    TiffDecoder decoder;
+    REQUIRE(TiffDecoder::IsTiff(file.data(), file.size()));
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.getPageCount() == pageCount);
+
+    WorkerPool pool(3);
+    for (unsigned int i = 0; i < pageCount; ++i)
+    {
+        std::vector<uint8_t> expected;
+        REQUIRE(ReadTestData(std::string(name) + "." + std::to_string(i) + ".bgra", expected));
+
+        TiffPage page;
+        REQUIRE(decoder.ReadPage(i, page));
+        REQUIRE(expected.size() == static_cast<size_t>(page.width) * page.height * 4);
+
+        std::vector<uint8_t> pixels(expected.size(), 0xEE);
+        CHECK(decoder.DecodePage(page, pixels.data(), page.width * 4));
+        CHECK(pixels == expected);
+
+        memset(pixels.data(), 0xEE, pixels.size());
+        CHECK(decoder.DecodePage(page, pixels.data(), page.width * 4, pool, false, nullptr));
+        CHECK(pixels == expected);
+    }
+}
+
+}
+
+TEST_CASE(TiffDecodesLzwStripsWithPredictor)
+{
+    CheckPages("rgb-lzw-predictor", 1);
+}
+
+TEST_CASE(TiffDecodesLzwWithClearCodes)
+{
+    CheckPages("gray-lzw", 1);
+}
+
+TEST_CASE(TiffDecodesDeflateTiles)
+{
+    CheckPages("rgba-deflate-tiles", 1);
+}
+
+TEST_CASE(TiffDecodesBigEndian16BitPackBits)
+{
+    CheckPages("gray16-packbits-be", 1);
+}
+
+TEST_CASE(TiffDecodes4BitPalette)
+{
+    CheckPages("palette4", 1);
+}
+
+TEST_CASE(TiffDecodesBigTiffPages)
+{
+    CheckPages("bigtiff-pages", 3);
+}
+
+TEST_CASE(TiffIndexesPagesOnDemand)
+{
+    std::vector<uint8_t> file;
+    REQUIRE(ReadTestData("bigtiff-pages.tif", file));
+
+    // Open only finds the first page, the others are found as they are read
+    TiffDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.getIndexedPageCount() == 1);
+    CHECK(!decoder.isIndexed());
+    TiffPage page;
+    CHECK(decoder.ReadPage(1, page));
+    CHECK(page.width == 12 && page.height == 5);
+    CHECK(decoder.getIndexedPageCount() == 2);
+    CHECK(decoder.IndexPages(2) == 2);
+    CHECK(!decoder.isIndexed());
+    CHECK(!decoder.ReadPage(3, page));
+    CHECK(decoder.getIndexedPageCount() == 3);
+    CHECK(decoder.isIndexed());
+    CHECK(decoder.IndexPages(10) == 3);
+
+    // The chain is followed up to the pages asked for
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    CHECK(decoder.IndexPages(2) == 2);
+    CHECK(!decoder.isIndexed());
+    CHECK(decoder.getPageCount() == 3);
+    CHECK(decoder.isIndexed());
+}
+
+TEST_CASE(TiffFailsTruncatedBlocksOnly)
+{
+    std::vector<uint8_t> file, expected;
+    REQUIRE(ReadTestData("rgba-deflate-tiles.tif", file) && ReadTestData("rgba-deflate-tiles.0.bgra", expected));
+
+    TiffDecoder decoder;
+    REQUIRE(decoder.Open(file.data(), file.size()));
+    TiffPage page;
+    REQUIRE(decoder.ReadPage(0, page));
+    REQUIRE(page.getBlockCount() == 6);
+
+    // The first tile is cut off in the middle and fails, the other tiles
+    // are decoded as before
+    page.blockByteCounts[0] /= 2;
+    std::vector<uint8_t> pixels(expected.size(), 0xEE);
+    std::vector<uint8_t> scratch;
+    CHECK(!decoder.DecodeBlock(page, 0, pixels.data(), 40 * 4, scratch));
+    for (unsigned int i = 1; i < page.getBlockCount(); ++i)
+    {
+        CHECK(decoder.DecodeBlock(page, i, pixels.data(), 40 * 4, scratch));
+    }
+    CHECK(memcmp(pixels.data() + 16 * 4, expected.data() + 16 * 4, 24 * 4) == 0);
+    CHECK(memcmp(pixels.data() + 20 * 40 * 4, expected.data() + 20 * 40 * 4, 40 * 4) == 0);
+}
+
+TEST_CASE(TiffRejectsInvalidFiles)
+{
+    const uint8_t notTiff[] = "II*\0\0\0\0\0";
+    TiffDecoder decoder;
+    CHECK(TiffDecoder::IsTiff(notTiff, 8));
+    CHECK(!decoder.Open(notTiff, 8));
+    CHECK(!decoder.isOpen());
+    CHECK(decoder.getPageCount() == 0);
+
+    const uint8_t gif[] = "GIF89a\0\0";
+    CHECK(!TiffDecoder::IsTiff(gif, 8));
+}
@@ -0,0 +1,165 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Tracer.h"
+#include "ZackTests.h"
+
+namespace {
+
+struct TracedSpan
+{
+    std::string  name;
+    unsigned int threadId;
+    double       start;
+};
+
+// Writes the Chrome trace and reads back its spans and thread names
+bool WriteTrace(std::vector<TracedSpan>& spans, std::map<unsigned int, std::string>& threadNames)
+{
+    FILE* file = tmpfile();
+    if (file == nullptr)
+        return false;
+    size_t count = Tracer::WriteChromeTrace(file);
+    rewind(file);
+
+    spans.clear();
+    threadNames.clear();
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        char name[64];
+        unsigned int threadId;
+        double start, duration;
+        if (sscanf(line, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%63[^\"]\"}}",
+            &threadId, name) == 2)
+        {
+            threadNames[threadId] = name;
+        }
+        else if (sscanf(line, "{\"name\":\"%63[^\"]\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lf,\"dur\":%lf}",
+            name, &threadId, &start, &duration) == 4)
+        {
+            TracedSpan span = { name, threadId, start };
+            spans.push_back(span);
+        }
+    }
+    fclose(file);
+    return count == spans.size();
+}
+
+}
+
+TEST_CASE(TracerNamesThreadsOfReusedRing)
+{
+    // The second thread gets the ring of the first one, which ended, and
+    // the spans of each are written with their own thread
+    Tracer::Clear();
+    std::thread first([]
+    {
+        Tracer::SetThreadName("First");
+        for (int i = 0; i < 10; ++i)
+        {
+            Tracer::Record("FirstSpan", Tracer::Now());
+        }
+    });
+    first.join();
+    std::thread second([]
+    {
+        Tracer::Record("SecondSpan", Tracer::Now());
+        Tracer::SetThreadName("Second");
+        for (int i = 0; i < 4; ++i)
+        {
+            Tracer::Record("SecondSpan", Tracer::Now());
+        }
+    });
+    second.join();
+
+    std::vector<TracedSpan> spans;
+    std::map<unsigned int, std::string> threadNames;
+    REQUIRE(WriteTrace(spans, threadNames));
+    REQUIRE(spans.size() == 15);
+    unsigned int firstId = spans[0].threadId;
+    unsigned int secondId = spans[14].threadId;
+    CHECK(firstId != secondId);
+    for (const TracedSpan& span : spans)
+    {
+        CHECK(span.threadId == (span.name == "FirstSpan" ? firstId : secondId));
+    }
+    CHECK(threadNames.size() == 2);
+    CHECK(threadNames[firstId] == "First");
+    CHECK(threadNames[secondId] == "Second");
+
+    Tracer::Clear();
+    REQUIRE(WriteTrace(spans, threadNames));
+    CHECK(spans.empty() && threadNames.empty());
+}
+
+TEST_CASE(TracerCopiesSpansWhileThreadsRecord)
+{
+    // The threads overwrite their rings while the trace is written, and
+    // each written span must be whole: its name tells the parity of its
+    // start
+    const unsigned int THREAD_COUNT = 3;
+    const unsigned int SPAN_COUNT = 100000;
+    Tracer::Clear();
+    std::atomic<unsigned int> started(0);
+    std::atomic<unsigned int> running(THREAD_COUNT);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < THREAD_COUNT; ++t)
+    {
+        threads.emplace_back([&started, &running]
+        {
+            // Each thread holds its own ring before any of them ends
+            Tracer::Record("Even", 0);
+            ++started;
+            while (started < THREAD_COUNT)
+            {
+                std::this_thread::yield();
+            }
+            for (unsigned int i = 1; i < SPAN_COUNT; ++i)
+            {
+                Tracer::Record(i % 2 ? "Odd" : "Even", static_cast<int64_t>(i) * 1000);
+            }
+            --running;
+        });
+    }
+
+    std::vector<TracedSpan> spans;
+    std::map<unsigned int, std::string> threadNames;
+    unsigned int writeCount = 0;
+    do
+    {
+        REQUIRE(WriteTrace(spans, threadNames));
+        for (const TracedSpan& span : spans)
+        {
+            unsigned int start = static_cast<unsigned int>(span.start);
+            CHECK(span.name == (start % 2 ? "Odd" : "Even"));
+            CHECK(threadNames.count(span.threadId) == 1);
+        }
+        ++writeCount;
+    } while (running > 0);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(writeCount > 0);
+
+    // Once the threads ended each ring keeps its last spans
+    REQUIRE(WriteTrace(spans, threadNames));
+    CHECK(threadNames.size() == THREAD_COUNT);
+    std::map<unsigned int, unsigned int> spanCounts;
+    for (const TracedSpan& span : spans)
+    {
+        ++spanCounts[span.threadId];
+    }
+    CHECK(spanCounts.size() == THREAD_COUNT);
+    for (const auto& spanCount : spanCounts)
+    {
+        CHECK(spanCount.second == 16384);
+    }
+    CHECK(static_cast<unsigned int>(spans.back().start) == SPAN_COUNT - 1);
+    Tracer::Clear();
+}
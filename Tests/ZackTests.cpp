@@ -0,0 +1,106 @@
+// Unit tests of the portable image pipeline: the decoders, the pixel kernels
+// and the parts of the viewer which need no window, Direct2D or WIC. The
+// decoders are checked against files with known pixels in Tests/Data, see
+// README.md for the build command.
+//
+// Usage: ZackTests [--data <test data directory>] [test name]...
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ZackTests.h"
+
+namespace {
+
+struct Test
+{
+    const char*  name;
+    TestFunction function;
+};
+
+std::vector<Test>& GetTests()
+{
+    static std::vector<Test> tests;
+    return tests;
+}
+
+std::string dataDirectory = "Tests/Data";
+unsigned int failureCount = 0;
+
+}
+
+TestRegistration::TestRegistration(const char* name, TestFunction function)
+{
+    Test test = { name, function };
+    GetTests().push_back(test);
+}
+
+void ReportFailure(const char* file, int line, const char* condition)
+{
+    fprintf(stderr, "%s:%d: failed: %s\n", file, line, condition);
+    ++failureCount;
+}
+
+std::string GetTestDataPath(const std::string& name)
+{
+    return dataDirectory + "/" + name;
+}
+
+bool ReadTestData(const std::string& name, std::vector<uint8_t>& bytes)
+{
+    std::string path = GetTestDataPath(name);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open %s\n", path.c_str());
+        return false;
+    }
+    bytes.clear();
+    uint8_t buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        bytes.insert(bytes.end(), buffer, buffer + count);
+    }
+    bool result = ferror(file) == 0;
+    fclose(file);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+            dataDirectory = argv[++i];
+        else
+            names.push_back(argv[i]);
+    }
+
+    unsigned int testCount = 0;
+    unsigned int failedTests = 0;
+    for (const Test& test : GetTests())
+    {
+        bool selected = names.empty();
+        for (const auto& name : names)
+        {
+            selected = selected || name == test.name;
+        }
+        if (!selected)
+            continue;
+
+        unsigned int failuresBefore = failureCount;
+        test.function();
+        ++testCount;
+        if (failureCount != failuresBefore)
+        {
+            fprintf(stderr, "FAILED %s\n", test.name);
+            ++failedTests;
+        }
+    }
+
+    printf("%u of %u tests passed\n", testCount - failedTests, testCount);
+    return failedTests == 0 && testCount > 0 ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Minimal assertion harness of the unit tests of the portable image
+// pipeline. Each TEST_CASE registers itself with the runner in
+// ZackTests.cpp. A failed CHECK is reported and the test goes on, a failed
+// REQUIRE also ends the test, for conditions the checks after it depend on.
+
+typedef void (*TestFunction)();
+
+struct TestRegistration
+{
+    TestRegistration(const char* name, TestFunction function);
+};
+
+void ReportFailure(const char* file, int line, const char* condition);
+
+// Reads a file of the test data directory, see Tests/Data/MakeTestData.py
+bool ReadTestData(const std::string& name, std::vector<uint8_t>& bytes);
+
+// Returns the path of a file of the test data directory
+std::string GetTestDataPath(const std::string& name);
+
+#define TEST_CASE(name) \
+    static void name(); \
+    static TestRegistration name##Registration(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { if (!(condition)) ReportFailure(__FILE__, __LINE__, #condition); } while (false)
+
+#define REQUIRE(condition) \
+    do { if (!(condition)) { ReportFailure(__FILE__, __LINE__, #condition); return; } } while (false)
@@ -0,0 +1,69 @@
+#include <cstring>
+#include <vector>
+#include "ZackTests.h"
+#include "ZlibInflater.h"
+
+namespace {
+
+void CheckInflate(const char* name)
+{
+    std::vector<uint8_t> stream, expected;
+    REQUIRE(ReadTestData(name, stream) && ReadTestData("text.raw", expected));
+
+    std::vector<uint8_t> output(expected.size() + 100, 0xEE);
+    size_t written = 0;
+    CHECK(ZlibInflater::Inflate(stream.data(), stream.size(), output.data(), output.size(), written));
+    CHECK(written == expected.size());
+    CHECK(memcmp(output.data(), expected.data(), expected.size()) == 0);
+    CHECK(output[expected.size()] == 0xEE);
+
+    // The raw deflate data follows the 2 byte header
+    written = 0;
+    CHECK(ZlibInflater::InflateRaw(stream.data() + 2, stream.size() - 6, output.data(), output.size(), written));
+    CHECK(written == expected.size());
+
+    // A full destination stops the stream without an error
+    std::vector<uint8_t> part(1000);
+    CHECK(ZlibInflater::Inflate(stream.data(), stream.size(), part.data(), part.size(), written));
+    CHECK(written == part.size());
+    CHECK(memcmp(part.data(), expected.data(), part.size()) == 0);
+
+    // A truncated stream fails and keeps the bytes decoded before the end
+    size_t cut = stream.size() / 2;
+    CHECK(!ZlibInflater::Inflate(stream.data(), cut, output.data(), output.size(), written));
+    CHECK(written > 0 && written < expected.size());
+    CHECK(memcmp(output.data(), expected.data(), written) == 0);
+}
+
+}
+
+TEST_CASE(ZlibInflatesStoredBlocks)
+{
+    CheckInflate("text-stored.zlib");
+}
+
+TEST_CASE(ZlibInflatesFixedHuffmanBlocks)
+{
+    CheckInflate("text-fixed.zlib");
+}
+
+TEST_CASE(ZlibInflatesDynamicHuffmanBlocks)
+{
+    CheckInflate("text-dynamic.zlib");
+}
+
+TEST_CASE(ZlibRejectsInvalidStreams)
+{
+    uint8_t output[16];
+    size_t written = 0;
+
+    // Wrong compression method, wrong header check and a reserved block type
+    const uint8_t method[] = { 0x79, 0x9C, 0x03, 0x00 };
+    const uint8_t check[] = { 0x78, 0x9D, 0x03, 0x00 };
+    const uint8_t reserved[] = { 0x78, 0x9C, 0x07, 0x00 };
+    CHECK(!ZlibInflater::Inflate(method, sizeof(method), output, sizeof(output), written));
+    CHECK(!ZlibInflater::Inflate(check, sizeof(check), output, sizeof(output), written));
+    CHECK(!ZlibInflater::Inflate(reserved, sizeof(reserved), output, sizeof(output), written));
+    CHECK(!ZlibInflater::Inflate(method, 0, output, sizeof(output), written));
+    CHECK(written == 0);
+}
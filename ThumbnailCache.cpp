@@ -0,0 +1,647 @@
+#include "ThumbnailCache.h"
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t KEY_BYTES = 64 * 1024;     // Bytes hashed at the start and at the end of a file
+const unsigned int BOX_SAMPLES = 4;     // Samples per row and column of the area a thumbnail pixel covers
+const uint64_t HASH_PRIME = 0x9E3779B97F4A7C15ull;
+
+inline uint64_t MixHash(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * HASH_PRIME;
+    return hash ^ (hash >> 32);
+}
+
+// Fast 64 bit hash of the bytes, four words at a time. It detects changed
+// and damaged bytes, it is no protection against deliberate collisions.
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash)
+{
+    uint64_t lanes[4] = { hash, hash + 1, hash + 2, hash + 3 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (unsigned int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t value;
+            memcpy(&value, data + i + lane * 8, sizeof(value));
+            lanes[lane] = MixHash(lanes[lane], value);
+        }
+    }
+    hash = MixHash(size, lanes[0]);
+    for (unsigned int lane = 1; lane < 4; ++lane)
+    {
+        hash = MixHash(hash, lanes[lane]);
+    }
+    for (; i < size; ++i)
+    {
+        hash = MixHash(hash, data[i]);
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 33);
+}
+
+inline size_t AlignRecord(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+}
+
+ThumbnailCache::ThumbnailCache(uint64_t budgetBytes) :
+    m_budgetBytes(budgetBytes),
+    m_fileSize(0),
+    m_data(nullptr),
+    m_mappedSize(0),
+    m_hitCount(0),
+    m_missCount(0),
+    m_corruptCount(0),
+#ifdef _WIN32
+    m_file(INVALID_HANDLE_VALUE),
+    m_mapping(nullptr)
+#else
+    m_file(-1)
+#endif
+{
+    static_assert(sizeof(Record) == 72, "The record layout is part of the file format");
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool ThumbnailCache::Open(const wchar_t* filename)
+{
+    Close();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Not shared, so that only one process appends
+    m_file = CreateFileW(filename, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    if (!Load())
+    {
+        CloseFile();
+        return false;
+    }
+    return true;
+}
+
+bool ThumbnailCache::GetKey(const wchar_t* filename, ThumbnailKey& key)
+{
+    HANDLE file = CreateFileW(
+        filename,
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    FILETIME writeTime;
+    bool result = GetFileSizeEx(file, &fileSize) && GetFileTime(file, nullptr, nullptr, &writeTime);
+    if (result)
+    {
+        key.fileSize = static_cast<uint64_t>(fileSize.QuadPart);
+        key.writeTime = (static_cast<uint64_t>(writeTime.dwHighDateTime) << 32) | writeTime.dwLowDateTime;
+    }
+
+    // The first and the last bytes, which hold the headers and the
+    // directories of most formats
+    std::vector<uint8_t> bytes(result ? static_cast<size_t>(std::min<uint64_t>(key.fileSize, KEY_BYTES * 2)) : 0);
+    size_t headBytes = std::min(bytes.size(), KEY_BYTES);
+    DWORD read = 0;
+    result = result &&
+        (headBytes == 0 || (ReadFile(file, bytes.data(), static_cast<DWORD>(headBytes), &read, nullptr) && read == headBytes));
+    if (result && bytes.size() > headBytes)
+    {
+        LARGE_INTEGER tailOffset;
+        tailOffset.QuadPart = static_cast<LONGLONG>(key.fileSize - (bytes.size() - headBytes));
+        result = SetFilePointerEx(file, tailOffset, nullptr, FILE_BEGIN) &&
+            ReadFile(file, bytes.data() + headBytes, static_cast<DWORD>(bytes.size() - headBytes), &read, nullptr) &&
+            read == bytes.size() - headBytes;
+    }
+    CloseHandle(file);
+    if (result)
+    {
+        key.contentHash = HashBytes(bytes.data(), bytes.size(), key.fileSize);
+    }
+    return result;
+}
+
+void ThumbnailCache::CloseFile()
+{
+    Unmap();
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_index.clear();
+    m_offsets.clear();
+    m_fileSize = 0;
+}
+
+bool ThumbnailCache::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file != INVALID_HANDLE_VALUE;
+}
+
+bool ThumbnailCache::Map()
+{
+    Unmap();
+    if (m_fileSize == 0)
+        return true;
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+        return false;
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+    m_mappedSize = m_fileSize;
+    return true;
+}
+
+void ThumbnailCache::Unmap()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+        m_data = nullptr;
+        m_mapping = nullptr;
+    }
+    m_mappedSize = 0;
+}
+
+bool ThumbnailCache::Append(const uint8_t* data, size_t size)
+{
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(m_fileSize);
+    DWORD written = 0;
+    if (!SetFilePointerEx(m_file, offset, nullptr, FILE_BEGIN) ||
+        !WriteFile(m_file, data, static_cast<DWORD>(size), &written, nullptr) || written != size)
+    {
+        // A partly written record fails the checks when the file is loaded
+        return false;
+    }
+    m_fileSize += size;
+    return true;
+}
+
+bool ThumbnailCache::Truncate(uint64_t size)
+{
+    // A mapped file cannot be made smaller
+    Unmap();
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(m_file, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(m_file))
+        return false;
+    m_fileSize = size;
+    return true;
+}
+
+#else
+
+bool ThumbnailCache::Open(const char* filename)
+{
+    Close();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Locked, so that only one process appends
+    m_file = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_file < 0)
+        return false;
+    if (flock(m_file, LOCK_EX | LOCK_NB) != 0 || !Load())
+    {
+        CloseFile();
+        return false;
+    }
+    return true;
+}
+
+bool ThumbnailCache::GetKey(const char* filename, ThumbnailKey& key)
+{
+    int file = open(filename, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return false;
+
+    struct stat fileStat;
+    bool result = fstat(file, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+    if (result)
+    {
+        key.fileSize = static_cast<uint64_t>(fileStat.st_size);
+        key.writeTime = static_cast<uint64_t>(fileStat.st_mtim.tv_sec) * 1000000000ull +
+            static_cast<uint64_t>(fileStat.st_mtim.tv_nsec);
+    }
+
+    // The first and the last bytes, which hold the headers and the
+    // directories of most formats
+    std::vector<uint8_t> bytes(result ? static_cast<size_t>(std::min<uint64_t>(key.fileSize, KEY_BYTES * 2)) : 0);
+    size_t headBytes = std::min(bytes.size(), KEY_BYTES);
+    result = result && pread(file, bytes.data(), headBytes, 0) == static_cast<ssize_t>(headBytes);
+    if (result && bytes.size() > headBytes)
+    {
+        size_t tailBytes = bytes.size() - headBytes;
+        result = pread(file, bytes.data() + headBytes, tailBytes, static_cast<off_t>(key.fileSize - tailBytes)) ==
+            static_cast<ssize_t>(tailBytes);
+    }
+    close(file);
+    if (result)
+    {
+        key.contentHash = HashBytes(bytes.data(), bytes.size(), key.fileSize);
+    }
+    return result;
+}
+
+void ThumbnailCache::CloseFile()
+{
+    Unmap();
+    if (m_file >= 0)
+    {
+        close(m_file);
+        m_file = -1;
+    }
+    m_index.clear();
+    m_offsets.clear();
+    m_fileSize = 0;
+}
+
+bool ThumbnailCache::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file >= 0;
+}
+
+bool ThumbnailCache::Map()
+{
+    Unmap();
+    if (m_fileSize == 0)
+        return true;
+    void* data = mmap(nullptr, static_cast<size_t>(m_fileSize), PROT_READ, MAP_SHARED, m_file, 0);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = static_cast<const uint8_t*>(data);
+    m_mappedSize = m_fileSize;
+    return true;
+}
+
+void ThumbnailCache::Unmap()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), static_cast<size_t>(m_mappedSize));
+        m_data = nullptr;
+    }
+    m_mappedSize = 0;
+}
+
+bool ThumbnailCache::Append(const uint8_t* data, size_t size)
+{
+    // A partly written record fails the checks when the file is loaded
+    if (pwrite(m_file, data, size, static_cast<off_t>(m_fileSize)) != static_cast<ssize_t>(size))
+        return false;
+    m_fileSize += size;
+    return true;
+}
+
+bool ThumbnailCache::Truncate(uint64_t size)
+{
+    Unmap();
+    if (ftruncate(m_file, static_cast<off_t>(size)) != 0)
+        return false;
+    m_fileSize = size;
+    return true;
+}
+
+#endif
+
+void ThumbnailCache::Close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    CloseFile();
+}
+
+void ThumbnailCache::GetThumbnailSize(
+    unsigned int width,
+    unsigned int height,
+    unsigned int maxSize,
+    unsigned int& thumbnailWidth,
+    unsigned int& thumbnailHeight)
+{
+    thumbnailWidth = std::max(1u, std::min(width, maxSize));
+    thumbnailHeight = std::max(1u, std::min(height, maxSize));
+    if (width == 0 || height == 0)
+        return;
+    if (width >= height && width > maxSize)
+    {
+        thumbnailHeight = static_cast<unsigned int>(std::max<uint64_t>(1, (static_cast<uint64_t>(height) * maxSize + width / 2) / width));
+    }
+    else if (height > width && height > maxSize)
+    {
+        thumbnailWidth = static_cast<unsigned int>(std::max<uint64_t>(1, (static_cast<uint64_t>(width) * maxSize + height / 2) / height));
+    }
+}
+
+uint64_t ThumbnailCache::GetIndexKey(const ThumbnailKey& key)
+{
+    return MixHash(MixHash(key.contentHash, key.fileSize), key.writeTime);
+}
+
+size_t ThumbnailCache::GetRecordSize(unsigned int width, unsigned int height)
+{
+    return AlignRecord(sizeof(Record) + static_cast<size_t>(width) * height * 4);
+}
+
+// Averages up to BOX_SAMPLES x BOX_SAMPLES pixels of the area each
+// thumbnail pixel covers, so that large images take no longer than small
+// ones. Averaging premultiplied pixels weights the colors by their alpha.
+void ThumbnailCache::Downscale(
+    const uint8_t* pixels,
+    size_t stride,
+    unsigned int width,
+    unsigned int height,
+    uint8_t* thumbnail,
+    unsigned int thumbnailWidth,
+    unsigned int thumbnailHeight)
+{
+    for (unsigned int ty = 0; ty < thumbnailHeight; ++ty)
+    {
+        unsigned int top = static_cast<unsigned int>(static_cast<uint64_t>(ty) * height / thumbnailHeight);
+        unsigned int bottom = std::max(top + 1, static_cast<unsigned int>(static_cast<uint64_t>(ty + 1) * height / thumbnailHeight));
+        unsigned int stepY = std::max(1u, (bottom - top) / BOX_SAMPLES);
+        for (unsigned int tx = 0; tx < thumbnailWidth; ++tx)
+        {
+            unsigned int left = static_cast<unsigned int>(static_cast<uint64_t>(tx) * width / thumbnailWidth);
+            unsigned int right = std::max(left + 1, static_cast<unsigned int>(static_cast<uint64_t>(tx + 1) * width / thumbnailWidth));
+            unsigned int stepX = std::max(1u, (right - left) / BOX_SAMPLES);
+            uint32_t sums[4] = {};
+            uint32_t count = 0;
+            for (unsigned int y = top; y < bottom; y += stepY)
+            {
+                const uint8_t* pixel = pixels + y * stride + left * 4;
+                for (unsigned int x = left; x < right; x += stepX, pixel += stepX * 4)
+                {
+                    sums[0] += pixel[0];
+                    sums[1] += pixel[1];
+                    sums[2] += pixel[2];
+                    sums[3] += pixel[3];
+                    ++count;
+                }
+            }
+            uint8_t* target = thumbnail + (static_cast<size_t>(ty) * thumbnailWidth + tx) * 4;
+            for (unsigned int c = 0; c < 4; ++c)
+            {
+                target[c] = static_cast<uint8_t>((sums[c] + count / 2) / count);
+            }
+        }
+    }
+}
+
+bool ThumbnailCache::CheckRecord(uint64_t offset, const Record*& record) const
+{
+    if (offset + sizeof(Record) > m_mappedSize)
+        return false;
+    record = reinterpret_cast<const Record*>(m_data + offset);
+    return record->magic == RECORD_MAGIC &&
+        record->info.width > 0 && record->info.width <= MAX_SIZE &&
+        record->info.height > 0 && record->info.height <= MAX_SIZE &&
+        record->recordSize == GetRecordSize(record->info.width, record->info.height) &&
+        offset + record->recordSize <= m_mappedSize &&
+        record->headerChecksum == HashBytes(m_data + offset, offsetof(Record, headerChecksum), RECORD_MAGIC);
+}
+
+// Indexes the records of the mapped file and returns the offset after the
+// last valid one
+uint64_t ThumbnailCache::IndexRecords()
+{
+    m_index.clear();
+    m_offsets.clear();
+    uint64_t offset = FILE_HEADER_SIZE;
+    const Record* record = nullptr;
+    while (offset < m_mappedSize && CheckRecord(offset, record))
+    {
+        m_index[GetIndexKey(record->key)] = offset;
+        m_offsets.push_back(offset);
+        offset += record->recordSize;
+    }
+    return offset;
+}
+
+bool ThumbnailCache::Load()
+{
+    // The size of the file is known once it is mapped
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize))
+        return false;
+    m_fileSize = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+    struct stat fileStat;
+    if (fstat(m_file, &fileStat) != 0)
+        return false;
+    m_fileSize = static_cast<uint64_t>(fileStat.st_size);
+#endif
+    if (!Map())
+        return false;
+
+    // A file of another version or no cache file at all starts over
+    uint64_t magic = 0;
+    if (m_mappedSize >= FILE_HEADER_SIZE)
+    {
+        memcpy(&magic, m_data, sizeof(magic));
+    }
+    if (magic != FILE_MAGIC)
+    {
+        uint8_t header[FILE_HEADER_SIZE] = {};
+        uint64_t fileMagic = FILE_MAGIC;
+        memcpy(header, &fileMagic, sizeof(fileMagic));
+        return Truncate(0) && Append(header, sizeof(header)) && Map();
+    }
+
+    // The rest of the file cannot be trusted
+    uint64_t offset = IndexRecords();
+    if (offset < m_fileSize)
+    {
+        ++m_corruptCount;
+        return Truncate(offset) && Map();
+    }
+    return true;
+}
+
+bool ThumbnailCache::Lookup(const ThumbnailKey& key, ThumbnailInfo& info, FrameBuffer& pixels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_index.find(GetIndexKey(key));
+    if (entry == m_index.end())
+    {
+        ++m_missCount;
+        return false;
+    }
+
+    // Records appended since the file was mapped need a new mapping
+    const Record* record = nullptr;
+    if (entry->second + sizeof(Record) > m_mappedSize && !Map())
+        return false;
+    if (!CheckRecord(entry->second, record) || !(record->key == key))
+    {
+        ++m_missCount;
+        return false;
+    }
+
+    const uint8_t* recordPixels = reinterpret_cast<const uint8_t*>(record + 1);
+    size_t pixelBytes = static_cast<size_t>(record->info.width) * record->info.height * 4;
+    if (static_cast<uint32_t>(HashBytes(recordPixels, pixelBytes, 0)) != record->pixelChecksum)
+    {
+        // Damaged since the file was loaded, the record is left to the next compaction
+        m_index.erase(entry);
+        ++m_corruptCount;
+        ++m_missCount;
+        return false;
+    }
+
+    if (!pixels.hasSize(record->info.width, record->info.height, 4))
+    {
+        pixels = FrameBufferPool::GetInstance().Acquire(record->info.width, record->info.height, 4);
+    }
+    if (pixels.empty())
+        return false;
+    memcpy(pixels.data(), recordPixels, pixelBytes);
+    info = record->info;
+    ++m_hitCount;
+    return true;
+}
+
+bool ThumbnailCache::Insert(
+    const ThumbnailKey& key,
+    const ThumbnailInfo& info,
+    const uint8_t* pixels,
+    size_t stride,
+    unsigned int width,
+    unsigned int height)
+{
+    if (info.width == 0 || info.width > MAX_SIZE || info.height == 0 || info.height > MAX_SIZE ||
+        width == 0 || height == 0 || pixels == nullptr)
+        return false;
+
+    // Scaled outside the lock, the record is written as a whole
+    std::vector<uint8_t> bytes(GetRecordSize(info.width, info.height), 0);
+    uint8_t* recordPixels = bytes.data() + sizeof(Record);
+    Downscale(pixels, stride, width, height, recordPixels, info.width, info.height);
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.magic = RECORD_MAGIC;
+    record.recordSize = static_cast<uint32_t>(bytes.size());
+    record.key = key;
+    record.info = info;
+    record.pixelChecksum = static_cast<uint32_t>(HashBytes(recordPixels, static_cast<size_t>(info.width) * info.height * 4, 0));
+    memcpy(bytes.data(), &record, sizeof(record));
+    record.headerChecksum = HashBytes(bytes.data(), offsetof(Record, headerChecksum), RECORD_MAGIC);
+    memcpy(bytes.data(), &record, sizeof(record));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+#ifdef _WIN32
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+#else
+    if (m_file < 0)
+        return false;
+#endif
+    uint64_t indexKey = GetIndexKey(key);
+    if (m_index.count(indexKey) > 0)
+        return true;
+    if (m_fileSize + bytes.size() > m_budgetBytes && !Compact(bytes.size()))
+        return false;
+
+    uint64_t offset = m_fileSize;
+    if (!Append(bytes.data(), bytes.size()))
+    {
+        // Cut off what was written of the record
+        Truncate(offset);
+        Map();
+        return false;
+    }
+    m_index[indexKey] = offset;
+    m_offsets.push_back(offset);
+    return true;
+}
+
+// Keeps the newest records which fit into half of the budget, together with
+// the incoming record, and writes them again after the file header
+bool ThumbnailCache::Compact(size_t incomingBytes)
+{
+    if (m_fileSize > m_mappedSize && !Map())
+        return false;
+
+    uint64_t keptBytes = FILE_HEADER_SIZE + incomingBytes;
+    size_t first = m_offsets.size();
+    while (first > 0)
+    {
+        const Record* record = nullptr;
+        uint64_t offset = m_offsets[first - 1];
+        if (!CheckRecord(offset, record) || keptBytes + record->recordSize > m_budgetBytes / 2)
+            break;
+        keptBytes += record->recordSize;
+        --first;
+    }
+
+    // Records which were dropped from the index are not kept
+    std::vector<uint8_t> kept;
+    kept.reserve(static_cast<size_t>(keptBytes));
+    for (size_t i = first; i < m_offsets.size(); ++i)
+    {
+        const Record* record = nullptr;
+        if (!CheckRecord(m_offsets[i], record))
+            continue;
+        auto entry = m_index.find(GetIndexKey(record->key));
+        if (entry != m_index.end() && entry->second == m_offsets[i])
+        {
+            kept.insert(kept.end(), m_data + m_offsets[i], m_data + m_offsets[i] + record->recordSize);
+        }
+    }
+
+    if (!Truncate(FILE_HEADER_SIZE) || !Append(kept.data(), kept.size()) || !Map())
+    {
+        m_index.clear();
+        m_offsets.clear();
+        return false;
+    }
+    IndexRecords();
+    return m_fileSize + incomingBytes <= m_budgetBytes;
+}
+
+size_t ThumbnailCache::getEntryCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index.size();
+}
+
+uint64_t ThumbnailCache::getFileSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_fileSize;
+}
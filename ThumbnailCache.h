@@ -0,0 +1,147 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "FrameBufferPool.h"
+
+// Identifies the content of a file without reading all of it
+struct ThumbnailKey
+{
+    uint64_t contentHash;   // Hash of the first and last bytes of the file
+    uint64_t fileSize;
+    uint64_t writeTime;     // Last write time in the units of the file system
+
+    bool operator==(const ThumbnailKey& other) const
+    {
+        return contentHash == other.contentHash && fileSize == other.fileSize && writeTime == other.writeTime;
+    }
+};
+
+// What the viewer knows about an image before its decoder is ready
+struct ThumbnailInfo
+{
+    uint32_t imageWidth;        // Displayed size of the image, with the pixel aspect ratio applied
+    uint32_t imageHeight;
+    uint32_t frameCount;
+    uint32_t loopCount;
+    uint32_t backgroundColor;   // Premultiplied BGRA, as 0xAARRGGBB
+    uint32_t width;             // Size of the thumbnail
+    uint32_t height;
+};
+
+// Keeps scaled down first frames and the image info of opened files in a
+// memory mapped file, so that they survive between runs. Records are only
+// appended. When the file would grow beyond the budget, the oldest records
+// are dropped and the newest half is written again. Every record has a
+// checksum of its header and of its pixels, records which fail the checks
+// and everything after them are dropped. The file is opened by one process
+// at a time. The cache can be used from any thread.
+class ThumbnailCache
+{
+public:
+    static const unsigned int MAX_SIZE = 1024;      // Thumbnails larger than this are rejected as corrupt
+
+    explicit ThumbnailCache(uint64_t budgetBytes);
+    ~ThumbnailCache();
+
+    // Opens or creates the cache file. Fails if another process uses it.
+#ifdef _WIN32
+    bool Open(const wchar_t* filename);
+    static bool GetKey(const wchar_t* filename, ThumbnailKey& key);
+#else
+    bool Open(const char* filename);
+    static bool GetKey(const char* filename, ThumbnailKey& key);
+#endif
+    void Close();
+    bool isOpen() const;
+
+    // Fits the size of an image into maxSize x maxSize, at least 1 x 1
+    static void GetThumbnailSize(
+        unsigned int width,
+        unsigned int height,
+        unsigned int maxSize,
+        unsigned int& thumbnailWidth,
+        unsigned int& thumbnailHeight);
+
+    // Scales the premultiplied BGRA image down into the thumbnail, whose
+    // rows are thumbnailWidth * 4 bytes
+    static void Downscale(
+        const uint8_t* pixels,
+        size_t stride,
+        unsigned int width,
+        unsigned int height,
+        uint8_t* thumbnail,
+        unsigned int thumbnailWidth,
+        unsigned int thumbnailHeight);
+
+    // Copies the thumbnail of the key into pixels, 32bpp premultiplied BGRA
+    bool Lookup(const ThumbnailKey& key, ThumbnailInfo& info, FrameBuffer& pixels);
+
+    // Scales the premultiplied BGRA image down to info.width x info.height
+    // and appends it. Does nothing if the key is cached already.
+    bool Insert(
+        const ThumbnailKey& key,
+        const ThumbnailInfo& info,
+        const uint8_t* pixels,
+        size_t stride,
+        unsigned int width,
+        unsigned int height);
+
+    size_t       getEntryCount()   const;
+    uint64_t     getFileSize()     const;
+    unsigned int getHitCount()     const { return m_hitCount; }
+    unsigned int getMissCount()    const { return m_missCount; }
+    unsigned int getCorruptCount() const { return m_corruptCount; }
+
+private:
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+    // Layout of a record in the file, followed by the pixels of the
+    // thumbnail and padding to 8 bytes
+    struct Record
+    {
+        uint32_t      magic;
+        uint32_t      recordSize;
+        ThumbnailKey  key;
+        ThumbnailInfo info;
+        uint32_t      pixelChecksum;
+        uint64_t      headerChecksum;   // Of the fields before
+    };
+
+    static const uint32_t RECORD_MAGIC = 0x52545A5A;    // "ZZTR"
+    static const uint64_t FILE_MAGIC = 0x314842545A5A5A5Aull;  // "ZZZZTBH1"
+    static const size_t   FILE_HEADER_SIZE = 16;
+
+    static uint64_t GetIndexKey(const ThumbnailKey& key);
+    static size_t   GetRecordSize(unsigned int width, unsigned int height);
+
+    void CloseFile();
+    bool Map();
+    void Unmap();
+    bool Append(const uint8_t* data, size_t size);
+    bool Truncate(uint64_t size);
+    uint64_t IndexRecords();
+    bool Load();
+    bool Compact(size_t incomingBytes);
+    bool CheckRecord(uint64_t offset, const Record*& record) const;
+
+    uint64_t                               m_budgetBytes;
+    mutable std::mutex                     m_mutex;
+    std::unordered_map<uint64_t, uint64_t> m_index;         // Offsets of the records, by their key
+    std::vector<uint64_t>                  m_offsets;       // Offsets of the records in the file, oldest first
+    uint64_t                               m_fileSize;
+    const uint8_t*                         m_data;          // Mapped part of the file
+    uint64_t                               m_mappedSize;
+    unsigned int                           m_hitCount;
+    unsigned int                           m_missCount;
+    unsigned int                           m_corruptCount;
+#ifdef _WIN32
+    void*                                  m_file;
+    void*                                  m_mapping;
+#else
+    int                                    m_file;
+#endif
+};
@@ -0,0 +1,222 @@
+#include "ThumbnailLoader.h"
+#include "ComPtr.h"
+#include "FrameDecodeWorker.h"
+#include "ImageInfo.h"
+#include "Tracer.h"
+
+ThumbnailLoader::ThumbnailLoader(ThumbnailCache& cache, unsigned int threadCount) :
+    m_cache(cache),
+    m_threadCount(threadCount > 0 ? threadCount : 1),
+    m_thumbnailSize(0),
+    m_generation(0),
+    m_notifyWindow(nullptr),
+    m_notifyMessage(0),
+    m_notified(false),
+    m_builtCount(0),
+    m_cachedCount(0)
+{
+}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+    Stop();
+}
+
+void ThumbnailLoader::Stop()
+{
+    m_queue.Stop();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+}
+
+void ThumbnailLoader::Reset(HWND notifyWindow, UINT notifyMessage)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_generation;
+        m_filenames.clear();
+        m_finished.clear();
+        m_notifyWindow = notifyWindow;
+        m_notifyMessage = notifyMessage;
+    }
+    m_queue.Reset();
+    m_notified = false;
+}
+
+void ThumbnailLoader::Load(const std::vector<Request>& requests, unsigned int thumbnailSize)
+{
+    std::vector<size_t> items;
+    items.reserve(requests.size());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_filenames.clear();
+        for (const auto& request : requests)
+        {
+            m_filenames[request.item] = request.filename;
+            items.push_back(request.item);
+        }
+        m_thumbnailSize = thumbnailSize;
+    }
+    m_queue.SetWanted(items);
+
+    // The threads are started when the grid view is first shown
+    while (!requests.empty() && m_threads.size() < m_threadCount)
+    {
+        m_threads.emplace_back(&ThumbnailLoader::Run, this);
+    }
+}
+
+void ThumbnailLoader::TakeFinished(std::vector<std::unique_ptr<Thumbnail>>& thumbnails)
+{
+    m_notified = false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& thumbnail : m_finished)
+    {
+        thumbnails.push_back(std::move(thumbnail));
+    }
+    m_finished.clear();
+}
+
+bool ThumbnailLoader::GetRequest(size_t item, std::wstring& filename, unsigned int& thumbnailSize, unsigned int& generation) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto request = m_filenames.find(item);
+    if (request == m_filenames.end())
+        return false;
+    filename = request->second;
+    thumbnailSize = m_thumbnailSize;
+    generation = m_generation;
+    return true;
+}
+
+void ThumbnailLoader::Publish(std::unique_ptr<Thumbnail> thumbnail, unsigned int generation)
+{
+    HWND notifyWindow = nullptr;
+    UINT notifyMessage = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (generation != m_generation || !m_queue.isWanted(thumbnail->item))
+            return;
+        m_finished.push_back(std::move(thumbnail));
+        notifyWindow = m_notifyWindow;
+        notifyMessage = m_notifyMessage;
+    }
+
+    // One notification at a time, the UI thread takes all thumbnails which
+    // are ready until then
+    if (notifyWindow && !m_notified.exchange(true))
+    {
+        PostMessage(notifyWindow, notifyMessage, 0, 0);
+    }
+}
+
+bool ThumbnailLoader::Build(IWICImagingFactory* factory, const std::wstring& filename, unsigned int thumbnailSize, Thumbnail& thumbnail)
+{
+    TRACE_SCOPE("BuildThumbnail");
+    ThumbnailKey key;
+    bool hasKey = ThumbnailCache::GetKey(filename.c_str(), key);
+    if (hasKey && m_cache.Lookup(key, thumbnail.info, thumbnail.pixels))
+    {
+        ++m_cachedCount;
+        return true;
+    }
+
+    ComPtr<IWICBitmapDecoder> decoder;
+    HRESULT hr = factory->CreateDecoderFromFilename(
+        filename.c_str(),
+        nullptr,
+        GENERIC_READ,
+        WICDecodeMetadataCacheOnDemand,
+        decoder.get_out_storage());
+
+    ImageInfo imageInfo;
+    if (SUCCEEDED(hr) && FAILED(imageInfo.GetGlobalMetadata(decoder.get())))
+    {
+        hr = imageInfo.GetDefaultMetadata(decoder.get());
+    }
+    if (SUCCEEDED(hr) && imageInfo.getFrameCount() == 0)
+    {
+        hr = E_FAIL;
+    }
+
+    // Single frame images are scaled while they are decoded, decoders like
+    // the JPEG decoder skip most of the work then
+    DecodedFrame frame;
+    frame.frameIndex = 0;
+    if (SUCCEEDED(hr))
+    {
+        hr = FrameDecodeWorker::DecodeFrame(factory, decoder.get(), frame, thumbnailSize, thumbnailSize);
+    }
+    if (FAILED(hr) || frame.width == 0 || frame.height == 0)
+        return false;
+
+    ThumbnailInfo& info = thumbnail.info;
+    info.imageWidth = imageInfo.getImageWidthPixel();
+    info.imageHeight = imageInfo.getImageHeightPixel();
+    info.frameCount = imageInfo.getFrameCount();
+    info.loopCount = imageInfo.getTotalLoopCount();
+    info.backgroundColor = ToCanvasColor(imageInfo.getBackgroundColor());
+    ThumbnailCache::GetThumbnailSize(frame.width, frame.height, thumbnailSize, info.width, info.height);
+    thumbnail.pixels = FrameBufferPool::GetInstance().Acquire(info.width, info.height, 4);
+    if (thumbnail.pixels.empty())
+        return false;
+    ThumbnailCache::Downscale(
+        frame.pixels.data(),
+        static_cast<size_t>(frame.width) * 4,
+        frame.width,
+        frame.height,
+        thumbnail.pixels.data(),
+        info.width,
+        info.height);
+    ++m_builtCount;
+
+    // The first frame of an animation may cover a part of the image only,
+    // the preview of the viewer needs the whole image
+    if (hasKey && (info.frameCount == 1 ||
+        (frame.width == imageInfo.getImageWidth() && frame.height == imageInfo.getImageHeight())))
+    {
+        m_cache.Insert(key, info, thumbnail.pixels.data(), thumbnail.pixels.getStride(), info.width, info.height);
+    }
+    return true;
+}
+
+void ThumbnailLoader::Run()
+{
+    Tracer::SetThreadName("Thumbnail loader");
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr))
+        return;
+
+    {
+        // The factory of the UI thread belongs to its apartment
+        ComPtr<IWICImagingFactory> factory;
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            nullptr,
+            CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(factory.get_out_storage()));
+
+        size_t item = 0;
+        while (SUCCEEDED(hr) && m_queue.Take(item))
+        {
+            std::wstring filename;
+            unsigned int thumbnailSize = 0;
+            unsigned int generation = 0;
+            std::unique_ptr<Thumbnail> thumbnail(new Thumbnail());
+            thumbnail->item = item;
+            bool built = GetRequest(item, filename, thumbnailSize, generation) &&
+                Build(factory.get(), filename, thumbnailSize, *thumbnail);
+            m_queue.Finish();
+            if (built)
+            {
+                Publish(std::move(thumbnail), generation);
+            }
+        }
+    }
+
+    CoUninitialize();
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <windows.h>
+#include <wincodec.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ThumbnailCache.h"
+#include "ThumbnailQueue.h"
+
+// The thumbnail of a file of the grid view
+struct Thumbnail
+{
+    size_t        item;         // Index of the file in the ShellNavigator
+    ThumbnailInfo info;
+    FrameBuffer   pixels;       // 32bpp premultiplied BGRA, info.width x info.height
+};
+
+// Builds the thumbnails of the files shown in the grid view on worker
+// threads, the visible files first and the files after them next. Cached
+// thumbnails are taken from the ThumbnailCache, other files are decoded
+// with WIC, single frame images scaled while they are decoded, and their
+// first frames are added to the cache. The window is notified when
+// thumbnails are ready.
+class ThumbnailLoader
+{
+public:
+    ThumbnailLoader(ThumbnailCache& cache, unsigned int threadCount);
+    ~ThumbnailLoader();
+
+    struct Request
+    {
+        size_t       item;
+        std::wstring filename;
+    };
+
+    // Forgets the files and the built thumbnails, for a new folder. The
+    // message is posted to the window whenever thumbnails are ready.
+    void Reset(HWND notifyWindow, UINT notifyMessage);
+
+    // Sets the files whose thumbnails are wanted, the most important first.
+    // Files which are no longer wanted are not decoded, and their thumbnails
+    // are dropped if they are ready before they were taken.
+    void Load(const std::vector<Request>& requests, unsigned int thumbnailSize);
+
+    // Moves the thumbnails which are ready into thumbnails
+    void TakeFinished(std::vector<std::unique_ptr<Thumbnail>>& thumbnails);
+
+    void Stop();
+
+    unsigned int getBuiltCount()    const { return m_builtCount; }     // Thumbnails decoded from the files
+    unsigned int getCachedCount()   const { return m_cachedCount; }    // Thumbnails taken from the cache
+    unsigned int getCanceledCount() const { return m_queue.getCanceledCount(); }
+
+private:
+    ThumbnailLoader(const ThumbnailLoader&) = delete;
+    ThumbnailLoader& operator=(const ThumbnailLoader&) = delete;
+
+    void Run();
+    bool GetRequest(size_t item, std::wstring& filename, unsigned int& thumbnailSize, unsigned int& generation) const;
+    bool Build(IWICImagingFactory* factory, const std::wstring& filename, unsigned int thumbnailSize, Thumbnail& thumbnail);
+    void Publish(std::unique_ptr<Thumbnail> thumbnail, unsigned int generation);
+
+    ThumbnailCache&                                 m_cache;
+    ThumbnailQueue                                  m_queue;
+    unsigned int                                    m_threadCount;
+    std::vector<std::thread>                        m_threads;
+
+    mutable std::mutex                              m_mutex;        // Protects the members below
+    std::unordered_map<size_t, std::wstring>        m_filenames;    // Of the wanted items
+    unsigned int                                    m_thumbnailSize;
+    unsigned int                                    m_generation;   // Counts the calls of Reset, thumbnails of older folders are dropped
+    std::vector<std::unique_ptr<Thumbnail>>         m_finished;     // Not yet taken by the UI thread
+    HWND                                            m_notifyWindow;
+    UINT                                            m_notifyMessage;
+
+    std::atomic<bool>                               m_notified;     // Whether a notification is pending
+    std::atomic<unsigned int>                       m_builtCount;
+    std::atomic<unsigned int>                       m_cachedCount;
+};
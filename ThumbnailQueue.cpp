@@ -0,0 +1,131 @@
+#include "ThumbnailQueue.h"
+#include <iterator>
+
+ThumbnailQueue::ThumbnailQueue() :
+    m_next(0),
+    m_running(0),
+    m_finishedCount(0),
+    m_canceledCount(0),
+    m_stop(false)
+{
+}
+
+void ThumbnailQueue::SetWanted(const std::vector<size_t>& items)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unordered_set<size_t> wantedSet(items.begin(), items.end());
+        for (size_t i = m_next; i < m_wanted.size(); ++i)
+        {
+            if (m_taken.count(m_wanted[i]) == 0 && wantedSet.count(m_wanted[i]) == 0)
+            {
+                ++m_canceledCount;
+            }
+        }
+        m_wanted = items;
+        m_wantedSet.swap(wantedSet);
+        m_next = 0;
+
+        // Items which come back into view are built again, their thumbnails
+        // were dropped
+        for (auto item = m_taken.begin(); item != m_taken.end();)
+        {
+            item = m_wantedSet.count(*item) == 0 ? m_taken.erase(item) : std::next(item);
+        }
+    }
+    m_wake.notify_all();
+
+    // Dropped items may have been all WaitIdle waits for
+    m_idle.notify_all();
+}
+
+void ThumbnailQueue::Reset()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wanted.clear();
+        m_wantedSet.clear();
+        m_taken.clear();
+        m_next = 0;
+    }
+    m_idle.notify_all();
+}
+
+// Skips the items at the front which were taken before, so that scanning
+// the list stays linear in its length
+void ThumbnailQueue::SkipTaken()
+{
+    while (m_next < m_wanted.size() && m_taken.count(m_wanted[m_next]) > 0)
+    {
+        ++m_next;
+    }
+}
+
+bool ThumbnailQueue::FindWanted(size_t& item)
+{
+    SkipTaken();
+    if (m_next == m_wanted.size())
+        return false;
+    item = m_wanted[m_next++];
+    return true;
+}
+
+bool ThumbnailQueue::Take(size_t& item)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wake.wait(lock, [this, &item] {
+        return m_stop || FindWanted(item);
+    });
+    if (m_stop)
+        return false;
+    m_taken.insert(item);
+    ++m_running;
+    return true;
+}
+
+void ThumbnailQueue::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_running;
+        ++m_finishedCount;
+    }
+    m_idle.notify_all();
+}
+
+bool ThumbnailQueue::isWanted(size_t item) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_wantedSet.count(item) > 0;
+}
+
+void ThumbnailQueue::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] {
+        SkipTaken();
+        return m_stop || (m_running == 0 && m_next == m_wanted.size());
+    });
+}
+
+void ThumbnailQueue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_idle.notify_all();
+}
+
+unsigned int ThumbnailQueue::getFinishedCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_finishedCount;
+}
+
+unsigned int ThumbnailQueue::getCanceledCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_canceledCount;
+}
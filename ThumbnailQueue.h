@@ -0,0 +1,64 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+// Hands out the items of a list whose thumbnails are wanted to worker
+// threads, the most important first. The wanted items are replaced when the
+// visible part of the list changes, items which are no longer wanted and
+// were not taken yet are dropped. An item is handed out once for as long as
+// it stays wanted. Items are indices into a list kept by the caller, like
+// the files of a folder. The queue can be used from any thread.
+class ThumbnailQueue
+{
+public:
+    ThumbnailQueue();
+
+    // Sets the wanted items, the most important first
+    void SetWanted(const std::vector<size_t>& items);
+
+    // Forgets the wanted items and which items were handed out, for a new
+    // list. Items taken before are still finished by their workers.
+    void Reset();
+
+    // Waits for a wanted item which was not handed out yet. Returns false
+    // once the queue is stopped.
+    bool Take(size_t& item);
+
+    // Called when the thumbnail of a taken item was built or failed
+    void Finish();
+
+    // Whether the item is still wanted, so that results of items scrolled
+    // out of view can be dropped
+    bool isWanted(size_t item) const;
+
+    // Waits until all wanted items are finished
+    void WaitIdle();
+
+    // Lets Take return false, for the workers to end
+    void Stop();
+
+    unsigned int getFinishedCount() const;
+    unsigned int getCanceledCount() const;  // Wanted items dropped before they were taken
+
+private:
+    ThumbnailQueue(const ThumbnailQueue&) = delete;
+    ThumbnailQueue& operator=(const ThumbnailQueue&) = delete;
+
+    void SkipTaken();
+    bool FindWanted(size_t& item);
+
+    mutable std::mutex          m_mutex;        // Protects the members below
+    std::condition_variable     m_wake;         // Signals new wanted items and stop to the workers
+    std::condition_variable     m_idle;         // Signals finished items
+    std::vector<size_t>         m_wanted;
+    std::unordered_set<size_t>  m_wantedSet;
+    size_t                      m_next;         // Position in m_wanted before which all items were taken
+    std::unordered_set<size_t>  m_taken;        // Wanted items which were handed out
+    unsigned int                m_running;      // Taken items which are not finished
+    unsigned int                m_finishedCount;
+    unsigned int                m_canceledCount;
+    bool                        m_stop;
+};
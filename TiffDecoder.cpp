@@ -0,0 +1,890 @@
+#include "TiffDecoder.h"
+#include <cstring>
+#include "PixelConverterKernels.h"
+#include "WorkerPool.h"
+#include "ZlibInflater.h"
+
+namespace {
+
+enum TIFF_TAGS
+{
+    TAG_IMAGE_WIDTH = 256,
+    TAG_IMAGE_LENGTH = 257,
+    TAG_BITS_PER_SAMPLE = 258,
+    TAG_COMPRESSION = 259,
+    TAG_PHOTOMETRIC = 262,
+    TAG_FILL_ORDER = 266,
+    TAG_STRIP_OFFSETS = 273,
+    TAG_SAMPLES_PER_PIXEL = 277,
+    TAG_ROWS_PER_STRIP = 278,
+    TAG_STRIP_BYTE_COUNTS = 279,
+    TAG_PLANAR_CONFIGURATION = 284,
+    TAG_PREDICTOR = 317,
+    TAG_COLOR_MAP = 320,
+    TAG_TILE_WIDTH = 322,
+    TAG_TILE_LENGTH = 323,
+    TAG_TILE_OFFSETS = 324,
+    TAG_TILE_BYTE_COUNTS = 325,
+    TAG_EXTRA_SAMPLES = 338,
+    TAG_SAMPLE_FORMAT = 339
+};
+
+enum TIFF_COMPRESSIONS
+{
+    COMPRESSION_NONE = 1,
+    COMPRESSION_LZW = 5,
+    COMPRESSION_DEFLATE = 8,
+    COMPRESSION_PACKBITS = 32773,
+    COMPRESSION_DEFLATE_OLD = 32946
+};
+
+enum TIFF_PHOTOMETRICS
+{
+    PHOTOMETRIC_WHITE_IS_ZERO = 0,
+    PHOTOMETRIC_BLACK_IS_ZERO = 1,
+    PHOTOMETRIC_RGB = 2,
+    PHOTOMETRIC_PALETTE = 3
+};
+
+enum TIFF_EXTRA_SAMPLES
+{
+    EXTRA_UNSPECIFIED = 0,
+    EXTRA_ASSOCIATED_ALPHA = 1,
+    EXTRA_UNASSOCIATED_ALPHA = 2
+};
+
+// Size in bytes of a value of the TIFF field types, 0 for unknown types
+unsigned int GetTypeSize(unsigned int type)
+{
+    switch (type)
+    {
+    case 1: case 2: case 6: case 7:
+        return 1;
+    case 3: case 8:
+        return 2;
+    case 4: case 9: case 11: case 13:
+        return 4;
+    case 5: case 10: case 12: case 16: case 17: case 18:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+bool DecodePackBits(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size, size_t& written)
+{
+    written = 0;
+    size_t pos = 0;
+    while (pos < sourceSize && written < size)
+    {
+        int header = static_cast<int8_t>(source[pos++]);
+        if (header >= 0)
+        {
+            size_t count = static_cast<size_t>(header) + 1;
+            if (count > sourceSize - pos)
+                count = sourceSize - pos;
+            if (count > size - written)
+                count = size - written;
+            memcpy(destination + written, source + pos, count);
+            pos += count;
+            written += count;
+        }
+        else if (header != -128 && pos < sourceSize)
+        {
+            size_t count = static_cast<size_t>(1 - header);
+            if (count > size - written)
+                count = size - written;
+            memset(destination + written, source[pos++], count);
+            written += count;
+        }
+    }
+    return true;
+}
+
+// TIFF LZW with codes of 9 to 12 bits, most significant bit first, which
+// grow one code early. Each code is kept as the position and length of its
+// string in the output, so strings are copied instead of being walked.
+bool DecodeLzw(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t size, size_t& written)
+{
+    const unsigned int CLEAR_CODE = 256;
+    const unsigned int END_CODE = 257;
+    const unsigned int MAX_CODES = 4096;
+
+    written = 0;
+
+    // Old-style LZW of early libtiff versions has the bits in reverse order
+    if (sourceSize >= 2 && source[0] == 0 && (source[1] & 1) != 0)
+        return false;
+
+    static thread_local uint32_t positions[MAX_CODES];
+    static thread_local uint16_t lengths[MAX_CODES];
+
+    unsigned int codeBits = 9;
+    unsigned int nextCode = END_CODE + 1;
+    bool hasPrevious = false;
+    size_t previousPosition = 0;
+    size_t previousLength = 0;
+    uint32_t bits = 0;
+    unsigned int bitCount = 0;
+    size_t pos = 0;
+
+    while (written < size)
+    {
+        while (bitCount < codeBits && pos < sourceSize)
+        {
+            bits = (bits << 8) | source[pos++];
+            bitCount += 8;
+        }
+        if (bitCount < codeBits)
+            break;
+        unsigned int code = (bits >> (bitCount - codeBits)) & ((1u << codeBits) - 1);
+        bitCount -= codeBits;
+
+        if (code == END_CODE)
+            break;
+        if (code == CLEAR_CODE)
+        {
+            codeBits = 9;
+            nextCode = END_CODE + 1;
+            hasPrevious = false;
+            continue;
+        }
+
+        size_t stringPosition;
+        size_t stringLength;
+        if (code < CLEAR_CODE)
+        {
+            stringPosition = 0;
+            stringLength = 1;
+        }
+        else if (!hasPrevious)
+        {
+            return false;
+        }
+        else if (code < nextCode)
+        {
+            stringPosition = positions[code];
+            stringLength = lengths[code];
+        }
+        else if (code == nextCode)
+        {
+            // The string of the previous code and its own first byte
+            stringPosition = previousPosition;
+            stringLength = previousLength + 1;
+        }
+        else
+        {
+            return false;
+        }
+
+        size_t position = written;
+        size_t count = stringLength < size - written ? stringLength : size - written;
+        if (code < CLEAR_CODE)
+        {
+            destination[written] = static_cast<uint8_t>(code);
+        }
+        else
+        {
+            // The string may overlap the bytes it produces
+            for (size_t i = 0; i < count; ++i)
+            {
+                destination[position + i] = destination[stringPosition + i];
+            }
+        }
+        written += count;
+
+        // The new code is the previous string followed by the first byte of
+        // this one, which directly follows it in the output
+        if (hasPrevious && nextCode < MAX_CODES && previousLength < 0xFFFF)
+        {
+            positions[nextCode] = static_cast<uint32_t>(previousPosition);
+            lengths[nextCode] = static_cast<uint16_t>(previousLength + 1);
+            ++nextCode;
+            if (nextCode == (1u << codeBits) - 1 && codeBits < 12)
+            {
+                ++codeBits;
+            }
+        }
+        hasPrevious = true;
+        previousPosition = position;
+        previousLength = stringLength;
+    }
+    return true;
+}
+
+// Unpacks samples of 1, 2 or 4 bits, most significant bits first, to bytes.
+// Gray values are scaled to 0 to 255.
+void UnpackRow(const uint8_t* source, uint8_t* destination, unsigned int width, unsigned int bits, bool scale)
+{
+    unsigned int mask = (1u << bits) - 1;
+    unsigned int factor = scale ? 255 / mask : 1;
+    unsigned int perByte = 8 / bits;
+    for (unsigned int x = 0; x < width; ++x)
+    {
+        unsigned int shift = 8 - bits * (x % perByte + 1);
+        destination[x] = static_cast<uint8_t>(((source[x / perByte] >> shift) & mask) * factor);
+    }
+}
+
+// Adds the difference of each sample to the same sample of the pixel before
+void UndoPredictor(uint8_t* row, unsigned int width, unsigned int samplesPerPixel, unsigned int bitsPerSample)
+{
+    size_t count = static_cast<size_t>(width) * samplesPerPixel;
+    if (bitsPerSample == 8)
+    {
+        for (size_t i = samplesPerPixel; i < count; ++i)
+        {
+            row[i] = static_cast<uint8_t>(row[i] + row[i - samplesPerPixel]);
+        }
+    }
+    else
+    {
+        // 16 bit samples, which are little endian at this point
+        for (size_t i = samplesPerPixel; i < count; ++i)
+        {
+            uint8_t* sample = row + i * 2;
+            const uint8_t* previous = sample - samplesPerPixel * 2;
+            unsigned int value = (sample[0] | (sample[1] << 8)) + (previous[0] | (previous[1] << 8));
+            sample[0] = static_cast<uint8_t>(value);
+            sample[1] = static_cast<uint8_t>(value >> 8);
+        }
+    }
+}
+
+}
+
+PixelRect TiffPage::getBlockRect(unsigned int blockIndex) const
+{
+    PixelRect rect = PixelRect::Make(
+        (blockIndex % blocksAcross) * blockWidth,
+        (blockIndex / blocksAcross) * blockHeight,
+        blockWidth,
+        blockHeight);
+    rect.Intersect(PixelRect::Make(0, 0, width, height));
+    return rect;
+}
+
+TiffDecoder::TiffDecoder()
+{
+    Reset();
+}
+
+bool TiffDecoder::IsTiff(const uint8_t* data, size_t size)
+{
+    if (size < 8)
+        return false;
+    bool littleEndian = data[0] == 'I' && data[1] == 'I';
+    bool bigEndian = data[0] == 'M' && data[1] == 'M';
+    if (!littleEndian && !bigEndian)
+        return false;
+    unsigned int version = littleEndian ? (data[2] | (data[3] << 8)) : ((data[2] << 8) | data[3]);
+    return version == 42 || (version == 43 && size >= 16);
+}
+
+bool TiffDecoder::Open(const uint8_t* data, size_t size)
+{
+    Reset();
+    if (!IsTiff(data, size))
+        return false;
+
+    m_data = data;
+    m_size = size;
+    m_bigEndian = data[0] == 'M';
+    m_bigTiff = Read16(2) == 43;
+    if (m_bigTiff)
+    {
+        // BigTIFF has 8 byte offsets
+        if (Read16(4) != 8 || Read16(6) != 0)
+        {
+            Reset();
+            return false;
+        }
+        m_nextOffset = Read64(8);
+    }
+    else
+    {
+        m_nextOffset = Read32(4);
+    }
+
+    // A file without a first page is no image
+    if (!FindPage(0))
+    {
+        Reset();
+        return false;
+    }
+    return true;
+}
+
+void TiffDecoder::Reset()
+{
+    m_data = nullptr;
+    m_size = 0;
+    m_bigEndian = false;
+    m_bigTiff = false;
+    m_pageOffsets.clear();
+    m_nextOffset = 0;
+    m_indexedOffsets.clear();
+}
+
+uint16_t TiffDecoder::Read16(size_t offset) const
+{
+    const uint8_t* p = m_data + offset;
+    return static_cast<uint16_t>(m_bigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8));
+}
+
+uint32_t TiffDecoder::Read32(size_t offset) const
+{
+    uint32_t high = Read16(offset + (m_bigEndian ? 0 : 2));
+    uint32_t low = Read16(offset + (m_bigEndian ? 2 : 0));
+    return (high << 16) | low;
+}
+
+uint64_t TiffDecoder::Read64(size_t offset) const
+{
+    uint64_t high = Read32(offset + (m_bigEndian ? 0 : 4));
+    uint64_t low = Read32(offset + (m_bigEndian ? 4 : 0));
+    return (high << 32) | low;
+}
+
+bool TiffDecoder::ReadNextOffset(uint64_t ifdOffset, uint64_t& nextOffset) const
+{
+    // Only the entry count is read to skip the entries
+    size_t countSize = m_bigTiff ? 8 : 2;
+    size_t entrySize = m_bigTiff ? 20 : 12;
+    size_t offsetSize = m_bigTiff ? 8 : 4;
+    if (ifdOffset < 8 || ifdOffset > m_size || m_size - ifdOffset < countSize)
+        return false;
+
+    uint64_t entryCount = m_bigTiff ? Read64(static_cast<size_t>(ifdOffset)) : Read16(static_cast<size_t>(ifdOffset));
+    uint64_t available = (m_size - ifdOffset - countSize) / entrySize;
+    if (entryCount > available)
+        return false;
+
+    size_t nextPosition = static_cast<size_t>(ifdOffset + countSize + entryCount * entrySize);
+    if (m_size - nextPosition < offsetSize)
+    {
+        // Some writers omit the offset after the last directory
+        nextOffset = 0;
+        return true;
+    }
+    nextOffset = m_bigTiff ? Read64(nextPosition) : Read32(nextPosition);
+    return true;
+}
+
+bool TiffDecoder::FindPage(unsigned int pageIndex)
+{
+    // Follow the chain from the last indexed directory
+    while (pageIndex >= m_pageOffsets.size() && m_nextOffset != 0)
+    {
+        uint64_t offset = m_nextOffset;
+        uint64_t nextOffset = 0;
+        if (!m_indexedOffsets.insert(offset).second || !ReadNextOffset(offset, nextOffset))
+        {
+            // A loop or an invalid directory ends the chain
+            m_nextOffset = 0;
+            break;
+        }
+        m_pageOffsets.push_back(offset);
+        m_nextOffset = nextOffset;
+    }
+
+    if (m_nextOffset == 0)
+    {
+        // The set is only needed while the chain is followed
+        std::unordered_set<uint64_t>().swap(m_indexedOffsets);
+    }
+    return pageIndex < m_pageOffsets.size();
+}
+
+unsigned int TiffDecoder::getPageCount()
+{
+    if (!isOpen())
+        return 0;
+    FindPage(UINT32_MAX);
+    return getIndexedPageCount();
+}
+
+unsigned int TiffDecoder::IndexPages(unsigned int pageCount)
+{
+    if (isOpen() && pageCount > 0)
+    {
+        FindPage(pageCount - 1);
+    }
+    return getIndexedPageCount();
+}
+
+bool TiffDecoder::ReadEntries(uint64_t ifdOffset, std::vector<Entry>& entries) const
+{
+    size_t countSize = m_bigTiff ? 8 : 2;
+    size_t entrySize = m_bigTiff ? 20 : 12;
+    size_t inlineSize = m_bigTiff ? 8 : 4;
+    uint64_t entryCount = m_bigTiff ? Read64(static_cast<size_t>(ifdOffset)) : Read16(static_cast<size_t>(ifdOffset));
+
+    entries.clear();
+    entries.reserve(static_cast<size_t>(entryCount));
+    for (uint64_t i = 0; i < entryCount; ++i)
+    {
+        size_t position = static_cast<size_t>(ifdOffset + countSize + i * entrySize);
+        Entry entry;
+        entry.tag = Read16(position);
+        entry.type = Read16(position + 2);
+        entry.count = m_bigTiff ? Read64(position + 4) : Read32(position + 4);
+        size_t valuePosition = position + (m_bigTiff ? 12 : 8);
+
+        // Values which do not fit into the entry are stored elsewhere
+        unsigned int typeSize = GetTypeSize(entry.type);
+        if (typeSize == 0 || entry.count > m_size / typeSize)
+            continue;
+        uint64_t valueSize = entry.count * typeSize;
+        if (valueSize <= inlineSize)
+        {
+            entry.valueOffset = valuePosition;
+        }
+        else
+        {
+            uint64_t offset = m_bigTiff ? Read64(valuePosition) : Read32(valuePosition);
+            if (offset > m_size || m_size - offset < valueSize)
+                continue;
+            entry.valueOffset = static_cast<size_t>(offset);
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+bool TiffDecoder::ReadValues(const Entry& entry, std::vector<uint64_t>& values) const
+{
+    values.resize(static_cast<size_t>(entry.count));
+    unsigned int typeSize = GetTypeSize(entry.type);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        size_t position = entry.valueOffset + i * typeSize;
+        switch (entry.type)
+        {
+        case 1: case 6: case 7:
+            values[i] = m_data[position];
+            break;
+        case 3: case 8:
+            values[i] = Read16(position);
+            break;
+        case 4: case 9: case 13:
+            values[i] = Read32(position);
+            break;
+        case 16: case 17: case 18:
+            values[i] = Read64(position);
+            break;
+        default:
+            // Rationals and floating point values are not used for the layout
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t TiffDecoder::ReadValue(const Entry& entry, uint64_t defaultValue) const
+{
+    std::vector<uint64_t> values;
+    if (entry.count == 0 || !ReadValues(entry, values))
+        return defaultValue;
+    return values[0];
+}
+
+bool TiffDecoder::ReadPage(unsigned int pageIndex, TiffPage& page)
+{
+    if (!FindPage(pageIndex))
+        return false;
+
+    std::vector<Entry> entries;
+    ReadEntries(m_pageOffsets[pageIndex], entries);
+    auto find = [&entries](unsigned int tag) -> const Entry*
+    {
+        for (const auto& entry : entries)
+        {
+            if (entry.tag == tag)
+                return &entry;
+        }
+        return nullptr;
+    };
+    auto value = [this, &find](unsigned int tag, uint64_t defaultValue) -> uint64_t
+    {
+        const Entry* entry = find(tag);
+        return entry ? ReadValue(*entry, defaultValue) : defaultValue;
+    };
+
+    uint64_t width = value(TAG_IMAGE_WIDTH, 0);
+    uint64_t height = value(TAG_IMAGE_LENGTH, 0);
+    if (width == 0 || height == 0 || width * height > MAX_PIXELS)
+        return false;
+    page.width = static_cast<unsigned int>(width);
+    page.height = static_cast<unsigned int>(height);
+    page.bitsPerSample = static_cast<unsigned int>(value(TAG_BITS_PER_SAMPLE, 1));
+    page.samplesPerPixel = static_cast<unsigned int>(value(TAG_SAMPLES_PER_PIXEL, 1));
+    page.photometric = static_cast<unsigned int>(value(TAG_PHOTOMETRIC, PHOTOMETRIC_BLACK_IS_ZERO));
+    page.compression = static_cast<unsigned int>(value(TAG_COMPRESSION, COMPRESSION_NONE));
+    page.predictor = static_cast<unsigned int>(value(TAG_PREDICTOR, 1));
+    page.whiteIsZero = page.photometric == PHOTOMETRIC_WHITE_IS_ZERO;
+    page.associatedAlpha = false;
+    if (page.samplesPerPixel == 0 || page.samplesPerPixel > 8 || page.bitsPerSample == 0 || page.bitsPerSample > 16)
+        return false;
+
+    const Entry* offsets;
+    const Entry* byteCounts;
+    page.tiled = find(TAG_TILE_WIDTH) != nullptr;
+    if (page.tiled)
+    {
+        page.blockWidth = static_cast<unsigned int>(value(TAG_TILE_WIDTH, 0));
+        page.blockHeight = static_cast<unsigned int>(value(TAG_TILE_LENGTH, 0));
+        offsets = find(TAG_TILE_OFFSETS);
+        byteCounts = find(TAG_TILE_BYTE_COUNTS);
+    }
+    else
+    {
+        uint64_t rowsPerStrip = value(TAG_ROWS_PER_STRIP, height);
+        page.blockWidth = page.width;
+        page.blockHeight = static_cast<unsigned int>(rowsPerStrip < height ? rowsPerStrip : height);
+        offsets = find(TAG_STRIP_OFFSETS);
+        byteCounts = find(TAG_STRIP_BYTE_COUNTS);
+    }
+    if (page.blockWidth == 0 || page.blockHeight == 0 || page.blockWidth > 65536 ||
+        static_cast<uint64_t>(page.blockWidth) * page.blockHeight > MAX_PIXELS || offsets == nullptr)
+        return false;
+    page.blocksAcross = (page.width + page.blockWidth - 1) / page.blockWidth;
+    page.blocksDown = (page.height + page.blockHeight - 1) / page.blockHeight;
+
+    if (!ReadValues(*offsets, page.blockOffsets) || page.blockOffsets.size() < page.getBlockCount())
+        return false;
+    if (byteCounts == nullptr)
+    {
+        // Only a single uncompressed strip can be read without byte counts
+        if (page.compression != COMPRESSION_NONE || page.getBlockCount() != 1)
+            return false;
+        page.blockByteCounts.assign(1, page.getBlockRowBytes() * page.height);
+    }
+    else if (!ReadValues(*byteCounts, page.blockByteCounts) || page.blockByteCounts.size() < page.getBlockCount())
+    {
+        return false;
+    }
+
+    SetConversion(page, entries);
+    return true;
+}
+
+bool TiffDecoder::SetConversion(TiffPage& page, const std::vector<Entry>& entries) const
+{
+    page.conversion = TC_UNSUPPORTED;
+    page.format = PF_UNSUPPORTED;
+
+    std::vector<uint64_t> bitsPerSample;
+    std::vector<uint64_t> extraSamples;
+    std::vector<uint64_t> colorMap;
+    uint64_t sampleFormat = 1;
+    uint64_t planarConfiguration = 1;
+    uint64_t fillOrder = 1;
+    for (const auto& entry : entries)
+    {
+        switch (entry.tag)
+        {
+        case TAG_BITS_PER_SAMPLE:
+            ReadValues(entry, bitsPerSample);
+            break;
+        case TAG_EXTRA_SAMPLES:
+            ReadValues(entry, extraSamples);
+            break;
+        case TAG_COLOR_MAP:
+            ReadValues(entry, colorMap);
+            break;
+        case TAG_SAMPLE_FORMAT:
+            sampleFormat = ReadValue(entry, 1);
+            break;
+        case TAG_PLANAR_CONFIGURATION:
+            planarConfiguration = ReadValue(entry, 1);
+            break;
+        case TAG_FILL_ORDER:
+            fillOrder = ReadValue(entry, 1);
+            break;
+        }
+    }
+
+    // Unsigned integer samples of the same size, interleaved in the order of
+    // the bits in each byte
+    for (uint64_t bits : bitsPerSample)
+    {
+        if (bits != page.bitsPerSample)
+            return false;
+    }
+    if (sampleFormat != 1 || fillOrder != 1 || (planarConfiguration != 1 && page.samplesPerPixel != 1))
+        return false;
+
+    switch (page.compression)
+    {
+    case COMPRESSION_NONE:
+    case COMPRESSION_LZW:
+    case COMPRESSION_DEFLATE:
+    case COMPRESSION_DEFLATE_OLD:
+    case COMPRESSION_PACKBITS:
+        break;
+    default:
+        return false;
+    }
+    if (page.predictor != 1 && (page.predictor != 2 || (page.bitsPerSample != 8 && page.bitsPerSample != 16)))
+        return false;
+
+    unsigned int bits = page.bitsPerSample;
+    unsigned int alpha = extraSamples.empty() ? static_cast<unsigned int>(EXTRA_UNSPECIFIED) : static_cast<unsigned int>(extraSamples[0]);
+    switch (page.photometric)
+    {
+    case PHOTOMETRIC_WHITE_IS_ZERO:
+    case PHOTOMETRIC_BLACK_IS_ZERO:
+        if (page.samplesPerPixel == 1)
+        {
+            if (bits == 8 || bits == 16)
+            {
+                page.conversion = TC_CONVERTER;
+                page.format = bits == 8 ? PF_GRAY8 : PF_GRAY16;
+            }
+            else if (bits == 1 || bits == 2 || bits == 4)
+            {
+                page.conversion = TC_GRAY;
+            }
+        }
+        else if (page.samplesPerPixel == 2 && bits == 8 && !page.whiteIsZero &&
+            (alpha == EXTRA_ASSOCIATED_ALPHA || alpha == EXTRA_UNASSOCIATED_ALPHA))
+        {
+            page.conversion = TC_GRAY_ALPHA;
+            page.associatedAlpha = alpha == EXTRA_ASSOCIATED_ALPHA;
+        }
+        break;
+
+    case PHOTOMETRIC_RGB:
+        if (page.samplesPerPixel == 3 && (bits == 8 || bits == 16))
+        {
+            page.conversion = TC_CONVERTER;
+            page.format = bits == 8 ? PF_RGB24 : PF_RGB48;
+        }
+        else if (page.samplesPerPixel == 4 && alpha == EXTRA_UNASSOCIATED_ALPHA && (bits == 8 || bits == 16))
+        {
+            page.conversion = TC_CONVERTER;
+            page.format = bits == 8 ? PF_RGBA32 : PF_RGBA64;
+        }
+        else if (page.samplesPerPixel == 4 && alpha == EXTRA_ASSOCIATED_ALPHA && bits == 8)
+        {
+            page.conversion = TC_RGBA_PREMULTIPLIED;
+            page.associatedAlpha = true;
+        }
+        break;
+
+    case PHOTOMETRIC_PALETTE:
+        if (page.samplesPerPixel == 1 && (bits == 1 || bits == 2 || bits == 4 || bits == 8) &&
+            colorMap.size() == 3u << bits && page.predictor == 1)
+        {
+            // The color map holds all red, then all green, then all blue
+            // values with 16 bits each
+            uint32_t colors[256];
+            unsigned int colorCount = 1u << bits;
+            for (unsigned int i = 0; i < colorCount; ++i)
+            {
+                colors[i] = 0xFF000000u |
+                    (static_cast<uint32_t>(colorMap[i] >> 8 & 0xFF) << 16) |
+                    (static_cast<uint32_t>(colorMap[colorCount + i] >> 8 & 0xFF) << 8) |
+                    static_cast<uint32_t>(colorMap[2 * colorCount + i] >> 8 & 0xFF);
+            }
+            page.palette.SetPalette(colors, colorCount);
+            page.conversion = TC_PALETTE;
+        }
+        break;
+    }
+    return page.conversion != TC_UNSUPPORTED;
+}
+
+bool TiffDecoder::Decompress(const TiffPage& page, unsigned int blockIndex, uint8_t* destination, size_t size) const
+{
+    // Blocks cut off by the end of the file are decoded as far as possible
+    uint64_t offset = page.blockOffsets[blockIndex];
+    uint64_t byteCount = page.blockByteCounts[blockIndex];
+    if (offset >= m_size)
+        return false;
+    if (byteCount > m_size - offset)
+        byteCount = m_size - offset;
+    const uint8_t* source = m_data + offset;
+    size_t sourceSize = static_cast<size_t>(byteCount);
+
+    size_t written = 0;
+    bool result = true;
+    switch (page.compression)
+    {
+    case COMPRESSION_NONE:
+        written = sourceSize < size ? sourceSize : size;
+        memcpy(destination, source, written);
+        break;
+    case COMPRESSION_PACKBITS:
+        result = DecodePackBits(source, sourceSize, destination, size, written);
+        break;
+    case COMPRESSION_LZW:
+        result = DecodeLzw(source, sourceSize, destination, size, written);
+        break;
+    case COMPRESSION_DEFLATE:
+    case COMPRESSION_DEFLATE_OLD:
+        result = ZlibInflater::Inflate(source, sourceSize, destination, size, written) || written == size;
+        break;
+    default:
+        return false;
+    }
+    memset(destination + written, 0, size - written);
+    return result;
+}
+
+bool TiffDecoder::DecodeBlock(
+    const TiffPage& page,
+    unsigned int blockIndex,
+    uint8_t* pixels,
+    size_t stride,
+    std::vector<uint8_t>& scratch) const
+{
+    if (page.conversion == TC_UNSUPPORTED || blockIndex >= page.getBlockCount())
+        return false;
+
+    // Strips at the bottom may have fewer rows, tiles always have all rows
+    PixelRect rect = page.getBlockRect(blockIndex);
+    unsigned int rows = page.tiled ? page.blockHeight : rect.getHeight();
+    size_t rowBytes = page.getBlockRowBytes();
+    size_t rawSize = rowBytes * rows;
+    scratch.resize(rawSize + page.blockWidth);
+    uint8_t* raw = scratch.data();
+    uint8_t* unpacked = raw + rawSize;
+    if (!Decompress(page, blockIndex, raw, rawSize))
+        return false;
+
+    // 16 bit samples are converted as little endian
+    if (page.bitsPerSample == 16 && m_bigEndian)
+    {
+        for (size_t i = 0; i + 1 < rawSize; i += 2)
+        {
+            uint8_t high = raw[i];
+            raw[i] = raw[i + 1];
+            raw[i + 1] = high;
+        }
+    }
+
+    unsigned int width = rect.getWidth();
+    for (unsigned int y = 0; y < rect.getHeight(); ++y)
+    {
+        uint8_t* source = raw + y * rowBytes;
+        uint8_t* destination = pixels + (rect.top + y) * stride + static_cast<size_t>(rect.left) * 4;
+        if (page.predictor == 2)
+        {
+            UndoPredictor(source, page.blockWidth, page.samplesPerPixel, page.bitsPerSample);
+        }
+
+        switch (page.conversion)
+        {
+        case TC_CONVERTER:
+            if (page.whiteIsZero)
+            {
+                // Only gray samples, inverting all bits inverts 8 and 16 bit values
+                for (size_t i = 0; i < width * page.bitsPerSample / 8; ++i)
+                {
+                    source[i] = static_cast<uint8_t>(~source[i]);
+                }
+            }
+            PixelConverter::ConvertRow(page.format, source, destination, width);
+            break;
+
+        case TC_GRAY:
+            UnpackRow(source, unpacked, width, page.bitsPerSample, true);
+            if (page.whiteIsZero)
+            {
+                for (unsigned int x = 0; x < width; ++x)
+                {
+                    unpacked[x] = static_cast<uint8_t>(~unpacked[x]);
+                }
+            }
+            PixelConverter::ConvertRow(PF_GRAY8, unpacked, destination, width);
+            break;
+
+        case TC_PALETTE:
+            if (page.bitsPerSample < 8)
+            {
+                UnpackRow(source, unpacked, width, page.bitsPerSample, false);
+                source = unpacked;
+            }
+            page.palette.ExpandRow(source, destination, nullptr, width);
+            break;
+
+        case TC_GRAY_ALPHA:
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                unsigned int alpha = source[x * 2 + 1];
+                unsigned int gray = source[x * 2];
+                gray = page.associatedAlpha ? (gray < alpha ? gray : alpha) : Premultiply(gray, alpha);
+                destination[x * 4] = static_cast<uint8_t>(gray);
+                destination[x * 4 + 1] = static_cast<uint8_t>(gray);
+                destination[x * 4 + 2] = static_cast<uint8_t>(gray);
+                destination[x * 4 + 3] = static_cast<uint8_t>(alpha);
+            }
+            break;
+
+        case TC_RGBA_PREMULTIPLIED:
+            // Colors above alpha would be invalid for blending
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                const uint8_t* rgba = source + x * 4;
+                uint8_t alpha = rgba[3];
+                destination[x * 4] = rgba[2] < alpha ? rgba[2] : alpha;
+                destination[x * 4 + 1] = rgba[1] < alpha ? rgba[1] : alpha;
+                destination[x * 4 + 2] = rgba[0] < alpha ? rgba[0] : alpha;
+                destination[x * 4 + 3] = alpha;
+            }
+            break;
+
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TiffDecoder::DecodePage(const TiffPage& page, uint8_t* pixels, size_t stride) const
+{
+    std::vector<uint8_t> scratch;
+    for (unsigned int i = 0; i < page.getBlockCount(); ++i)
+    {
+        if (!DecodeBlock(page, i, pixels, stride, scratch))
+            return false;
+    }
+    return true;
+}
+
+bool TiffDecoder::DecodePage(
+    const TiffPage& page,
+    uint8_t* pixels,
+    size_t stride,
+    WorkerPool& pool,
+    bool urgent,
+    const std::atomic<bool>* cancel) const
+{
+    if (page.conversion == TC_UNSUPPORTED)
+        return false;
+
+    // The scratch buffers are kept by the threads for the next pages, unless
+    // a block was large, like the single strip of an uncompressed page. The
+    // threads of the pool live as long as the viewer, which would hold the
+    // largest block ever decoded once per thread.
+    const size_t MAX_KEPT_SCRATCH_SIZE = 4 << 20;
+    std::atomic<bool> succeeded(true);
+    pool.ForEach(page.getBlockCount(), [&](unsigned int blockIndex)
+    {
+        static thread_local std::vector<uint8_t> scratch;
+        if (!succeeded.load(std::memory_order_relaxed))
+            return;
+        if ((cancel && cancel->load(std::memory_order_relaxed)) ||
+            !DecodeBlock(page, blockIndex, pixels, stride, scratch))
+        {
+            succeeded.store(false, std::memory_order_relaxed);
+        }
+        if (scratch.capacity() > MAX_KEPT_SCRATCH_SIZE)
+        {
+            std::vector<uint8_t>().swap(scratch);
+        }
+    }, urgent);
+    return succeeded;
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include "FrameCompositor.h"
+#include "PaletteExpander.h"
+#include "PixelConverter.h"
+
+class WorkerPool;
+
+// How the samples of a TIFF page are converted to 32bpp premultiplied BGRA
+enum TIFF_CONVERSIONS
+{
+    TC_UNSUPPORTED = 0,
+    TC_CONVERTER,           // By the PixelConverter
+    TC_GRAY,                // 1, 2 or 4 bit gray
+    TC_GRAY_ALPHA,          // 8 bit gray with alpha
+    TC_PALETTE,             // 1, 2, 4 or 8 bit palette indices
+    TC_RGBA_PREMULTIPLIED   // 8 bit RGB with associated alpha
+};
+
+// The layout of a page and the position of its strips or tiles, which are
+// both called blocks
+struct TiffPage
+{
+    unsigned int          width;
+    unsigned int          height;
+    unsigned int          bitsPerSample;
+    unsigned int          samplesPerPixel;
+    unsigned int          photometric;
+    unsigned int          compression;
+    unsigned int          predictor;
+    bool                  whiteIsZero;
+    bool                  associatedAlpha;
+    bool                  tiled;
+    unsigned int          blockWidth;       // Tile width, or the page width for strips
+    unsigned int          blockHeight;      // Tile height, or the rows per strip
+    unsigned int          blocksAcross;
+    unsigned int          blocksDown;
+    std::vector<uint64_t> blockOffsets;
+    std::vector<uint64_t> blockByteCounts;
+    TIFF_CONVERSIONS      conversion;
+    PIXEL_FORMATS         format;           // Source format for TC_CONVERTER
+    PaletteExpander       palette;          // Colors for TC_PALETTE
+
+    unsigned int getBlockCount() const { return blocksAcross * blocksDown; }
+
+    // Bytes of one decompressed row of a block
+    size_t getBlockRowBytes() const
+    {
+        return (static_cast<size_t>(blockWidth) * samplesPerPixel * bitsPerSample + 7) / 8;
+    }
+
+    // The part of the page covered by the block
+    PixelRect getBlockRect(unsigned int blockIndex) const;
+};
+
+// Portable TIFF decoder that works directly on the bytes of the file, like
+// the GifDecoder. The offsets of the image file directories are indexed
+// lazily: a page is found by following the chain from the last page indexed
+// so far, and once a page is indexed, it is read without touching the pages
+// before it. Classic TIFF and BigTIFF with stripped or tiled pages are
+// supported, uncompressed or compressed with PackBits, LZW or Deflate, with
+// gray, palette or RGB samples of up to 16 bits.
+//
+// The decoder does not copy the file, so the bytes must stay valid as long as
+// the decoder is used.
+class TiffDecoder
+{
+public:
+    TiffDecoder();
+
+    // Whether the bytes start with a TIFF header
+    static bool IsTiff(const uint8_t* data, size_t size);
+
+    bool Open(const uint8_t* data, size_t size);
+    void Reset();
+    bool isOpen() const { return m_data != nullptr; }
+
+    // Returns the number of pages, which indexes all pages the first time
+    unsigned int getPageCount();
+
+    // Indexes the pages up to the given number of pages, if the file has
+    // them, and returns the number of pages indexed
+    unsigned int IndexPages(unsigned int pageCount);
+
+    // Number of pages indexed so far
+    unsigned int getIndexedPageCount() const { return static_cast<unsigned int>(m_pageOffsets.size()); }
+
+    // Whether all pages are indexed, so that getIndexedPageCount is the
+    // number of pages
+    bool isIndexed() const { return m_nextOffset == 0; }
+
+    // Reads the layout of a page. Returns false if the page does not exist
+    // or is not a valid TIFF page.
+    bool ReadPage(unsigned int pageIndex, TiffPage& page);
+
+    // Decodes a block into the page sized image at pixels. Blocks do not
+    // overlap and the method does not change the decoder, so the blocks of
+    // a page can be decoded on several threads, each with its own scratch
+    // buffer. Returns false for unsupported pages and invalid data.
+    bool DecodeBlock(
+        const TiffPage& page,
+        unsigned int blockIndex,
+        uint8_t* pixels,
+        size_t stride,
+        std::vector<uint8_t>& scratch) const;
+
+    // Decodes all blocks of a page as 32bpp premultiplied BGRA
+    bool DecodePage(const TiffPage& page, uint8_t* pixels, size_t stride) const;
+
+    // Decodes the blocks of a page on the threads of the pool, each block
+    // straight into the pixels. Blocks not started yet are skipped once
+    // cancel is set, which makes the call fail.
+    bool DecodePage(
+        const TiffPage& page,
+        uint8_t* pixels,
+        size_t stride,
+        WorkerPool& pool,
+        bool urgent = true,
+        const std::atomic<bool>* cancel = nullptr) const;
+
+private:
+    TiffDecoder(const TiffDecoder&) = delete;
+    TiffDecoder& operator=(const TiffDecoder&) = delete;
+
+    struct Entry
+    {
+        unsigned int tag;
+        unsigned int type;
+        uint64_t     count;
+        size_t       valueOffset;   // Offset of the values in the file
+    };
+
+    bool     FindPage(unsigned int pageIndex);
+    bool     ReadNextOffset(uint64_t ifdOffset, uint64_t& nextOffset) const;
+    bool     ReadEntries(uint64_t ifdOffset, std::vector<Entry>& entries) const;
+    bool     ReadValues(const Entry& entry, std::vector<uint64_t>& values) const;
+    uint64_t ReadValue(const Entry& entry, uint64_t defaultValue) const;
+    bool     SetConversion(TiffPage& page, const std::vector<Entry>& entries) const;
+    bool     Decompress(const TiffPage& page, unsigned int blockIndex, uint8_t* destination, size_t size) const;
+
+    uint16_t Read16(size_t offset) const;
+    uint32_t Read32(size_t offset) const;
+    uint64_t Read64(size_t offset) const;
+
+    static const unsigned int MAX_PIXELS = 1u << 28;   // Largest page decoded, like 16384 x 16384
+
+    const uint8_t*        m_data;
+    size_t                m_size;
+    bool                  m_bigEndian;
+    bool                  m_bigTiff;
+    std::vector<uint64_t> m_pageOffsets;    // Offsets of the image file directories indexed so far
+    uint64_t              m_nextOffset;     // Offset of the directory after the last indexed one, 0 at the end
+    std::unordered_set<uint64_t> m_indexedOffsets;  // To stop at directory chains with loops
+};
@@ -0,0 +1,219 @@
+#include "TiffEncoder.h"
+
+namespace {
+
+const uint64_t MAX_FILE_SIZE = 0xFFFFFFFFu;    // Offsets of classic TIFF have 32 bits
+
+enum TIFF_TYPES
+{
+    TYPE_SHORT = 3,
+    TYPE_LONG = 4
+};
+
+// Files up to 4 GB are larger than long on Windows
+int Seek(FILE* file, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), origin);
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+}
+
+}
+
+TiffEncoder::TiffEncoder() :
+    m_file(nullptr),
+    m_position(0),
+    m_nextOffsetPosition(0),
+    m_pageCount(0),
+    m_failed(false)
+{
+}
+
+TiffEncoder::~TiffEncoder()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool TiffEncoder::Open(const wchar_t* filename)
+#else
+bool TiffEncoder::Open(const char* filename)
+#endif
+{
+    Close();
+#ifdef _WIN32
+    if (_wfopen_s(&m_file, filename, L"wb") != 0)
+    {
+        m_file = nullptr;
+    }
+#else
+    m_file = fopen(filename, "wb");
+#endif
+    if (m_file == nullptr)
+        return false;
+
+    // Little endian header, the offset of the first page is set with the page
+    m_position = 0;
+    m_pageCount = 0;
+    m_failed = false;
+    static const uint8_t header[8] = { 'I', 'I', 42, 0, 0, 0, 0, 0 };
+    Write(header, sizeof(header));
+    m_nextOffsetPosition = 4;
+    return !m_failed;
+}
+
+bool TiffEncoder::Close()
+{
+    if (m_file == nullptr)
+        return false;
+    bool succeeded = fclose(m_file) == 0 && !m_failed && m_pageCount > 0;
+    m_file = nullptr;
+    m_row.clear();
+    m_row.shrink_to_fit();
+    return succeeded;
+}
+
+bool TiffEncoder::Write(const void* data, size_t size)
+{
+    if (m_failed || m_position + size > MAX_FILE_SIZE || fwrite(data, 1, size, m_file) != size)
+    {
+        m_failed = true;
+        return false;
+    }
+    m_position += size;
+    return true;
+}
+
+bool TiffEncoder::Write16(unsigned int value)
+{
+    uint8_t bytes[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+    return Write(bytes, sizeof(bytes));
+}
+
+bool TiffEncoder::Write32(uint32_t value)
+{
+    uint8_t bytes[4] =
+    {
+        static_cast<uint8_t>(value),
+        static_cast<uint8_t>(value >> 8),
+        static_cast<uint8_t>(value >> 16),
+        static_cast<uint8_t>(value >> 24)
+    };
+    return Write(bytes, sizeof(bytes));
+}
+
+bool TiffEncoder::WriteEntry(unsigned int tag, unsigned int type, uint32_t count, uint32_t value)
+{
+    Write16(tag);
+    Write16(type);
+    Write32(count);
+    if (type == TYPE_SHORT && count == 1)
+    {
+        Write16(value);
+        return Write16(0);
+    }
+    return Write32(value);
+}
+
+bool TiffEncoder::Align()
+{
+    // Directories and arrays of values start at even offsets
+    static const uint8_t zero = 0;
+    return (m_position & 1) == 0 || Write(&zero, 1);
+}
+
+bool TiffEncoder::WritePage(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height)
+{
+    if (m_file == nullptr || m_failed || width == 0 || height == 0 || width > 0x3FFFFFFF / 4)
+        return false;
+
+    // The strips, with the colors in RGBA order
+    size_t rowBytes = static_cast<size_t>(width) * 4;
+    unsigned int rowsPerStrip = static_cast<unsigned int>(STRIP_BYTES / rowBytes);
+    rowsPerStrip = rowsPerStrip == 0 ? 1 : rowsPerStrip > height ? height : rowsPerStrip;
+    m_row.resize(rowBytes);
+    m_stripOffsets.clear();
+    m_stripByteCounts.clear();
+    for (unsigned int y = 0; y < height && !m_failed; ++y)
+    {
+        if (y % rowsPerStrip == 0)
+        {
+            unsigned int rows = height - y < rowsPerStrip ? height - y : rowsPerStrip;
+            m_stripOffsets.push_back(static_cast<uint32_t>(m_position));
+            m_stripByteCounts.push_back(static_cast<uint32_t>(rows * rowBytes));
+        }
+        const uint8_t* source = pixels + y * stride;
+        for (size_t x = 0; x < rowBytes; x += 4)
+        {
+            m_row[x] = source[x + 2];
+            m_row[x + 1] = source[x + 1];
+            m_row[x + 2] = source[x];
+            m_row[x + 3] = source[x + 3];
+        }
+        Write(m_row.data(), rowBytes);
+    }
+
+    // Arrays of more than one value are stored before the directory
+    uint32_t stripCount = static_cast<uint32_t>(m_stripOffsets.size());
+    Align();
+    uint32_t bitsPerSamplePosition = static_cast<uint32_t>(m_position);
+    for (int i = 0; i < 4; ++i)
+    {
+        Write16(8);
+    }
+    uint32_t stripOffsetsValue = m_stripOffsets[0];
+    uint32_t stripByteCountsValue = m_stripByteCounts[0];
+    if (stripCount > 1)
+    {
+        stripOffsetsValue = static_cast<uint32_t>(m_position);
+        for (uint32_t offset : m_stripOffsets)
+        {
+            Write32(offset);
+        }
+        stripByteCountsValue = static_cast<uint32_t>(m_position);
+        for (uint32_t byteCount : m_stripByteCounts)
+        {
+            Write32(byteCount);
+        }
+    }
+
+    // The directory, with the tags in ascending order
+    uint32_t directoryPosition = static_cast<uint32_t>(m_position);
+    Write16(11);
+    WriteEntry(256, TYPE_LONG, 1, width);
+    WriteEntry(257, TYPE_LONG, 1, height);
+    WriteEntry(258, TYPE_SHORT, 4, bitsPerSamplePosition);
+    WriteEntry(259, TYPE_SHORT, 1, 1);          // No compression
+    WriteEntry(262, TYPE_SHORT, 1, 2);          // RGB
+    WriteEntry(273, TYPE_LONG, stripCount, stripOffsetsValue);
+    WriteEntry(277, TYPE_SHORT, 1, 4);
+    WriteEntry(278, TYPE_LONG, 1, rowsPerStrip);
+    WriteEntry(279, TYPE_LONG, stripCount, stripByteCountsValue);
+    WriteEntry(284, TYPE_SHORT, 1, 1);          // Interleaved samples
+    WriteEntry(338, TYPE_SHORT, 1, 1);          // Associated alpha
+    uint64_t nextOffsetPosition = m_position;
+    Write32(0);
+    if (m_failed)
+        return false;
+
+    // Links the directory to the one before it
+    uint8_t offset[4] =
+    {
+        static_cast<uint8_t>(directoryPosition),
+        static_cast<uint8_t>(directoryPosition >> 8),
+        static_cast<uint8_t>(directoryPosition >> 16),
+        static_cast<uint8_t>(directoryPosition >> 24)
+    };
+    if (Seek(m_file, m_nextOffsetPosition, SEEK_SET) != 0 ||
+        fwrite(offset, 1, sizeof(offset), m_file) != sizeof(offset) ||
+        Seek(m_file, 0, SEEK_END) != 0)
+    {
+        m_failed = true;
+        return false;
+    }
+    m_nextOffsetPosition = nextOffsetPosition;
+    ++m_pageCount;
+    return true;
+}
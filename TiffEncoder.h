@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Writes pages of 32bpp premultiplied BGRA as a classic TIFF, one page at a
+// time, so that memory does not grow with the number of pages. The pages are
+// stored uncompressed as 8 bit RGBA with associated alpha, which the
+// TiffDecoder reads back without loss.
+class TiffEncoder
+{
+public:
+    TiffEncoder();
+    ~TiffEncoder();
+
+#ifdef _WIN32
+    bool Open(const wchar_t* filename);
+#else
+    bool Open(const char* filename);
+#endif
+
+    bool WritePage(const uint8_t* pixels, size_t stride, unsigned int width, unsigned int height);
+
+    // Finishes the file. Returns false if any page could not be written.
+    bool Close();
+
+    unsigned int getPageCount() const { return m_pageCount; }
+
+private:
+    TiffEncoder(const TiffEncoder&) = delete;
+    TiffEncoder& operator=(const TiffEncoder&) = delete;
+
+    bool Write(const void* data, size_t size);
+    bool Write16(unsigned int value);
+    bool Write32(uint32_t value);
+    bool WriteEntry(unsigned int tag, unsigned int type, uint32_t count, uint32_t value);
+    bool Align();
+
+    static const size_t STRIP_BYTES = 256 * 1024;   // Approximate size of the strips
+
+    FILE*                 m_file;
+    uint64_t              m_position;           // Bytes written so far
+    uint64_t              m_nextOffsetPosition; // Where the offset of the next page goes
+    unsigned int          m_pageCount;
+    bool                  m_failed;
+    std::vector<uint8_t>  m_row;
+    std::vector<uint32_t> m_stripOffsets;
+    std::vector<uint32_t> m_stripByteCounts;
+};
@@ -0,0 +1,179 @@
+#include "TiffPagePrefetcher.h"
+#include <algorithm>
+#include "Tracer.h"
+#include "WorkerPool.h"
+
+TiffPagePrefetcher::TiffPagePrefetcher(WorkerPool& pool) :
+    m_pool(pool),
+    m_cancel(false),
+    m_stop(false)
+{
+}
+
+TiffPagePrefetcher::~TiffPagePrefetcher()
+{
+    Stop();
+}
+
+void TiffPagePrefetcher::Start(const uint8_t* data, size_t size)
+{
+    Stop();
+    if (!m_decoder.Open(data, size))
+        return;
+
+    m_stop = false;
+    m_cancel = false;
+    m_thread = std::thread(&TiffPagePrefetcher::Run, this);
+}
+
+void TiffPagePrefetcher::Stop()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cancel = true;
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    // The pixels go back to the pool
+    m_wanted.clear();
+    m_pages.clear();
+    m_decoder.Reset();
+}
+
+bool TiffPagePrefetcher::isWanted(unsigned int pageIndex) const
+{
+    return std::find(m_wanted.begin(), m_wanted.end(), pageIndex) != m_wanted.end();
+}
+
+TiffPagePrefetcher::Page* TiffPagePrefetcher::FindPage(unsigned int pageIndex)
+{
+    for (auto& page : m_pages)
+    {
+        if (page.pageIndex == pageIndex)
+            return &page;
+    }
+    return nullptr;
+}
+
+void TiffPagePrefetcher::Prefetch(unsigned int pageIndex, unsigned int distance)
+{
+    if (!isRunning())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wanted.clear();
+        for (unsigned int i = 1; i <= distance; ++i)
+        {
+            if (pageIndex + i > pageIndex)
+                m_wanted.push_back(pageIndex + i);
+            if (pageIndex >= i)
+                m_wanted.push_back(pageIndex - i);
+        }
+
+        // The page being decoded is dropped by the thread when it is done
+        m_pages.erase(
+            std::remove_if(m_pages.begin(), m_pages.end(), [this](const Page& page)
+            {
+                return page.decoded && !isWanted(page.pageIndex);
+            }),
+            m_pages.end());
+    }
+    m_wake.notify_one();
+}
+
+bool TiffPagePrefetcher::Take(unsigned int pageIndex, FrameBuffer& pixels)
+{
+    if (!isRunning())
+        return false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_decoded.wait(lock, [this, pageIndex]
+    {
+        Page* page = FindPage(pageIndex);
+        return page == nullptr || page->decoded;
+    });
+
+    Page* page = FindPage(pageIndex);
+    if (page == nullptr || page->pixels.empty())
+        return false;
+
+    // The page is not decoded again until it is wanted again
+    pixels.swap(page->pixels);
+    m_pages.erase(m_pages.begin() + (page - m_pages.data()));
+    m_wanted.erase(std::remove(m_wanted.begin(), m_wanted.end(), pageIndex), m_wanted.end());
+    return true;
+}
+
+void TiffPagePrefetcher::Run()
+{
+    Tracer::SetThreadName("TIFF page prefetcher");
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        // The most important page which is not decoded yet
+        unsigned int pageIndex = 0;
+        bool found = false;
+        while (!m_stop && !found)
+        {
+            for (unsigned int wanted : m_wanted)
+            {
+                if (FindPage(wanted) == nullptr)
+                {
+                    pageIndex = wanted;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                m_wake.wait(lock);
+            }
+        }
+        if (m_stop)
+            return;
+
+        Page decoding;
+        decoding.pageIndex = pageIndex;
+        decoding.decoded = false;
+        m_pages.push_back(std::move(decoding));
+        lock.unlock();
+
+        FrameBuffer pixels;
+        {
+            TRACE_SCOPE("PrefetchTiffPage");
+            TiffPage page;
+            if (m_decoder.ReadPage(pageIndex, page) && page.conversion != TC_UNSUPPORTED)
+            {
+                pixels = FrameBufferPool::GetInstance().TryAcquire(page.width, page.height, 4);
+                if (!pixels.empty() &&
+                    !m_decoder.DecodePage(page, pixels.data(), pixels.getStride(), m_pool, false, &m_cancel))
+                {
+                    pixels.Release();
+                }
+            }
+        }
+
+        lock.lock();
+        Page* decoded = FindPage(pageIndex);
+        if (decoded != nullptr)
+        {
+            if (isWanted(pageIndex))
+            {
+                decoded->pixels.swap(pixels);
+                decoded->decoded = true;
+            }
+            else
+            {
+                m_pages.erase(m_pages.begin() + (decoded - m_pages.data()));
+            }
+        }
+        m_decoded.notify_all();
+    }
+}
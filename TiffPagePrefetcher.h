@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FrameBufferPool.h"
+#include "TiffDecoder.h"
+
+class WorkerPool;
+
+// Decodes the pages next to the displayed page of a TIFF on a thread, so
+// that paging shows them without waiting. Like the FrameDecodeWorker, the
+// thread uses its own decoder on the bytes of the file. The blocks of a page
+// are decoded on the pool, after the loops of the UI thread. The pages are
+// drawn from the FrameBufferPool and skipped when its budget is used up.
+class TiffPagePrefetcher
+{
+public:
+    explicit TiffPagePrefetcher(WorkerPool& pool);
+    ~TiffPagePrefetcher();
+
+    // The bytes must stay valid until Stop is called
+    void Start(const uint8_t* data, size_t size);
+    void Stop();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // Decodes the pages up to distance before and after the page, the
+    // following pages first, and drops all other pages
+    void Prefetch(unsigned int pageIndex, unsigned int distance);
+
+    // Trades the pixels of the page for the given buffer if the page is
+    // decoded, waiting for it if it is being decoded. Returns false if the
+    // page was not prefetched or could not be decoded.
+    bool Take(unsigned int pageIndex, FrameBuffer& pixels);
+
+private:
+    TiffPagePrefetcher(const TiffPagePrefetcher&) = delete;
+    TiffPagePrefetcher& operator=(const TiffPagePrefetcher&) = delete;
+
+    struct Page
+    {
+        unsigned int pageIndex;
+        bool         decoded;   // False while the page is being decoded
+        FrameBuffer  pixels;    // Empty if the page could not be decoded
+    };
+
+    void Run();
+    bool isWanted(unsigned int pageIndex) const;
+    Page* FindPage(unsigned int pageIndex);
+
+    WorkerPool&               m_pool;
+    TiffDecoder               m_decoder;    // Only used by the thread
+    std::atomic<bool>         m_cancel;     // Stops decoding the current page
+
+    std::mutex                m_mutex;      // Protects the members below
+    std::condition_variable   m_wake;       // Signals new wanted pages and stop to the thread
+    std::condition_variable   m_decoded;    // Signals decoded pages to Take
+    std::vector<unsigned int> m_wanted;     // Pages to decode, the most important first
+    std::vector<Page>         m_pages;
+    bool                      m_stop;
+    std::thread               m_thread;
+};
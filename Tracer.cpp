@@ -0,0 +1,221 @@
+#include "Tracer.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const size_t RING_SIZE = 16384;     // Spans kept per thread
+
+// A span. The fields are written by the thread which owns the ring while
+// WriteChromeTrace may copy them, so they are atomics. The sequence is the
+// number of the span the slot holds plus one, or 0 while it is written.
+struct TraceEvent
+{
+    std::atomic<uint64_t>     sequence;
+    std::atomic<const char*>  name;
+    std::atomic<int64_t>      start;
+    std::atomic<int64_t>      duration;
+    std::atomic<unsigned int> threadId;
+};
+
+// The spans of one thread. Only the owning thread writes to it, the writer
+// publishes each span by advancing the count. Clear only moves the first
+// span to export, so the count is only written by the owner.
+struct ThreadRing
+{
+    TraceEvent               events[RING_SIZE];
+    std::atomic<uint64_t>    written;
+    std::atomic<uint64_t>    cleared;
+    std::atomic<bool>        inUse;
+    unsigned int             threadId;
+};
+
+// The rings of all threads which recorded spans. Rings of finished threads
+// are kept for their spans and reused by new threads, which get a new id,
+// so each span keeps the id of the thread which recorded it. The names are
+// indexed by the thread id minus one.
+std::mutex                               s_ringsMutex;
+std::vector<std::unique_ptr<ThreadRing>> s_rings;
+std::vector<const char*>                 s_threadNames;
+
+ThreadRing* AcquireRing(const char* threadName)
+{
+    std::lock_guard<std::mutex> lock(s_ringsMutex);
+    s_threadNames.push_back(threadName);
+    unsigned int threadId = static_cast<unsigned int>(s_threadNames.size());
+    for (auto& ring : s_rings)
+    {
+        if (!ring->inUse.load())
+        {
+            ring->inUse = true;
+            ring->threadId = threadId;
+            return ring.get();
+        }
+    }
+    std::unique_ptr<ThreadRing> ring(new ThreadRing);
+    for (auto& event : ring->events)
+    {
+        event.sequence.store(0, std::memory_order_relaxed);
+    }
+    ring->written = 0;
+    ring->cleared = 0;
+    ring->inUse = true;
+    ring->threadId = threadId;
+    s_rings.push_back(std::move(ring));
+    return s_rings.back().get();
+}
+
+// The ring of a thread, which is only allocated once the thread records a
+// span. It is given back when the thread ends.
+struct RingOwner
+{
+    ThreadRing* ring = nullptr;
+    const char* threadName = nullptr;
+
+    ~RingOwner()
+    {
+        if (ring)
+        {
+            ring->inUse = false;
+        }
+    }
+};
+
+thread_local RingOwner s_owner;
+
+ThreadRing* GetThreadRing()
+{
+    if (s_owner.ring == nullptr)
+    {
+        s_owner.ring = AcquireRing(s_owner.threadName);
+    }
+    return s_owner.ring;
+}
+
+const std::chrono::steady_clock::time_point s_epoch = std::chrono::steady_clock::now();
+
+}
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+void Tracer::Enable(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::SetThreadName(const char* name)
+{
+    s_owner.threadName = name;
+    if (s_owner.ring)
+    {
+        std::lock_guard<std::mutex> lock(s_ringsMutex);
+        s_threadNames[s_owner.ring->threadId - 1] = name;
+    }
+}
+
+int64_t Tracer::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+void Tracer::Record(const char* name, int64_t start)
+{
+    int64_t end = Now();
+    ThreadRing* ring = GetThreadRing();
+    uint64_t index = ring->written.load(std::memory_order_relaxed);
+    TraceEvent& event = ring->events[index % RING_SIZE];
+
+    // A copy which reads any of the new fields also reads the cleared
+    // sequence after it
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(end - start, std::memory_order_relaxed);
+    event.threadId.store(ring->threadId, std::memory_order_relaxed);
+    event.sequence.store(index + 1, std::memory_order_release);
+    ring->written.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::Clear()
+{
+    // Spans recorded meanwhile may survive
+    std::lock_guard<std::mutex> lock(s_ringsMutex);
+    for (auto& ring : s_rings)
+    {
+        ring->cleared.store(ring->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+size_t Tracer::WriteChromeTrace(FILE* file)
+{
+    struct Span
+    {
+        const char*  name;
+        int64_t      start;
+        int64_t      duration;
+        unsigned int threadId;
+    };
+
+    std::lock_guard<std::mutex> lock(s_ringsMutex);
+    std::vector<Span> spans;
+    for (auto& ring : s_rings)
+    {
+        // A span is copied only if its slot holds the same span before and
+        // after the copy, the thread may be overwriting the oldest ones
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = ring->cleared.load(std::memory_order_relaxed);
+        if (written > RING_SIZE && first < written - RING_SIZE)
+        {
+            first = written - RING_SIZE;
+        }
+        for (uint64_t i = first; i < written; ++i)
+        {
+            const TraceEvent& event = ring->events[i % RING_SIZE];
+            if (event.sequence.load(std::memory_order_acquire) != i + 1)
+                continue;
+            Span span;
+            span.name = event.name.load(std::memory_order_relaxed);
+            span.start = event.start.load(std::memory_order_relaxed);
+            span.duration = event.duration.load(std::memory_order_relaxed);
+            span.threadId = event.threadId.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) == i + 1)
+            {
+                spans.push_back(span);
+            }
+        }
+    }
+
+    // Name the threads which recorded a span
+    std::vector<bool> hasSpans(s_threadNames.size() + 1, false);
+    for (const Span& span : spans)
+    {
+        hasSpans[span.threadId] = true;
+    }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+    const char* separator = "\n";
+    for (unsigned int threadId = 1; threadId < hasSpans.size(); ++threadId)
+    {
+        if (!hasSpans[threadId])
+            continue;
+        const char* threadName = s_threadNames[threadId - 1];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            separator, threadId, threadName ? threadName : "Thread");
+        separator = ",\n";
+    }
+    for (const Span& span : spans)
+    {
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            separator,
+            span.name,
+            span.threadId,
+            span.start / 1000.0,
+            span.duration / 1000.0);
+        separator = ",\n";
+    }
+    fputs("\n]}\n", file);
+    return spans.size();
+}
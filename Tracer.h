@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// Records how long the stages of decoding, composing and rendering take, so
+// that stutters can be attributed. Each thread writes its spans into its own
+// ring buffer without locks, which keeps the most recent spans. While
+// tracing is disabled a span costs one relaxed load. The spans can be
+// written as Chrome trace events, which chrome://tracing and Perfetto show
+// on a timeline.
+class Tracer
+{
+public:
+    static void Enable(bool enabled);
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Names the calling thread in the trace. The name must be a literal.
+    static void SetThreadName(const char* name);
+
+    // Adds a span from start to now. The name must be a literal.
+    static void Record(const char* name, int64_t start);
+
+    // Monotonic time in ns
+    static int64_t Now();
+
+    // Drops all recorded spans
+    static void Clear();
+
+    // Writes the recorded spans in the Chrome trace event format. Returns the
+    // number of spans written.
+    static size_t WriteChromeTrace(FILE* file);
+
+private:
+    Tracer() = delete;
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    static std::atomic<bool> s_enabled;
+};
+
+// Records the time from its construction to the end of the scope
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) :
+        m_name(Tracer::isEnabled() ? name : nullptr),
+        m_start(m_name ? Tracer::Now() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (m_name)
+        {
+            Tracer::Record(m_name, m_start);
+        }
+    }
+
+private:
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    const char* m_name;
+    int64_t     m_start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Traces the rest of the enclosing scope
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
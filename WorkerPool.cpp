@@ -0,0 +1,107 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned int threadCount) :
+    m_stop(false)
+{
+    m_threads.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+        m_threads.emplace_back(&WorkerPool::Run, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+unsigned int WorkerPool::getDefaultThreadCount()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+bool WorkerPool::RunIterations(Loop& loop)
+{
+    bool finishedLast = false;
+    unsigned int index;
+    while ((index = loop.next.fetch_add(1, std::memory_order_relaxed)) < loop.count)
+    {
+        (*loop.body)(index);
+        finishedLast = loop.finished.fetch_add(1, std::memory_order_acq_rel) + 1 == loop.count;
+    }
+    return finishedLast;
+}
+
+void WorkerPool::ForEach(unsigned int count, const std::function<void(unsigned int)>& body, bool urgent)
+{
+    if (count == 0)
+        return;
+    if (count == 1 || m_threads.empty())
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            body(i);
+        }
+        return;
+    }
+
+    auto loop = std::make_shared<Loop>();
+    loop->body = &body;
+    loop->count = count;
+    loop->next = 0;
+    loop->finished = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (urgent)
+            m_loops.push_front(loop);
+        else
+            m_loops.push_back(loop);
+    }
+    m_wake.notify_all();
+
+    RunIterations(*loop);
+
+    // The threads may still run the last iterations
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_loops.erase(std::remove(m_loops.begin(), m_loops.end(), loop), m_loops.end());
+    m_finished.wait(lock, [&loop] { return loop->finished.load(std::memory_order_acquire) == loop->count; });
+}
+
+void WorkerPool::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        // Loops whose iterations are all taken are dropped
+        while (!m_loops.empty() && m_loops.front()->next.load(std::memory_order_relaxed) >= m_loops.front()->count)
+        {
+            m_loops.pop_front();
+        }
+        if (m_stop)
+            return;
+        if (m_loops.empty())
+        {
+            m_wake.wait(lock);
+            continue;
+        }
+
+        std::shared_ptr<Loop> loop = m_loops.front();
+        lock.unlock();
+        bool finishedLast = RunIterations(*loop);
+        lock.lock();
+        if (finishedLast)
+        {
+            m_finished.notify_all();
+        }
+    }
+}
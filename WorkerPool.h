@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run the iterations of parallel loops. The
+// thread calling ForEach runs iterations too, so a pool without threads runs
+// the loop on the calling thread. Several threads can run loops on the same
+// pool at the same time, the threads work on urgent loops first.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned int threadCount);
+    ~WorkerPool();
+
+    // One thread less than the number of cores, since the caller works too
+    static unsigned int getDefaultThreadCount();
+
+    unsigned int getThreadCount() const { return static_cast<unsigned int>(m_threads.size()); }
+
+    // Calls body for each index below count, in any order and on any
+    // thread, and returns when all calls returned. Loops of the UI thread
+    // should be urgent, speculative work should not.
+    void ForEach(unsigned int count, const std::function<void(unsigned int)>& body, bool urgent = true);
+
+private:
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    struct Loop
+    {
+        const std::function<void(unsigned int)>* body;
+        unsigned int                             count;
+        std::atomic<unsigned int>                next;       // Next index to run
+        std::atomic<unsigned int>                finished;   // Number of calls that returned
+    };
+
+    void Run();
+
+    // Runs iterations of the loop until all are taken. Returns true if this
+    // thread finished the last iteration.
+    static bool RunIterations(Loop& loop);
+
+    std::vector<std::thread>              m_threads;
+    std::mutex                            m_mutex;      // Protects the members below
+    std::condition_variable               m_wake;       // Signals new loops and stop to the threads
+    std::condition_variable               m_finished;   // Signals finished loops to the callers
+    std::deque<std::shared_ptr<Loop>>     m_loops;      // Loops with iterations not taken yet
+    bool                                  m_stop;
+};
@@ -1,14 +1,25 @@
 #include <windows.h>
+#include <windowsx.h>
+#include <mmsystem.h>
 #include <wincodec.h>
 #include <Wincodecsdk.h>
 #include <commdlg.h>
 #include <d2d1.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <shellapi.h>
 #include <shlobj.h>
 #include <shlwapi.h>    
 #include "ZackApp.h"
+#include "BatchConverter.h"
 #include "ImagingFactorySingleton.h"
+#include "ScaledDecoder.h"
+#include "Tracer.h"
 
 const UINT DELAY_TIMER_ID = 1;    // Global ID for the timer, only one timer is used
 
@@ -43,6 +54,18 @@ int WINAPI wWinMain(
     UNREFERENCED_PARAMETER(nCmdShow);
 
     HeapSetInformation(nullptr, HeapEnableTerminationOnCorruption, nullptr, 0);
+    Tracer::SetThreadName("UI");
+
+    // Converts files without showing a window
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv != nullptr && argc > 1 && wcscmp(argv[1], L"--convert") == 0)
+    {
+        int exitCode = ZackApp::RunBatchConversion(argc - 2, argv + 2);
+        LocalFree(argv);
+        return exitCode;
+    }
+    LocalFree(argv);
 
     HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
     if (SUCCEEDED(hr))
@@ -80,20 +103,42 @@ ZackApp::ZackApp() :
     m_hWnd(nullptr),
     m_pD2DFactory(nullptr),
     m_pHwndRT(nullptr),
-    m_pFrameComposeRT(nullptr),
-    m_pRawFrame(nullptr),
-    m_pSavedFrame(nullptr),
+    m_pComposedFrame(nullptr),
     m_pDecoder(nullptr),
+    m_workerPool(WorkerPool::getDefaultThreadCount()),
+    m_pagePrefetcher(m_workerPool),
+    m_prefetcher(PREFETCH_BUDGET),
+    m_thumbnailCache(THUMBNAIL_CACHE_BUDGET),
+    m_thumbnailKey(),
+    m_hasThumbnailKey(false),
+    m_thumbnailCached(false),
+    m_thumbnailLoader(m_thumbnailCache, WorkerPool::getDefaultThreadCount()),
     uFrameDisposal(DM_UNDEFINED),
     uFrameDelay(0),
+    m_uploadRect(PixelRect::Empty()),
+    m_frameCache(FRAME_CACHE_BUDGET),
+    m_checkpoints(CHECKPOINT_BUDGET),
+    m_uCheckpointInterval(CHECKPOINT_INTERVAL),
+    m_uDecodeWidth(0),
+    m_uDecodeHeight(0),
     m_uLoopNumber(0),
-    m_uNextFrameIndex(0)
+    m_uNextFrameIndex(0),
+    m_framePosition(PixelRect::Empty()),
+    m_uComposedFrameIndex(0),
+    m_composedFrameValid(false),
+    m_uShownFrameDelay(0),
+    m_gridMode(false),
+    m_gridSelection(0),
+    m_gridFirstRow(0)
 {
+    m_scheduler.SetPolicy(CATCH_UP_POLICY, CATCH_UP_TOLERANCE);
+    FrameBufferPool::GetInstance().SetBudget(FRAME_BUFFER_BUDGET);
 }
 
 ZackApp::~ZackApp()
 {
-
+    // Stops the worker and releases the decoder before the file is unmapped
+    CleanDisplay();
 }
 
 HRESULT ZackApp::Initialize(HINSTANCE hInstance)
@@ -142,6 +187,7 @@ HRESULT ZackApp::Initialize(HINSTANCE hInstance)
 
     if (SUCCEEDED(hr))
     {
+        OpenThumbnailCache();
         SelectAndDisplayFile();
     }
 
@@ -153,11 +199,11 @@ HRESULT ZackApp::Initialize(HINSTANCE hInstance)
 *  DemoApp::CreateDeviceResources                                 *
 *                                                                 *
 *  Creates a D2D hwnd render target for displaying gif frames     *
-*  to users and a D2D bitmap render for composing frames.         *
+*  to users and a D2D bitmap the composed frames are uploaded to. *
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::CreateDeviceResources()
+HRESULT ZackApp::CreateRenderTarget()
 {
     HRESULT hr = S_OK;
 
@@ -197,16 +243,28 @@ HRESULT ZackApp::CreateDeviceResources()
         }
     }
 
+    return hr;
+}
+
+HRESULT ZackApp::CreateDeviceResources()
+{
+    HRESULT hr = CreateRenderTarget();
+
+    if (SUCCEEDED(hr))
+    {
+        // Create the bitmap the composed frames are uploaded to. Bitmaps
+        // cannot be resized, so we always recreate it.
+        m_pComposedFrame.reset(nullptr);
+        hr = m_pHwndRT->CreateBitmap(
+            D2D1::SizeU(m_compositor.getWidth(), m_compositor.getHeight()),
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+            m_pComposedFrame.get_out_storage());
+    }
+
     if (SUCCEEDED(hr))
     {
-        // Create a bitmap render target used to compose frames. Bitmap render 
-        // targets cannot be resized, so we always recreate it.		
-        m_pFrameComposeRT.reset(nullptr);
-        hr = m_pHwndRT->CreateCompatibleRenderTarget(
-            D2D1::SizeF(
-                static_cast<float>(m_imageInfo.getImageWidth()),
-                static_cast<float>(m_imageInfo.getImageHeight())),
-            m_pFrameComposeRT.get_out_storage());
+        // The new bitmap has none of the composed pixels yet
+        m_uploadRect = m_compositor.getBounds();
     }
 
     return hr;
@@ -226,10 +284,13 @@ HRESULT ZackApp::CreateDeviceResources()
 
 HRESULT ZackApp::OnRender()
 {
+    TRACE_SCOPE("OnRender");
 
+    if (m_gridMode)
+        return RenderGrid();
 
-    // Check to see if the render targets are initialized
-    if (!m_pHwndRT.get() || !m_pFrameComposeRT.get())
+    // Check to see if the render target and the bitmap are initialized
+    if (!m_pHwndRT.get() || !m_pComposedFrame.get())
         return S_OK;
 
 
@@ -239,13 +300,7 @@ HRESULT ZackApp::OnRender()
 
 
     D2D1_RECT_F drawRect;
-    HRESULT hr = CalculateDrawRectangle(drawRect);
-    if (FAILED(hr))
-        return hr;
-
-    // Get the bitmap to draw on the hwnd render target
-    ComPtr<ID2D1Bitmap> pFrameToRender;
-    hr = m_pFrameComposeRT->GetBitmap(pFrameToRender.get_out_storage());
+    HRESULT hr = CalculateDrawRectangle(m_imageInfo.getImageWidthPixel(), m_imageInfo.getImageHeightPixel(), drawRect);
     if (FAILED(hr))
         return hr;
 
@@ -253,7 +308,7 @@ HRESULT ZackApp::OnRender()
     m_pHwndRT->BeginDraw();
 
     m_pHwndRT->Clear(D2D1::ColorF(D2D1::ColorF::Black));
-    m_pHwndRT->DrawBitmap(pFrameToRender.get(), drawRect);
+    m_pHwndRT->DrawBitmap(m_pComposedFrame.get(), drawRect);
 
     return m_pHwndRT->EndDraw();
 }
@@ -384,6 +439,113 @@ bool ZackApp::GetFileSave(WCHAR *pszFileName, DWORD cchFileName, GUID& container
     return false;
 }
 
+// Finds the encoder that writes files with the extension, like ".tif" for
+// the TIFF encoder
+bool FindContainerFormat(IWICImagingFactory* factory, const std::wstring& extension, GUID& containerFormat)
+{
+    ComPtr<IEnumUnknown> e;
+    HRESULT hr = factory->CreateComponentEnumerator(WICEncoder, WICComponentEnumerateRefresh, e.get_out_storage());
+    if (FAILED(hr))
+        return false;
+    std::wstring dottedExtension = L"." + extension;
+    ULONG num = 0;
+    ComPtr<IUnknown> unk;
+    while ((S_OK == e->Next(1, unk.get_out_storage(), &num)) && (1 == num))
+    {
+        ComPtr<IWICBitmapEncoderInfo> encoderInfo;
+        if (FAILED(unk->QueryInterface(encoderInfo.get_out_storage())))
+            continue;
+
+        // The extensions are separated by commas
+        std::wstring fileExtensions;
+        READ_WIC_STRING(encoderInfo->GetFileExtensions, fileExtensions);
+        size_t start = 0;
+        while (start <= fileExtensions.size())
+        {
+            size_t end = fileExtensions.find(L',', start);
+            end = end == std::wstring::npos ? fileExtensions.size() : end;
+            if (_wcsicmp(fileExtensions.substr(start, end - start).c_str(), dottedExtension.c_str()) == 0)
+                return SUCCEEDED(encoderInfo->GetContainerFormat(&containerFormat));
+            start = end + 1;
+        }
+    }
+    return false;
+}
+
+/******************************************************************
+*                                                                 *
+*  ZackApp::RunBatchConversion                                    *
+*                                                                 *
+*  Saves the files matching the patterns in another format on a   *
+*  pool of workers, each saving a file with a FileSaver, which    *
+*  copies the metadata blocks, and prints the throughput.         *
+*                                                                 *
+******************************************************************/
+
+int ZackApp::RunBatchConversion(int argc, const wchar_t* const* argv)
+{
+    // The viewer has no console of its own, it writes to the one it was started from
+    if (AttachConsole(ATTACH_PARENT_PROCESS))
+    {
+        FILE* console = nullptr;
+        freopen_s(&console, "CONOUT$", "w", stdout);
+        freopen_s(&console, "CONOUT$", "w", stderr);
+    }
+
+    BatchConverter converter;
+    if (!converter.ParseArguments(argc, argv))
+    {
+        fprintf(stderr, "Usage: ZackViewer --convert %s\n", BatchConverter::getUsage());
+        return 2;
+    }
+
+    // The workers join the multithreaded apartment of this thread
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+    if (FAILED(hr))
+        return 1;
+
+    int exitCode = 1;
+    GUID containerFormat = GUID_NULL;
+    {
+        ComPtr<IWICImagingFactory> factory;
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            nullptr,
+            CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(factory.get_out_storage()));
+        if (FAILED(hr) || !FindContainerFormat(factory.get(), converter.getFormat(), containerFormat))
+        {
+            fprintf(stderr, "No encoder writes .%ls files\n", converter.getFormat().c_str());
+        }
+        else
+        {
+            bool converted = converter.Run([&containerFormat](const std::wstring& source, const std::wstring& target)
+            {
+                HRESULT result = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+                if (SUCCEEDED(result))
+                {
+                    FileSaver saver;
+                    saver.SetDithering(GIF_DITHERING);
+                    result = saver.Save(source, target, containerFormat);
+                    CoUninitialize();
+                }
+                return SUCCEEDED(result);
+            });
+            printf("Converted %u of %u files in %.2f s, %.1f files/s with %u workers\n",
+                converter.getConvertedCount(),
+                converter.getFileCount(),
+                converter.getSeconds(),
+                converter.getFilesPerSecond(),
+                converter.getWorkerCount());
+            exitCode = converted ? 0 : 1;
+        }
+    }
+
+    CoUninitialize();
+    fflush(stdout);
+    return exitCode;
+}
+
 /******************************************************************
 *                                                                 *
 *  DemoApp::OnResize                                              *
@@ -457,9 +619,9 @@ LRESULT CALLBACK ZackApp::s_WndProc(
 
 bool ZackApp::ShowFirstPage()
 {
-    if (m_imageInfo.getFrameCount() > 1 && uFrameDelay == 0 && m_uNextFrameIndex > 0) {
-        m_uNextFrameIndex = 0;
-        ComposeNextFrame();
+    if (m_imageInfo.getFrameCount() > 1 && m_uComposedFrameIndex > 0) {
+        SeekToFrame(0);
+        UpdateCaption();
         InvalidateRect(m_hWnd, nullptr, FALSE);
         return true;
     }
@@ -468,9 +630,11 @@ bool ZackApp::ShowFirstPage()
 
 bool ZackApp::ShowLastPage()
 {
-    if (m_imageInfo.getFrameCount() > 1 && uFrameDelay == 0 && m_uNextFrameIndex < m_imageInfo.getFrameCount() - 1) {
-        m_uNextFrameIndex = m_imageInfo.getFrameCount() - 1;
-        ComposeNextFrame();
+    // The last page of a TIFF is only known once all pages are indexed
+    IndexPages(UINT_MAX);
+    if (m_imageInfo.getFrameCount() > 1 && m_uComposedFrameIndex < m_imageInfo.getFrameCount() - 1) {
+        SeekToFrame(m_imageInfo.getFrameCount() - 1);
+        UpdateCaption();
         InvalidateRect(m_hWnd, nullptr, FALSE);
         return true;
     }
@@ -479,9 +643,10 @@ bool ZackApp::ShowLastPage()
 
 bool ZackApp::ShowNextPage()
 {
-    if (m_imageInfo.getFrameCount() > 1 && uFrameDelay == 0 && m_uNextFrameIndex < m_imageInfo.getFrameCount() - 1) {
-        ++m_uNextFrameIndex;
-        ComposeNextFrame();
+    IndexPages(m_uComposedFrameIndex + 2);
+    if (m_imageInfo.getFrameCount() > 1 && m_uComposedFrameIndex < m_imageInfo.getFrameCount() - 1) {
+        SeekToFrame(m_uComposedFrameIndex + 1);
+        UpdateCaption();
         InvalidateRect(m_hWnd, nullptr, FALSE);
         UpdateWindow(m_hWnd);
         return true;
@@ -491,9 +656,9 @@ bool ZackApp::ShowNextPage()
 
 bool ZackApp::ShowPreviousPage()
 {
-    if (m_imageInfo.getFrameCount() > 1 && uFrameDelay == 0 && m_uNextFrameIndex > 0) {
-        --m_uNextFrameIndex;
-        ComposeNextFrame();
+    if (m_imageInfo.getFrameCount() > 1 && m_uComposedFrameIndex > 0) {
+        SeekToFrame(m_uComposedFrameIndex - 1);
+        UpdateCaption();
         InvalidateRect(m_hWnd, nullptr, FALSE);
         UpdateWindow(m_hWnd);
         return true;
@@ -508,19 +673,7 @@ bool ZackApp::ShowPreviousFile()
         if (!m_shellNavigator.GetPrevious(m_imageFile.get_out_storage()))
             return false;
 
-        HRESULT hr;
-        LPWSTR filename = nullptr;
-        hr = m_imageFile->GetDisplayName(SIGDN_FILESYSPATH, &filename);
-        if (FAILED(hr))
-            return false;
-        hr = ImagingFactorySingleton::GetInstance()->CreateDecoderFromFilename(
-            filename,
-            nullptr,
-            GENERIC_READ,
-            WICDecodeMetadataCacheOnLoad,
-            m_pDecoder.get_out_storage());
-        CoTaskMemFree(filename);
-
+        HRESULT hr = OpenImageFile();
         if (SUCCEEDED(hr))
         {
             UpdateCaption();
@@ -538,19 +691,7 @@ bool ZackApp::ShowNextFile()
         if (!m_shellNavigator.GetNext(m_imageFile.get_out_storage()))
             return false;
 
-        HRESULT hr;
-        LPWSTR filename = nullptr;
-        hr = m_imageFile->GetDisplayName(SIGDN_FILESYSPATH, &filename);
-        if (FAILED(hr))
-            return false;
-        hr = ImagingFactorySingleton::GetInstance()->CreateDecoderFromFilename(
-            filename,
-            nullptr,
-            GENERIC_READ,
-            WICDecodeMetadataCacheOnLoad,
-            m_pDecoder.get_out_storage());
-        CoTaskMemFree(filename);
-
+        HRESULT hr = OpenImageFile();
         if (SUCCEEDED(hr))
         {
             UpdateCaption();
@@ -597,6 +738,9 @@ LRESULT ZackApp::WndProc(
 
     case WM_KEYDOWN:
     {
+        if (m_gridMode && OnGridKey(wParam))
+            return 0;
+
         switch (wParam)
         {
         case VK_HOME:
@@ -623,6 +767,19 @@ LRESULT ZackApp::WndProc(
             if (ShowNextFile())
                 return 0;
             break;
+        case VK_F9:
+            ToggleTracing();
+            return 0;
+        case 'G':
+            ShowGrid(true);
+            return 0;
+        case VK_ESCAPE:
+            if (m_fileSaver.isRunning())
+            {
+                m_fileSaver.Cancel();
+                return 0;
+            }
+            break;
 
         }
     }
@@ -633,6 +790,28 @@ LRESULT ZackApp::WndProc(
         UINT uWidth = LOWORD(lParam);
         UINT uHeight = HIWORD(lParam);
         hr = OnResize(uWidth, uHeight);
+        if (m_gridMode)
+        {
+            UpdateGrid();
+        }
+    }
+    break;
+
+    case WM_MOUSEWHEEL:
+    {
+        if (m_gridMode)
+        {
+            ScrollGrid(-GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA);
+        }
+    }
+    break;
+
+    case WM_LBUTTONDOWN:
+    {
+        if (m_gridMode)
+        {
+            SelectGridCell(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+        }
     }
     break;
 
@@ -658,10 +837,48 @@ LRESULT ZackApp::WndProc(
 
     case WM_TIMER:
     {
+        // The animation pauses while the grid view is shown
+        if (m_gridMode)
+            break;
+
         // Timer expired, display the next frame and set a new timer
         // if needed
         hr = ComposeNextFrame();
         InvalidateRect(hWnd, nullptr, FALSE);
+        RecordFrameJitter();
+    }
+    break;
+
+    case WM_SAVE_PROGRESS:
+    {
+        m_fileSaver.AcknowledgeProgress();
+        UpdateCaption();
+    }
+    break;
+
+    case WM_SAVE_FINISHED:
+    {
+        OnSaveFinished(static_cast<HRESULT>(wParam));
+    }
+    break;
+
+    case WM_NAVIGATOR_UPDATED:
+    {
+        // The neighbours of the displayed file may have been found
+        if (m_gridMode)
+        {
+            UpdateGrid();
+        }
+        else if (m_pDecoder.get())
+        {
+            UpdatePrefetch();
+        }
+    }
+    break;
+
+    case WM_THUMBNAILS_READY:
+    {
+        OnThumbnailsReady();
     }
     break;
 
@@ -669,8 +886,8 @@ LRESULT ZackApp::WndProc(
         return DefWindowProc(hWnd, uMsg, wParam, lParam);
     }
 
-    // In case of a device loss, recreate all the resources and start playing
-    // gif from the beginning
+    // In case of a device loss, recreate all the resources and upload the
+    // composed frame again
     //
     // In case of other errors from resize, paint, and timer event, we will
     // try our best to continue displaying the animation
@@ -692,7 +909,7 @@ LRESULT ZackApp::WndProc(
 *                                                                 *
 *  DemoApp::GetRawFrame()                                         *
 *                                                                 *
-*  Decodes the current raw frame, retrieves its timing            *
+*  Decodes the current raw frame and looks up its timing          *
 *  information, disposal method, and frame dimension for          *
 *  rendering.  Raw frame is the frame read directly from the gif  *
 *  file without composing.                                        *
@@ -701,303 +918,284 @@ LRESULT ZackApp::WndProc(
 
 HRESULT ZackApp::GetRawFrame(UINT uFrameIndex)
 {
-    ComPtr<IWICFormatConverter> pConverter;
+    TRACE_SCOPE("GetRawFrame");
     ComPtr<IWICBitmapFrameDecode> pWicFrame;
+    ComPtr<IWICBitmapSource> pSource;
+    HRESULT hr = S_OK;
 
-    PROPVARIANT propValue;
-    PropVariantInit(&propValue);
-
-    // Retrieve the current frame
-    HRESULT hr = m_pDecoder->GetFrame(uFrameIndex, pWicFrame.get_out_storage());
-    if (SUCCEEDED(hr))
-    {
-        // Format convert to 32bppPBGRA which D2D expects
-        hr = ImagingFactorySingleton::GetInstance()->CreateFormatConverter(pConverter.get_out_storage());
-    }
-
-    if (SUCCEEDED(hr))
-    {
-        hr = pConverter->Initialize(
-            pWicFrame.get(),
-            GUID_WICPixelFormat32bppPBGRA,
-            WICBitmapDitherTypeNone,
-            nullptr,
-            0.f,
-            WICBitmapPaletteTypeCustom);
-    }
+    const FrameInfo& frameInfo = m_frameIndex.getFrame(uFrameIndex);
+    bool scaled = (m_uDecodeWidth != m_imageInfo.getImageWidth() || m_uDecodeHeight != m_imageInfo.getImageHeight());
+    UINT uWidth = scaled ? m_uDecodeWidth : frameInfo.width;
+    UINT uHeight = scaled ? m_uDecodeHeight : frameInfo.height;
 
-    if (SUCCEEDED(hr))
+    // Use the frame if it was prefetched or the worker already decoded it
+    bool decoded = false;
+    if (uFrameIndex == 0 && m_prefetchedFrame &&
+        m_prefetchedFrame->width == uWidth && m_prefetchedFrame->height == uHeight)
     {
-        // Create a D2DBitmap from IWICBitmapSource
-        m_pRawFrame.reset(nullptr);
-        hr = m_pHwndRT->CreateBitmapFromWicBitmap(
-            pConverter.get(),
-            nullptr,
-            m_pRawFrame.get_out_storage());
+        // The prefetcher keeps its frame for the next visit of the file
+        const FrameBuffer& prefetchedPixels = m_prefetchedFrame->pixels;
+        if (!m_rawFrameBuffer.pixels.hasSize(uWidth, uHeight, 4))
+        {
+            m_rawFrameBuffer.pixels = FrameBufferPool::GetInstance().Acquire(uWidth, uHeight, 4);
+        }
+        if (!prefetchedPixels.empty())
+        {
+            memcpy(m_rawFrameBuffer.pixels.data(), prefetchedPixels.data(), prefetchedPixels.size());
+        }
+        m_rawFrameBuffer.coverage.Release();
+        m_rawFrameBuffer.frameIndex = m_prefetchedFrame->frameIndex;
+        m_rawFrameBuffer.width = uWidth;
+        m_rawFrameBuffer.height = uHeight;
+        m_rawFrameBuffer.result = m_prefetchedFrame->result;
+        m_prefetchedFrame.reset();
+        decoded = true;
     }
-
-    m_framePosition.left = 0;
-    m_framePosition.top = 0;
-    m_framePosition.right = static_cast<float>(m_imageInfo.getImageWidthPixel());
-    m_framePosition.bottom = static_cast<float>(m_imageInfo.getImageHeightPixel());
-    uFrameDelay = 0;
-    uFrameDisposal = DM_UNDEFINED;
-
-    HRESULT metadatareaderresult;
-    if (SUCCEEDED(hr))
+    else if (m_decodeWorker.isRunning())
     {
-
-        ComPtr<IWICMetadataQueryReader> pFrameMetadataQueryReader;
-
-        // Get Metadata Query Reader from the frame
-        metadatareaderresult = pWicFrame->GetMetadataQueryReader(pFrameMetadataQueryReader.get_out_storage());
-
-
-        // Get the Metadata for the current frame
-        if (SUCCEEDED(metadatareaderresult))
+        DecodedFrame* pDecodedFrame = m_decodeWorker.TakeFrame(uFrameIndex);
+        if (pDecodedFrame)
         {
-            metadatareaderresult = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Left", &propValue);
-            if (SUCCEEDED(metadatareaderresult))
+            hr = pDecodedFrame->result;
+            if (SUCCEEDED(hr))
             {
-                metadatareaderresult = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
-                if (SUCCEEDED(hr))
-                {
-                    m_framePosition.left = static_cast<float>(propValue.uiVal);
-                }
-                PropVariantClear(&propValue);
+                // Trade buffers with the worker instead of copying the pixels
+                m_rawFrameBuffer.width = pDecodedFrame->width;
+                m_rawFrameBuffer.height = pDecodedFrame->height;
+                m_rawFrameBuffer.pixels.swap(pDecodedFrame->pixels);
+                m_rawFrameBuffer.coverage.swap(pDecodedFrame->coverage);
             }
+            m_decodeWorker.ReleaseFrame(pDecodedFrame);
+            decoded = true;
         }
+    }
 
-        if (SUCCEEDED(metadatareaderresult))
+    // Pages of TIFF files the TiffDecoder supports are decoded without WIC,
+    // the others and scaled pages by WIC. The strips or tiles of a page are
+    // decoded in parallel, and the pages next to it in the background.
+    if (!decoded && !scaled && m_tiffDecoder.isOpen())
+    {
+        TiffPage tiffPage;
+        if (m_pagePrefetcher.Take(uFrameIndex, m_rawFrameBuffer.pixels))
         {
-            metadatareaderresult = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Top", &propValue);
-            if (SUCCEEDED(metadatareaderresult))
-            {
-                metadatareaderresult = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
-                if (SUCCEEDED(hr))
-                {
-                    m_framePosition.top = static_cast<float>(propValue.uiVal);
-                }
-                PropVariantClear(&propValue);
-            }
+            decoded = true;
         }
-
-        if (SUCCEEDED(metadatareaderresult))
+        else if (m_tiffDecoder.ReadPage(uFrameIndex, tiffPage) && tiffPage.conversion != TC_UNSUPPORTED)
         {
-            metadatareaderresult = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Width", &propValue);
-            if (SUCCEEDED(metadatareaderresult))
+            TRACE_SCOPE("DecodeTiffPage");
+            if (!m_rawFrameBuffer.pixels.hasSize(tiffPage.width, tiffPage.height, 4))
             {
-                metadatareaderresult = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
-                if (SUCCEEDED(hr))
-                {
-                    m_framePosition.right = static_cast<float>(propValue.uiVal)
-                        + m_framePosition.left;
-                }
-                PropVariantClear(&propValue);
+                m_rawFrameBuffer.pixels = FrameBufferPool::GetInstance().Acquire(tiffPage.width, tiffPage.height, 4);
             }
+            decoded = m_tiffDecoder.DecodePage(
+                tiffPage,
+                m_rawFrameBuffer.pixels.data(),
+                m_rawFrameBuffer.pixels.getStride(),
+                m_workerPool);
         }
 
-        if (SUCCEEDED(metadatareaderresult))
+        if (decoded)
         {
-            metadatareaderresult = pFrameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Height", &propValue);
-            if (SUCCEEDED(metadatareaderresult))
-            {
-                metadatareaderresult = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
-                if (SUCCEEDED(hr))
-                {
-                    m_framePosition.bottom = static_cast<float>(propValue.uiVal)
-                        + m_framePosition.top;
-                }
-                PropVariantClear(&propValue);
-            }
+            m_rawFrameBuffer.coverage.Release();
+            m_rawFrameBuffer.frameIndex = uFrameIndex;
+            m_rawFrameBuffer.width = m_rawFrameBuffer.pixels.getWidth();
+            m_rawFrameBuffer.height = m_rawFrameBuffer.pixels.getHeight();
+            m_rawFrameBuffer.result = S_OK;
         }
+        m_pagePrefetcher.Prefetch(uFrameIndex, TIFF_PREFETCH_PAGES);
+    }
 
-        if (SUCCEEDED(metadatareaderresult))
+    // Frames of GIF files are decoded without WIC, scaled ones and the
+    // frames the GifDecoder fails on by WIC
+    if (!decoded && !scaled && m_gifDecoder.isOpen())
+    {
+        TRACE_SCOPE("DecodeGifFrame");
+        decoded = m_gifDecoder.ExpandFrame(uFrameIndex, m_rawFrameBuffer.pixels, &m_rawFrameBuffer.coverage);
+        if (decoded)
         {
-            // Get delay from the optional Graphic Control Extension
-            if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
-                L"/grctlext/Delay",
-                &propValue)))
-            {
-                metadatareaderresult = (propValue.vt == VT_UI2 ? S_OK : E_FAIL);
-                if (SUCCEEDED(hr))
-                {
-                    // Convert the delay retrieved in 10 ms units to a delay in 1 ms units
-                    metadatareaderresult = UIntMult(propValue.uiVal, 10, &uFrameDelay);
-                }
-                PropVariantClear(&propValue);
-            }
-            else
-            {
-                // Failed to get delay from graphic control extension. Possibly a
-                // single frame image (non-animated gif)
-                uFrameDelay = 0;
-            }
-
-            if (SUCCEEDED(metadatareaderresult))
-            {
-                // Insert an artificial delay to ensure rendering for gif with very small
-                // or 0 delay.  This delay number is picked to match with most browsers' 
-                // gif display speed.
-                //
-                // This will defeat the purpose of using zero delay intermediate frames in 
-                // order to preserve compatibility. If this is removed, the zero delay 
-                // intermediate frames will not be visible.
-                if (uFrameDelay < 20)
-                {
-                    uFrameDelay = 20;
-                }
-            }
+            m_rawFrameBuffer.frameIndex = uFrameIndex;
+            m_rawFrameBuffer.width = m_rawFrameBuffer.pixels.getWidth();
+            m_rawFrameBuffer.height = m_rawFrameBuffer.pixels.getHeight();
+            m_rawFrameBuffer.result = S_OK;
         }
+    }
+
+    if (!decoded)
+    {
+        // Retrieve the current frame
+        hr = m_pDecoder->GetFrame(uFrameIndex, pWicFrame.get_out_storage());
+    }
 
-        if (SUCCEEDED(metadatareaderresult))
+    if (SUCCEEDED(hr) && !decoded)
+    {
+        // Images larger than the screen are decoded at the size they are shown
+        if (scaled)
         {
-            if (SUCCEEDED(pFrameMetadataQueryReader->GetMetadataByName(
-                L"/grctlext/Disposal",
-                &propValue)))
-            {
-                metadatareaderresult = (propValue.vt == VT_UI1) ? S_OK : E_FAIL;
-                if (SUCCEEDED(hr))
-                {
-                    uFrameDisposal = (DISPOSAL_METHODS)propValue.bVal;
-                }
-            }
-            else
-            {
-                // Failed to get the disposal method, use default. Possibly a 
-                // non-animated gif.
-                uFrameDisposal = DM_UNDEFINED;
-            }
+            hr = ScaledDecoder::CreateSource(
+                ImagingFactorySingleton::GetInstance(),
+                pWicFrame.get(),
+                uWidth,
+                uHeight,
+                pSource.get_out_storage());
+        }
+        else
+        {
+            pSource.reset(pWicFrame.new_ref());
         }
     }
-    PropVariantClear(&propValue);
+
+    if (SUCCEEDED(hr) && !decoded)
+    {
+        // Convert to 32bppPBGRA which the FrameCompositor expects
+        hr = FrameDecodeWorker::CopyFrame(ImagingFactorySingleton::GetInstance(), pSource.get(), m_rawFrameBuffer);
+    }
+
+    // Position, timing and disposal were read when the file was opened. The
+    // size of a page is only known once it is decoded, the pages of a TIFF
+    // are indexed with the size of the first page.
+    if (SUCCEEDED(hr) && !scaled && frameInfo.delay == 0)
+    {
+        uWidth = m_rawFrameBuffer.width;
+        uHeight = m_rawFrameBuffer.height;
+    }
+    m_framePosition = scaled ?
+        PixelRect::Make(0, 0, uWidth, uHeight) :
+        PixelRect::Make(frameInfo.left, frameInfo.top, uWidth, uHeight);
+    uFrameDelay = frameInfo.delay;
+    uFrameDisposal = frameInfo.disposal;
+
     return hr;
 }
 
-
 /******************************************************************
 *                                                                 *
-*  DemoApp::CalculateDrawRectangle()                              *
+*  DemoApp::UploadComposedFrame()                                 *
 *                                                                 *
-*  Calculates a specific rectangular area of the hwnd             *
-*  render target to draw a bitmap containing the current          *
-*  composed frame.                                                *
+*  Copies the area changed by composing since the last upload     *
+*  into the bitmap shown on the hwnd render target.               *
 *                                                                 *
 ******************************************************************/
 
-bool ZackApp::EndOfAnimation() const
-{
-    return m_imageInfo.hasLoop() && IsLastFrame() && m_uLoopNumber == m_imageInfo.getTotalLoopCount() + 1;
-}
-
-HRESULT ZackApp::CalculateDrawRectangle(D2D1_RECT_F &drawRect) const
+HRESULT ZackApp::UploadComposedFrame()
 {
-    HRESULT hr = S_OK;
-    RECT rcClient;
-
-    // Top and left of the client rectangle are both 0
-    if (!GetClientRect(m_hWnd, &rcClient))
-    {
-        hr = HRESULT_FROM_WIN32(GetLastError());
-    }
+    TRACE_SCOPE("UploadComposedFrame");
+    m_uploadRect.Include(m_compositor.TakeDirtyRect());
+    if (!m_pComposedFrame.get() || m_uploadRect.isEmpty())
+        return S_OK;
 
+    D2D1_RECT_U destinationRect = D2D1::RectU(
+        m_uploadRect.left,
+        m_uploadRect.top,
+        m_uploadRect.right,
+        m_uploadRect.bottom);
+    const uint8_t* pixels = m_compositor.getPixels() +
+        m_uploadRect.top * m_compositor.getStride() + m_uploadRect.left * 4;
+
+    HRESULT hr = m_pComposedFrame->CopyFromMemory(
+        &destinationRect,
+        pixels,
+        static_cast<UINT32>(m_compositor.getStride()));
     if (SUCCEEDED(hr))
     {
-        // Calculate the area to display the image
-        // Center the image if the client rectangle is larger
-        drawRect.left = (static_cast<float>(rcClient.right) - m_imageInfo.getImageWidthPixel()) / 2.f;
-        drawRect.top = (static_cast<float>(rcClient.bottom) - m_imageInfo.getImageHeightPixel()) / 2.f;
-        drawRect.right = drawRect.left + m_imageInfo.getImageWidthPixel();
-        drawRect.bottom = drawRect.top + m_imageInfo.getImageHeightPixel();
-
-        // If the client area is resized to be smaller than the image size, scale
-        // the image, and preserve the aspect ratio
-        auto aspectRatio = static_cast<float>(m_imageInfo.getImageWidthPixel()) /
-            static_cast<float>(m_imageInfo.getImageHeightPixel());
-
-        if (drawRect.left < 0)
-        {
-            auto newWidth = static_cast<float>(rcClient.right);
-            float newHeight = newWidth / aspectRatio;
-            drawRect.left = 0;
-            drawRect.top = (static_cast<float>(rcClient.bottom) - newHeight) / 2.f;
-            drawRect.right = newWidth;
-            drawRect.bottom = drawRect.top + newHeight;
-        }
-
-        if (drawRect.top < 0)
-        {
-            auto newHeight = static_cast<float>(rcClient.bottom);
-            float newWidth = newHeight * aspectRatio;
-            drawRect.left = (static_cast<float>(rcClient.right) - newWidth) / 2.f;
-            drawRect.top = 0;
-            drawRect.right = drawRect.left + newWidth;
-            drawRect.bottom = newHeight;
-        }
+        m_uploadRect = PixelRect::Empty();
     }
-
     return hr;
 }
 
+
 /******************************************************************
 *                                                                 *
-*  DemoApp::RestoreSavedFrame()                                   *
+*  DemoApp::GetDecodeLimit()                                      *
 *                                                                 *
-*  Copys the saved frame to the frame in the bitmap render        *
-*  target.                                                        *
+*  Gets the size of the monitor showing the window. Larger        *
+*  single frame images are decoded scaled down to this size.      *
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::RestoreSavedFrame()
+void ZackApp::GetDecodeLimit(UINT& uMaxWidth, UINT& uMaxHeight) const
 {
-    HRESULT hr = S_OK;
-
-    ComPtr<ID2D1Bitmap> pFrameToCopyTo;
-
-    hr = m_pSavedFrame.get() ? S_OK : E_FAIL;
-
-    if (SUCCEEDED(hr))
-    {
-        hr = m_pFrameComposeRT->GetBitmap(pFrameToCopyTo.get_out_storage());
-    }
+    uMaxWidth = 0;
+    uMaxHeight = 0;
 
-    if (SUCCEEDED(hr))
+    MONITORINFO monitorInfo = {};
+    monitorInfo.cbSize = sizeof(monitorInfo);
+    if (GetMonitorInfo(MonitorFromWindow(m_hWnd, MONITOR_DEFAULTTONEAREST), &monitorInfo))
     {
-        // Copy the whole bitmap
-        hr = pFrameToCopyTo->CopyFromBitmap(nullptr, m_pSavedFrame.get(), nullptr);
+        uMaxWidth = RectWidth(monitorInfo.rcMonitor);
+        uMaxHeight = RectHeight(monitorInfo.rcMonitor);
     }
-
-    return hr;
 }
 
 /******************************************************************
 *                                                                 *
-*  DemoApp::ClearCurrentFrameArea()                               *
+*  DemoApp::CalculateDrawRectangle()                              *
 *                                                                 *
-*  Clears a rectangular area equal to the area overlaid by the    *
-*  current raw frame in the bitmap render target with background  *
-*  color.                                                         *
+*  Calculates a specific rectangular area of the hwnd             *
+*  render target to draw a bitmap containing the current          *
+*  composed frame.                                                *
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::ClearCurrentFrameArea()
+bool ZackApp::EndOfAnimation() const
 {
-    m_pFrameComposeRT->BeginDraw();
+    return m_imageInfo.hasLoop() && IsLastFrame() && m_uLoopNumber == m_imageInfo.getTotalLoopCount() + 1;
+}
 
-    // Clip the render target to the size of the raw frame
-    m_pFrameComposeRT->PushAxisAlignedClip(
-        &m_framePosition,
-        D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
+// Centers an image of the given size in the area. If the area is smaller
+// than the image, the image is scaled down and keeps its aspect ratio.
+D2D1_RECT_F FitRectangle(UINT uImageWidth, UINT uImageHeight, const D2D1_RECT_F& area)
+{
+    float areaWidth = area.right - area.left;
+    float areaHeight = area.bottom - area.top;
+    float width = static_cast<float>(uImageWidth);
+    float height = static_cast<float>(uImageHeight);
+    auto aspectRatio = width / height;
 
-    m_pFrameComposeRT->Clear(m_imageInfo.getBackgroundColor());
+    if (width > areaWidth)
+    {
+        width = areaWidth;
+        height = width / aspectRatio;
+    }
 
-    // Remove the clipping
-    m_pFrameComposeRT->PopAxisAlignedClip();
+    if (height > areaHeight)
+    {
+        height = areaHeight;
+        width = height * aspectRatio;
+    }
 
-    return m_pFrameComposeRT->EndDraw();
+    D2D1_RECT_F drawRect;
+    drawRect.left = area.left + (areaWidth - width) / 2.f;
+    drawRect.top = area.top + (areaHeight - height) / 2.f;
+    drawRect.right = drawRect.left + width;
+    drawRect.bottom = drawRect.top + height;
+    return drawRect;
 }
 
-bool ZackApp::IsLastFrame() const
+HRESULT ZackApp::CalculateDrawRectangle(UINT uImageWidth, UINT uImageHeight, D2D1_RECT_F &drawRect) const
+{
+    HRESULT hr = S_OK;
+    RECT rcClient;
+
+    // Top and left of the client rectangle are both 0
+    if (!GetClientRect(m_hWnd, &rcClient))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Center the image if the client rectangle is larger, scale it if
+        // the client area is resized to be smaller than the image size
+        drawRect = FitRectangle(
+            uImageWidth,
+            uImageHeight,
+            D2D1::RectF(0.f, 0.f, static_cast<float>(rcClient.right), static_cast<float>(rcClient.bottom)));
+    }
+
+    return hr;
+}
+
+bool ZackApp::IsLastFrame() const
 {
     return (m_uNextFrameIndex == 0);
 }
@@ -1011,158 +1209,1046 @@ bool ZackApp::IsLastFrame() const
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::DisposeCurrentFrame()
+HRESULT ZackApp::DisposeCurrentFrame()
+{
+    TRACE_SCOPE("DisposeCurrentFrame");
+    // Disposal none draws the next frame on the current one. Disposal
+    // background clears the area covered by the current raw frame with the
+    // background color, and disposal previous restores the area from the
+    // composed frame saved before the current raw frame was drawn.
+    bool disposed = m_compositor.Dispose(
+        uFrameDisposal,
+        m_framePosition,
+        ToCanvasColor(m_imageInfo.getBackgroundColor()));
+
+    // Invalid disposal method, or no saved frame
+    return disposed ? S_OK : E_FAIL;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::OverlayNextFrame()                                    *
+*                                                                 *
+*  Loads and draws the next raw frame into the composed frame.    *
+*  This is called after the current frame is disposed.            *
+*                                                                 *
+******************************************************************/
+
+HRESULT ZackApp::OverlayNextFrame()
+{
+    TRACE_SCOPE("OverlayNextFrame");
+    // Play the frame from the cache if an earlier loop already composed it
+    if (m_imageInfo.getFrameCount() > 1)
+    {
+        FrameCache::Entry* pCachedFrame = m_frameCache.Lookup(m_uNextFrameIndex);
+        if (pCachedFrame)
+        {
+            return OverlayCachedFrame(*pCachedFrame);
+        }
+    }
+
+    // A composed frame is only correct if all frames before it were composed
+    // in order, which is not the case after jumping to a page
+    bool composedInOrder = (m_uNextFrameIndex == 0) ||
+        (m_composedFrameValid && m_uComposedFrameIndex + 1 == m_uNextFrameIndex);
+
+    // Get Frame information
+    HRESULT hr = GetRawFrame(m_uNextFrameIndex);
+    if (SUCCEEDED(hr) && composedInOrder &&
+        m_uNextFrameIndex % m_uCheckpointInterval == 0 &&
+        !m_frameIndex.isKeyFrame(m_uNextFrameIndex))
+    {
+        // Keep the image this frame is drawn on, so that seeking can start
+        // composing here. Failing to keep it is not an error.
+        m_checkpoints.Insert(
+            m_uNextFrameIndex,
+            m_compositor,
+            m_compositor.getBounds(),
+            m_framePosition,
+            uFrameDelay,
+            uFrameDisposal);
+    }
+
+    if (SUCCEEDED(hr) && m_frameIndex.getFrame(m_uNextFrameIndex).delay == 0)
+    {
+        // Pages are shown on their own at their own size
+        hr = ResizeComposedFrame(m_framePosition.getWidth(), m_framePosition.getHeight());
+        if (SUCCEEDED(hr))
+        {
+            m_compositor.Clear(ToCanvasColor(m_imageInfo.getBackgroundColor()));
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // If starting a new animation loop
+        if (m_uNextFrameIndex == 0)
+        {
+            // Draw background and increase loop count
+            m_compositor.Clear(ToCanvasColor(m_imageInfo.getBackgroundColor()));
+            m_uLoopNumber++;
+        }
+
+        // For disposal 3 method, we would want to save a copy of the area
+        // the frame is drawn on
+        if (uFrameDisposal == DM_PREVIOUS)
+        {
+            m_compositor.SaveCanvas(m_framePosition);
+        }
+
+        // Produce the next frame, drawing no more than the decoded pixels and
+        // skipping the transparent pixels of indexed frames
+        PixelRect drawRect = PixelRect::Make(
+            m_framePosition.left,
+            m_framePosition.top,
+            m_rawFrameBuffer.width,
+            m_rawFrameBuffer.height);
+        drawRect.Intersect(m_framePosition);
+        const FrameBuffer& coverage = m_rawFrameBuffer.coverage;
+        bool covered = coverage.hasSize(m_rawFrameBuffer.width, m_rawFrameBuffer.height, 1);
+        m_compositor.Overlay(
+            m_rawFrameBuffer.pixels.data(),
+            m_rawFrameBuffer.pixels.getStride(),
+            covered ? coverage.data() : nullptr,
+            coverage.getStride(),
+            drawRect);
+
+        m_uComposedFrameIndex = m_uNextFrameIndex;
+        m_composedFrameValid = composedInOrder;
+
+        PixelRect changedRect = m_compositor.TakeDirtyRect();
+        m_uploadRect.Include(changedRect);
+
+        // To avoid decoding/composing this frame in the following animation
+        // loops, the composed frame is cached in memory. Failing to cache
+        // the frame is not an error.
+        if (composedInOrder && m_imageInfo.getFrameCount() > 1)
+        {
+            m_frameCache.Insert(
+                m_uNextFrameIndex,
+                m_compositor,
+                changedRect,
+                m_framePosition,
+                uFrameDelay,
+                uFrameDisposal);
+        }
+    }
+
+    return hr;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::OverlayCachedFrame()                                  *
+*                                                                 *
+*  Copies a frame composed in an earlier animation loop into the  *
+*  composed frame. No decoding is needed. When the frame before   *
+*  it is composed, only the area that changed is decompressed     *
+*  and copied.                                                    *
+*                                                                 *
+******************************************************************/
+
+HRESULT ZackApp::OverlayCachedFrame(FrameCache::Entry& cachedFrame)
+{
+    TRACE_SCOPE("OverlayCachedFrame");
+    bool composedInOrder = (m_uNextFrameIndex == 0) ||
+        (m_composedFrameValid && m_uComposedFrameIndex + 1 == m_uNextFrameIndex);
+
+    // Pages are cached at their own size and replace the page before
+    bool isPage = m_frameIndex.getFrame(m_uNextFrameIndex).delay == 0;
+    if (isPage)
+    {
+        HRESULT hr = ResizeComposedFrame(cachedFrame.framePosition.getWidth(), cachedFrame.framePosition.getHeight());
+        if (FAILED(hr))
+            return hr;
+    }
+
+    // Mostly decompressed already while the frame before was shown
+    PixelRect copyRect = composedInOrder && !isPage ? cachedFrame.changedRect : m_compositor.getBounds();
+    const uint8_t* pixels = m_frameCache.GetPixels(m_uNextFrameIndex, copyRect);
+    if (pixels == nullptr)
+        return E_OUTOFMEMORY;
+
+    m_framePosition = cachedFrame.framePosition;
+    uFrameDelay = cachedFrame.frameDelay;
+    uFrameDisposal = cachedFrame.frameDisposal;
+
+    // The following frame may not be cached, so keep the saved area for
+    // disposal 3 method up to date
+    if (uFrameDisposal == DM_PREVIOUS)
+    {
+        // The first frame is drawn on the background
+        if (m_uNextFrameIndex == 0)
+        {
+            m_compositor.Clear(ToCanvasColor(m_imageInfo.getBackgroundColor()));
+        }
+        m_compositor.SaveCanvas(m_framePosition);
+    }
+
+    m_compositor.Copy(pixels, m_compositor.getStride(), copyRect);
+    m_uploadRect.Include(m_compositor.TakeDirtyRect());
+
+    // If starting a new animation loop increase loop count
+    if (m_uNextFrameIndex == 0)
+    {
+        m_uLoopNumber++;
+    }
+    m_uComposedFrameIndex = m_uNextFrameIndex;
+    m_composedFrameValid = true;
+
+    return S_OK;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ResizeComposedFrame()                                 *
+*                                                                 *
+*  Resizes the composed frame and the bitmap it is uploaded to,   *
+*  for pages which differ in size from the page before. The       *
+*  composed frame is cleared to transparent black.                *
+*                                                                 *
+******************************************************************/
+
+HRESULT ZackApp::ResizeComposedFrame(UINT uWidth, UINT uHeight)
+{
+    if (m_compositor.getWidth() == uWidth && m_compositor.getHeight() == uHeight)
+        return S_OK;
+
+    TRACE_SCOPE("ResizeComposedFrame");
+    m_compositor.Reset(uWidth, uHeight);
+    return CreateDeviceResources();
+}
+
+
+void ZackApp::UpdateCaption()
+{
+    LPWSTR displayName = nullptr;
+    if (m_imageFile.get() && SUCCEEDED(m_imageFile->GetDisplayName(SIGDN_NORMALDISPLAY, &displayName))) {
+        WCHAR newCaption[MAX_PATH + 64] = {};
+        if (m_fileSaver.isRunning())
+        {
+            swprintf_s(newCaption, L"Zack Viewer (\"%s\") - Saving page %u of %u, Esc to cancel",
+                displayName, m_fileSaver.getSavedCount(), m_fileSaver.getPageCount());
+        }
+        else if (m_tiffDecoder.isOpen() && m_imageInfo.getFrameCount() > 1)
+        {
+            // The page count is marked with a + until all pages are indexed
+            swprintf_s(newCaption, L"Zack Viewer (\"%s\") - Page %u of %u%s",
+                displayName, m_uComposedFrameIndex + 1, m_imageInfo.getFrameCount(),
+                m_tiffDecoder.isIndexed() ? L"" : L"+");
+        }
+        else
+        {
+            swprintf_s(newCaption, L"Zack Viewer (\"%s\")", displayName);
+        }
+        CoTaskMemFree(displayName);
+        SetWindowText(m_hWnd, newCaption);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::RecordFrameJitter()                                   *
+*                                                                 *
+*  Records how much longer or shorter than its delay the last     *
+*  frame of an animation was shown.                               *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::RecordFrameJitter()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (m_uShownFrameDelay > 0)
+    {
+        std::chrono::duration<double, std::milli> shown = now - m_lastFrameTime;
+        m_frameJitter.Add(shown.count() - m_uShownFrameDelay);
+    }
+    m_lastFrameTime = now;
+    m_uShownFrameDelay = uFrameDelay;
+}
+
+void ZackApp::ReportStatistics()
+{
+    WCHAR report[256] = {};
+    if (m_frameJitter.getCount() > 0)
+    {
+        swprintf_s(report, L"Frame jitter: p50 %.1f ms, p99 %.1f ms, %u frames, decode ahead %s\n",
+            m_frameJitter.getPercentile(0.5),
+            m_frameJitter.getPercentile(0.99),
+            static_cast<unsigned int>(m_frameJitter.getCount()),
+            DECODE_AHEAD ? L"on" : L"off");
+        OutputDebugString(report);
+    }
+    m_frameJitter.Reset();
+    m_uShownFrameDelay = 0;
+
+    if (m_frameCache.GetHitCount() + m_frameCache.GetMissCount() > 0)
+    {
+        swprintf_s(report, L"Frame cache: %u hits, %u misses, %.1f MB for %.1f MB of frames, %u prefetched, %u late\n",
+            m_frameCache.GetHitCount(),
+            m_frameCache.GetMissCount(),
+            m_frameCache.GetUsedBytes() / 1048576.0,
+            m_frameCache.GetRawBytes() / 1048576.0,
+            m_frameCache.GetPrefetchedCount(),
+            m_frameCache.GetLateCount());
+        OutputDebugString(report);
+    }
+
+    if (m_scheduler.getDroppedCount() + m_scheduler.getStretchedCount() > 0)
+    {
+        swprintf_s(report, L"Frame schedule: %u frames dropped, %u times stretched\n",
+            m_scheduler.getDroppedCount(),
+            m_scheduler.getStretchedCount());
+        OutputDebugString(report);
+    }
+    m_scheduler.ResetCounts();
+
+    if (m_compositor.getSaveCount() > 0)
+    {
+        swprintf_s(report, L"Disposal previous: %u frames, %.1f KB copied per frame\n",
+            m_compositor.getSaveCount(),
+            m_compositor.getSavedBytes() / 1024.0 / m_compositor.getSaveCount());
+        OutputDebugString(report);
+    }
+
+    FrameBufferPool& pool = FrameBufferPool::GetInstance();
+    if (pool.getAcquireCount() > 0)
+    {
+        swprintf_s(report, L"Frame buffers: %.1f MB live, %.1f MB peak, %.0f%% of %u reused\n",
+            pool.getLiveBytes() / 1048576.0,
+            pool.getPeakBytes() / 1048576.0,
+            100.0 * pool.getReuseCount() / pool.getAcquireCount(),
+            pool.getAcquireCount());
+        OutputDebugString(report);
+    }
+    pool.ResetCounts();
+
+    unsigned int prefetchRequests = m_prefetcher.getHitCount() + m_prefetcher.getMissCount();
+    if (prefetchRequests > 0)
+    {
+        swprintf_s(report, L"Prefetch: %u of %u files hit (%.0f%%), depth %u\n",
+            m_prefetcher.getHitCount(),
+            prefetchRequests,
+            100.0 * m_prefetcher.getHitCount() / prefetchRequests,
+            PREFETCH_DEPTH);
+        OutputDebugString(report);
+    }
+
+    if (m_thumbnailCache.getHitCount() + m_thumbnailCache.getMissCount() > 0)
+    {
+        swprintf_s(report, L"Thumbnail cache: %u hits, %u misses, %u corrupt, %u entries, %.1f MB\n",
+            m_thumbnailCache.getHitCount(),
+            m_thumbnailCache.getMissCount(),
+            m_thumbnailCache.getCorruptCount(),
+            static_cast<unsigned int>(m_thumbnailCache.getEntryCount()),
+            m_thumbnailCache.getFileSize() / 1048576.0);
+        OutputDebugString(report);
+    }
+
+    if (m_thumbnailLoader.getBuiltCount() + m_thumbnailLoader.getCachedCount() > 0)
+    {
+        swprintf_s(report, L"Grid thumbnails: %u decoded, %u cached, %u canceled\n",
+            m_thumbnailLoader.getBuiltCount(),
+            m_thumbnailLoader.getCachedCount(),
+            m_thumbnailLoader.getCanceledCount());
+        OutputDebugString(report);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ToggleTracing()                                       *
+*                                                                 *
+*  Starts recording trace spans, or stops recording and writes    *
+*  the spans as Chrome trace events to the temporary folder.      *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::ToggleTracing()
+{
+    if (!Tracer::isEnabled())
+    {
+        Tracer::Clear();
+        Tracer::Enable(true);
+        return;
+    }
+    Tracer::Enable(false);
+
+    WCHAR path[MAX_PATH] = {};
+    DWORD length = GetTempPath(MAX_PATH, path);
+    if (length == 0 || length + ARRAYSIZE(TRACE_FILE_NAME) > MAX_PATH)
+        return;
+    wcscat_s(path, TRACE_FILE_NAME);
+
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, path, L"w") != 0 || file == nullptr)
+    {
+        MessageBox(m_hWnd, L"The trace could not be written.", L"Error", MB_OK);
+        return;
+    }
+    size_t spans = Tracer::WriteChromeTrace(file);
+    fclose(file);
+
+    WCHAR message[MAX_PATH + 64] = {};
+    swprintf_s(message, L"%u trace spans written to %s\n", static_cast<unsigned int>(spans), path);
+    OutputDebugString(message);
+    MessageBox(m_hWnd, message, L"Trace", MB_OK);
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::UpdatePrefetch()                                      *
+*                                                                 *
+*  Asks the prefetcher for the first frames of the files next to  *
+*  the displayed file, the nearest ones first.                    *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::UpdatePrefetch()
+{
+    std::vector<std::wstring> filenames;
+    for (unsigned int distance = 1; distance <= PREFETCH_DEPTH; ++distance)
+    {
+        for (ptrdiff_t offset : { static_cast<ptrdiff_t>(distance), -static_cast<ptrdiff_t>(distance) })
+        {
+            std::wstring filename;
+            if (m_shellNavigator.GetNeighbour(offset, filename))
+            {
+                filenames.push_back(filename);
+            }
+        }
+    }
+    UINT uMaxWidth = 0;
+    UINT uMaxHeight = 0;
+    if (SCALED_DECODE)
+    {
+        GetDecodeLimit(uMaxWidth, uMaxHeight);
+    }
+    m_prefetcher.Prefetch(filenames, uMaxWidth, uMaxHeight);
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ShowGrid()                                            *
+*                                                                 *
+*  Shows the files of the folder as a grid of thumbnails instead  *
+*  of the image, or the image again. The animation pauses while   *
+*  the grid is shown.                                             *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::ShowGrid(bool show)
+{
+    if (show == m_gridMode)
+        return;
+    m_gridMode = show;
+
+    if (show)
+    {
+        KillTimer(m_hWnd, DELAY_TIMER_ID);
+        StopScheduler();
+        m_uShownFrameDelay = 0;
+        m_gridSelection = m_shellNavigator.GetCurrentIndex();
+        if (FAILED(CreateRenderTarget()))
+            return;
+        MoveGridSelection(0);
+    }
+    else
+    {
+        // Nothing is built for the grid until it is shown again
+        m_thumbnailLoader.Load(std::vector<ThumbnailLoader::Request>(), THUMBNAIL_SIZE);
+        m_gridThumbnails.clear();
+        if (CanAdvance())
+        {
+            SetTimer(m_hWnd, DELAY_TIMER_ID, 0, nullptr);
+        }
+        InvalidateRect(m_hWnd, nullptr, FALSE);
+    }
+}
+
+bool ZackApp::OnGridKey(WPARAM key)
+{
+    UINT uColumns = 0;
+    UINT uRows = 0;
+    UINT uFullRows = 0;
+    GetGridLayout(uColumns, uRows, uFullRows);
+    ptrdiff_t page = static_cast<ptrdiff_t>(uColumns) * uFullRows;
+
+    switch (key)
+    {
+    case VK_LEFT:
+        MoveGridSelection(-1);
+        return true;
+    case VK_RIGHT:
+        MoveGridSelection(1);
+        return true;
+    case VK_UP:
+        MoveGridSelection(-static_cast<ptrdiff_t>(uColumns));
+        return true;
+    case VK_DOWN:
+        MoveGridSelection(uColumns);
+        return true;
+    case VK_PRIOR:
+        MoveGridSelection(-page);
+        return true;
+    case VK_NEXT:
+        MoveGridSelection(page);
+        return true;
+    case VK_HOME:
+        MoveGridSelection(-static_cast<ptrdiff_t>(m_gridSelection));
+        return true;
+    case VK_END:
+        MoveGridSelection(static_cast<ptrdiff_t>(m_shellNavigator.GetFileCount()));
+        return true;
+    case VK_RETURN:
+        OpenGridSelection();
+        return true;
+    case VK_ESCAPE:
+        if (m_fileSaver.isRunning())
+            return false;
+        ShowGrid(false);
+        return true;
+    case 'G':
+        ShowGrid(false);
+        return true;
+    }
+    return false;
+}
+
+// Gets the number of cells per row and the number of rows which are
+// visible, partly or fully
+void ZackApp::GetGridLayout(UINT& uColumns, UINT& uRows, UINT& uFullRows) const
+{
+    RECT rcClient = {};
+    GetClientRect(m_hWnd, &rcClient);
+    uColumns = std::max<UINT>(1, RectWidth(rcClient) / GRID_CELL_SIZE);
+    uRows = std::max<UINT>(1, (RectHeight(rcClient) + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE);
+    uFullRows = std::max<UINT>(1, RectHeight(rcClient) / GRID_CELL_SIZE);
+}
+
+// Moves the selection by offset files and scrolls it into view
+void ZackApp::MoveGridSelection(ptrdiff_t offset)
+{
+    size_t fileCount = m_shellNavigator.GetFileCount();
+    if (fileCount > 0)
+    {
+        // The selection starts after the last file while the current file
+        // was not found
+        m_gridSelection = std::min(m_gridSelection, fileCount - 1);
+        if (offset < 0)
+        {
+            m_gridSelection -= std::min(m_gridSelection, static_cast<size_t>(-offset));
+        }
+        else
+        {
+            m_gridSelection = std::min(m_gridSelection + static_cast<size_t>(offset), fileCount - 1);
+        }
+
+        UINT uColumns = 0;
+        UINT uRows = 0;
+        UINT uFullRows = 0;
+        GetGridLayout(uColumns, uRows, uFullRows);
+        size_t row = m_gridSelection / uColumns;
+        if (row < m_gridFirstRow)
+        {
+            m_gridFirstRow = row;
+        }
+        else if (row >= m_gridFirstRow + uFullRows)
+        {
+            m_gridFirstRow = row - uFullRows + 1;
+        }
+    }
+    UpdateGrid();
+}
+
+void ZackApp::ScrollGrid(ptrdiff_t rows)
+{
+    m_gridFirstRow -= std::min(m_gridFirstRow, static_cast<size_t>(rows < 0 ? -rows : 0));
+    m_gridFirstRow += static_cast<size_t>(rows > 0 ? rows : 0);
+    UpdateGrid();
+}
+
+void ZackApp::SelectGridCell(int x, int y)
+{
+    UINT uColumns = 0;
+    UINT uRows = 0;
+    UINT uFullRows = 0;
+    GetGridLayout(uColumns, uRows, uFullRows);
+    if (x < 0 || y < 0 || static_cast<UINT>(x) >= uColumns * GRID_CELL_SIZE)
+        return;
+
+    size_t item = (m_gridFirstRow + y / GRID_CELL_SIZE) * uColumns + x / GRID_CELL_SIZE;
+    if (item < m_shellNavigator.GetFileCount())
+    {
+        m_gridSelection = item;
+        InvalidateRect(m_hWnd, nullptr, FALSE);
+    }
+}
+
+void ZackApp::OpenGridSelection()
+{
+    ComPtr<IShellItem> imageFile;
+    if (!m_shellNavigator.MoveTo(m_gridSelection, imageFile.get_out_storage()))
+        return;
+
+    ShowGrid(false);
+    CleanDisplay();
+    m_imageFile = std::move(imageFile);
+    if (SUCCEEDED(OpenImageFile()))
+    {
+        UpdateCaption();
+        DisplayImage();
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::UpdateGrid()                                          *
+*                                                                 *
+*  Asks the thumbnail loader for the thumbnails of the visible    *
+*  files first and of the rows around them next, and drops the    *
+*  thumbnails of the files further away.                          *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::UpdateGrid()
+{
+    UINT uColumns = 0;
+    UINT uRows = 0;
+    UINT uFullRows = 0;
+    GetGridLayout(uColumns, uRows, uFullRows);
+    size_t fileCount = m_shellNavigator.GetFileCount();
+    size_t rowCount = (fileCount + uColumns - 1) / uColumns;
+    m_gridFirstRow = std::min(m_gridFirstRow, rowCount > uFullRows ? rowCount - uFullRows : 0);
+
+    size_t first = m_gridFirstRow * uColumns;
+    size_t end = std::min(fileCount, (m_gridFirstRow + uRows) * uColumns);
+    size_t lookAhead = static_cast<size_t>(GRID_LOOKAHEAD_ROWS) * uColumns;
+    size_t keepFirst = first - std::min(first, lookAhead);
+    size_t keepEnd = std::min(fileCount, end + lookAhead);
+
+    std::vector<ThumbnailLoader::Request> requests;
+    auto want = [this, &requests](size_t item)
+    {
+        ThumbnailLoader::Request request;
+        request.item = item;
+        if (m_gridThumbnails.count(item) == 0 && m_shellNavigator.GetFilename(item, request.filename))
+        {
+            requests.push_back(std::move(request));
+        }
+    };
+
+    // The visible files first, then the rows after them, as paging down is
+    // more common, then the rows before them
+    for (size_t item = first; item < end; ++item)
+    {
+        want(item);
+    }
+    for (size_t item = end; item < keepEnd; ++item)
+    {
+        want(item);
+    }
+    for (size_t item = first; item > keepFirst; --item)
+    {
+        want(item - 1);
+    }
+    m_thumbnailLoader.Load(requests, THUMBNAIL_SIZE);
+
+    for (auto thumbnail = m_gridThumbnails.begin(); thumbnail != m_gridThumbnails.end();)
+    {
+        if (thumbnail->first < keepFirst || thumbnail->first >= keepEnd)
+        {
+            thumbnail = m_gridThumbnails.erase(thumbnail);
+        }
+        else
+        {
+            ++thumbnail;
+        }
+    }
+    InvalidateRect(m_hWnd, nullptr, FALSE);
+}
+
+void ZackApp::OnThumbnailsReady()
+{
+    std::vector<std::unique_ptr<Thumbnail>> thumbnails;
+    m_thumbnailLoader.TakeFinished(thumbnails);
+    if (!m_gridMode || !m_pHwndRT.get())
+        return;
+
+    for (const auto& thumbnail : thumbnails)
+    {
+        GridThumbnail gridThumbnail;
+        gridThumbnail.uImageWidth = thumbnail->info.imageWidth;
+        gridThumbnail.uImageHeight = thumbnail->info.imageHeight;
+        if (SUCCEEDED(m_pHwndRT->CreateBitmap(
+            D2D1::SizeU(thumbnail->info.width, thumbnail->info.height),
+            thumbnail->pixels.data(),
+            static_cast<UINT32>(thumbnail->pixels.getStride()),
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+            gridThumbnail.bitmap.get_out_storage())))
+        {
+            m_gridThumbnails[thumbnail->item] = std::move(gridThumbnail);
+        }
+    }
+    if (!thumbnails.empty())
+    {
+        InvalidateRect(m_hWnd, nullptr, FALSE);
+    }
+}
+
+HRESULT ZackApp::RenderGrid()
+{
+    TRACE_SCOPE("RenderGrid");
+    if (!m_pHwndRT.get() || (m_pHwndRT->CheckWindowState() & D2D1_WINDOW_STATE_OCCLUDED))
+        return S_OK;
+
+    UINT uColumns = 0;
+    UINT uRows = 0;
+    UINT uFullRows = 0;
+    GetGridLayout(uColumns, uRows, uFullRows);
+    size_t fileCount = m_shellNavigator.GetFileCount();
+
+    ComPtr<ID2D1SolidColorBrush> brush;
+    HRESULT hr = m_pHwndRT->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::DimGray), brush.get_out_storage());
+    if (FAILED(hr))
+        return hr;
+
+    m_pHwndRT->BeginDraw();
+    m_pHwndRT->Clear(D2D1::ColorF(D2D1::ColorF::Black));
+    for (UINT uRow = 0; uRow < uRows; ++uRow)
+    {
+        for (UINT uColumn = 0; uColumn < uColumns; ++uColumn)
+        {
+            size_t item = (m_gridFirstRow + uRow) * uColumns + uColumn;
+            if (item >= fileCount)
+                break;
+
+            D2D1_RECT_F cell = D2D1::RectF(
+                static_cast<float>(uColumn * GRID_CELL_SIZE + GRID_MARGIN),
+                static_cast<float>(uRow * GRID_CELL_SIZE + GRID_MARGIN),
+                static_cast<float>((uColumn + 1) * GRID_CELL_SIZE - GRID_MARGIN),
+                static_cast<float>((uRow + 1) * GRID_CELL_SIZE - GRID_MARGIN));
+
+            // Files whose thumbnails are not ready yet get an empty cell
+            auto thumbnail = m_gridThumbnails.find(item);
+            if (thumbnail != m_gridThumbnails.end())
+            {
+                m_pHwndRT->DrawBitmap(
+                    thumbnail->second.bitmap.get(),
+                    FitRectangle(thumbnail->second.uImageWidth, thumbnail->second.uImageHeight, cell),
+                    1.f,
+                    D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+            }
+            else
+            {
+                brush->SetColor(D2D1::ColorF(0.15f, 0.15f, 0.15f));
+                m_pHwndRT->FillRectangle(cell, brush.get());
+            }
+
+            if (item == m_gridSelection)
+            {
+                brush->SetColor(D2D1::ColorF(D2D1::ColorF::DodgerBlue));
+                m_pHwndRT->DrawRectangle(
+                    D2D1::RectF(cell.left - GRID_MARGIN / 2.f, cell.top - GRID_MARGIN / 2.f,
+                        cell.right + GRID_MARGIN / 2.f, cell.bottom + GRID_MARGIN / 2.f),
+                    brush.get(),
+                    3.f);
+            }
+        }
+    }
+
+    return m_pHwndRT->EndDraw();
+}
+
+void ZackApp::CleanDisplay()
+{
+    // The workers read the bytes of the file
+    m_decodeWorker.Stop();
+    m_pagePrefetcher.Stop();
+    KillTimer(m_hWnd, DELAY_TIMER_ID);
+    StopScheduler();
+    ReportStatistics();
+    m_prefetchedFrame.reset();
+    m_rawFrameBuffer.pixels.Release();
+    m_rawFrameBuffer.coverage.Release();
+
+    // Reset the states
+    m_uNextFrameIndex = 0;
+    uFrameDisposal = DM_NONE;  // No previous frame, use disposal none
+    m_uLoopNumber = 0;
+    m_imageInfo.Reset();
+    m_frameIndex.Reset();
+    m_frameCache.Reset(0);
+    m_checkpoints.Reset(0);
+    m_uComposedFrameIndex = 0;
+    m_composedFrameValid = false;
+
+    // The decoders read from the bytes of the file, so release them first
+    m_pDecoder.reset(nullptr);
+    m_gifDecoder.Reset();
+    m_tiffDecoder.Reset();
+    m_byteSource.Close();
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::OpenImageFile()                                       *
+*                                                                 *
+*  Creates a decoder for m_imageFile. The decoder parses the      *
+*  memory mapped bytes of the file instead of reading and         *
+*  copying the file.                                              *
+*                                                                 *
+******************************************************************/
+
+HRESULT ZackApp::OpenImageFile()
+{
+    TRACE_SCOPE("OpenImageFile");
+    ComPtr<IWICStream> stream;
+    LPWSTR filename = nullptr;
+
+    m_pDecoder.reset(nullptr);
+    m_gifDecoder.Reset();
+    m_tiffDecoder.Reset();
+    HRESULT hr = m_imageFile->GetDisplayName(SIGDN_FILESYSPATH, &filename);
+    if (FAILED(hr))
+        return hr;
+
+    ShowPreview(filename);
+    m_prefetchedFrame = m_prefetcher.Take(filename);
+
+    // IWICStream can only wrap up to 4 GB of memory. Larger files and files
+    // which cannot be read are left to WIC.
+    if (!m_byteSource.Open(filename) || m_byteSource.getSize() > MAXDWORD)
+    {
+        TRACE_SCOPE("CreateDecoder");
+        m_byteSource.Close();
+        hr = ImagingFactorySingleton::GetInstance()->CreateDecoderFromFilename(
+            filename,
+            nullptr,
+            GENERIC_READ,
+            WICDecodeMetadataCacheOnLoad,
+            m_pDecoder.get_out_storage());
+        CoTaskMemFree(filename);
+        return hr;
+    }
+    CoTaskMemFree(filename);
+
+    // Frames of GIF files are read by the GifDecoder and pages of TIFF files
+    // by the TiffDecoder. WIC still decodes the files and pages they do not
+    // support.
+    if (GifDecoder::IsGif(m_byteSource.getData(), m_byteSource.getSize()))
+    {
+        TRACE_SCOPE("OpenGif");
+        if (!m_gifDecoder.Open(m_byteSource.getData(), m_byteSource.getSize()) || m_gifDecoder.getFrameCount() == 0)
+        {
+            m_gifDecoder.Reset();
+        }
+    }
+    else if (TiffDecoder::IsTiff(m_byteSource.getData(), m_byteSource.getSize()))
+    {
+        TRACE_SCOPE("OpenTiff");
+        m_tiffDecoder.Open(m_byteSource.getData(), m_byteSource.getSize());
+    }
+
+    hr = ImagingFactorySingleton::GetInstance()->CreateStream(stream.get_out_storage());
+    if (SUCCEEDED(hr))
+    {
+        // The stream only reads from the bytes
+        hr = stream->InitializeFromMemory(
+            const_cast<BYTE*>(m_byteSource.getData()),
+            static_cast<DWORD>(m_byteSource.getSize()));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        TRACE_SCOPE("CreateDecoder");
+        hr = ImagingFactorySingleton::GetInstance()->CreateDecoderFromStream(
+            stream.get(),
+            nullptr,
+            WICDecodeMetadataCacheOnLoad,
+            m_pDecoder.get_out_storage());
+    }
+
+    if (FAILED(hr))
+    {
+        m_gifDecoder.Reset();
+        m_tiffDecoder.Reset();
+        m_byteSource.Close();
+    }
+    return hr;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::OpenThumbnailCache()                                  *
+*                                                                 *
+*  Opens the file keeping the first frames of opened files in     *
+*  the local application data folder. Without it, for example     *
+*  when another instance of the viewer uses it, nothing is        *
+*  shown before a file is decoded.                                *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::OpenThumbnailCache()
 {
-    HRESULT hr = S_OK;
-
-    switch (uFrameDisposal)
-    {
-    case DM_UNDEFINED:
-    case DM_NONE:
-        // We simply draw on the previous frames. Do nothing here.
-        break;
-    case DM_BACKGROUND:
-        // Dispose background
-        // Clear the area covered by the current raw frame with background color
-        hr = ClearCurrentFrameArea();
-        break;
-    case DM_PREVIOUS:
-        // Dispose previous
-        // We restore the previous composed frame first
-        hr = RestoreSavedFrame();
-        break;
-    default:
-        // Invalid disposal method
-        hr = E_FAIL;
-    }
+    PWSTR folder = nullptr;
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_CREATE, nullptr, &folder)))
+        return;
+    std::wstring path = folder;
+    CoTaskMemFree(folder);
+    path += L"\\";
+    path += THUMBNAIL_CACHE_NAME;
 
-    return hr;
+    CreateDirectory(path.substr(0, path.rfind(L'\\')).c_str(), nullptr);
+    m_thumbnailCache.Open(path.c_str());
 }
 
 /******************************************************************
 *                                                                 *
-*  DemoApp::OverlayNextFrame()                                    *
+*  DemoApp::ShowPreview()                                         *
 *                                                                 *
-*  Loads and draws the next raw frame into the composed frame     *
-*  render target. This is called after the current frame is       *
-*  disposed.                                                      *
+*  Draws the cached first frame of the file scaled up to the      *
+*  size of the image, before the decoder is created. It is        *
+*  replaced by the decoded first frame.                           *
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::OverlayNextFrame()
+void ZackApp::ShowPreview(const wchar_t* filename)
 {
-    // Get Frame information
-    HRESULT hr = GetRawFrame(m_uNextFrameIndex);
+    TRACE_SCOPE("ShowPreview");
+    m_thumbnailCached = false;
+    m_hasThumbnailKey = m_thumbnailCache.isOpen() && ThumbnailCache::GetKey(filename, m_thumbnailKey);
+    if (!m_hasThumbnailKey)
+        return;
+
+    ThumbnailInfo info = {};
+    FrameBuffer pixels;
+    m_thumbnailCached = m_thumbnailCache.Lookup(m_thumbnailKey, info, pixels);
+    if (!m_thumbnailCached || FAILED(CreateRenderTarget()))
+        return;
+    if ((m_pHwndRT->CheckWindowState() & D2D1_WINDOW_STATE_OCCLUDED))
+        return;
+
+    ComPtr<ID2D1Bitmap> preview;
+    HRESULT hr = m_pHwndRT->CreateBitmap(
+        D2D1::SizeU(info.width, info.height),
+        pixels.data(),
+        static_cast<UINT32>(pixels.getStride()),
+        D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+        preview.get_out_storage());
+
+    D2D1_RECT_F drawRect;
     if (SUCCEEDED(hr))
     {
-        // For disposal 3 method, we would want to save a copy of the current
-        // composed frame
-        if (uFrameDisposal == DM_PREVIOUS)
-        {
-            hr = SaveComposedFrame();
-        }
+        hr = CalculateDrawRectangle(info.imageWidth, info.imageHeight, drawRect);
     }
 
     if (SUCCEEDED(hr))
     {
-        // Start producing the next bitmap
-        m_pFrameComposeRT->BeginDraw();
-
-        // If starting a new animation loop
-        if (m_uNextFrameIndex == 0)
-        {
-            // Draw background and increase loop count
-            m_pFrameComposeRT->Clear(m_imageInfo.getBackgroundColor());
-            m_uLoopNumber++;
-        }
-
-        // Produce the next frame
-        m_pFrameComposeRT->DrawBitmap(
-            m_pRawFrame.get(),
-            m_framePosition);
-
-        hr = m_pFrameComposeRT->EndDraw();
+        m_pHwndRT->BeginDraw();
+        m_pHwndRT->Clear(D2D1::ColorF(D2D1::ColorF::Black));
+        m_pHwndRT->DrawBitmap(preview.get(), drawRect, 1.f, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+        hr = m_pHwndRT->EndDraw();
     }
 
-    // To improve performance and avoid decoding/composing this frame in the 
-    // following animation loops, the composed frame can be cached here in system 
-    // or video memory.
-    return hr;
+    // DisplayImage creates the device resources again
+    if (hr == D2DERR_RECREATE_TARGET)
+    {
+        m_pComposedFrame.reset(nullptr);
+        m_pHwndRT.reset(nullptr);
+    }
 }
 
 /******************************************************************
 *                                                                 *
-*  DemoApp::SaveComposedFrame()                                   *
+*  DemoApp::CacheThumbnail()                                      *
 *                                                                 *
-*  Saves the current composed frame in the bitmap render target   *
-*  into a temporary bitmap. Initializes the temporary bitmap if   *
-*  needed.                                                        *
+*  Keeps the composed first frame of the displayed file scaled    *
+*  down in the thumbnail cache, unless it is cached already.      *
 *                                                                 *
 ******************************************************************/
 
-HRESULT ZackApp::SaveComposedFrame()
+void ZackApp::CacheThumbnail()
+{
+    if (!m_hasThumbnailKey || m_thumbnailCached || m_compositor.getWidth() == 0 || m_compositor.getHeight() == 0)
+        return;
+
+    TRACE_SCOPE("CacheThumbnail");
+    ThumbnailInfo info = {};
+    info.imageWidth = m_imageInfo.getImageWidthPixel();
+    info.imageHeight = m_imageInfo.getImageHeightPixel();
+    info.frameCount = m_imageInfo.getFrameCount();
+    info.loopCount = m_imageInfo.getTotalLoopCount();
+    info.backgroundColor = ToCanvasColor(m_imageInfo.getBackgroundColor());
+    ThumbnailCache::GetThumbnailSize(
+        m_compositor.getWidth(),
+        m_compositor.getHeight(),
+        THUMBNAIL_SIZE,
+        info.width,
+        info.height);
+    m_thumbnailCached = m_thumbnailCache.Insert(
+        m_thumbnailKey,
+        info,
+        m_compositor.getPixels(),
+        m_compositor.getStride(),
+        m_compositor.getWidth(),
+        m_compositor.getHeight());
+}
+
+HRESULT ZackApp::DisplayImage()
 {
     HRESULT hr = S_OK;
-    ComPtr<ID2D1Bitmap> pFrameToBeSaved;
-    hr = m_pFrameComposeRT->GetBitmap(pFrameToBeSaved.get_out_storage());
-    if (SUCCEEDED(hr))
+
+    // TIFF files have no animation metadata, so the pages are found by
+    // following the directory chain instead of querying every WIC frame.
+    // Only the second page is looked up here, the pages after it are
+    // indexed when they are shown, see IndexPages.
+    TiffPage firstPage;
+    if (m_tiffDecoder.isOpen() && m_tiffDecoder.ReadPage(0, firstPage))
     {
-        // Create the temporary bitmap if it hasn't been created yet 
-        if (m_pSavedFrame.get() == nullptr)
+        TRACE_SCOPE("BuildFrameIndex");
+        m_imageInfo.SetPageMetadata(firstPage.width, firstPage.height, m_tiffDecoder.IndexPages(2));
+        m_frameIndex.BuildPages(m_imageInfo);
+        if (m_imageInfo.getFrameCount() > 1)
         {
-            auto bitmapSize = pFrameToBeSaved->GetPixelSize();
-            D2D1_BITMAP_PROPERTIES bitmapProp;
-            pFrameToBeSaved->GetDpi(&bitmapProp.dpiX, &bitmapProp.dpiY);
-            bitmapProp.pixelFormat = pFrameToBeSaved->GetPixelFormat();
-
-            hr = m_pFrameComposeRT->CreateBitmap(
-                bitmapSize,
-                bitmapProp,
-                m_pSavedFrame.get_out_storage());
+            m_pagePrefetcher.Start(m_byteSource.getData(), m_byteSource.getSize());
         }
+        UpdateCaption();
     }
-    if (SUCCEEDED(hr))
+    else if (m_gifDecoder.isOpen())
     {
-        // Copy the whole bitmap
-        hr = m_pSavedFrame->CopyFromBitmap(nullptr, pFrameToBeSaved.get(), nullptr);
+        // The GifDecoder read the descriptors of all frames when the file
+        // was opened
+        TRACE_SCOPE("BuildFrameIndex");
+        m_imageInfo.SetGifMetadata(m_gifDecoder);
+        m_frameIndex.BuildGif(m_gifDecoder, m_imageInfo);
     }
-    return hr;
-}
-
+    else
+    {
+        {
+            TRACE_SCOPE("GetGlobalMetadata");
+            if (FAILED(m_imageInfo.GetGlobalMetadata(m_pDecoder.get())))
+            {
+                hr = m_imageInfo.GetDefaultMetadata(m_pDecoder.get());
+                if (FAILED(hr))
+                    return hr;
+            }
+        }
 
-void ZackApp::UpdateCaption()
-{
-    LPWSTR displayName = nullptr;
-    if (SUCCEEDED(m_imageFile->GetDisplayName(SIGDN_NORMALDISPLAY, &displayName))) {
-        WCHAR newCaption[MAX_PATH] = {};
-        swprintf_s(newCaption, L"Zack Viewer (\"%s\")", displayName);
-        CoTaskMemFree(displayName);
-        SetWindowText(m_hWnd, newCaption);
+        // Without the frame index all frames are shown as pages covering the
+        // whole image
+        {
+            TRACE_SCOPE("BuildFrameIndex");
+            m_frameIndex.Build(m_pDecoder.get(), m_imageInfo);
+        }
     }
-}
-
-void ZackApp::CleanDisplay()
-{
-    // Reset the states
-    m_uNextFrameIndex = 0;
-    uFrameDisposal = DM_NONE;  // No previous frame, use disposal none
-    m_uLoopNumber = 0;
-    m_imageInfo.Reset();
-    m_pSavedFrame.reset(nullptr);
-
-    // Create a decoder for the gif file
-    m_pDecoder.reset(nullptr);
-}
-
-HRESULT ZackApp::DisplayImage()
-{
-    HRESULT hr = S_OK;
 
-    if (FAILED(m_imageInfo.GetGlobalMetadata(m_pDecoder.get())))
+    // Animations are played in order, so the worker continues with the
+    // second frame while the first one is decoded right away
+    if (DECODE_AHEAD && m_imageInfo.getFrameCount() > 1 && m_frameIndex.getFrame(0).delay > 0 &&
+        m_byteSource.getData() != nullptr)
     {
-        hr = m_imageInfo.GetDefaultMetadata(m_pDecoder.get());
-        if (FAILED(hr))
-            return hr;
+        m_decodeWorker.Start(m_byteSource.getData(), m_byteSource.getSize(), m_imageInfo.getFrameCount(), 1);
     }
 
     RECT rcClient = {};
@@ -1185,10 +2271,49 @@ HRESULT ZackApp::DisplayImage()
             return hr;
     }
 
+    // A single frame covering the image is decoded no larger than the screen
+    m_uDecodeWidth = m_imageInfo.getImageWidth();
+    m_uDecodeHeight = m_imageInfo.getImageHeight();
+    const FrameInfo& firstFrame = m_frameIndex.getFrame(0);
+    if (SCALED_DECODE && m_imageInfo.getFrameCount() == 1 &&
+        firstFrame.left == 0 && firstFrame.top == 0 &&
+        firstFrame.width == m_uDecodeWidth && firstFrame.height == m_uDecodeHeight)
+    {
+        UINT uMaxWidth = 0;
+        UINT uMaxHeight = 0;
+        GetDecodeLimit(uMaxWidth, uMaxHeight);
+        ScaledDecoder::GetFitSize(
+            m_imageInfo.getImageWidth(),
+            m_imageInfo.getImageHeight(),
+            uMaxWidth,
+            uMaxHeight,
+            m_uDecodeWidth,
+            m_uDecodeHeight);
+    }
+
+    m_compositor.Reset(m_uDecodeWidth, m_uDecodeHeight);
     hr = CreateDeviceResources();
     if (FAILED(hr))
         return hr;
 
+    m_frameCache.Reset(m_imageInfo.getFrameCount());
+    m_checkpoints.Reset(m_imageInfo.getFrameCount());
+
+    // Space the checkpoints so that all of them fit into the budget
+    m_uCheckpointInterval = CHECKPOINT_INTERVAL;
+    size_t frameBytes = static_cast<size_t>(m_imageInfo.getImageWidth()) * m_imageInfo.getImageHeight() * 4;
+    if (frameBytes > 0)
+    {
+        size_t maxCheckpoints = CHECKPOINT_BUDGET / frameBytes;
+        if (maxCheckpoints == 0)
+        {
+            m_uCheckpointInterval = UINT_MAX;
+        }
+        else if (m_imageInfo.getFrameCount() / maxCheckpoints >= CHECKPOINT_INTERVAL)
+        {
+            m_uCheckpointInterval = static_cast<unsigned int>(m_imageInfo.getFrameCount() / maxCheckpoints) + 1;
+        }
+    }
 
     // If we have at least one frame, start playing
     // the animation from the first frame
@@ -1196,8 +2321,17 @@ HRESULT ZackApp::DisplayImage()
     {
         hr = ComposeNextFrame();
         InvalidateRect(m_hWnd, nullptr, FALSE);
+        RecordFrameJitter();
+        if (SUCCEEDED(hr))
+        {
+            CacheThumbnail();
+        }
     }
 
+    // The displayed file is decoded, so the worker can use the time until
+    // the next file is selected
+    UpdatePrefetch();
+
     return hr;
 }
 
@@ -1209,25 +2343,15 @@ HRESULT ZackApp::SelectAndDisplayFile()
     if (SelectImageFile(m_imageFile.get_out_storage()))
     {
 
+        ShowGrid(false);
         UpdateCaption();
-        m_shellNavigator.Reset(m_imageFile.get());
+        m_shellNavigator.Reset(m_imageFile.get(), m_hWnd, WM_NAVIGATOR_UPDATED);
+        m_thumbnailLoader.Reset(m_hWnd, WM_THUMBNAILS_READY);
         CleanDisplay();
 
-        {
-            LPWSTR filename = nullptr;
-            m_imageFile->GetDisplayName(SIGDN_FILESYSPATH, &filename);
-            if (FAILED(hr))
-                return hr;
-            hr = ImagingFactorySingleton::GetInstance()->CreateDecoderFromFilename(
-                filename,
-                nullptr,
-                GENERIC_READ,
-                WICDecodeMetadataCacheOnLoad,
-                m_pDecoder.get_out_storage());
-            CoTaskMemFree(filename);
-            if (FAILED(hr))
-                return hr;
-        }
+        hr = OpenImageFile();
+        if (FAILED(hr))
+            return hr;
 
         hr = DisplayImage();
     }
@@ -1236,78 +2360,48 @@ HRESULT ZackApp::SelectAndDisplayFile()
 }
 
 HRESULT ZackApp::SelectAndSaveFile() {
-    if (m_pDecoder.get() == nullptr)
+    // One file is saved at a time
+    if (m_pDecoder.get() == nullptr || m_fileSaver.isRunning())
         return S_FALSE;
 
-    HRESULT hr = S_OK;
+    LPWSTR sourceFilename = nullptr;
+    HRESULT hr = m_imageFile->GetDisplayName(SIGDN_FILESYSPATH, &sourceFilename);
+    if (FAILED(hr))
+        return hr;
+    std::wstring source = sourceFilename;
+    CoTaskMemFree(sourceFilename);
 
     WCHAR szFileName[MAX_PATH];
     GUID containerformat = { 0 };
     // If the user cancels selection, then nothing happens
     if (GetFileSave(szFileName, ARRAYSIZE(szFileName), containerformat))
     {
-        ComPtr<IWICBitmapEncoder> encoder;
-        ComPtr<IWICStream> stream;
-        ComPtr<IWICBitmapFrameEncode> frameEncode;
-        ComPtr<IWICBitmapFrameDecode> frameDecode;
-        ComPtr<IWICMetadataBlockWriter> blockWriter;
-        ComPtr<IWICMetadataBlockReader> blockReader;
-
-        hr = ImagingFactorySingleton::GetInstance()->CreateStream(stream.get_out_storage());
-        if (FAILED(hr))
-            return hr;
-
-        hr = stream->InitializeFromFilename(szFileName, GENERIC_WRITE);
-        if (FAILED(hr))
-            return hr;
-
-        hr = ImagingFactorySingleton::GetInstance()->CreateEncoder(containerformat, nullptr, encoder.get_out_storage());
-        if (FAILED(hr))
-            return hr;
-
-        hr = encoder->Initialize(stream.get(), WICBitmapEncoderNoCache);
-        if (FAILED(hr))
-            return hr;
-
-        hr = encoder->CreateNewFrame(frameEncode.get_out_storage(), nullptr);
-        if (FAILED(hr))
-            return hr;
-
-        hr = frameEncode->Initialize(nullptr);
-        if (FAILED(hr))
-            return hr;
-
-        UINT frameCount = 0;
-        hr = m_pDecoder->GetFrameCount(&frameCount);
-        if (FAILED(hr))
-            return hr;
-        for (UINT i = 0; i < frameCount; ++i) {
-            hr = m_pDecoder->GetFrame(i, frameDecode.get_out_storage());
-            if (FAILED(hr))
-                return hr;
-
-            if (SUCCEEDED(frameDecode->QueryInterface(blockReader.get_out_storage())) &&
-                SUCCEEDED(frameEncode->QueryInterface(blockWriter.get_out_storage())))
-            {
-                blockWriter->InitializeFromBlockReader(blockReader.get());
-            }
-
-            hr = frameEncode->WriteSource(frameDecode.get(), nullptr);
-            if (FAILED(hr))
-                return hr;
-
-            hr = frameEncode->Commit();
-            if (FAILED(hr))
-                return hr;
+        // The file is read while it is saved
+        if (_wcsicmp(source.c_str(), szFileName) == 0)
+        {
+            MessageBox(m_hWnd, L"A file cannot be saved over itself.", L"Error", MB_OK);
+            return S_FALSE;
         }
 
-        hr = encoder->Commit();
-        if (FAILED(hr))
-            return hr;
+        // The pages are decoded and encoded by the saver's workers, so the
+        // window stays responsive
+        m_fileSaver.SetDithering(GIF_DITHERING);
+        m_fileSaver.Start(source, szFileName, containerformat, m_hWnd, WM_SAVE_PROGRESS, WM_SAVE_FINISHED);
+        UpdateCaption();
     }
     return hr;
 }
 
+void ZackApp::OnSaveFinished(HRESULT hr)
+{
+    m_fileSaver.Stop();
+    UpdateCaption();
+    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_CANCELLED))
+    {
+        MessageBox(m_hWnd, L"The file could not be saved.", L"Error", MB_OK);
+    }
+}
+
 /******************************************************************
 *                                                                 *
 *  DemoApp::ComposeNextFrame()                                    *
@@ -1322,10 +2416,11 @@ HRESULT ZackApp::SelectAndSaveFile() {
 
 HRESULT ZackApp::ComposeNextFrame()
 {
+    TRACE_SCOPE("ComposeNextFrame");
     HRESULT hr = S_OK;
 
-    // Check to see if the render targets are initialized
-    if (m_pHwndRT.get() && m_pFrameComposeRT.get())
+    // Check to see if the render target and the bitmap are initialized
+    if (m_pHwndRT.get() && m_pComposedFrame.get())
     {
         // First, kill the timer since the delay is no longer valid
         KillTimer(m_hWnd, DELAY_TIMER_ID);
@@ -1337,19 +2432,229 @@ HRESULT ZackApp::ComposeNextFrame()
             hr = OverlayNextFrame();
         }
 
-        // If we have more frames to play, set the timer according to the delay.
-        // Set the timer regardless of whether we succeeded in composing a frame
-        // to try our best to continue displaying the animation.
-        if (!EndOfAnimation() && m_imageInfo.getFrameCount() > 1 && uFrameDelay > 0)
+        // Frames which would be replaced before they could be seen are
+        // composed but not shown. At most one loop is dropped at a time, so
+        // that the window stays responsive.
+        for (unsigned int uDropped = 0;
+            SUCCEEDED(hr) && uDropped < m_imageInfo.getFrameCount() &&
+            m_scheduler.isRunning() && CanAdvance() && m_scheduler.ShouldDrop(uFrameDelay);
+            ++uDropped)
+        {
+            m_scheduler.Drop(uFrameDelay);
+            m_uNextFrameIndex = (m_uNextFrameIndex + 1) % m_imageInfo.getFrameCount();
+            hr = DisposeCurrentFrame();
+            if (SUCCEEDED(hr))
+            {
+                hr = OverlayNextFrame();
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = UploadComposedFrame();
+        }
+
+        ScheduleNextFrame();
+    }
+
+    return hr;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ScheduleNextFrame()                                   *
+*                                                                 *
+*  If there are more frames to play, advances to the next frame   *
+*  and sets a timer that expires at the deadline of the frame.    *
+*  The deadlines are counted from the start of the animation, so  *
+*  the time spent composing does not delay the animation. A       *
+*  cached next frame is decompressed while waiting for it.        *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::ScheduleNextFrame()
+{
+    // If we have more frames to play, set the timer according to the delay.
+    // Set the timer regardless of whether we succeeded in composing a frame
+    // to try our best to continue displaying the animation.
+    if (CanAdvance())
+    {
+        // Increase the frame index by 1
+        m_uNextFrameIndex = (++m_uNextFrameIndex) % m_imageInfo.getFrameCount();
+
+        // The frame composed now is shown from now on. The default timer
+        // resolution of about 15.6 ms would make short delays much longer.
+        if (!m_scheduler.isRunning())
+        {
+            timeBeginPeriod(TIMER_RESOLUTION);
+            m_scheduler.Start();
+        }
+        m_scheduler.Advance(uFrameDelay);
+
+        // Set the timer according to the deadline
+        SetTimer(m_hWnd, DELAY_TIMER_ID, m_scheduler.getWaitMs(), nullptr);
+
+        // Decompress the next frame while the composed frame is shown, only
+        // the area it changes if it follows the composed frame
+        FrameCache::Entry* pCachedFrame = m_frameCache.Find(m_uNextFrameIndex);
+        if (pCachedFrame)
+        {
+            bool composedInOrder = (m_uNextFrameIndex == 0) ||
+                (m_composedFrameValid && m_uComposedFrameIndex + 1 == m_uNextFrameIndex);
+            m_frameCache.Prefetch(
+                m_uNextFrameIndex,
+                composedInOrder ? pCachedFrame->changedRect : m_compositor.getBounds());
+        }
+    }
+    else
+    {
+        StopScheduler();
+    }
+}
+
+void ZackApp::StopScheduler()
+{
+    if (m_scheduler.isRunning())
+    {
+        m_scheduler.Stop();
+        timeEndPeriod(TIMER_RESOLUTION);
+    }
+}
+
+bool ZackApp::CanAdvance() const
+{
+    return !EndOfAnimation() && m_imageInfo.getFrameCount() > 1 && uFrameDelay > 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::IndexPages()                                          *
+*                                                                 *
+*  Indexes the pages of a TIFF up to the given number of pages,   *
+*  so that the pages found are shown like the pages known when    *
+*  the file was opened.                                           *
+*                                                                 *
+******************************************************************/
+
+void ZackApp::IndexPages(UINT uPageCount)
+{
+    if (!m_tiffDecoder.isOpen() || m_tiffDecoder.isIndexed() || m_imageInfo.getFrameCount() >= uPageCount)
+        return;
+
+    TRACE_SCOPE("IndexPages");
+    UINT uFrameCount = m_tiffDecoder.IndexPages(uPageCount);
+    if (uFrameCount > m_imageInfo.getFrameCount())
+    {
+        m_imageInfo.m_frameCount = uFrameCount;
+        m_frameIndex.BuildPages(m_imageInfo);
+        m_frameCache.Grow(uFrameCount);
+        m_checkpoints.Grow(uFrameCount);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::SeekToFrame()                                         *
+*                                                                 *
+*  Composes the given frame. Composing starts at the closest      *
+*  frame before it which is composed or cached, which has a       *
+*  checkpoint of the image it is drawn on, or which is a key      *
+*  frame, so that the result is the same as when all frames had   *
+*  been composed from the first frame. Animations continue to     *
+*  play from the given frame.                                     *
+*                                                                 *
+******************************************************************/
+
+HRESULT ZackApp::SeekToFrame(UINT uFrameIndex)
+{
+    TRACE_SCOPE("SeekToFrame");
+    HRESULT hr = S_OK;
+
+    // Check to see if the render target and the bitmap are initialized
+    if (!m_pHwndRT.get() || !m_pComposedFrame.get())
+        return hr;
+
+    KillTimer(m_hWnd, DELAY_TIMER_ID);
+    StopScheduler();
+    m_uShownFrameDelay = 0;
+
+    // Search backwards for the frame to start composing at. Frame 0 is
+    // always a key frame.
+    UINT uStartIndex = uFrameIndex;
+    FrameCache::Entry* pStart = nullptr;
+    bool startComposed = false;     // Whether uStartIndex is composed, or only the image it is drawn on
+    for (;; --uStartIndex)
+    {
+        if (m_composedFrameValid && m_uComposedFrameIndex == uStartIndex)
+        {
+            startComposed = true;
+            break;
+        }
+
+        // Disposing a cached frame with disposal 3 method would need the
+        // image the cached frame was drawn on
+        pStart = m_frameCache.Find(uStartIndex);
+        if (pStart && pStart->frameDisposal != DM_PREVIOUS)
+        {
+            startComposed = true;
+            break;
+        }
+
+        pStart = m_checkpoints.Find(uStartIndex);
+        if (pStart || m_frameIndex.isKeyFrame(uStartIndex))
+            break;
+    }
+
+    UINT uNextIndex = uStartIndex + 1;
+    if (startComposed)
+    {
+        if (pStart)
+        {
+            m_uNextFrameIndex = uStartIndex;
+            hr = OverlayCachedFrame(*pStart);
+        }
+    }
+    else
+    {
+        // Prepare the image the start frame is drawn on
+        const uint8_t* pixels = pStart ? m_checkpoints.GetPixels(uStartIndex, m_compositor.getBounds()) : nullptr;
+        if (pixels)
+        {
+            m_compositor.Copy(pixels, m_compositor.getStride(), m_compositor.getBounds());
+        }
+        else if (uStartIndex > 0)
+        {
+            m_compositor.Clear(ToCanvasColor(m_imageInfo.getBackgroundColor()));
+        }
+
+        if (SUCCEEDED(hr))
         {
-            // Increase the frame index by 1
-            m_uNextFrameIndex = (++m_uNextFrameIndex) % m_imageInfo.getFrameCount();
+            // The image now is the one after disposing the frame before
+            m_uComposedFrameIndex = uStartIndex - 1;
+            m_composedFrameValid = true;
+            m_uNextFrameIndex = uStartIndex;
+            hr = OverlayNextFrame();
+        }
+    }
 
-            // Set the timer according to the delay
-            SetTimer(m_hWnd, DELAY_TIMER_ID, uFrameDelay, nullptr);
+    for (UINT i = uNextIndex; SUCCEEDED(hr) && i <= uFrameIndex; ++i)
+    {
+        m_uNextFrameIndex = i;
+        hr = DisposeCurrentFrame();
+        if (SUCCEEDED(hr))
+        {
+            hr = OverlayNextFrame();
         }
     }
 
+    if (SUCCEEDED(hr))
+    {
+        hr = UploadComposedFrame();
+    }
+
+    m_uNextFrameIndex = uFrameIndex;
+    ScheduleNextFrame();
+
     return hr;
 }
 
@@ -1357,31 +2662,30 @@ HRESULT ZackApp::ComposeNextFrame()
 *                                                                 *
 *  DemoApp::RecoverDeviceResources                                *
 *                                                                 *
-*  Discards device-specific resources and recreates them.         *
-*  Also starts the animation from the beginning.                  *
+*  Discards device-specific resources and recreates them. The     *
+*  frames are composed in memory, so the animation continues      *
+*  after the composed frame is uploaded again.                    *
 *                                                                 *
 ******************************************************************/
 
 HRESULT ZackApp::RecoverDeviceResources()
 {
+    // The thumbnails are built again, most of them from the cache
+    m_gridThumbnails.clear();
+    m_thumbnailLoader.Load(std::vector<ThumbnailLoader::Request>(), THUMBNAIL_SIZE);
     m_pHwndRT.reset(nullptr);
-    m_pFrameComposeRT.reset(nullptr);
-    m_pSavedFrame.reset(nullptr);
-
-    m_uNextFrameIndex = 0;
-    uFrameDisposal = DM_NONE;  // No previous frames. Use disposal none.
-    m_uLoopNumber = 0;
+    m_pComposedFrame.reset(nullptr);
 
     HRESULT hr = CreateDeviceResources();
     if (SUCCEEDED(hr))
     {
-        if (m_imageInfo.getFrameCount() > 0)
-        {
-            // Load the first frame
-            hr = ComposeNextFrame();
-            InvalidateRect(m_hWnd, nullptr, FALSE);
-        }
+        hr = UploadComposedFrame();
+        InvalidateRect(m_hWnd, nullptr, FALSE);
+    }
+    if (m_gridMode)
+    {
+        UpdateGrid();
     }
 
     return hr;
-}
\ No newline at end of file
+}
@@ -8,20 +8,53 @@
 
 #pragma once
 
+#include <chrono>
+#include <unordered_map>
 #include "resource.h"
 #include "ComPtr.h"
+#include "ByteSource.h"
 #include "ImageInfo.h"
+#include "FrameIndex.h"
+#include "FrameCache.h"
+#include "FrameCompositor.h"
+#include "FrameDecodeWorker.h"
+#include "FrameScheduler.h"
+#include "FilePrefetcher.h"
+#include "FileSaver.h"
+#include "GifDecoder.h"
+#include "LatencyStats.h"
 #include "ShellNavigator.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailLoader.h"
+#include "TiffDecoder.h"
+#include "TiffPagePrefetcher.h"
+#include "WorkerPool.h"
 
 const float DEFAULT_DPI = 96.f;   // Default DPI that maps image resolution directly to screen resoltuion
-
-enum DISPOSAL_METHODS
-{
-    DM_UNDEFINED = 0,
-    DM_NONE = 1,
-    DM_BACKGROUND = 2,
-    DM_PREVIOUS = 3
-};
+const size_t FRAME_BUFFER_BUDGET = 768 * 1024 * 1024;  // Memory in bytes used by all frame buffers, the caches stop growing beyond it
+const size_t FRAME_CACHE_BUDGET = 256 * 1024 * 1024;   // Memory in bytes used by the compressed composed animation frames
+const size_t CHECKPOINT_BUDGET = 64 * 1024 * 1024;     // Memory in bytes used for seek checkpoints
+const unsigned int CHECKPOINT_INTERVAL = 16;           // Frames between seek checkpoints if the budget allows
+const bool DECODE_AHEAD = true;                        // Decode the next animation frames on a worker thread
+const unsigned int PREFETCH_DEPTH = 2;                 // Files before and after the displayed file whose first frame is prefetched
+const size_t PREFETCH_BUDGET = 128 * 1024 * 1024;      // Memory in bytes used by prefetched first frames
+const bool SCALED_DECODE = true;                       // Decode single frame images larger than the screen at screen size
+const unsigned int TIFF_PREFETCH_PAGES = 1;            // TIFF pages before and after the displayed page which are decoded speculatively
+const bool GIF_DITHERING = false;                      // Ordered dithering of animations saved as GIF, smoother gradients but larger files
+const uint64_t THUMBNAIL_CACHE_BUDGET = 64 * 1024 * 1024;  // Size in bytes of the file keeping the first frames of opened files between runs
+const unsigned int THUMBNAIL_SIZE = 256;               // Longest side in pixels of the cached first frames shown while a file is decoded
+const unsigned int GRID_CELL_SIZE = 176;               // Size in pixels of the cells of the grid view
+const unsigned int GRID_MARGIN = 8;                    // Space in pixels around the thumbnails in the cells
+const unsigned int GRID_LOOKAHEAD_ROWS = 3;            // Rows before and after the visible rows whose thumbnails are built after the visible ones
+const UINT WM_NAVIGATOR_UPDATED = WM_APP + 1;          // Posted by the ShellNavigator when it found more files
+const UINT WM_SAVE_PROGRESS = WM_APP + 2;              // Posted by the FileSaver when it saved more pages
+const UINT WM_SAVE_FINISHED = WM_APP + 3;              // Posted by the FileSaver when it is done, with the HRESULT as wParam
+const UINT WM_THUMBNAILS_READY = WM_APP + 4;           // Posted by the ThumbnailLoader when thumbnails of the grid view are ready
+const CATCH_UP_POLICIES CATCH_UP_POLICY = CP_DROP;     // How animations catch up when frames are late
+const unsigned int CATCH_UP_TOLERANCE = 50;            // Lateness in ms made up by shorter delays instead of the catch-up policy
+const UINT TIMER_RESOLUTION = 1;                       // System timer resolution in ms requested while animations play
+const wchar_t TRACE_FILE_NAME[] = L"ZackViewer.trace.json";  // Chrome trace written to the temporary folder when tracing stops
+const wchar_t THUMBNAIL_CACHE_NAME[] = L"ZackViewer\\Thumbnails.cache";  // Thumbnail cache in the local application data folder
 
 
 class ZackApp
@@ -33,12 +66,17 @@ public:
 
     HRESULT Initialize(HINSTANCE hInstance);
 
+    // Converts files without a window, for "--convert" on the command line.
+    // Returns the exit code of the process.
+    static int RunBatchConversion(int argc, const wchar_t* const* argv);
+
 private:
 
     // No copy and assign.
     ZackApp(const ZackApp&) = delete;
     void operator=(const ZackApp&) = delete;
 
+    HRESULT CreateRenderTarget();
     HRESULT CreateDeviceResources();
     HRESULT RecoverDeviceResources();
 
@@ -49,25 +87,52 @@ private:
     bool	GetFileSave(WCHAR * pszFileName, DWORD cchFileName, GUID& containerformat) const;
     HRESULT SelectAndDisplayFile();
     HRESULT SelectAndSaveFile();
+    HRESULT OpenImageFile();
+    void    OpenThumbnailCache();
+    void    ShowPreview(const wchar_t* filename);
+    void    CacheThumbnail();
 
     HRESULT GetRawFrame(UINT uFrameIndex);
+    HRESULT UploadComposedFrame();
+    void    GetDecodeLimit(UINT& uMaxWidth, UINT& uMaxHeight) const;
 
     HRESULT ComposeNextFrame();
+    void    ScheduleNextFrame();
+    void    StopScheduler();
+    bool    CanAdvance() const;
+    HRESULT SeekToFrame(UINT uFrameIndex);
     HRESULT DisposeCurrentFrame();
     HRESULT OverlayNextFrame();
+    HRESULT OverlayCachedFrame(FrameCache::Entry& cachedFrame);
+    HRESULT ResizeComposedFrame(UINT uWidth, UINT uHeight);
 
-    HRESULT SaveComposedFrame();
     void UpdateCaption();
+    void RecordFrameJitter();
+    void ReportStatistics();
+    void UpdatePrefetch();
+    void ToggleTracing();
+    void OnSaveFinished(HRESULT hr);
     void CleanDisplay();
     HRESULT DisplayImage();
-    HRESULT RestoreSavedFrame();
-    HRESULT ClearCurrentFrameArea();
+
+    void IndexPages(UINT uPageCount);
 
     bool IsLastFrame() const;
 
     bool EndOfAnimation() const;
 
-    HRESULT CalculateDrawRectangle(D2D1_RECT_F &drawRect) const;
+    HRESULT CalculateDrawRectangle(UINT uImageWidth, UINT uImageHeight, D2D1_RECT_F &drawRect) const;
+
+    void    ShowGrid(bool show);
+    bool    OnGridKey(WPARAM key);
+    void    GetGridLayout(UINT& uColumns, UINT& uRows, UINT& uFullRows) const;
+    void    MoveGridSelection(ptrdiff_t offset);
+    void    ScrollGrid(ptrdiff_t rows);
+    void    SelectGridCell(int x, int y);
+    void    OpenGridSelection();
+    void    UpdateGrid();
+    void    OnThumbnailsReady();
+    HRESULT RenderGrid();
            
     LRESULT WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
     static LRESULT CALLBACK s_WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
@@ -83,20 +148,61 @@ private:
 
     ComPtr<ID2D1Factory>             m_pD2DFactory;
     ComPtr<ID2D1HwndRenderTarget>    m_pHwndRT;
-    ComPtr<ID2D1BitmapRenderTarget>  m_pFrameComposeRT;
-    ComPtr<ID2D1Bitmap>              m_pRawFrame;
-    ComPtr<ID2D1Bitmap>              m_pSavedFrame;          // The temporary bitmap used for disposal 3 method
+    ComPtr<ID2D1Bitmap>              m_pComposedFrame;       // The composed frame uploaded for display
     ComPtr<IWICBitmapDecoder>        m_pDecoder;
+    ByteSource                       m_byteSource;           // The bytes of the file read by m_pDecoder
+    GifDecoder                       m_gifDecoder;           // Decodes the frames of GIF files in m_byteSource without WIC
+    TiffDecoder                      m_tiffDecoder;          // Decodes the pages of TIFF files in m_byteSource without WIC
+    WorkerPool                       m_workerPool;           // Decodes the strips and tiles of TIFF pages in parallel
+    TiffPagePrefetcher               m_pagePrefetcher;
+    FrameDecodeWorker                m_decodeWorker;
+    FilePrefetcher                   m_prefetcher;
+    std::shared_ptr<DecodedFrame>    m_prefetchedFrame;      // The first frame of the opened file if it was prefetched
+    ThumbnailCache                   m_thumbnailCache;
+    ThumbnailKey                     m_thumbnailKey;         // Key of the opened file in m_thumbnailCache
+    bool                             m_hasThumbnailKey;
+    bool                             m_thumbnailCached;      // Whether m_thumbnailCache has the first frame of the opened file
+    ThumbnailLoader                  m_thumbnailLoader;      // Builds the thumbnails of the grid view
+    DecodedFrame                     m_rawFrameBuffer;       // Pixels of frames decoded on the UI thread
     ComPtr<IShellItem>               m_imageFile;
 
     DISPOSAL_METHODS uFrameDisposal;
     unsigned int     uFrameDelay;
 
     ShellNavigator  m_shellNavigator;
+    FileSaver       m_fileSaver;
     ImageInfo       m_imageInfo;
+    FrameIndex      m_frameIndex;
+    FrameCompositor m_compositor;       // Composes the frames in memory
+    PixelRect       m_uploadRect;       // Area of m_pComposedFrame which differs from the composed frame
+    FrameCache      m_frameCache;
+    FrameCache      m_checkpoints;      // The images frames are drawn on, kept every m_uCheckpointInterval frames
+    unsigned int    m_uCheckpointInterval;
+    UINT            m_uDecodeWidth;     // Size of the composed frames, smaller than the image if it is decoded scaled
+    UINT            m_uDecodeHeight;
     unsigned int    m_uLoopNumber;      // The current animation loop number (e.g. 1 when the animation is first played)
     unsigned int    m_uNextFrameIndex;
-    D2D1_RECT_F     m_framePosition;
+    PixelRect       m_framePosition;
+    unsigned int    m_uComposedFrameIndex;  // The frame index currently composed in m_compositor
+    bool            m_composedFrameValid;   // Whether all frames before m_uComposedFrameIndex were composed in order
+
+    FrameScheduler                        m_scheduler;          // Deadlines of the animation frames
+    LatencyStats                          m_frameJitter;        // Difference between shown time and delay of animation frames in ms
+    std::chrono::steady_clock::time_point m_lastFrameTime;
+    unsigned int                          m_uShownFrameDelay;   // Delay of the frame shown since m_lastFrameTime, 0 if not animating
+
+    // A thumbnail of the grid view, drawn with the aspect ratio of the image
+    struct GridThumbnail
+    {
+        ComPtr<ID2D1Bitmap> bitmap;
+        UINT                uImageWidth;
+        UINT                uImageHeight;
+    };
+
+    bool                                      m_gridMode;       // Whether the grid view is shown instead of the image
+    size_t                                    m_gridSelection;  // Index of the selected file in m_shellNavigator
+    size_t                                    m_gridFirstRow;   // First visible row
+    std::unordered_map<size_t, GridThumbnail> m_gridThumbnails; // Of the visible files and the files around them, by index
 
 };
 
@@ -0,0 +1,405 @@
+#include "ZlibInflater.h"
+#include <cstring>
+
+namespace {
+
+const unsigned int MAX_BITS = 15;
+const unsigned int FAST_BITS = 10;     // Codes up to this length are decoded with one lookup
+
+// Reads the bits of a deflate stream, least significant bit first. Reading
+// past the end returns zero bits and marks the stream as truncated.
+class BitReader
+{
+public:
+    BitReader(const uint8_t* data, size_t size) :
+        m_data(data),
+        m_end(data + size),
+        m_bits(0),
+        m_count(0),
+        m_overrunBits(0),
+        m_overrun(false)
+    {
+    }
+
+    void Refill()
+    {
+        while (m_count <= 56)
+        {
+            if (m_data < m_end)
+            {
+                m_bits |= static_cast<uint64_t>(*m_data++) << m_count;
+            }
+            else
+            {
+                // Zero bits count as read past the end once they are used
+                m_overrunBits += 8;
+            }
+            m_count += 8;
+        }
+    }
+
+    unsigned int Peek(unsigned int count)
+    {
+        if (m_count < count)
+            Refill();
+        return static_cast<unsigned int>(m_bits & ((1ull << count) - 1));
+    }
+
+    void Consume(unsigned int count)
+    {
+        m_bits >>= count;
+        m_count -= count;
+        if (m_overrunBits > m_count)
+        {
+            m_overrun = true;
+        }
+    }
+
+    unsigned int Read(unsigned int count)
+    {
+        unsigned int value = Peek(count);
+        Consume(count);
+        return value;
+    }
+
+    // Drops the bits up to the next byte boundary
+    void AlignToByte()
+    {
+        Consume(m_count % 8);
+    }
+
+    bool isOverrun() const { return m_overrun; }
+
+private:
+    const uint8_t* m_data;
+    const uint8_t* m_end;
+    uint64_t       m_bits;
+    unsigned int   m_count;
+    unsigned int   m_overrunBits;       // Zero bits added past the end, at the top of m_bits
+    bool           m_overrun;
+};
+
+// Canonical Huffman code as described in RFC 1951
+class Huffman
+{
+public:
+    // Returns false if the code lengths are over-subscribed. Incomplete codes
+    // are allowed, their missing codes fail to decode.
+    bool Build(const uint8_t* lengths, unsigned int count)
+    {
+        memset(m_counts, 0, sizeof(m_counts));
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            ++m_counts[lengths[i]];
+        }
+        m_counts[0] = 0;
+
+        int left = 1;
+        for (unsigned int bits = 1; bits <= MAX_BITS; ++bits)
+        {
+            left = (left << 1) - m_counts[bits];
+            if (left < 0)
+                return false;
+        }
+
+        uint16_t offsets[MAX_BITS + 1];
+        offsets[1] = 0;
+        for (unsigned int bits = 1; bits < MAX_BITS; ++bits)
+        {
+            offsets[bits + 1] = offsets[bits] + m_counts[bits];
+        }
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            if (lengths[i] != 0)
+            {
+                m_symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+            }
+        }
+
+        // Codes are sent most significant bit first, so the lookup table is
+        // indexed by the reversed codes
+        memset(m_fast, 0, sizeof(m_fast));
+        unsigned int code = 0;
+        unsigned int index = 0;
+        for (unsigned int bits = 1; bits <= FAST_BITS; ++bits)
+        {
+            for (unsigned int n = 0; n < m_counts[bits]; ++n, ++code, ++index)
+            {
+                unsigned int reversed = 0;
+                for (unsigned int b = 0; b < bits; ++b)
+                {
+                    reversed |= ((code >> b) & 1) << (bits - 1 - b);
+                }
+                uint16_t entry = static_cast<uint16_t>((bits << 9) | m_symbols[index]);
+                for (unsigned int fill = reversed; fill < (1u << FAST_BITS); fill += 1u << bits)
+                {
+                    m_fast[fill] = entry;
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // Returns the next symbol, or -1 for a code which is not part of the tree
+    int Decode(BitReader& reader) const
+    {
+        uint16_t entry = m_fast[reader.Peek(FAST_BITS)];
+        if (entry != 0)
+        {
+            reader.Consume(entry >> 9);
+            return entry & 0x1FF;
+        }
+
+        // Longer codes are decoded one bit at a time
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (unsigned int bits = 1; bits <= MAX_BITS; ++bits)
+        {
+            code |= static_cast<int>(reader.Read(1));
+            int count = m_counts[bits];
+            if (code - first < count)
+                return m_symbols[index + code - first];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+private:
+    uint16_t m_counts[MAX_BITS + 1];
+    uint16_t m_symbols[288];
+    uint16_t m_fast[1 << FAST_BITS];    // Code length << 9 | symbol, 0 for longer codes
+};
+
+const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const uint8_t CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Decodes the literals and matches of a compressed block. Returns 1 at the
+// end of the block, 0 if the destination is full and -1 for invalid data.
+int InflateCodes(
+    BitReader& reader,
+    const Huffman& literals,
+    const Huffman& distances,
+    uint8_t* destination,
+    size_t destinationSize,
+    size_t& written)
+{
+    for (;;)
+    {
+        int symbol = literals.Decode(reader);
+        if (symbol < 0 || reader.isOverrun())
+            return -1;
+        if (symbol < 256)
+        {
+            if (written == destinationSize)
+                return 0;
+            destination[written++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+        if (symbol == 256)
+            return 1;
+
+        symbol -= 257;
+        if (symbol >= 29)
+            return -1;
+        size_t length = LENGTH_BASE[symbol] + reader.Read(LENGTH_EXTRA[symbol]);
+        int distanceSymbol = distances.Decode(reader);
+        if (distanceSymbol < 0 || distanceSymbol >= 30 || reader.isOverrun())
+            return -1;
+        size_t distance = DISTANCE_BASE[distanceSymbol] + reader.Read(DISTANCE_EXTRA[distanceSymbol]);
+        if (distance > written || reader.isOverrun())
+            return -1;
+
+        bool full = false;
+        if (length > destinationSize - written)
+        {
+            length = destinationSize - written;
+            full = true;
+        }
+
+        // Matches may overlap the bytes they produce
+        uint8_t* target = destination + written;
+        const uint8_t* match = target - distance;
+        if (distance >= length)
+        {
+            memcpy(target, match, length);
+        }
+        else
+        {
+            for (size_t i = 0; i < length; ++i)
+            {
+                target[i] = match[i];
+            }
+        }
+        written += length;
+        if (full)
+            return 0;
+    }
+}
+
+bool BuildFixedCodes(Huffman& literals, Huffman& distances)
+{
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    uint8_t distanceLengths[30];
+    memset(distanceLengths, 5, sizeof(distanceLengths));
+    return literals.Build(lengths, 288) && distances.Build(distanceLengths, 30);
+}
+
+bool BuildDynamicCodes(BitReader& reader, Huffman& literals, Huffman& distances)
+{
+    unsigned int literalCount = reader.Read(5) + 257;
+    unsigned int distanceCount = reader.Read(5) + 1;
+    unsigned int codeLengthCount = reader.Read(4) + 4;
+    if (literalCount > 286 || distanceCount > 30)
+        return false;
+
+    uint8_t lengths[286 + 30] = {};
+    for (unsigned int i = 0; i < codeLengthCount; ++i)
+    {
+        lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(reader.Read(3));
+    }
+    Huffman codeLengths;
+    if (!codeLengths.Build(lengths, 19))
+        return false;
+
+    memset(lengths, 0, sizeof(lengths));
+    unsigned int count = 0;
+    while (count < literalCount + distanceCount)
+    {
+        int symbol = codeLengths.Decode(reader);
+        if (symbol < 0 || reader.isOverrun())
+            return false;
+        if (symbol < 16)
+        {
+            lengths[count++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t value = 0;
+        unsigned int repeat;
+        if (symbol == 16)
+        {
+            if (count == 0)
+                return false;
+            value = lengths[count - 1];
+            repeat = 3 + reader.Read(2);
+        }
+        else if (symbol == 17)
+        {
+            repeat = 3 + reader.Read(3);
+        }
+        else
+        {
+            repeat = 11 + reader.Read(7);
+        }
+        if (count + repeat > literalCount + distanceCount)
+            return false;
+        memset(lengths + count, value, repeat);
+        count += repeat;
+    }
+
+    // A block without end code cannot be decoded
+    if (lengths[256] == 0)
+        return false;
+    return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+}
+
+}
+
+bool ZlibInflater::Inflate(
+    const uint8_t* source,
+    size_t sourceSize,
+    uint8_t* destination,
+    size_t destinationSize,
+    size_t& written)
+{
+    written = 0;
+    if (sourceSize < 2)
+        return false;
+
+    // Deflate compression with a window of at most 32 KB and no dictionary
+    unsigned int method = source[0];
+    unsigned int flags = source[1];
+    if ((method & 0x0F) != 8 || (method >> 4) > 7 || (method * 256 + flags) % 31 != 0 || (flags & 0x20) != 0)
+        return false;
+
+    return InflateRaw(source + 2, sourceSize - 2, destination, destinationSize, written);
+}
+
+bool ZlibInflater::InflateRaw(
+    const uint8_t* source,
+    size_t sourceSize,
+    uint8_t* destination,
+    size_t destinationSize,
+    size_t& written)
+{
+    written = 0;
+    BitReader reader(source, sourceSize);
+    Huffman literals;
+    Huffman distances;
+
+    bool last = false;
+    while (!last)
+    {
+        last = reader.Read(1) != 0;
+        unsigned int type = reader.Read(2);
+        if (reader.isOverrun())
+            return false;
+
+        if (type == 0)
+        {
+            // Stored block
+            reader.AlignToByte();
+            unsigned int length = reader.Read(16);
+            unsigned int inverted = reader.Read(16);
+            if (reader.isOverrun() || length != (~inverted & 0xFFFF))
+                return false;
+            for (unsigned int i = 0; i < length; ++i)
+            {
+                uint8_t value = static_cast<uint8_t>(reader.Read(8));
+                if (reader.isOverrun())
+                    return false;
+                if (written == destinationSize)
+                    return true;
+                destination[written++] = value;
+            }
+            continue;
+        }
+
+        if (type == 1)
+        {
+            if (!BuildFixedCodes(literals, distances))
+                return false;
+        }
+        else if (type != 2 || !BuildDynamicCodes(reader, literals, distances))
+        {
+            return false;
+        }
+
+        int result = InflateCodes(reader, literals, distances, destination, destinationSize, written);
+        if (result < 0)
+            return false;
+        if (result == 0)
+            return true;
+    }
+    return true;
+}
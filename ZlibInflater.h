@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Decompresses zlib streams, like the strips and tiles of TIFF files with
+// Deflate compression. It has no dependency on a zlib library.
+class ZlibInflater
+{
+public:
+    // Decompresses a zlib stream into the destination and stops when the
+    // stream ends or the destination is full. Returns false for invalid or
+    // truncated streams. The bytes decoded up to the error are kept and
+    // counted in written.
+    static bool Inflate(
+        const uint8_t* source,
+        size_t sourceSize,
+        uint8_t* destination,
+        size_t destinationSize,
+        size_t& written);
+
+    // Decompresses raw deflate data without the zlib header
+    static bool InflateRaw(
+        const uint8_t* source,
+        size_t sourceSize,
+        uint8_t* destination,
+        size_t destinationSize,
+        size_t& written);
+
+private:
+    ZlibInflater() = delete;
+    ZlibInflater(const ZlibInflater&) = delete;
+    ZlibInflater& operator=(const ZlibInflater&) = delete;
+};